@@ -96,11 +96,11 @@ def build_objects_64bit(objects, name, *extra_arguments):
 def build_objects_16bit(objects, name, *extra_arguments):
     build_objects(objects, 'i686-unknown-unknown-code16', name, *extra_arguments)
 
-def do_linking(objects, name, *extra_arguments):
+def do_linking(objects, name, *extra_arguments, output_name=None):
     run_command(
         linker_path,
         *extra_arguments,
-        '-o', os.path.join(build_directory, '{}.elf'.format(name)),
+        '-o', os.path.join(build_directory, '{}.elf'.format(output_name or name)),
         *[os.path.join(object_directory, name, object_name) for _, object_name in objects]
     )
 
@@ -302,12 +302,45 @@ if arguments.rebuild or not os.path.exists(user_openlibm_archive):
         *[os.path.join(object_directory, 'user_openlibm', object_name) for _, object_name in objects]
     )
 
+# Shared library for linked user programs, loaded once by the kernel and mapped into every process that needs it
+libuser_objects = [
+    (os.path.join(source_directory, 'shared', 'memory.cpp'), 'memory.o'),
+]
+
+build_objects_64bit(
+    libuser_objects,
+    'libuser',
+    '-I{}'.format(os.path.join(source_directory, 'shared')),
+    '-fpie'
+)
+
+libuser_library = os.path.join(build_directory, 'libuser.elf')
+
+do_linking(
+    libuser_objects,
+    'libuser',
+    '-shared',
+    '-soname', 'libuser.so',
+    '-Bsymbolic',
+    '-z', 'defs',
+    '-z', 'max-page-size=4096',
+    '-z', 'separate-loadable-segments',
+    '--whole-archive',
+    user_openlibm_archive,
+    '--no-whole-archive'
+)
+
 test_app_objects = [
     (os.path.join(user_source_directory, 'test_app', 'main.cpp'), 'main.o'),
     (os.path.join(source_directory, 'shared', 'memory.cpp'), 'memory.o'),
     (os.path.join(printf_directory, 'printf.c'), 'printf.o'),
 ]
 
+# The linked build takes memory.o and openlibm from libuser instead
+test_app_linked_objects = [
+    (source_path, object_name) for source_path, object_name in test_app_objects if object_name != 'memory.o'
+]
+
 build_objects_64bit(
     test_app_objects,
     'test_app',
@@ -326,10 +359,49 @@ do_linking(
     user_openlibm_archive
 )
 
+# Linked position-independent executable, so repeat launches can share its read-only segments and libuser's
+do_linking(
+    test_app_linked_objects,
+    'test_app',
+    '-pie',
+    '--no-dynamic-linker',
+    '-e', 'entry',
+    '-z', 'now',
+    '-z', 'max-page-size=4096',
+    '-z', 'separate-loadable-segments',
+    libuser_library,
+    output_name='test_app_linked'
+)
+
+benchmark_objects = [
+    (os.path.join(user_source_directory, 'benchmark', 'main.cpp'), 'main.o'),
+    (os.path.join(printf_directory, 'printf.c'), 'printf.o'),
+]
+
+build_objects_64bit(
+    benchmark_objects,
+    'benchmark',
+    '-I{}'.format(os.path.join(source_directory, 'shared')),
+    '-I{}'.format(os.path.join(user_source_directory, 'shared')),
+    '-I{}'.format(os.path.join(printf_directory)),
+    '-fpie'
+)
+
+do_linking(
+    benchmark_objects,
+    'benchmark',
+    '-pie',
+    '--no-dynamic-linker',
+    '-e', 'entry',
+    '-z', 'now',
+    '-z', 'max-page-size=4096',
+    '-z', 'separate-loadable-segments',
+    libuser_library
+)
+
 init_objects = [
     (os.path.join(user_source_directory, 'init', 'main.cpp'), 'main.o'),
     (os.path.join(user_source_directory, 'init', 'virtio.cpp'), 'virtio.o'),
-    (os.path.join(source_directory, 'shared', 'memory.cpp'), 'memory.o'),
     (os.path.join(printf_directory, 'printf.c'), 'printf.o'),
 ]
 
@@ -344,10 +416,17 @@ build_objects_64bit(
     '-fpie'
 )
 
+# Linked like test_app_linked, taking memory.o from libuser
 do_linking(
     init_objects,
     'init',
-    '--relocatable'
+    '-pie',
+    '--no-dynamic-linker',
+    '-e', 'entry',
+    '-z', 'now',
+    '-z', 'max-page-size=4096',
+    '-z', 'separate-loadable-segments',
+    libuser_library
 )
 
 objects_multiprocessor = [
@@ -389,6 +468,8 @@ objects_kernel = [
     (os.path.join(source_directory, 'kernel', 'interrupts.S'), 'interrupts.o'),
     (os.path.join(source_directory, 'kernel', 'main.cpp'), 'main.o'),
     (os.path.join(source_directory, 'kernel', 'process.cpp'), 'process.o'),
+    (os.path.join(source_directory, 'kernel', 'handles.cpp'), 'handles.o'),
+    (os.path.join(source_directory, 'kernel', 'pcie_devices.cpp'), 'pcie_devices.o'),
     (os.path.join(source_directory, 'kernel', 'console.cpp'), 'console.o'),
     (os.path.join(source_directory, 'kernel', 'paging.cpp'), 'paging.o'),
     (os.path.join(source_directory, 'kernel', 'io.cpp'), 'io.o'),
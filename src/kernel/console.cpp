@@ -9,6 +9,15 @@ static void serial_write(uint16_t base_port, uint8_t value) {
     io_out(base_port, value);
 }
 
+static bool serial_read(uint16_t base_port, uint8_t *value) {
+    if((io_in(base_port + 5) & 0x01) == 0) {
+        return false;
+    }
+
+    *value = io_in(base_port);
+    return true;
+}
+
 void setup_console() {
     io_out(0x3F8 + 1, 0x00);
     io_out(0x3F8 + 3, 0x80);
@@ -28,4 +37,8 @@ void _putchar(char character) {
 
 void putchar(char character) {
     _putchar(character);
+}
+
+bool read_console_character(char *character) {
+    return serial_read(0x3F8, (uint8_t*)character);
 }
\ No newline at end of file
@@ -4,4 +4,7 @@
 #include "printf.h"
 
 void setup_console();
-void putchar(char character);
\ No newline at end of file
+void putchar(char character);
+
+// Doesn't wait for a character to arrive, returns false if there isn't one
+bool read_console_character(char *character);
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "handles.h"
+#include "memory.h"
+#include "bucket_array_kernel.h"
+#include "threading_kernel.h"
+#include "heap.h"
+
+// Handle tables start out this big, and double whenever they're full
+const size_t initial_handle_capacity = 16;
+
+// Shared memory is cleared through kernel mappings of at most this many pages at a time, as the kernel address space is
+// small
+const size_t shared_memory_clear_page_count = 64;
+
+Channel *create_channel() {
+    auto channel = (Channel*)allocate(sizeof(Channel));
+    if(channel == nullptr) {
+        return nullptr;
+    }
+
+    fill_memory(channel, sizeof(Channel), 0);
+
+    channel->object.type = KernelObjectType::Channel;
+    channel->object.reference_count = 1;
+
+    return channel;
+}
+
+Event *create_event() {
+    auto event = (Event*)allocate(sizeof(Event));
+    if(event == nullptr) {
+        return nullptr;
+    }
+
+    fill_memory(event, sizeof(Event), 0);
+
+    event->object.type = KernelObjectType::Event;
+    event->object.reference_count = 1;
+
+    return event;
+}
+
+// Length of the run of physically consecutive pages at the start of physical_pages, up to max_count
+static size_t count_consecutive_physical_pages(const size_t *physical_pages, size_t max_count) {
+    size_t count = 1;
+    while(count < max_count && physical_pages[count] == physical_pages[0] + count) {
+        count += 1;
+    }
+
+    return count;
+}
+
+static void deallocate_physical_pages(const size_t *physical_pages, size_t page_count, Array<uint8_t> bitmap) {
+    size_t index = 0;
+    while(index < page_count) {
+        auto count = count_consecutive_physical_pages(&physical_pages[index], page_count - index);
+
+        deallocate_bitmap_range(bitmap, physical_pages[index], count);
+
+        index += count;
+    }
+}
+
+SharedMemory *create_shared_memory(size_t page_count, Array<uint8_t> bitmap) {
+    if(page_count == 0) {
+        return nullptr;
+    }
+
+    auto shared_memory = (SharedMemory*)allocate(sizeof(SharedMemory));
+    if(shared_memory == nullptr) {
+        return nullptr;
+    }
+
+    auto physical_pages = (size_t*)allocate(page_count * sizeof(size_t));
+    if(physical_pages == nullptr) {
+        deallocate(shared_memory);
+
+        return nullptr;
+    }
+
+    size_t bitmap_index = 0;
+    size_t bitmap_sub_bit_index = 0;
+
+    for(size_t i = 0; i < page_count; i += 1) {
+        if(!allocate_next_physical_page(&bitmap_index, &bitmap_sub_bit_index, bitmap, &physical_pages[i])) {
+            if(i != 0) {
+                deallocate_physical_pages(physical_pages, i, bitmap);
+            }
+
+            deallocate(physical_pages);
+            deallocate(shared_memory);
+
+            return nullptr;
+        }
+    }
+
+    size_t index = 0;
+    while(index < page_count) {
+        auto max_count = page_count - index;
+        if(max_count > shared_memory_clear_page_count) {
+            max_count = shared_memory_clear_page_count;
+        }
+
+        auto count = count_consecutive_physical_pages(&physical_pages[index], max_count);
+
+        size_t kernel_pages_start;
+        if(!map_pages(physical_pages[index], count, bitmap, &kernel_pages_start)) {
+            deallocate_physical_pages(physical_pages, page_count, bitmap);
+
+            deallocate(physical_pages);
+            deallocate(shared_memory);
+
+            return nullptr;
+        }
+
+        fill_memory((void*)(kernel_pages_start * page_size), count * page_size, 0);
+
+        unmap_pages(kernel_pages_start, count);
+
+        index += count;
+    }
+
+    shared_memory->object.type = KernelObjectType::SharedMemory;
+    shared_memory->object.reference_count = 1;
+    shared_memory->page_count = page_count;
+    shared_memory->physical_pages = physical_pages;
+
+    return shared_memory;
+}
+
+bool map_shared_memory(
+    Process *process,
+    SharedMemory *shared_memory,
+    PagePermissions permissions,
+    Array<uint8_t> bitmap,
+    size_t *result_user_pages_start
+) {
+    auto page_count = shared_memory->page_count;
+    auto physical_pages = shared_memory->physical_pages;
+
+    size_t user_pages_start;
+    if(!find_free_user_pages(page_count, process->pml4_table_physical_address, bitmap, &user_pages_start)) {
+        return false;
+    }
+
+    size_t index = 0;
+    while(index < page_count) {
+        auto count = count_consecutive_physical_pages(&physical_pages[index], page_count - index);
+
+        if(!map_pages_at(
+            physical_pages[index],
+            count,
+            permissions,
+            process->pml4_table_physical_address,
+            bitmap,
+            user_pages_start + index
+        )) {
+            if(index != 0) {
+                unmap_pages(user_pages_start, index, process->pml4_table_physical_address, false, bitmap);
+            }
+
+            return false;
+        }
+
+        index += count;
+    }
+
+    if(!register_process_mapping(process, user_pages_start, page_count, true, false, bitmap, false, shared_memory)) {
+        unmap_pages(user_pages_start, page_count, process->pml4_table_physical_address, false, bitmap);
+
+        return false;
+    }
+
+    reference_kernel_object(&shared_memory->object);
+
+    *result_user_pages_start = user_pages_start;
+    return true;
+}
+
+void reference_kernel_object(KernelObject *object) {
+    __atomic_add_fetch(&object->reference_count, 1, __ATOMIC_RELAXED);
+}
+
+void release_kernel_object(KernelObject *object, Array<uint8_t> bitmap) {
+    if(__atomic_sub_fetch(&object->reference_count, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    switch(object->type) {
+        case KernelObjectType::Channel: {
+            auto channel = (Channel*)object;
+
+            unmap_and_deallocate_bucket_array(&channel->receivers, bitmap);
+
+            deallocate(channel);
+        } break;
+
+        case KernelObjectType::Event: {
+            auto event = (Event*)object;
+
+            unmap_and_deallocate_bucket_array(&event->waiters, bitmap);
+
+            deallocate(event);
+        } break;
+
+        case KernelObjectType::SharedMemory: {
+            auto shared_memory = (SharedMemory*)object;
+
+            deallocate_physical_pages(shared_memory->physical_pages, shared_memory->page_count, bitmap);
+
+            deallocate(shared_memory->physical_pages);
+            deallocate(shared_memory);
+        } break;
+    }
+}
+
+bool create_handle(Process *process, KernelObject *object, size_t rights, size_t *result_handle) {
+    acquire_lock(&process->handles_lock);
+
+    if(process->are_handles_closed) {
+        process->handles_lock = false;
+
+        return false;
+    }
+
+    size_t index = 0;
+    while(index < process->handle_capacity && process->handles[index].object != nullptr) {
+        index += 1;
+    }
+
+    if(index == process->handle_capacity) {
+        auto new_capacity = process->handle_capacity == 0 ? initial_handle_capacity : process->handle_capacity * 2;
+
+        auto new_handles = (Handle*)allocate(new_capacity * sizeof(Handle));
+        if(new_handles == nullptr) {
+            process->handles_lock = false;
+
+            return false;
+        }
+
+        fill_memory(new_handles, new_capacity * sizeof(Handle), 0);
+
+        if(process->handles != nullptr) {
+            copy_memory(process->handles, new_handles, process->handle_capacity * sizeof(Handle));
+
+            deallocate(process->handles);
+        }
+
+        process->handles = new_handles;
+        process->handle_capacity = new_capacity;
+    }
+
+    process->handles[index].object = object;
+    process->handles[index].rights = rights;
+
+    process->handles_lock = false;
+
+    // 0 is never a valid handle
+    *result_handle = index + 1;
+    return true;
+}
+
+bool reference_handle(Process *process, size_t handle, KernelObject **result_object, size_t *result_rights) {
+    acquire_lock(&process->handles_lock);
+
+    if(handle == 0 || handle > process->handle_capacity || process->handles[handle - 1].object == nullptr) {
+        process->handles_lock = false;
+
+        return false;
+    }
+
+    auto entry = process->handles[handle - 1];
+
+    reference_kernel_object(entry.object);
+
+    process->handles_lock = false;
+
+    *result_object = entry.object;
+    *result_rights = entry.rights;
+    return true;
+}
+
+static bool reference_typed_handle(
+    Process *process,
+    size_t handle,
+    KernelObjectType type,
+    size_t rights,
+    KernelObject **result_object,
+    size_t *result_rights
+) {
+    acquire_lock(&process->handles_lock);
+
+    if(
+        handle == 0 ||
+        handle > process->handle_capacity ||
+        process->handles[handle - 1].object == nullptr ||
+        process->handles[handle - 1].object->type != type ||
+        (process->handles[handle - 1].rights & rights) != rights
+    ) {
+        process->handles_lock = false;
+
+        return false;
+    }
+
+    auto entry = process->handles[handle - 1];
+
+    reference_kernel_object(entry.object);
+
+    process->handles_lock = false;
+
+    *result_object = entry.object;
+    *result_rights = entry.rights;
+    return true;
+}
+
+bool reference_channel_handle(Process *process, size_t handle, size_t rights, Channel **result_channel) {
+    size_t handle_rights;
+    return reference_typed_handle(process, handle, KernelObjectType::Channel, rights, (KernelObject**)result_channel, &handle_rights);
+}
+
+bool reference_event_handle(Process *process, size_t handle, size_t rights, Event **result_event) {
+    size_t handle_rights;
+    return reference_typed_handle(process, handle, KernelObjectType::Event, rights, (KernelObject**)result_event, &handle_rights);
+}
+
+bool reference_shared_memory_handle(
+    Process *process,
+    size_t handle,
+    size_t rights,
+    SharedMemory **result_shared_memory,
+    size_t *result_rights
+) {
+    return reference_typed_handle(
+        process,
+        handle,
+        KernelObjectType::SharedMemory,
+        rights,
+        (KernelObject**)result_shared_memory,
+        result_rights
+    );
+}
+
+bool close_handle(Process *process, size_t handle, Array<uint8_t> bitmap) {
+    acquire_lock(&process->handles_lock);
+
+    if(handle == 0 || handle > process->handle_capacity || process->handles[handle - 1].object == nullptr) {
+        process->handles_lock = false;
+
+        return false;
+    }
+
+    auto object = process->handles[handle - 1].object;
+
+    process->handles[handle - 1].object = nullptr;
+
+    process->handles_lock = false;
+
+    release_kernel_object(object, bitmap);
+
+    return true;
+}
+
+void close_all_handles(Process *process, Array<uint8_t> bitmap) {
+    acquire_lock(&process->handles_lock);
+
+    process->are_handles_closed = true;
+
+    auto handles = process->handles;
+    auto handle_capacity = process->handle_capacity;
+
+    process->handles = nullptr;
+    process->handle_capacity = 0;
+
+    process->handles_lock = false;
+
+    if(handles == nullptr) {
+        return;
+    }
+
+    for(size_t i = 0; i < handle_capacity; i += 1) {
+        if(handles[i].object != nullptr) {
+            release_kernel_object(handles[i].object, bitmap);
+        }
+    }
+
+    deallocate(handles);
+}
+
+bool copy_handles(Process *source_process, Process *destination_process) {
+    acquire_lock(&source_process->handles_lock);
+
+    if(source_process->handle_capacity == 0) {
+        source_process->handles_lock = false;
+
+        return true;
+    }
+
+    auto handles = (Handle*)allocate(source_process->handle_capacity * sizeof(Handle));
+    if(handles == nullptr) {
+        source_process->handles_lock = false;
+
+        return false;
+    }
+
+    copy_memory(source_process->handles, handles, source_process->handle_capacity * sizeof(Handle));
+
+    for(size_t i = 0; i < source_process->handle_capacity; i += 1) {
+        if(handles[i].object != nullptr) {
+            reference_kernel_object(handles[i].object);
+        }
+    }
+
+    auto handle_capacity = source_process->handle_capacity;
+
+    source_process->handles_lock = false;
+
+    acquire_lock(&destination_process->handles_lock);
+
+    destination_process->handles = handles;
+    destination_process->handle_capacity = handle_capacity;
+
+    destination_process->handles_lock = false;
+
+    return true;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include "process.h"
+#include "paging.h"
+
+// Kernel objects are referenced by processes through handles, and freed once the last reference is released. Every
+// handle holds a reference, as does anything in the kernel that uses the object outside of a handle table lock.
+enum struct KernelObjectType : uint8_t {
+    Channel,
+    Event,
+    SharedMemory
+};
+
+struct KernelObject {
+    KernelObjectType type;
+
+    volatile size_t reference_count;
+};
+
+struct ChannelMessage {
+    size_t sender_process_id;
+
+    IPCMessage message;
+};
+
+struct ChannelReceiver {
+    ProcessThread *thread;
+
+    // Position of the channel among the ones the thread is receiving from
+    size_t index;
+};
+
+using ChannelReceivers = BucketArray<ChannelReceiver, 4>;
+
+// See SyscallType::ChannelSend. Everything but the object header is only touched while holding global_ipc_lock.
+struct Channel {
+    KernelObject object;
+
+    // Free-running indices into messages
+    size_t head;
+    size_t tail;
+
+    ChannelMessage messages[channel_capacity];
+
+    // Threads blocked receiving from the channel, which can only be the case while it's empty
+    ChannelReceivers receivers;
+};
+
+// Threads blocked in WaitEvent, which wait for any of the signals in their waiting_event_mask
+struct EventWaiter {
+    ProcessThread *thread;
+};
+
+using EventWaiters = BucketArray<EventWaiter, 4>;
+
+// See SyscallType::SignalEvent. Everything but the object header is only touched while holding global_ipc_lock.
+struct Event {
+    KernelObject object;
+
+    // Raised by SignalEvent, and cleared as WaitEvent takes them
+    size_t signals;
+
+    EventWaiters waiters;
+};
+
+// Pages that can be mapped into any number of processes, see SyscallType::MapSharedMemoryObject. Every mapping holds a
+// reference, so the pages stay allocated until the last process unmaps them.
+struct SharedMemory {
+    KernelObject object;
+
+    size_t page_count;
+
+    // Physical page indices, not necessarily consecutive. Never changed after creation.
+    size_t *physical_pages;
+};
+
+struct Handle {
+    // nullptr for a free entry
+    KernelObject *object;
+
+    size_t rights;
+};
+
+// Returns nullptr if out of memory. The caller holds the only reference.
+Channel *create_channel();
+
+// Returns nullptr if out of memory. The caller holds the only reference.
+Event *create_event();
+
+// Returns nullptr if out of memory. The pages are cleared, and the caller holds the only reference.
+SharedMemory *create_shared_memory(size_t page_count, Array<uint8_t> bitmap);
+
+// Maps all of the pages into the process at free addresses, and registers the mapping, which adds its own reference.
+// Must hold process->syscall_lock.
+bool map_shared_memory(
+    Process *process,
+    SharedMemory *shared_memory,
+    PagePermissions permissions,
+    Array<uint8_t> bitmap,
+    size_t *result_user_pages_start
+);
+
+void reference_kernel_object(KernelObject *object);
+void release_kernel_object(KernelObject *object, Array<uint8_t> bitmap);
+
+// Takes over the caller's reference to the object. Fails if out of memory, or if the process is being destroyed.
+bool create_handle(Process *process, KernelObject *object, size_t rights, size_t *result_handle);
+
+// Adds a reference to the handle's object, which the caller has to release
+bool reference_handle(Process *process, size_t handle, KernelObject **result_object, size_t *result_rights);
+
+// Only succeed if the handle is for an object of the right type, and has all of the rights
+bool reference_channel_handle(Process *process, size_t handle, size_t rights, Channel **result_channel);
+bool reference_event_handle(Process *process, size_t handle, size_t rights, Event **result_event);
+
+// Also gives all of the handle's rights, which decide whether the memory is mapped writable
+bool reference_shared_memory_handle(
+    Process *process,
+    size_t handle,
+    size_t rights,
+    SharedMemory **result_shared_memory,
+    size_t *result_rights
+);
+
+bool close_handle(Process *process, size_t handle, Array<uint8_t> bitmap);
+
+// No handles can be created in the process afterwards
+void close_all_handles(Process *process, Array<uint8_t> bitmap);
+
+// Gives the destination process, which must not have any handles yet, the same handles (at the same values) as the
+// source process
+bool copy_handles(Process *source_process, Process *destination_process);
@@ -7,16 +7,20 @@ extern "C" {
 #include "heap.h"
 #include "paging.h"
 #include "process.h"
+#include "handles.h"
 #include "memory.h"
 #include "bucket_array.h"
 #include "bucket_array_kernel.h"
 #include "syscalls.h"
 #include "pcie.h"
+#include "pcie_devices.h"
 #include "halt.h"
 #include "array.h"
 #include "multiprocessing.h"
 #include "io.h"
 #include "kernel_extern.h"
+#include "timing.h"
+#include "kernel_info.h"
 
 #define do_ranges_intersect(a_start, a_end, b_start, b_end) (!((a_end) <= (b_start) || (b_end) <= (a_start)))
 
@@ -44,12 +48,6 @@ static inline void print_time(const char *name) {
     printf("Time at %s: %zu\n", name, time);
 }
 
-struct MCFGTable {
-    ACPI_TABLE_MCFG preamble;
-
-    ACPI_MCFG_ALLOCATION allocations[0];
-};
-
 struct MADTTable {
     ACPI_TABLE_MADT preamble;
 
@@ -88,6 +86,22 @@ static ProcessorArea *global_processor_areas;
 
 const uint32_t preempt_time = 0x100000;
 
+// Measured against the PIT at boot by calibrate_timers
+static uint64_t global_timestamp_counter_frequency; // Hz
+static uint64_t global_apic_timer_frequency; // Hz, after the divider
+
+// APIC timer ticks per timestamp counter cycle, as a 32.32 fixed point number
+static uint64_t global_apic_timer_ticks_per_cycle;
+
+// Length of a preempt_time timeslice in timestamp counter cycles
+static uint64_t global_preempt_cycles;
+
+static KernelInfo *global_kernel_info;
+static size_t global_kernel_info_physical_address;
+
+// Protects the process slots in the kernel info page
+static volatile bool global_kernel_info_lock = false;
+
 const auto kernel_pd_start = kernel_pages_start / page_table_length;
 const auto kernel_pd_end = divide_round_up(kernel_pages_end, page_table_length);
 const auto kernel_pd_count = kernel_pd_end - kernel_pd_start;
@@ -197,6 +211,72 @@ static inline void write_cr4(uint64_t value) {
     );
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    asm volatile(
+        "cpuid"
+        : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+        : "a"(leaf), "c"(subleaf)
+    );
+}
+
+static bool global_fpu_uses_xsave = false;
+static bool global_fpu_uses_xsaveopt = false;
+static uint64_t global_fpu_xsave_mask;
+
+static inline void save_fpu_state(FPUState *state) {
+    if(global_fpu_uses_xsaveopt) {
+        // Skips state components that are unmodified since they were restored
+        asm volatile(
+            "xsaveopt64 (%0)"
+            :
+            : "r"(state), "a"((uint32_t)global_fpu_xsave_mask), "d"((uint32_t)(global_fpu_xsave_mask >> 32))
+            : "memory"
+        );
+    } else if(global_fpu_uses_xsave) {
+        asm volatile(
+            "xsave64 (%0)"
+            :
+            : "r"(state), "a"((uint32_t)global_fpu_xsave_mask), "d"((uint32_t)(global_fpu_xsave_mask >> 32))
+            : "memory"
+        );
+    } else {
+        asm volatile(
+            "fxsave64 (%0)"
+            :
+            : "r"(state)
+            : "memory"
+        );
+    }
+}
+
+static inline void restore_fpu_state(const FPUState *state) {
+    if(global_fpu_uses_xsave) {
+        asm volatile(
+            "xrstor64 (%0)"
+            :
+            : "r"(state), "a"((uint32_t)global_fpu_xsave_mask), "d"((uint32_t)(global_fpu_xsave_mask >> 32))
+            : "memory"
+        );
+    } else {
+        asm volatile(
+            "fxrstor64 (%0)"
+            :
+            : "r"(state)
+            : "memory"
+        );
+    }
+}
+
+const uint64_t cr0_task_switched = 1 << 3;
+
+// Must be called while the thread is still resident on the current processor, before it is given up
+static void save_thread_fpu_state(ProcessThread *thread) {
+    // CR0.TS is only clear if the thread has (potentially) touched the FPU since it was entered
+    if((read_cr0() & cr0_task_switched) == 0) {
+        save_fpu_state(&thread->fpu_state);
+    }
+}
+
 static inline void enable_interrupts() {
     asm volatile(
         "sti"
@@ -209,12 +289,331 @@ static inline void disable_interrupts() {
     );
 }
 
+static volatile bool global_periodic_lock = false;
+
+// Protected by global_periodic_lock, but also read without it as a hint
+static size_t global_periodic_thread_count;
+static size_t global_periodic_utilization; // Per-mille of a processor, summed over all periodic threads
+
+// Earliest start of a period for a thread that is waiting for it or has used up its budget, as of the last
+// claim_periodic_thread
+static uint64_t global_next_periodic_release = UINT64_MAX;
+
+static size_t global_polled_syscall_ring_count;
+
+static size_t global_log_ring_count;
+
+// How often idle processors poll syscall rings and drain log rings
+const uint64_t syscall_ring_poll_frequency = 10000; // Hz
+
+// Earliest wait_deadline of a thread waiting on an event or receiving IPC calls, as of the last expire_waits,
+// WaitEvent or IPCReceive. Protected by global_ipc_lock, but also read without it as a hint.
+static uint64_t global_next_wait_timeout = UINT64_MAX;
+
+// Vectors that devices can be bound to with BindPCIEInterrupt, right after the spurious interrupt vector
+const size_t device_interrupt_vectors_start = 48;
+const size_t device_interrupt_vector_count = 16;
+
+// Device interrupts that have come in but haven't been delivered to their events yet, one bit per device interrupt
+// vector. The interrupt handlers can't take locks, so they only set these, and the scheduler delivers them.
+static volatile size_t global_pending_device_interrupts;
+
+static void expire_waits();
+static void deliver_device_interrupts();
+static void poll_syscall_rings();
+static void drain_log_rings();
+static void drain_log_ring(Process *process);
+static void print_syscall_statistics();
+
+// Must hold global_periodic_lock
+static void replenish_periodic_thread(ProcessThread *thread, uint64_t time) {
+    if(time - thread->period_start >= thread->period) {
+        auto elapsed_periods = (time - thread->period_start) / thread->period;
+
+        thread->period_start += elapsed_periods * thread->period;
+        thread->budget_used = 0;
+        thread->is_waiting_for_next_period = false;
+    }
+}
+
+// APIC timer count that fires at deadline (in timestamp counter cycles), capped to a normal timeslice
+static uint32_t get_timer_count(uint64_t time, uint64_t deadline) {
+    if(deadline <= time) {
+        return 1;
+    }
+
+    auto cycles = deadline - time;
+
+    if(global_apic_timer_ticks_per_cycle == 0 || cycles >= global_preempt_cycles) {
+        return preempt_time;
+    }
+
+    auto count = (uint32_t)(cycles * global_apic_timer_ticks_per_cycle >> 32);
+    if(count == 0) {
+        return 1;
+    }
+
+    return count;
+}
+
+// The thread must already be made resident on the current processor, with processor_area's iterators pointing to it
+[[noreturn]] static void enter_thread(ProcessorArea *processor_area, Process *process, ProcessThread *thread) {
+    auto processor_id = get_processor_id();
+
+    auto processor_area_user_address = user_processor_areas_memory_start + processor_id * sizeof(ProcessorArea);
+
+    GDTDescriptor gdt_descriptor {
+        (uint16_t)(gdt_size * sizeof(GDTEntry) - 1),
+        processor_area_user_address + offsetof(ProcessorArea, gdt_entries)
+    };
+
+    if(thread->has_been_resident && thread->resident_processor_id != processor_id) {
+        processor_area->scheduler_statistics.thread_migration_count += 1;
+    }
+
+    thread->resident_processor_id = processor_id;
+    thread->has_been_resident = true;
+    thread->affinity_skip_count = 0;
+
+    { // Leave the FPU state in the registers if they still hold it, otherwise restore it on first use (device_not_available_handler)
+        auto value = read_cr0();
+        auto new_value = value;
+
+        if(
+            processor_area->fpu_state_owner == thread &&
+            thread->is_fpu_state_loaded &&
+            thread->fpu_state_processor_id == processor_id
+        ) {
+            new_value &= ~cr0_task_switched;
+        } else {
+            new_value |= cr0_task_switched;
+        }
+
+        if(new_value != value) {
+            write_cr0(new_value);
+        }
+    }
+
+    // The rest of the registers are loaded by user_enter_thunk straight from thread->frame while still on the kernel page
+    // tables, only the part iretq pops (and a scratch register) needs to be in user-mapped memory
+    processor_area->user_enter_frame.rax = thread->frame.rax;
+    processor_area->user_enter_frame.interrupt_frame = thread->frame.interrupt_frame;
+
+    auto user_enter_frame_user_address = processor_area_user_address + offsetof(ProcessorArea, user_enter_frame);
+
+    // Periodic threads are preempted when their budget runs out (after which they only get spare time like any other
+    // thread), other threads when the next periodic thread is released
+    auto time = read_timestamp_counter();
+
+    thread->entered_time = time;
+
+    uint32_t timer_count;
+    if(thread->is_periodic && thread->budget_used < thread->budget) {
+        timer_count = get_timer_count(time, time + (thread->budget - thread->budget_used));
+    } else if(global_periodic_thread_count != 0) {
+        timer_count = get_timer_count(time, global_next_periodic_release);
+    } else {
+        timer_count = preempt_time;
+    }
+
+    // Disable interrupts until process entry for interrupt safety
+    disable_interrupts();
+
+    // These values may not be reset under certain conditions, so reset them here while interrupts are disabled
+    processor_area->in_syscall_or_user_exception = false;
+    processor_area->preempt_during_syscall_or_user_exception = false;
+
+    if(processor_area->context_switch_start_time != 0) {
+        processor_area->scheduler_statistics.context_switch_count += 1;
+        processor_area->scheduler_statistics.context_switch_cycles += time - processor_area->context_switch_start_time;
+
+        processor_area->context_switch_start_time = 0;
+    }
+
+    // Set timer value
+    processor_area->apic_registers->timer_initial_count.value = timer_count;
+
+    // Enable APIC timer
+    processor_area->apic_registers->lvt_timer.value &= ~(1 << 16);
+
+    asm volatile(
+        // Load GDT
+        "lgdtq (%0)\n"
+
+        // Jump to thunk for entering user mode, which switches to the user page tables
+        "jmp user_enter_thunk"
+        :
+        : "r"(&gdt_descriptor), "D"(&thread->frame), "S"(user_enter_frame_user_address), "d"(process->pml4_table_physical_address)
+    );
+
+    unreachable();
+}
+
+// Must be called while the thread is still resident on the current processor, after thread->frame is saved.
+// The thread stops being resident afterwards.
+static void release_thread(ProcessorArea *processor_area, ProcessThread *thread) {
+    auto time = read_timestamp_counter();
+
+    processor_area->context_switch_start_time = time;
+
+    save_thread_fpu_state(thread);
+
+    if(thread->is_periodic) {
+        acquire_lock(&global_periodic_lock);
+
+        thread->budget_used += time - thread->entered_time;
+
+        replenish_periodic_thread(thread, time);
+
+        __atomic_store_n(&thread->is_resident, false, __ATOMIC_RELEASE);
+
+        global_periodic_lock = false;
+    } else {
+        // Release store, so other processors never see the thread as non-resident before its state is saved
+        __atomic_store_n(&thread->is_resident, false, __ATOMIC_RELEASE);
+    }
+}
+
+static void suspend_thread(ProcessorArea *processor_area, ProcessThread *thread, const ThreadStackFrame *frame) {
+    thread->frame = *frame;
+
+    release_thread(processor_area, thread);
+}
+
+// How many times a thread is passed over by other processors before one of them takes it anyway
+const size_t thread_migration_skip_threshold = 4;
+
+struct MigrationCandidate {
+    bool found;
+
+    Processes::Iterator process_iterator;
+    ProcessThreads::Iterator thread_iterator;
+};
+
+// Tries to make the thread at processor_area's iterators resident on this processor. Threads last resident on another
+// processor are left for that processor (to keep its caches and TLB warm) unless it has fallen behind, the first such
+// thread is remembered so it can still be taken instead of idling.
+static bool try_claim_thread(
+    ProcessorArea *processor_area,
+    uint8_t processor_id,
+    ProcessThread *thread,
+    MigrationCandidate *migration_candidate
+) {
+    if(!thread->is_ready || thread->is_waiting_for_next_period) {
+        return false;
+    }
+
+    if(thread->has_been_resident && thread->resident_processor_id != processor_id) {
+        // Stops counting once the threshold is reached, so the count can't wrap around while the thread isn't entered
+        auto skip_count = __atomic_load_n(&thread->affinity_skip_count, __ATOMIC_RELAXED);
+        if(skip_count < thread_migration_skip_threshold) {
+            skip_count = __atomic_add_fetch(&thread->affinity_skip_count, 1, __ATOMIC_RELAXED);
+        }
+
+        if(skip_count < thread_migration_skip_threshold) {
+            if(!migration_candidate->found) {
+                migration_candidate->found = true;
+                migration_candidate->process_iterator = processor_area->current_process_iterator;
+                migration_candidate->thread_iterator = processor_area->current_thread_iterator;
+            }
+
+            return false;
+        }
+    }
+
+    return compare_and_swap(&thread->is_resident, false, true);
+}
+
+// Makes the ready periodic thread with the earliest deadline that still has budget left this period resident on this
+// processor, ahead of any other thread. Also updates global_next_periodic_release.
+static bool claim_periodic_thread(Processes::Iterator *result_process_iterator, ProcessThreads::Iterator *result_thread_iterator) {
+    auto time = read_timestamp_counter();
+
+    acquire_lock(&global_periodic_lock);
+
+    auto found = false;
+    uint64_t earliest_deadline;
+    Processes::Iterator earliest_process_iterator;
+    ProcessThreads::Iterator earliest_thread_iterator;
+
+    uint64_t next_release = UINT64_MAX;
+
+    for(auto process_iterator = begin(global_processes); process_iterator != end(global_processes); ++process_iterator) {
+        auto process = *process_iterator;
+
+        if(!process->is_ready) {
+            continue;
+        }
+
+        for(auto thread_iterator = begin(process->threads); thread_iterator != end(process->threads); ++thread_iterator) {
+            auto thread = *thread_iterator;
+
+            if(!thread->is_periodic || thread->is_resident) {
+                continue;
+            }
+
+            replenish_periodic_thread(thread, time);
+
+            auto period_end = thread->period_start + thread->period;
+
+            if(thread->is_waiting_for_next_period || thread->budget_used >= thread->budget) {
+                if(period_end < next_release) {
+                    next_release = period_end;
+                }
+            } else if(thread->is_ready && (!found || period_end < earliest_deadline)) {
+                found = true;
+                earliest_deadline = period_end;
+                earliest_process_iterator = process_iterator;
+                earliest_thread_iterator = thread_iterator;
+            }
+        }
+    }
+
+    global_next_periodic_release = next_release;
+
+    auto claimed = found && compare_and_swap(&(*earliest_thread_iterator)->is_resident, false, true);
+
+    global_periodic_lock = false;
+
+    if(claimed) {
+        *result_process_iterator = earliest_process_iterator;
+        *result_thread_iterator = earliest_thread_iterator;
+    }
+
+    return claimed;
+}
+
 // APIC timer must be disabled or at 0 when this function is called, and there must be no pending APIC timer interrupts
 [[noreturn]] static void enter_next_process(
     ProcessorArea *processor_area,
     Array<uint8_t> bitmap,
     Processes *processes
 ) {
+    processor_area->is_idle = false;
+
+    if(global_pending_device_interrupts != 0) {
+        deliver_device_interrupts();
+    }
+
+    if(global_next_wait_timeout != UINT64_MAX && read_timestamp_counter() >= global_next_wait_timeout) {
+        expire_waits();
+    }
+
+    if(global_periodic_thread_count != 0) {
+        Processes::Iterator process_iterator;
+        ProcessThreads::Iterator thread_iterator;
+        if(claim_periodic_thread(&process_iterator, &thread_iterator)) {
+            processor_area->current_process_iterator = process_iterator;
+            processor_area->current_thread_iterator = thread_iterator;
+
+            enter_thread(processor_area, *process_iterator, *thread_iterator);
+        }
+    }
+
+    auto processor_id = get_processor_id();
+
+    MigrationCandidate migration_candidate {};
+
     Process *process;
     ProcessThread *thread;
     if(processor_area->current_process_iterator.current_bucket != nullptr) {
@@ -230,7 +629,7 @@ static inline void disable_interrupts() {
 
                 thread = *processor_area->current_thread_iterator;
 
-                if(thread->is_ready && compare_and_swap(&thread->is_resident, false, true)) {
+                if(try_claim_thread(processor_area, processor_id, thread, &migration_candidate)) {
                     break;
                 }
 
@@ -258,7 +657,7 @@ static inline void disable_interrupts() {
 
                     thread = *processor_area->current_thread_iterator;
 
-                    if(thread->is_ready && compare_and_swap(&thread->is_resident, false, true)) {
+                    if(try_claim_thread(processor_area, processor_id, thread, &migration_candidate)) {
                         break;
                     }
 
@@ -279,7 +678,40 @@ static inline void disable_interrupts() {
         processor_area->current_process_iterator = begin(*processes);
 
         while(true) {
+            if(processor_area->current_process_iterator.current_bucket == nullptr && migration_candidate.found) {
+                // Nothing left for this processor, so take a thread from a busier one rather than idling
+                auto candidate_thread = *migration_candidate.thread_iterator;
+
+                if(
+                    (*migration_candidate.process_iterator)->is_ready &&
+                    candidate_thread->is_ready &&
+                    compare_and_swap(&candidate_thread->is_resident, false, true)
+                ) {
+                    processor_area->current_process_iterator = migration_candidate.process_iterator;
+                    processor_area->current_thread_iterator = migration_candidate.thread_iterator;
+
+                    process = *migration_candidate.process_iterator;
+                    thread = candidate_thread;
+
+                    break;
+                }
+            }
+
             if(processor_area->current_process_iterator.current_bucket == nullptr) {
+                if(global_polled_syscall_ring_count != 0) {
+                    poll_syscall_rings();
+                }
+
+                if(global_log_ring_count != 0) {
+                    drain_log_rings();
+                }
+
+                // Sending 's' over the serial console dumps the syscall statistics
+                char console_character;
+                if(read_console_character(&console_character) && console_character == 's') {
+                    print_syscall_statistics();
+                }
+
                 // Disable interrupts until stack is correctly setup for interrupt safety
                 disable_interrupts();
 
@@ -287,12 +719,38 @@ static inline void disable_interrupts() {
                 processor_area->in_syscall_or_user_exception = false;
                 processor_area->preempt_during_syscall_or_user_exception = false;
 
-                // Set timer value
-                processor_area->apic_registers->timer_initial_count.value = preempt_time;
+                // Idle time doesn't count towards the context switch time
+                processor_area->context_switch_start_time = 0;
+
+                // Set timer value, waking up in time for the next periodic thread, event wait timeout or syscall/log
+                // ring poll
+                auto time = read_timestamp_counter();
+
+                uint64_t wake_time = global_next_wait_timeout;
+                if(global_periodic_thread_count != 0 && global_next_periodic_release < wake_time) {
+                    wake_time = global_next_periodic_release;
+                }
+
+                if(global_polled_syscall_ring_count != 0 || global_log_ring_count != 0) {
+                    auto poll_time = time + global_timestamp_counter_frequency / syscall_ring_poll_frequency;
+
+                    if(poll_time < wake_time) {
+                        wake_time = poll_time;
+                    }
+                }
+
+                // A device interrupt that came in after delivering them above would otherwise wait for the next wake up
+                if(global_pending_device_interrupts != 0) {
+                    wake_time = time;
+                }
+
+                processor_area->apic_registers->timer_initial_count.value = get_timer_count(time, wake_time);
 
                 // Enable APIC timer
                 processor_area->apic_registers->lvt_timer.value &= ~(1 << 16);
 
+                processor_area->is_idle = true;
+
                 // Halt current processor until next timer interval, also reset stack to top to prevent stack overflow
                 asm volatile(
                     "mov %0, %%rsp\n"
@@ -318,7 +776,7 @@ static inline void disable_interrupts() {
                     
                     thread = *processor_area->current_thread_iterator;
 
-                    if(thread->is_ready && compare_and_swap(&thread->is_resident, false, true)) {
+                    if(try_claim_thread(processor_area, processor_id, thread, &migration_candidate)) {
                         break;
                     }
 
@@ -334,68 +792,535 @@ static inline void disable_interrupts() {
         }
     }
 
-    auto processor_id = get_processor_id();
+    enter_thread(processor_area, process, thread);
+}
 
-    auto processor_area_user_address = user_processor_areas_memory_start + processor_id * sizeof(ProcessorArea);
+static volatile bool global_ipc_lock = false;
 
-    auto stack_kernel_address = (size_t)&processor_area->stack;
-    auto stack_user_address = processor_area_user_address + offsetof(ProcessorArea, stack);
+static bool find_ready_process(size_t process_id, Processes::Iterator *result_iterator) {
+    Processes::Iterator iterator;
+    if(!find_process(process_id, &iterator) || !(*iterator)->is_ready) {
+        return false;
+    }
 
-    GDTDescriptor gdt_descriptor {
-        (uint16_t)(gdt_size * sizeof(GDTEntry) - 1),
-        processor_area_user_address + offsetof(ProcessorArea, gdt_entries)
-    };
+    *result_iterator = iterator;
+    return true;
+}
 
-    thread->resident_processor_id = processor_id;
+static void copy_ipc_message(const ThreadStackFrame *source, ThreadStackFrame *destination) {
+    destination->rsi = source->rsi;
+    destination->rdi = source->rdi;
+    destination->r8 = source->r8;
+    destination->r9 = source->r9;
+    destination->r10 = source->r10;
+}
 
-    // Must be a full copy on the kernel stack, so that the user-page-table user_enter_thunk can access it
-    auto stack_frame_copy = thread->frame;
+// global_ipc_lock must be held
+static bool find_ipc_caller_thread(
+    size_t caller_process_id,
+    size_t callee_process_id,
+    ThreadIPCState state,
+    Processes::Iterator *result_process_iterator,
+    ProcessThreads::Iterator *result_thread_iterator
+) {
+    Processes::Iterator process_iterator;
+    if(!find_ready_process(caller_process_id, &process_iterator)) {
+        return false;
+    }
 
-    auto stack_frame_copy_kernel_address = (size_t)&stack_frame_copy;
+    auto process = *process_iterator;
 
-    auto stack_frame_copy_relative_address = stack_frame_copy_kernel_address - stack_kernel_address;
+    for(auto iterator = begin(process->threads); iterator != end(process->threads); ++iterator) {
+        auto thread = *iterator;
 
-    auto stack_frame_copy_user_address = stack_user_address + stack_frame_copy_relative_address;
+        if(thread->ipc_state == state && thread->ipc_peer_process_id == callee_process_id) {
+            *result_process_iterator = process_iterator;
+            *result_thread_iterator = iterator;
+            return true;
+        }
+    }
 
-    // Disable interrupts until process entry for interrupt safety
-    disable_interrupts();
+    return false;
+}
 
-    // These values may not be reset under certain conditions, so reset them here while interrupts are disabled
-    processor_area->in_syscall_or_user_exception = false;
-    processor_area->preempt_during_syscall_or_user_exception = false;
+// global_ipc_lock must be held. Sets the return values of frame as for a successful IPCReceive.
+static bool receive_queued_ipc_call(Process *process, ThreadStackFrame *frame) {
+    for(auto iterator = begin(process->ipc_queued_calls); iterator != end(process->ipc_queued_calls); ++iterator) {
+        auto caller_process_id = (*iterator)->caller_process_id;
 
-    // Set timer value
-    processor_area->apic_registers->timer_initial_count.value = preempt_time;
+        remove_item_from_bucket_array(iterator);
 
-    // Enable APIC timer
-    processor_area->apic_registers->lvt_timer.value &= ~(1 << 16);
+        // The caller may have been destroyed since queueing the call
+        Processes::Iterator caller_process_iterator;
+        ProcessThreads::Iterator caller_thread_iterator;
+        if(find_ipc_caller_thread(caller_process_id, process->id, ThreadIPCState::Calling, &caller_process_iterator, &caller_thread_iterator)) {
+            auto caller_thread = *caller_thread_iterator;
 
-    asm volatile(
-        // Load GDT
-        "lgdtq (%0)\n"
+            copy_ipc_message(&caller_thread->frame, frame);
+            frame->rbx = (size_t)IPCReceiveResult::Success;
+            frame->rdx = caller_process_id;
 
-        // Switch to user page tables
-        "mov %1, %%cr3\n"
+            caller_thread->ipc_state = ThreadIPCState::WaitingForReply;
 
-        // Jump to thunk for entering user mode
-        "jmp user_enter_thunk"
-        :
-        : "r"(&gdt_descriptor), "r"(process->pml4_table_physical_address), "D"(stack_frame_copy_user_address)
-    );
+            return true;
+        }
+    }
 
-    unreachable();
+    return false;
 }
 
-// Basically using always_inline as a type-safe macro
-static __attribute__((always_inline)) void continue_in_function_return(ThreadStackFrame *stack_frame, void (*function_continued)(ThreadStackFrame*)) {
-    auto current_pml4_table = read_cr3();
+// Sets the return values of frame as for a successful ChannelReceive
+static void set_channel_receive_frame(ThreadStackFrame *frame, const ChannelMessage *message, size_t index) {
+    frame->rbx = (size_t)ChannelReceiveResult::Success;
+    frame->rdx = message->sender_process_id;
+    frame->rsi = message->message.words[0];
+    frame->rdi = message->message.words[1];
+    frame->r8 = message->message.words[2];
+    frame->r9 = message->message.words[3];
+    frame->r10 = message->message.words[4];
+    frame->r12 = index;
+}
 
-    if(current_pml4_table == (size_t)&kernel_pml4_table) {
-        function_continued(stack_frame);
-    } else {
-        auto processor_id = get_processor_id();
+// global_ipc_lock must be held. Takes the oldest message of the first channel that has one.
+static bool take_channel_message(Channel *const *channels, size_t channel_count, ThreadStackFrame *frame) {
+    for(size_t i = 0; i < channel_count; i += 1) {
+        auto channel = channels[i];
 
-        auto processor_area_offset = processor_id * sizeof(ProcessorArea);
+        if(channel->head != channel->tail) {
+            set_channel_receive_frame(frame, &channel->messages[channel->head % channel_capacity], i);
+
+            channel->head += 1;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// global_ipc_lock must be held. Removes the thread from the receivers of all the channels it's blocked on, and drops
+// its references to them.
+static void stop_receiving_channels(ProcessThread *thread) {
+    for(size_t i = 0; i < thread->receiving_channel_count; i += 1) {
+        auto channel = thread->receiving_channels[i];
+
+        for(auto iterator = begin(channel->receivers); iterator != end(channel->receivers); ++iterator) {
+            if((*iterator)->thread == thread) {
+                remove_item_from_bucket_array(iterator);
+
+                break;
+            }
+        }
+
+        release_kernel_object(&channel->object, global_bitmap);
+    }
+
+    thread->receiving_channel_count = 0;
+    thread->ipc_state = ThreadIPCState::None;
+}
+
+// Hands the message straight to a thread blocked receiving from the channel if there is one, otherwise queues it
+static ChannelSendResult send_channel_message(Channel *channel, size_t sender_process_id, const IPCMessage *message) {
+    ChannelMessage channel_message {
+        sender_process_id,
+        *message
+    };
+
+    acquire_lock(&global_ipc_lock);
+
+    auto receiver_iterator = begin(channel->receivers);
+    if(receiver_iterator != end(channel->receivers)) {
+        auto receiver = *receiver_iterator;
+        auto thread = receiver->thread;
+
+        set_channel_receive_frame(&thread->frame, &channel_message, receiver->index);
+
+        stop_receiving_channels(thread);
+
+        thread->is_ready = true;
+
+        global_ipc_lock = false;
+
+        return ChannelSendResult::Success;
+    }
+
+    if(channel->tail - channel->head >= channel_capacity) {
+        global_ipc_lock = false;
+
+        return ChannelSendResult::Full;
+    }
+
+    channel->messages[channel->tail % channel_capacity] = channel_message;
+    channel->tail += 1;
+
+    global_ipc_lock = false;
+
+    return ChannelSendResult::Success;
+}
+
+// global_ipc_lock must be held. Removes the thread from the waiters of the event it's blocked on, and drops its
+// reference to it.
+static void stop_waiting_for_event(ProcessThread *thread) {
+    auto event = thread->waiting_event;
+
+    for(auto iterator = begin(event->waiters); iterator != end(event->waiters); ++iterator) {
+        if((*iterator)->thread == thread) {
+            remove_item_from_bucket_array(iterator);
+
+            break;
+        }
+    }
+
+    release_kernel_object(&event->object, global_bitmap);
+
+    thread->waiting_event = nullptr;
+    thread->ipc_state = ThreadIPCState::None;
+}
+
+// Raises the signals, then hands them out to the waiting threads in turn, each taking the raised signals in its mask
+static void signal_event(Event *event, size_t signals) {
+    acquire_lock(&global_ipc_lock);
+
+    event->signals |= signals;
+
+    for(auto iterator = begin(event->waiters); iterator != end(event->waiters); ++iterator) {
+        auto thread = (*iterator)->thread;
+
+        auto taken_signals = event->signals & thread->waiting_event_mask;
+        if(taken_signals == 0) {
+            continue;
+        }
+
+        event->signals &= ~taken_signals;
+
+        thread->frame.rbx = (size_t)WaitEventResult::Success;
+        thread->frame.rdx = taken_signals;
+
+        // Removing the current item doesn't disturb the iteration, and the signalling thread still holds a reference
+        stop_waiting_for_event(thread);
+
+        thread->is_ready = true;
+
+        if(event->signals == 0) {
+            break;
+        }
+    }
+
+    global_ipc_lock = false;
+}
+
+// global_ipc_lock must be held. Turns a timeout in microseconds into a wait_deadline. event_wait_forever and
+// ipc_receive_forever, and timeouts too long to represent, wait forever.
+static uint64_t get_wait_deadline(size_t timeout) {
+    auto cycles_per_microsecond = global_timestamp_counter_frequency / 1000000;
+
+    if(timeout == SIZE_MAX || timeout >= UINT64_MAX / 2 / cycles_per_microsecond) {
+        return UINT64_MAX;
+    }
+
+    auto deadline = read_timestamp_counter() + timeout * cycles_per_microsecond;
+
+    if(deadline < global_next_wait_timeout) {
+        global_next_wait_timeout = deadline;
+    }
+
+    return deadline;
+}
+
+// Times out the event waits and IPC receives whose deadline has passed, and finds the next deadline
+static void expire_waits() {
+    acquire_lock(&global_ipc_lock);
+
+    auto time = read_timestamp_counter();
+
+    uint64_t next_timeout = UINT64_MAX;
+
+    for(auto process : global_processes) {
+        for(auto thread : process->threads) {
+            if(thread->ipc_state != ThreadIPCState::WaitingForEvent && thread->ipc_state != ThreadIPCState::Receiving) {
+                continue;
+            }
+
+            if(thread->wait_deadline <= time) {
+                if(thread->ipc_state == ThreadIPCState::WaitingForEvent) {
+                    thread->frame.rbx = (size_t)WaitEventResult::TimedOut;
+                    thread->frame.rdx = 0;
+
+                    stop_waiting_for_event(thread);
+                } else {
+                    thread->frame.rbx = (size_t)IPCReceiveResult::NoCall;
+
+                    process->ipc_receiving_thread = nullptr;
+
+                    thread->ipc_state = ThreadIPCState::None;
+                }
+
+                thread->is_ready = true;
+            } else if(thread->wait_deadline < next_timeout) {
+                next_timeout = thread->wait_deadline;
+            }
+        }
+    }
+
+    global_next_wait_timeout = next_timeout;
+
+    global_ipc_lock = false;
+}
+
+// See SyscallType::BindPCIEInterrupt. Only touched while holding global_device_interrupts_lock, except for location and
+// entry, which only change while the entry isn't used.
+struct DeviceInterrupt {
+    bool is_used;
+
+    // nullptr until the device is set up, and again while the binding is removed, so the vector's interrupts are dropped
+    Event *event;
+    size_t signals;
+
+    size_t process_id;
+    size_t location;
+    size_t entry;
+};
+
+// Indexed by vector - device_interrupt_vectors_start
+static DeviceInterrupt global_device_interrupts[device_interrupt_vector_count];
+
+static volatile bool global_device_interrupts_lock = false;
+
+static void deliver_device_interrupts() {
+    auto pending = __atomic_exchange_n(&global_pending_device_interrupts, (size_t)0, __ATOMIC_ACQUIRE);
+
+    acquire_lock(&global_device_interrupts_lock);
+
+    for(size_t i = 0; i < device_interrupt_vector_count; i += 1) {
+        auto device_interrupt = &global_device_interrupts[i];
+
+        if((pending & (size_t)1 << i) != 0 && device_interrupt->event != nullptr) {
+            signal_event(device_interrupt->event, device_interrupt->signals);
+        }
+    }
+
+    global_device_interrupts_lock = false;
+}
+
+// Stops the device sending the vector before freeing it, so a later binding never sees the old device's interrupts.
+// Must be called by the owning process while holding its syscall_lock, or when it's being destroyed.
+static void unbind_device_interrupt(size_t index) {
+    auto device_interrupt = &global_device_interrupts[index];
+
+    acquire_lock(&global_device_interrupts_lock);
+
+    auto event = device_interrupt->event;
+    device_interrupt->event = nullptr;
+
+    global_device_interrupts_lock = false;
+
+    disable_pcie_interrupt(device_interrupt->location, device_interrupt->entry, global_bitmap);
+
+    acquire_lock(&global_device_interrupts_lock);
+
+    device_interrupt->is_used = false;
+
+    global_device_interrupts_lock = false;
+
+    if(event != nullptr) {
+        release_kernel_object(&event->object, global_bitmap);
+    }
+}
+
+static void unbind_process_device_interrupts(Process *process) {
+    for(size_t i = 0; i < device_interrupt_vector_count; i += 1) {
+        acquire_lock(&global_device_interrupts_lock);
+
+        auto is_owned = global_device_interrupts[i].is_used && global_device_interrupts[i].process_id == process->id;
+
+        global_device_interrupts_lock = false;
+
+        if(is_owned) {
+            unbind_device_interrupt(i);
+        }
+    }
+}
+
+// The current thread must be ready to be released (see release_thread), and the target thread must be ready.
+// Enters the target thread directly on this processor if no other processor has picked it up yet.
+[[noreturn]] static void hand_off_to_thread(
+    ProcessorArea *processor_area,
+    ProcessThread *thread,
+    Processes::Iterator target_process_iterator,
+    ProcessThreads::Iterator target_thread_iterator
+) {
+    release_thread(processor_area, thread);
+
+    auto target_thread = *target_thread_iterator;
+
+    if(compare_and_swap(&target_thread->is_resident, false, true)) {
+        processor_area->current_process_iterator = target_process_iterator;
+        processor_area->current_thread_iterator = target_thread_iterator;
+
+        enter_thread(processor_area, *target_process_iterator, target_thread);
+    }
+
+    enter_next_process(processor_area, global_bitmap, &global_processes);
+}
+
+static void publish_process_alive(size_t process_id) {
+    auto slot = &global_kernel_info->process_slots[process_id % kernel_info_process_slot_count];
+
+    acquire_lock(&global_kernel_info_lock);
+
+    if(*slot == 0) {
+        __atomic_store_n(slot, process_id + 1, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(slot, kernel_info_process_slot_shared, __ATOMIC_RELEASE);
+    }
+
+    global_kernel_info_lock = false;
+}
+
+// The process must already be marked as not ready
+static void publish_process_dead(size_t process_id) {
+    auto slot_index = process_id % kernel_info_process_slot_count;
+    auto slot = &global_kernel_info->process_slots[slot_index];
+
+    acquire_lock(&global_kernel_info_lock);
+
+    if(*slot == kernel_info_process_slot_shared) {
+        // Find out which processes are left in the slot
+        size_t new_slot = 0;
+        for(auto process : global_processes) {
+            if(process->is_ready && process->id % kernel_info_process_slot_count == slot_index) {
+                if(new_slot == 0) {
+                    new_slot = process->id + 1;
+                } else {
+                    new_slot = kernel_info_process_slot_shared;
+                    break;
+                }
+            }
+        }
+
+        __atomic_store_n(slot, new_slot, __ATOMIC_RELEASE);
+    } else if(*slot == process_id + 1) {
+        __atomic_store_n(slot, (size_t)0, __ATOMIC_RELEASE);
+    }
+
+    global_kernel_info_lock = false;
+}
+
+// Each exit watcher gets a channel message from the process with the user data as the first word, or has the user data
+// signalled on its event. Notifications to a full channel are lost. The process must already be marked as not ready.
+static void notify_process_exit(Process *process) {
+    for(auto iterator = begin(process->exit_watchers); iterator != end(process->exit_watchers); ++iterator) {
+        auto watcher = *iterator;
+
+        switch(watcher->object->type) {
+            case KernelObjectType::Channel: {
+                IPCMessage message {
+                    { watcher->user_data }
+                };
+
+                send_channel_message((Channel*)watcher->object, process->id, &message);
+            } break;
+
+            case KernelObjectType::Event: {
+                signal_event((Event*)watcher->object, watcher->user_data);
+            } break;
+
+            default: break;
+        }
+
+        release_kernel_object(watcher->object, global_bitmap);
+
+        remove_item_from_bucket_array(iterator);
+    }
+}
+
+// Fails any IPC calls still waiting on the process, notifies its exit watchers, then destroys it
+static void terminate_process(Processes::Iterator iterator) {
+    auto process = *iterator;
+
+    acquire_lock(&global_ipc_lock);
+
+    process->is_ready = false;
+
+    for(auto thread : process->threads) {
+        if(thread->ipc_state == ThreadIPCState::ReceivingChannels) {
+            stop_receiving_channels(thread);
+        } else if(thread->ipc_state == ThreadIPCState::WaitingForEvent) {
+            stop_waiting_for_event(thread);
+        }
+    }
+
+    for(auto other_process : global_processes) {
+        for(auto other_thread : other_process->threads) {
+            if(
+                (other_thread->ipc_state == ThreadIPCState::Calling || other_thread->ipc_state == ThreadIPCState::WaitingForReply) &&
+                other_thread->ipc_peer_process_id == process->id
+            ) {
+                other_thread->frame.rbx = (size_t)IPCCallResult::InvalidProcessID;
+
+                other_thread->ipc_state = ThreadIPCState::None;
+                other_thread->is_ready = true;
+            }
+        }
+    }
+
+    global_ipc_lock = false;
+
+    // No watchers can be added anymore, as the process isn't ready
+    notify_process_exit(process);
+
+    publish_process_dead(process->id);
+
+    acquire_lock(&global_periodic_lock);
+
+    for(auto thread : process->threads) {
+        if(thread->is_periodic) {
+            thread->is_periodic = false;
+
+            global_periodic_thread_count -= 1;
+            global_periodic_utilization -= thread->utilization;
+        }
+    }
+
+    global_periodic_lock = false;
+
+    // Wait out any ring submissions being performed for the process by another processor
+    acquire_lock(&process->syscall_lock);
+
+    if(process->is_syscall_ring_polled) {
+        process->is_syscall_ring_polled = false;
+
+        __atomic_sub_fetch(&global_polled_syscall_ring_count, 1, __ATOMIC_RELAXED);
+    }
+
+    process->syscall_lock = false;
+
+    unbind_process_device_interrupts(process);
+
+    // Print whatever the process logged last, waiting out any other processor draining it
+    acquire_lock(&process->log_lock);
+
+    if(process->log_ring != nullptr) {
+        drain_log_ring(process);
+
+        __atomic_sub_fetch(&global_log_ring_count, 1, __ATOMIC_RELAXED);
+    }
+
+    process->log_lock = false;
+
+    destroy_process(iterator, global_bitmap);
+}
+
+// Basically using always_inline as a type-safe macro
+static __attribute__((always_inline)) void continue_in_function_return(ThreadStackFrame *stack_frame, void (*function_continued)(ThreadStackFrame*)) {
+    auto current_pml4_table = read_cr3();
+
+    if(current_pml4_table == (size_t)&kernel_pml4_table) {
+        function_continued(stack_frame);
+    } else {
+        auto processor_id = get_processor_id();
+
+        auto processor_area_offset = processor_id * sizeof(ProcessorArea);
 
         auto frame_user_address = (size_t)stack_frame;
 
@@ -579,7 +1504,7 @@ static __attribute__((always_inline)) void continue_in_function_return(ThreadSta
             }
         }
 
-        destroy_process(processor_area->current_process_iterator, global_bitmap);
+        terminate_process(processor_area->current_process_iterator);
 
         enter_next_process(processor_area, global_bitmap, &global_processes);
     } else {
@@ -589,13 +1514,76 @@ static __attribute__((always_inline)) void continue_in_function_return(ThreadSta
     }
 }
 
+// Not-present faults in the process's stack reserve grow its stack and resume it, anything else ends the process
+[[noreturn]] void user_page_fault_handler_continued(const ThreadStackFrame *frame) {
+    auto fault_address = read_cr2();
+
+    auto processor_area = &global_processor_areas[get_processor_id()];
+
+    auto is_stack_overflow = false;
+
+    if(processor_area->current_process_iterator.current_bucket != nullptr) {
+        auto process = *processor_area->current_process_iterator;
+
+        auto error_code = frame->interrupt_frame.error_code;
+
+        if((error_code & 1) == 0 || (error_code & 0b10) != 0) { // Page not present, or write
+            acquire_lock(&process->syscall_lock);
+
+            bool is_resolved;
+            if((error_code & 1) == 0) {
+                is_resolved = grow_process_stack(process, fault_address, global_bitmap);
+            } else {
+                // The page may be copy-on-write, or already copied by the kernel on another processor
+                auto is_writable = false;
+                is_resolved = copy_on_write_user_pages(
+                    fault_address / page_size,
+                    1,
+                    process->pml4_table_physical_address,
+                    global_bitmap,
+                    &is_writable
+                ) && is_writable;
+            }
+
+            process->syscall_lock = false;
+
+            if(is_resolved) {
+                suspend_thread(processor_area, *processor_area->current_thread_iterator, frame);
+
+                enter_next_process(processor_area, global_bitmap, &global_processes);
+            }
+        }
+
+        is_stack_overflow = fault_address / page_size == process->stack_reserve_pages_start - 1;
+    }
+
+    printf(
+        "EXCEPTION 0x%X(0x%X) AT %p ACCESSING %p",
+        0x0E,
+        frame->interrupt_frame.error_code,
+        frame->interrupt_frame.instruction_pointer,
+        (void*)fault_address
+    );
+
+    if(is_stack_overflow) {
+        printf(" (stack overflow)");
+    }
+
+    user_exception_handler_continued(frame);
+}
+
 extern "C" [[noreturn]] void exception_handler(size_t index, const ThreadStackFrame *frame) {
-    printf("EXCEPTION 0x%X(0x%X) AT %p", index, frame->interrupt_frame.error_code, frame->interrupt_frame.instruction_pointer);
+    auto is_user_page_fault = index == 0x0E && frame->interrupt_frame.code_segment != 0x08;
+
+    // User page faults are only reported once they turn out not to be stack growth
+    if(!is_user_page_fault) {
+        printf("EXCEPTION 0x%X(0x%X) AT %p", index, frame->interrupt_frame.error_code, frame->interrupt_frame.instruction_pointer);
 
-    if(index == 0x0E) { // Page Fault
-        auto fault_address = read_cr2();
+        if(index == 0x0E) { // Page Fault
+            auto fault_address = read_cr2();
 
-        printf(" ACCESSING %p", (void*)fault_address);
+            printf(" ACCESSING %p", (void*)fault_address);
+        }
     }
 
     if(frame->interrupt_frame.code_segment != 0x08) {
@@ -613,7 +1601,11 @@ extern "C" [[noreturn]] void exception_handler(size_t index, const ThreadStackFr
         user_processor_area->in_syscall_or_user_exception = false;
         user_processor_area->preempt_during_syscall_or_user_exception = false;
 
-        continue_in_function(frame, &user_exception_handler_continued);
+        if(is_user_page_fault) {
+            continue_in_function(frame, &user_page_fault_handler_continued);
+        } else {
+            continue_in_function(frame, &user_exception_handler_continued);
+        }
     } else {
         printf(" in kernel (processor %u)\n", get_processor_id());
 
@@ -630,9 +1622,7 @@ extern "C" [[noreturn]] void exception_handler(size_t index, const ThreadStackFr
     if(processor_area->current_process_iterator.current_bucket != nullptr) {
         auto old_thread = *processor_area->current_thread_iterator;
 
-        old_thread->frame = *frame;
-
-        old_thread->is_resident = false;
+        suspend_thread(processor_area, old_thread, frame);
     }
 
     enable_interrupts();
@@ -640,6 +1630,32 @@ extern "C" [[noreturn]] void exception_handler(size_t index, const ThreadStackFr
     enter_next_process(processor_area, global_bitmap, &global_processes);
 }
 
+void device_not_available_handler_continued(ThreadStackFrame *frame) {
+    auto processor_id = get_processor_id();
+    auto processor_area = &global_processor_areas[processor_id];
+
+    auto thread = *processor_area->current_thread_iterator;
+
+    asm volatile("clts");
+
+    restore_fpu_state(&thread->fpu_state);
+
+    thread->is_fpu_state_loaded = true;
+    thread->fpu_state_processor_id = processor_id;
+
+    processor_area->fpu_state_owner = thread;
+}
+
+extern "C" void device_not_available_handler(ThreadStackFrame *frame) {
+    if(frame->interrupt_frame.code_segment == 0x08) {
+        printf("EXCEPTION 0x7(0x0) AT %p in kernel (processor %u)\n", frame->interrupt_frame.instruction_pointer, get_processor_id());
+
+        halt();
+    }
+
+    continue_in_function_return(frame, &device_not_available_handler_continued);
+}
+
 extern "C" void preempt_timer_handler(ThreadStackFrame *frame) {
     if(frame->interrupt_frame.code_segment == 0x08) {
         auto processor_area = &global_processor_areas[get_processor_id()];
@@ -662,24 +1678,85 @@ extern "C" void preempt_timer_handler(ThreadStackFrame *frame) {
     }
 }
 
-extern "C" void spurious_interrupt_handler(const ThreadStackFrame *frame) {
-    printf("Spurious interrupt at %p\n", frame->interrupt_frame.instruction_pointer);
-}
-
-volatile bool global_kernel_tables_update_lock = false;
-volatile size_t global_kernel_tables_update_pages_start;
-volatile size_t global_kernel_tables_update_page_count;
-volatile size_t global_kernel_tables_update_progress;
-
-void kernel_page_tables_update_handler_continued(ThreadStackFrame *frame) {
+[[noreturn]] void device_interrupt_handler_continued(const ThreadStackFrame *frame) {
     auto processor_area = &global_processor_areas[get_processor_id()];
 
+    __atomic_or_fetch(&global_pending_device_interrupts, (size_t)1 << frame->interrupt_frame.error_code, __ATOMIC_RELEASE);
+
     // Send the End of Interrupt signal
     processor_area->apic_registers->end_of_interrupt.value = 0;
-}
-
-extern "C" void kernel_page_tables_update_handler(ThreadStackFrame *frame) {
-    auto current_pml4_table = read_cr3();
+
+    if(processor_area->current_process_iterator.current_bucket != nullptr) {
+        auto old_thread = *processor_area->current_thread_iterator;
+
+        suspend_thread(processor_area, old_thread, frame);
+    }
+
+    enable_interrupts();
+
+    enter_next_process(processor_area, global_bitmap, &global_processes);
+}
+
+// The error code is the device interrupt index. The interrupt is only marked as pending when the kernel is busy, as it
+// may hold any lock, and gets delivered the next time the processor enters the scheduler. Interrupted user threads and
+// idle processors go straight there instead, so waiting drivers wake up right away.
+extern "C" void device_interrupt_handler(ThreadStackFrame *frame) {
+    if(frame->interrupt_frame.code_segment == 0x08) {
+        auto processor_area = &global_processor_areas[get_processor_id()];
+
+        if(!processor_area->is_idle) {
+            __atomic_or_fetch(&global_pending_device_interrupts, (size_t)1 << frame->interrupt_frame.error_code, __ATOMIC_RELEASE);
+
+            if(processor_area->in_syscall_or_user_exception) {
+                processor_area->preempt_during_syscall_or_user_exception = true;
+            }
+
+            // Send the End of Interrupt signal
+            processor_area->apic_registers->end_of_interrupt.value = 0;
+
+            return;
+        }
+    }
+
+    // Still on the user page tables if a user thread was interrupted, so the user mapping of the processor area is used
+    auto processor_area = (ProcessorArea*)(user_processor_areas_memory_start + get_processor_id() * sizeof(ProcessorArea));
+    if(frame->interrupt_frame.code_segment == 0x08) {
+        processor_area = &global_processor_areas[get_processor_id()];
+    }
+
+    // enter_next_process needs the APIC timer disabled, and the preempt of the interrupted thread (or the idle wake-up)
+    // may still be counting down or already pending. A pending one is ignored like one during a syscall.
+    processor_area->in_syscall_or_user_exception = true;
+
+    // Disable APIC timer
+    processor_area->apic_registers->lvt_timer.value |= 1 << 16;
+
+    enable_interrupts();
+
+    processor_area->in_syscall_or_user_exception = false;
+    processor_area->preempt_during_syscall_or_user_exception = false;
+
+    continue_in_function(frame, &device_interrupt_handler_continued);
+}
+
+extern "C" void spurious_interrupt_handler(const ThreadStackFrame *frame) {
+    printf("Spurious interrupt at %p\n", frame->interrupt_frame.instruction_pointer);
+}
+
+volatile bool global_kernel_tables_update_lock = false;
+volatile size_t global_kernel_tables_update_pages_start;
+volatile size_t global_kernel_tables_update_page_count;
+volatile size_t global_kernel_tables_update_progress;
+
+void kernel_page_tables_update_handler_continued(ThreadStackFrame *frame) {
+    auto processor_area = &global_processor_areas[get_processor_id()];
+
+    // Send the End of Interrupt signal
+    processor_area->apic_registers->end_of_interrupt.value = 0;
+}
+
+extern "C" void kernel_page_tables_update_handler(ThreadStackFrame *frame) {
+    auto current_pml4_table = read_cr3();
 
     if(current_pml4_table == (size_t)&kernel_pml4_table) {
         for(
@@ -696,7 +1773,9 @@ extern "C" void kernel_page_tables_update_handler(ThreadStackFrame *frame) {
     continue_in_function_return(frame, &kernel_page_tables_update_handler_continued);
 }
 
-const size_t idt_length = 48;
+const size_t idt_length = 64;
+
+static_assert(device_interrupt_vectors_start + device_interrupt_vector_count == idt_length, "Device interrupt vectors not at the end of the IDT");
 
 #define idt_entry_exception(index) {\
     (uint16_t)(size_t)&exception_handler_thunk_##index, \
@@ -737,6 +1816,19 @@ const size_t idt_length = 48;
     0 \
 }
 
+#define idt_entry_device(index) {\
+    (uint16_t)(size_t)&device_interrupt_handler_thunk_##index, \
+    0x08, \
+    0, \
+    0, \
+    0xE, \
+    false, \
+    0, \
+    true, \
+    (uint64_t)(size_t)&device_interrupt_handler_thunk_##index >> 16, \
+    0 \
+}
+
 const size_t kernel_page_tables_update_vector = 33;
 const size_t legacy_pic_vectors_start = 34;
 
@@ -748,7 +1840,7 @@ IDTEntry idt_entries[idt_length] {
     idt_entry_exception(4),
     idt_entry_exception(5),
     idt_entry_exception(6),
-    idt_entry_exception(7),
+    idt_entry_general(device_not_available),
     idt_entry_exception(8),
     {},
     idt_entry_exception(10),
@@ -776,7 +1868,23 @@ IDTEntry idt_entries[idt_length] {
     idt_entry_legacy_pic(),
     idt_entry_legacy_pic(),
     {}, {}, {}, {}, {},
-    idt_entry_general(spurious_interrupt)
+    idt_entry_general(spurious_interrupt),
+    idt_entry_device(0),
+    idt_entry_device(1),
+    idt_entry_device(2),
+    idt_entry_device(3),
+    idt_entry_device(4),
+    idt_entry_device(5),
+    idt_entry_device(6),
+    idt_entry_device(7),
+    idt_entry_device(8),
+    idt_entry_device(9),
+    idt_entry_device(10),
+    idt_entry_device(11),
+    idt_entry_device(12),
+    idt_entry_device(13),
+    idt_entry_device(14),
+    idt_entry_device(15)
 };
 
 static void inline memory_fence() {
@@ -827,7 +1935,122 @@ enum struct MapProcessMemoryResult {
     InvalidMemoryRange
 };
 
-static MapProcessMemoryResult map_process_memory_into_kernel(Process *process, size_t user_memory_start, size_t size, void **kernel_memory_start) {
+static const char *syscall_names[syscall_type_count] {
+#define X(name, snake_name, result_type, parameter_count) #name,
+    SYSCALL_TABLE(X)
+#undef X
+};
+
+static void record_syscall_latency(SyscallStatistics *statistics, uint64_t cycles, uint64_t combined_paging_lock_wait_cycles) {
+    statistics->total_cycles += cycles;
+    statistics->combined_paging_lock_wait_cycles += combined_paging_lock_wait_cycles;
+
+    size_t bucket_index = 0;
+    if(cycles != 0) {
+        bucket_index = 63 - __builtin_clzll(cycles);
+    }
+
+    if(bucket_index >= syscall_latency_bucket_count) {
+        bucket_index = syscall_latency_bucket_count - 1;
+    }
+
+    statistics->latency_histogram[bucket_index] += 1;
+}
+
+// Other processors may be updating their statistics at the same time, so the sum is only approximately consistent
+static void sum_syscall_statistics(size_t syscall_type, SyscallStatistics *result_statistics) {
+    SyscallStatistics statistics {};
+
+    for(size_t i = 0; i < global_processor_area_count; i += 1) {
+        auto processor_statistics = &global_processor_areas[i].syscall_statistics[syscall_type];
+
+        statistics.call_count += processor_statistics->call_count;
+        statistics.total_cycles += processor_statistics->total_cycles;
+        statistics.combined_paging_lock_wait_cycles += processor_statistics->combined_paging_lock_wait_cycles;
+
+        for(size_t j = 0; j < syscall_latency_bucket_count; j += 1) {
+            statistics.latency_histogram[j] += processor_statistics->latency_histogram[j];
+        }
+    }
+
+    *result_statistics = statistics;
+}
+
+static volatile bool global_syscall_statistics_print_lock = false;
+
+// Dumps the statistics for every syscall that has been made to the console
+static void print_syscall_statistics() {
+    // Another processor is already printing them
+    if(!compare_and_swap(&global_syscall_statistics_print_lock, false, true)) {
+        return;
+    }
+
+    printf("Syscall statistics (timestamp counter cycles, histogram buckets are log2 of cycles):\n");
+
+    for(size_t i = 0; i < syscall_type_count; i += 1) {
+        SyscallStatistics statistics;
+        sum_syscall_statistics(i, &statistics);
+
+        if(statistics.call_count == 0) {
+            continue;
+        }
+
+        size_t sampled_count = 0;
+        for(size_t j = 0; j < syscall_latency_bucket_count; j += 1) {
+            sampled_count += statistics.latency_histogram[j];
+        }
+
+        uint64_t mean_cycles = 0;
+        if(sampled_count != 0) {
+            mean_cycles = statistics.total_cycles / sampled_count;
+        }
+
+        printf(
+            "%s: %zu calls, %zu mean cycles, %zu cycles waiting for paging lock\n ",
+            syscall_names[i],
+            statistics.call_count,
+            (size_t)mean_cycles,
+            (size_t)statistics.combined_paging_lock_wait_cycles
+        );
+
+        for(size_t j = 0; j < syscall_latency_bucket_count; j += 1) {
+            if(statistics.latency_histogram[j] != 0) {
+                printf(" %zu:%zu", j, statistics.latency_histogram[j]);
+            }
+        }
+
+        printf("\n");
+    }
+
+    printf("Prelinked image cache: %zu hits, %zu misses\n", prelinked_image_hit_count, prelinked_image_miss_count);
+
+    for(size_t i = 0; i < global_processor_area_count; i += 1) {
+        auto statistics = &global_processor_areas[i].scheduler_statistics;
+
+        if(statistics->context_switch_count == 0) {
+            continue;
+        }
+
+        printf(
+            "Processor %zu: %zu context switches, %zu mean cycles, %zu thread migrations\n",
+            i,
+            statistics->context_switch_count,
+            (size_t)(statistics->context_switch_cycles / statistics->context_switch_count),
+            statistics->thread_migration_count
+        );
+    }
+
+    global_syscall_statistics_print_lock = false;
+}
+
+// Set is_written if the kernel is going to write to the memory, so any copy-on-write pages in it are copied first
+static MapProcessMemoryResult map_process_memory_into_kernel(
+    Process *process,
+    size_t user_memory_start,
+    size_t size,
+    bool is_written,
+    void **kernel_memory_start
+) {
     auto user_memory_end = user_memory_start + size;
 
     auto user_pages_start = user_memory_start / page_size;
@@ -837,15 +2060,30 @@ static MapProcessMemoryResult map_process_memory_into_kernel(Process *process, s
     auto offset = user_memory_start - user_pages_start * page_size;
 
     auto found = false;
-    for(auto iterator = begin(process->mappings); iterator != end(process->mappings); ++iterator) {
-        auto mapping = *iterator;
-
+    if(user_pages_start >= process->stack_reserve_pages_start && user_pages_end <= process->stack_pages_end) {
+        // Parts of the stack the process hasn't touched yet are committed as if it had
         if(
-            user_pages_start >= mapping->logical_pages_start &&
-            user_pages_end <= mapping->logical_pages_start + mapping->page_count
+            user_pages_start < process->stack_committed_pages_start &&
+            !grow_process_stack(process, user_pages_start * page_size, global_bitmap)
         ) {
-            found = true;
-            break;
+            return MapProcessMemoryResult::OutOfMemory;
+        }
+
+        found = true;
+    } else {
+        for(auto iterator = begin(process->mappings); iterator != end(process->mappings); ++iterator) {
+            auto mapping = *iterator;
+
+            // The kernel only writes into memory that belongs to the process alone, never into pages shared with
+            // other processes, such as prelinked code or shared memory
+            if(
+                user_pages_start >= mapping->logical_pages_start &&
+                user_pages_end <= mapping->logical_pages_start + mapping->page_count &&
+                (!is_written || mapping->is_owned)
+            ) {
+                found = true;
+                break;
+            }
         }
     }
 
@@ -853,6 +2091,24 @@ static MapProcessMemoryResult map_process_memory_into_kernel(Process *process, s
         return MapProcessMemoryResult::InvalidMemoryRange;
     }
 
+    if(is_written) {
+        bool is_writable;
+        if(!copy_on_write_user_pages(
+            user_pages_start,
+            page_count,
+            process->pml4_table_physical_address,
+            global_bitmap,
+            &is_writable
+        )) {
+            return MapProcessMemoryResult::OutOfMemory;
+        }
+
+        // The kernel mapping is always writable, so the process's own permissions have to be checked
+        if(!is_writable) {
+            return MapProcessMemoryResult::InvalidMemoryRange;
+        }
+    }
+
     size_t kernel_pages_start;
     if(!map_pages_from_user(
         user_pages_start,
@@ -868,40 +2124,237 @@ static MapProcessMemoryResult map_process_memory_into_kernel(Process *process, s
     return MapProcessMemoryResult::Success;
 }
 
-void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
-    auto processor_area = &global_processor_areas[get_processor_id()];
+// Allocates zeroed memory that is shared between the kernel and a process. The kernel mapping is kept, as rings are
+// accessed outside of the process's address space. If is_fixed_address is set the memory is mapped at
+// *user_pages_start, rather than wherever there's room.
+static bool allocate_kernel_shared_memory(
+    Process *process,
+    size_t size,
+    bool is_fixed_address,
+    void **kernel_memory_start,
+    size_t *user_pages_start
+) {
+    auto page_count = divide_round_up(size, page_size);
 
-    processor_area->in_syscall_or_user_exception = true;
+    size_t kernel_pages_start;
+    if(!map_and_allocate_pages(page_count, global_bitmap, &kernel_pages_start)) {
+        return false;
+    }
 
-    enable_interrupts();
+    bool is_mapped;
+    if(is_fixed_address) {
+        is_mapped = map_pages_from_kernel_at(
+            kernel_pages_start,
+            page_count,
+            PagePermissions::Write,
+            process->pml4_table_physical_address,
+            global_bitmap,
+            *user_pages_start
+        );
+    } else {
+        is_mapped = map_pages_from_kernel(
+            kernel_pages_start,
+            page_count,
+            PagePermissions::Write,
+            process->pml4_table_physical_address,
+            global_bitmap,
+            user_pages_start
+        );
+    }
 
-    auto process = *processor_area->current_process_iterator;
-    auto thread = *processor_area->current_thread_iterator;
+    if(!is_mapped) {
+        unmap_and_deallocate_pages(kernel_pages_start, page_count, global_bitmap);
 
-    auto syscall_index = stack_frame->rbx;
-    auto parameter_1 = stack_frame->rdx;
-    // auto parameter_2 = stack_frame->rsi;
+        return false;
+    }
 
-    auto return_1 = &stack_frame->rbx;
-    auto return_2 = &stack_frame->rdx;
+    if(!register_process_mapping(process, *user_pages_start, page_count, false, true, global_bitmap)) {
+        unmap_and_deallocate_pages(kernel_pages_start, page_count, global_bitmap);
 
-    static_assert(configuration_area_size == page_size, "PCI-E MMIO area not page-sized");
+        unmap_pages(*user_pages_start, page_count, process->pml4_table_physical_address, false, global_bitmap);
 
-    switch((SyscallType)syscall_index) {
-        case SyscallType::Exit: {
-            destroy_process(processor_area->current_process_iterator, global_bitmap);
+        return false;
+    }
 
-            enter_next_process(processor_area, global_bitmap, &global_processes);
-        } break;
+    clear_pages(kernel_pages_start, page_count);
 
-        case SyscallType::RelinquishTime: {
-            thread->frame = *stack_frame;
+    *kernel_memory_start = (void*)(kernel_pages_start * page_size);
+    return true;
+}
 
-            thread->is_resident = false;
+// Gives a clone its own syscall and log rings, at the same addresses and with the same contents as the source
+// process's. Must hold source_process->syscall_lock.
+static bool clone_process_rings(Process *source_process, Process *process) {
+    if(source_process->syscall_ring != nullptr) {
+        auto user_pages_start = source_process->syscall_ring_user_pages_start;
 
-            enter_next_process(processor_area, global_bitmap, &global_processes);
-        } break;
+        SyscallRing *ring;
+        if(!allocate_kernel_shared_memory(process, sizeof(SyscallRing), true, (void**)&ring, &user_pages_start)) {
+            return false;
+        }
+
+        copy_memory(source_process->syscall_ring, ring, sizeof(SyscallRing));
+
+        process->syscall_ring = ring;
+        process->syscall_ring_user_pages_start = user_pages_start;
+    }
+
+    if(source_process->log_ring != nullptr) {
+        auto user_pages_start = source_process->log_ring_user_pages_start;
+
+        LogRing *ring;
+        if(!allocate_kernel_shared_memory(process, sizeof(LogRing), true, (void**)&ring, &user_pages_start)) {
+            return false;
+        }
+
+        // Drained first, so what's already in the ring is only printed once
+        acquire_lock(&source_process->log_lock);
+
+        drain_log_ring(source_process);
+
+        copy_memory(source_process->log_ring, ring, sizeof(LogRing));
+
+        source_process->log_lock = false;
+
+        process->log_ring = ring;
+        process->log_ring_user_pages_start = user_pages_start;
+    }
+
+    return true;
+}
+
+// Prints everything written to the log ring so far. Must hold process->log_lock.
+static void drain_log_ring(Process *process) {
+    auto ring = process->log_ring;
+
+    auto head = ring->head;
+    auto tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    // A misbehaving process could have moved the tail anywhere
+    if(tail - head > log_ring_length) {
+        head = tail - log_ring_length;
+    }
+
+    while(head != tail) {
+        putchar(ring->buffer[head % log_ring_length]);
+
+        head += 1;
+    }
+
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+// Called by processors with nothing else to do
+static void drain_log_rings() {
+    for(auto process : global_processes) {
+        if(process->log_ring == nullptr) {
+            continue;
+        }
+
+        // Skip processes whose ring is already being drained
+        if(!compare_and_swap(&process->log_lock, false, true)) {
+            continue;
+        }
+
+        if(process->is_ready && process->log_ring != nullptr) {
+            drain_log_ring(process);
+        }
+
+        process->log_lock = false;
+    }
+}
+
+// Where each syscall in SYSCALL_TABLE is dispatched. Immediate syscalls complete straight away and only act on the
+// process (not the calling thread), so they can also be performed through its syscall ring, see
+// perform_immediate_syscall. Thread syscalls can block or switch threads, and are handled in syscall_entrance_continued.
+#define IMMEDIATE_SYSCALLS(X) \
+    X(DebugPrint) \
+    X(MapFreeMemory) \
+    X(MapFreeConsecutiveMemory) \
+    X(CreateSharedMemory) \
+    X(CreateSharedMemoryObject) \
+    X(MapSharedMemoryObject) \
+    X(UnmapMemory) \
+    X(CreateProcess) \
+    X(DoesProcessExist) \
+    X(FindPCIEDevice) \
+    X(MapPCIEConfiguration) \
+    X(MapPCIEBar) \
+    X(CreateLogRing) \
+    X(DebugWrite) \
+    X(GetSyscallStatistics) \
+    X(GetSchedulerStatistics) \
+    X(ShareHandle) \
+    X(CloseHandle) \
+    X(CreateChannel) \
+    X(ChannelSend) \
+    X(WatchProcessExit) \
+    X(CreateEvent) \
+    X(SignalEvent) \
+    X(BindPCIEInterrupt) \
+    X(UnbindPCIEInterrupt)
+
+#define THREAD_SYSCALLS(X) \
+    X(Exit) \
+    X(RelinquishTime) \
+    X(SetThreadPeriod) \
+    X(CreateSyscallRing) \
+    X(SubmitSyscallRing) \
+    X(CloneProcess) \
+    X(MapSharedMemory) \
+    X(GrantMemory) \
+    X(WaitForNextPeriod) \
+    X(IPCCall) \
+    X(IPCReceive) \
+    X(IPCReply) \
+    X(IPCReplyAndReceive) \
+    X(ChannelReceive) \
+    X(WaitEvent)
+
+#define X(name) SyscallType::name,
+static constexpr SyscallType dispatched_syscalls[] { IMMEDIATE_SYSCALLS(X) THREAD_SYSCALLS(X) };
+#undef X
+
+const size_t dispatched_syscall_count = sizeof(dispatched_syscalls) / sizeof(SyscallType);
+
+static constexpr size_t count_dispatches(SyscallType syscall_type, size_t index) {
+    return index == dispatched_syscall_count ? 0 :
+        (dispatched_syscalls[index] == syscall_type ? 1 : 0) + count_dispatches(syscall_type, index + 1);
+}
+
+static constexpr bool is_every_syscall_dispatched_once(size_t syscall_index) {
+    return syscall_index == syscall_type_count ||
+        (count_dispatches((SyscallType)syscall_index, 0) == 1 && is_every_syscall_dispatched_once(syscall_index + 1));
+}
+
+// Each list's cases are also in the other's switch, so a syscall listed in the wrong one is a duplicate case, and one
+// left out of perform_immediate_syscall's switch is caught by -Wswitch
+static_assert(
+    dispatched_syscall_count == syscall_type_count && is_every_syscall_dispatched_once(0),
+    "Every syscall has to be in exactly one of IMMEDIATE_SYSCALLS and THREAD_SYSCALLS"
+);
+
+// Returns false if syscall_type isn't one of IMMEDIATE_SYSCALLS. Must hold process->syscall_lock.
+static bool perform_immediate_syscall(
+    Process *process,
+    SyscallType syscall_type,
+    const size_t parameters[syscall_parameter_count],
+    size_t *return_1,
+    size_t *return_2
+) {
+    auto parameter_1 = parameters[0];
+    auto parameter_2 = parameters[1];
+    auto parameter_3 = parameters[2];
+    auto parameter_4 = parameters[3];
+
+    static_assert(configuration_area_size == page_size, "PCI-E MMIO area not page-sized");
+
+    // Ring submissions can have any type
+    if((size_t)syscall_type >= syscall_type_count) {
+        return false;
+    }
 
+    switch(syscall_type) {
         case SyscallType::DebugPrint: {
             putchar((char)parameter_1);
         } break;
@@ -978,7 +2431,7 @@ void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
                 break;
             }
 
-            if(!register_process_mapping(process, user_pages_start, page_count, false, true, global_bitmap)) {
+            if(!register_process_mapping(process, user_pages_start, page_count, false, true, global_bitmap, true)) {
                 unmap_and_deallocate_pages(kernel_pages_start, page_count, global_bitmap);
 
                 unmap_pages(user_pages_start, page_count, process->pml4_table_physical_address, false, global_bitmap);
@@ -994,514 +2447,1582 @@ void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
             *return_2 = physical_pages_start * page_size;
         } break;
 
-        case SyscallType::CreateSharedMemory: {
-            *return_1 = 0;
-
-            auto size = parameter_1;
-            auto page_count = divide_round_up(size, page_size);
+        case SyscallType::CreateSharedMemory: {
+            *return_1 = 0;
+
+            auto size = parameter_1;
+            auto page_count = divide_round_up(size, page_size);
+
+            // Backed by an object without a handle, so the pages outlive this mapping for as long as other processes
+            // have them mapped
+            auto shared_memory = create_shared_memory(page_count, global_bitmap);
+            if(shared_memory == nullptr) {
+                break;
+            }
+
+            size_t user_pages_start;
+            if(map_shared_memory(process, shared_memory, PagePermissions::Write, global_bitmap, &user_pages_start)) {
+                *return_1 = user_pages_start * page_size;
+            }
+
+            release_kernel_object(&shared_memory->object, global_bitmap);
+        } break;
+
+        case SyscallType::CreateSharedMemoryObject: {
+            auto page_count = divide_round_up(parameter_1, page_size);
+
+            auto shared_memory = create_shared_memory(page_count, global_bitmap);
+            if(shared_memory == nullptr) {
+                *return_1 = (size_t)CreateSharedMemoryObjectResult::OutOfMemory;
+                break;
+            }
+
+            size_t handle;
+            if(!create_handle(process, &shared_memory->object, handle_right_read | handle_right_write, &handle)) {
+                release_kernel_object(&shared_memory->object, global_bitmap);
+
+                *return_1 = (size_t)CreateSharedMemoryObjectResult::OutOfMemory;
+                break;
+            }
+
+            *return_1 = (size_t)CreateSharedMemoryObjectResult::Success;
+            *return_2 = handle;
+        } break;
+
+        case SyscallType::MapSharedMemoryObject: {
+            SharedMemory *shared_memory;
+            size_t rights;
+            if(!reference_shared_memory_handle(process, parameter_1, handle_right_read, &shared_memory, &rights)) {
+                *return_1 = (size_t)MapSharedMemoryObjectResult::InvalidHandle;
+                break;
+            }
+
+            // Mapped read-only unless the handle allows writing
+            auto permissions = (PagePermissions)0;
+            if((rights & handle_right_write) != 0) {
+                permissions = PagePermissions::Write;
+            }
+
+            size_t user_pages_start;
+            if(map_shared_memory(process, shared_memory, permissions, global_bitmap, &user_pages_start)) {
+                *return_1 = (size_t)MapSharedMemoryObjectResult::Success;
+                *return_2 = user_pages_start * page_size;
+            } else {
+                *return_1 = (size_t)MapSharedMemoryObjectResult::OutOfMemory;
+            }
+
+            release_kernel_object(&shared_memory->object, global_bitmap);
+        } break;
+
+        case SyscallType::UnmapMemory: {
+            auto logical_pages_start = parameter_1 / page_size;
+
+            // The kernel keeps using the syscall and log rings for the lifetime of the process
+            if(process->syscall_ring != nullptr && logical_pages_start == process->syscall_ring_user_pages_start) {
+                break;
+            }
+
+            if(process->log_ring != nullptr && logical_pages_start == process->log_ring_user_pages_start) {
+                break;
+            }
+
+            for(auto iterator = begin(process->mappings); iterator != end(process->mappings); ++iterator) {
+                auto mapping = *iterator;
+
+                if(mapping->logical_pages_start == logical_pages_start) {
+                    remove_item_from_bucket_array(iterator);
+
+                    unmap_pages(
+                        mapping->logical_pages_start,
+                        mapping->page_count,
+                        process->pml4_table_physical_address,
+                        mapping->is_owned,
+                        global_bitmap
+                    );
+
+                    if(mapping->shared_memory != nullptr) {
+                        release_kernel_object(&mapping->shared_memory->object, global_bitmap);
+                    }
+
+                    break;
+                }
+            }
+        } break;
+
+        case SyscallType::CreateProcess: {
+            auto elf_binary_address = parameter_1;
+            auto elf_binary_size = parameter_2;
+            auto data_address = parameter_3;
+            auto data_size = parameter_4 & ~create_process_move_data;
+            auto is_data_moved = (parameter_4 & create_process_move_data) != 0;
+            auto stack_size = parameters[4];
+            auto stack_reserve = parameters[5];
+
+            uint8_t *elf_binary;
+            switch(map_process_memory_into_kernel(process, elf_binary_address, elf_binary_size, false, (void**)&elf_binary)) {
+                case MapProcessMemoryResult::Success: {
+                    void *data;
+                    if(data_address == 0 || data_size == 0) {
+                        data = nullptr;
+                    } else if(is_data_moved) {
+                        // Stays a process address, the pages are moved rather than read
+                        data = (void*)data_address;
+                    } else {
+                        auto success = true;
+                        switch(map_process_memory_into_kernel(process, data_address, data_size, false, &data)) {
+                            case MapProcessMemoryResult::Success: break;
+
+                            case MapProcessMemoryResult::OutOfMemory: {
+                                *return_1 = (size_t)CreateProcessResult::OutOfMemory;
+
+                                success = false;
+                            } break;
+
+                            case MapProcessMemoryResult::InvalidMemoryRange: {
+                                *return_1 = (size_t)CreateProcessResult::InvalidMemoryRange;
+
+                                success = false;
+                            } break;
+                        }
+
+                        if(!success) {
+                            unmap_memory(elf_binary, elf_binary_size);
+
+                            break;
+                        }
+                    }
+
+                    Process *new_process;
+                    Processes::Iterator new_process_iterator;
+                    ProcessThread *new_thread;
+                    switch(create_process_from_elf(
+                        elf_binary,
+                        elf_binary_size,
+                        data,
+                        data_size,
+                        is_data_moved ? process : nullptr,
+                        stack_size,
+                        stack_reserve,
+                        global_bitmap,
+                        global_processor_area_count,
+                        global_processor_areas_physical_address,
+                        global_kernel_info_physical_address,
+                        &global_processes,
+                        &new_process,
+                        &new_process_iterator,
+                        &new_thread
+                    )) {
+                        case CreateProcessFromELFResult::Success: {
+                            // The process can exit as soon as it's ready, so it's published as alive before that, and
+                            // not touched afterwards
+                            auto new_process_id = new_process->id;
+
+                            publish_process_alive(new_process_id);
+
+                            new_thread->is_ready = true;
+                            new_process->is_ready = true;
+
+                            *return_1 = (size_t)CreateProcessResult::Success;
+                            *return_2 = new_process_id;
+                        } break;
+
+                        case CreateProcessFromELFResult::OutOfMemory: {
+                            *return_1 = (size_t)CreateProcessResult::OutOfMemory;
+                        } break;
+
+                        case CreateProcessFromELFResult::InvalidELF: {
+                            *return_1 = (size_t)CreateProcessResult::InvalidELF;
+                        } break;
+
+                        case CreateProcessFromELFResult::InvalidMemoryRange: {
+                            *return_1 = (size_t)CreateProcessResult::InvalidMemoryRange;
+                        } break;
+
+                        default: halt();
+                    }
+
+                    if(data != nullptr && !is_data_moved) {
+                        unmap_memory(data, data_size);
+                    }
+
+                    unmap_memory(elf_binary, elf_binary_size);
+                } break;
+
+                case MapProcessMemoryResult::OutOfMemory: {
+                    *return_1 = (size_t)CreateProcessResult::OutOfMemory;
+                } break;
+
+                case MapProcessMemoryResult::InvalidMemoryRange: {
+                    *return_1 = (size_t)CreateProcessResult::InvalidMemoryRange;
+                } break;
+            }
+        } break;
+
+        case SyscallType::DoesProcessExist: {
+            auto process_id = parameter_1;
+
+            Processes::Iterator iterator;
+            *return_1 = find_ready_process(process_id, &iterator) ? 1 : 0;
+        } break;
+
+        case SyscallType::FindPCIEDevice: {
+            auto index = parameter_1;
+
+            auto vendor_id = (uint16_t)parameter_2;
+            auto device_id = (uint16_t)(parameter_2 >> 16);
+            auto class_code = (uint8_t)(parameter_2 >> 32);
+            auto subclass = (uint8_t)(parameter_2 >> 40);
+            auto interface = (uint8_t)(parameter_2 >> 48);
+
+            auto requirements = parameter_3;
+
+            const PCIEDevice *device;
+            if(!find_pcie_device(index, vendor_id, device_id, class_code, subclass, interface, requirements, &device)) {
+                *return_1 = (size_t)FindPCIEDeviceResult::NotFound;
+                break;
+            }
+
+            *return_1 = (size_t)FindPCIEDeviceResult::Success;
+            *return_2 = device->location;
+        } break;
+
+        case SyscallType::MapPCIEConfiguration: {
+            *return_1 = 0;
+
+            size_t physical_memory_start;
+            if(!get_pcie_configuration_address(parameter_1, &physical_memory_start)) {
+                break;
+            }
+
+            size_t logical_pages_start;
+            if(!map_pages(
+                physical_memory_start / page_size,
+                1,
+                PagePermissions::Write,
+                process->pml4_table_physical_address,
+                global_bitmap,
+                &logical_pages_start
+            )) {
+                break;
+            }
+
+            if(!register_process_mapping(process, logical_pages_start, 1, false, false, global_bitmap)) {
+                break;
+            }
+
+            *return_1 = logical_pages_start * page_size;
+        } break;
+
+        case SyscallType::MapPCIEBar: {
+            auto bar_index = parameter_1 & bits_to_mask(bar_index_bits);
+            auto location = parameter_1 >> bar_index_bits;
+
+            *return_1 = 0;
+
+            size_t physical_memory_start;
+            if(!get_pcie_configuration_address(location, &physical_memory_start)) {
+                break;
+            }
+
+            auto configuration_memory = map_memory(physical_memory_start, configuration_area_size, global_bitmap);
+            if(configuration_memory == nullptr) {
+                break;
+            }
+
+            auto header = (volatile PCIHeader*)configuration_memory;
+
+            auto bar_value = header->bars[bar_index];
+
+            auto bar_type = bar_value & bits_to_mask(bar_type_bits);
+
+            size_t address;
+            size_t size;
+            auto valid_bar = true;
+            if(bar_type == 0) { // Memory BAR
+                auto memory_bar_type = bar_value >> bar_type_bits & bits_to_mask(memory_bar_type_bits);
+
+                const auto info_bits = bar_type_bits + memory_bar_type_bits + memory_bar_prefetchable_bits;
+
+                switch(memory_bar_type) {
+                    case 0b00: { // 32-bit memory BAR
+                        address = (size_t)(bar_value & ~bits_to_mask(info_bits));
+
+                        header->bars[bar_index] = -1;
+
+                        auto temp_bar_value = header->bars[bar_index] & ~bits_to_mask(info_bits);
+
+                        temp_bar_value = ~temp_bar_value;
+                        temp_bar_value += 1;
+
+                        size = (size_t)temp_bar_value;
+
+                        header->bars[bar_index] = bar_value;
+                    } break;
+
+                    case 0b10: { // 64-bit memory BAR
+                        auto second_bar_value = header->bars[bar_index + 1];
+
+                        address = (size_t)(bar_value & ~bits_to_mask(info_bits)) | (size_t)second_bar_value << 32;
+
+                        header->bars[bar_index] = -1;
+                        header->bars[bar_index + 1] = -1;
+
+                        size = (header->bars[bar_index] & ~bits_to_mask(info_bits)) | (size_t)header->bars[bar_index + 1] << 32;
+
+                        size = ~size;
+                        size += 1;
+
+                        header->bars[bar_index] = bar_value;
+                        header->bars[bar_index + 1] = second_bar_value;
+                    } break;
+
+                    default: {
+                        valid_bar = false;
+                    } break;
+                }
+            } else { // IO BAR
+                valid_bar = false;
+            }
+
+            unmap_memory(configuration_memory, configuration_area_size);
+
+            if(!valid_bar) {
+                break;
+            }
+
+            auto physical_pages_start = address / page_size;
+            auto physical_pages_end = divide_round_up(address + size, page_size);
+            auto page_count = physical_pages_end - physical_pages_start;
+
+            size_t logical_pages_start;
+            if(!map_pages(
+                physical_pages_start,
+                page_count,
+                PagePermissions::Write,
+                process->pml4_table_physical_address,
+                global_bitmap,
+                &logical_pages_start
+            )) {
+                break;
+            }
+
+            if(!register_process_mapping(process, logical_pages_start, page_count, false, false, global_bitmap)) {
+                break;
+            }
+
+            *return_1 = logical_pages_start * page_size;
+        } break;
+
+        case SyscallType::CreateLogRing: {
+            if(process->log_ring != nullptr) {
+                *return_1 = (size_t)CreateLogRingResult::AlreadyCreated;
+                break;
+            }
+
+            LogRing *ring;
+            size_t user_pages_start;
+            if(!allocate_kernel_shared_memory(process, sizeof(LogRing), false, (void**)&ring, &user_pages_start)) {
+                *return_1 = (size_t)CreateLogRingResult::OutOfMemory;
+                break;
+            }
+
+            acquire_lock(&process->log_lock);
+
+            process->log_ring = ring;
+            process->log_ring_user_pages_start = user_pages_start;
+
+            process->log_lock = false;
+
+            __atomic_add_fetch(&global_log_ring_count, 1, __ATOMIC_RELAXED);
+
+            *return_1 = (size_t)CreateLogRingResult::Success;
+            *return_2 = user_pages_start * page_size;
+        } break;
+
+        case SyscallType::DebugWrite: {
+            auto address = parameter_1;
+            auto size = parameter_2;
+
+            char *buffer = nullptr;
+            if(size != 0) {
+                auto result = map_process_memory_into_kernel(process, address, size, false, (void**)&buffer);
+                if(result == MapProcessMemoryResult::OutOfMemory) {
+                    *return_1 = (size_t)DebugWriteResult::OutOfMemory;
+                    break;
+                } else if(result == MapProcessMemoryResult::InvalidMemoryRange) {
+                    *return_1 = (size_t)DebugWriteResult::InvalidMemoryRange;
+                    break;
+                }
+            }
+
+            acquire_lock(&process->log_lock);
+
+            if(process->log_ring != nullptr) {
+                drain_log_ring(process);
+            }
+
+            for(size_t i = 0; i < size; i += 1) {
+                putchar(buffer[i]);
+            }
+
+            process->log_lock = false;
+
+            if(size != 0) {
+                unmap_memory(buffer, size);
+            }
+
+            *return_1 = (size_t)DebugWriteResult::Success;
+        } break;
+
+        case SyscallType::GetSyscallStatistics: {
+            auto statistics_syscall_type = parameter_1;
+            auto statistics_address = parameter_2;
+
+            if(statistics_syscall_type >= syscall_type_count) {
+                *return_1 = (size_t)GetSyscallStatisticsResult::InvalidSyscallType;
+                break;
+            }
+
+            SyscallStatistics *statistics;
+            switch(map_process_memory_into_kernel(process, statistics_address, sizeof(SyscallStatistics), true, (void**)&statistics)) {
+                case MapProcessMemoryResult::Success: {
+                    sum_syscall_statistics(statistics_syscall_type, statistics);
+
+                    unmap_memory(statistics, sizeof(SyscallStatistics));
+
+                    *return_1 = (size_t)GetSyscallStatisticsResult::Success;
+                } break;
+
+                case MapProcessMemoryResult::OutOfMemory: {
+                    *return_1 = (size_t)GetSyscallStatisticsResult::OutOfMemory;
+                } break;
+
+                case MapProcessMemoryResult::InvalidMemoryRange: {
+                    *return_1 = (size_t)GetSyscallStatisticsResult::InvalidMemoryRange;
+                } break;
+            }
+        } break;
+
+        case SyscallType::GetSchedulerStatistics: {
+            auto processor_id = parameter_1;
+            auto statistics_address = parameter_2;
+
+            if(processor_id >= global_processor_area_count) {
+                *return_1 = (size_t)GetSchedulerStatisticsResult::InvalidProcessorID;
+                break;
+            }
+
+            SchedulerStatistics *statistics;
+            switch(map_process_memory_into_kernel(process, statistics_address, sizeof(SchedulerStatistics), true, (void**)&statistics)) {
+                case MapProcessMemoryResult::Success: {
+                    // The processor may be updating them at the same time, so they're only approximately consistent
+                    *statistics = global_processor_areas[processor_id].scheduler_statistics;
+
+                    unmap_memory(statistics, sizeof(SchedulerStatistics));
+
+                    *return_1 = (size_t)GetSchedulerStatisticsResult::Success;
+                } break;
+
+                case MapProcessMemoryResult::OutOfMemory: {
+                    *return_1 = (size_t)GetSchedulerStatisticsResult::OutOfMemory;
+                } break;
+
+                case MapProcessMemoryResult::InvalidMemoryRange: {
+                    *return_1 = (size_t)GetSchedulerStatisticsResult::InvalidMemoryRange;
+                } break;
+            }
+        } break;
+
+        case SyscallType::ShareHandle: {
+            auto handle = parameter_1;
+            auto target_process_id = parameter_2;
+            auto rights = parameter_3;
+
+            KernelObject *object;
+            size_t handle_rights;
+            if(!reference_handle(process, handle, &object, &handle_rights)) {
+                *return_1 = (size_t)ShareHandleResult::InvalidHandle;
+                break;
+            }
+
+            if((rights & handle_rights) != rights) {
+                release_kernel_object(object, global_bitmap);
+
+                *return_1 = (size_t)ShareHandleResult::InvalidRights;
+                break;
+            }
+
+            *return_1 = (size_t)ShareHandleResult::InvalidProcessID;
+
+            Processes::Iterator target_iterator;
+            if(find_ready_process(target_process_id, &target_iterator)) {
+                auto target_process = *target_iterator;
+
+                // Hands the reference over to the new handle
+                size_t target_handle;
+                if(create_handle(target_process, object, rights, &target_handle)) {
+                    object = nullptr;
+
+                    *return_1 = (size_t)ShareHandleResult::Success;
+                    *return_2 = target_handle;
+                } else if(!target_process->are_handles_closed) {
+                    *return_1 = (size_t)ShareHandleResult::OutOfMemory;
+                }
+            }
+
+            if(object != nullptr) {
+                release_kernel_object(object, global_bitmap);
+            }
+        } break;
+
+        case SyscallType::CloseHandle: {
+            close_handle(process, parameter_1, global_bitmap);
+        } break;
+
+        case SyscallType::CreateChannel: {
+            auto channel = create_channel();
+            if(channel == nullptr) {
+                *return_1 = (size_t)CreateChannelResult::OutOfMemory;
+                break;
+            }
+
+            size_t handle;
+            if(!create_handle(process, &channel->object, handle_right_send | handle_right_receive, &handle)) {
+                release_kernel_object(&channel->object, global_bitmap);
+
+                *return_1 = (size_t)CreateChannelResult::OutOfMemory;
+                break;
+            }
+
+            *return_1 = (size_t)CreateChannelResult::Success;
+            *return_2 = handle;
+        } break;
+
+        case SyscallType::ChannelSend: {
+            // The message words follow the handle
+            IPCMessage message {
+                {
+                    parameters[1],
+                    parameters[2],
+                    parameters[3],
+                    parameters[4],
+                    parameters[5]
+                }
+            };
+
+            Channel *channel;
+            if(!reference_channel_handle(process, parameter_1, handle_right_send, &channel)) {
+                *return_1 = (size_t)ChannelSendResult::InvalidHandle;
+                break;
+            }
+
+            *return_1 = (size_t)send_channel_message(channel, process->id, &message);
+
+            release_kernel_object(&channel->object, global_bitmap);
+        } break;
+
+        case SyscallType::WatchProcessExit: {
+            auto target_process_id = parameter_1;
+            auto handle = parameter_2;
+            auto user_data = parameter_3;
+
+            KernelObject *object;
+            size_t rights;
+            if(!reference_handle(process, handle, &object, &rights)) {
+                *return_1 = (size_t)WatchProcessExitResult::InvalidHandle;
+                break;
+            }
+
+            if(
+                !(object->type == KernelObjectType::Channel && (rights & handle_right_send) != 0) &&
+                !(object->type == KernelObjectType::Event && (rights & handle_right_signal) != 0)
+            ) {
+                release_kernel_object(object, global_bitmap);
+
+                *return_1 = (size_t)WatchProcessExitResult::InvalidHandle;
+                break;
+            }
+
+            // Checked under the lock terminate_process marks processes as not ready under, so the watcher is always
+            // either notified or never added
+            acquire_lock(&global_ipc_lock);
+
+            Processes::Iterator target_process_iterator;
+            if(!find_ready_process(target_process_id, &target_process_iterator)) {
+                global_ipc_lock = false;
+
+                release_kernel_object(object, global_bitmap);
+
+                *return_1 = (size_t)WatchProcessExitResult::InvalidProcessID;
+                break;
+            }
+
+            auto watcher = allocate_from_bucket_array(&(*target_process_iterator)->exit_watchers, global_bitmap, true);
+            if(watcher == nullptr) {
+                global_ipc_lock = false;
+
+                release_kernel_object(object, global_bitmap);
+
+                *return_1 = (size_t)WatchProcessExitResult::OutOfMemory;
+                break;
+            }
+
+            // The reference now belongs to the watcher
+            watcher->object = object;
+            watcher->user_data = user_data;
+
+            global_ipc_lock = false;
+
+            *return_1 = (size_t)WatchProcessExitResult::Success;
+        } break;
+
+        case SyscallType::CreateEvent: {
+            auto event = create_event();
+            if(event == nullptr) {
+                *return_1 = (size_t)CreateEventResult::OutOfMemory;
+                break;
+            }
+
+            size_t handle;
+            if(!create_handle(process, &event->object, handle_right_signal | handle_right_wait, &handle)) {
+                release_kernel_object(&event->object, global_bitmap);
+
+                *return_1 = (size_t)CreateEventResult::OutOfMemory;
+                break;
+            }
+
+            *return_1 = (size_t)CreateEventResult::Success;
+            *return_2 = handle;
+        } break;
+
+        case SyscallType::SignalEvent: {
+            Event *event;
+            if(!reference_event_handle(process, parameter_1, handle_right_signal, &event)) {
+                *return_1 = (size_t)SignalEventResult::InvalidHandle;
+                break;
+            }
+
+            signal_event(event, parameter_2);
+
+            release_kernel_object(&event->object, global_bitmap);
+
+            *return_1 = (size_t)SignalEventResult::Success;
+        } break;
+
+        case SyscallType::BindPCIEInterrupt: {
+            auto location = parameter_1;
+            auto entry = parameter_2;
+            auto signals = parameter_4;
+
+            Event *event;
+            if(!reference_event_handle(process, parameter_3, handle_right_signal, &event)) {
+                *return_1 = (size_t)BindPCIEInterruptResult::InvalidHandle;
+                break;
+            }
+
+            acquire_lock(&global_device_interrupts_lock);
+
+            auto is_bound = false;
+            auto index = device_interrupt_vector_count;
+            for(size_t i = 0; i < device_interrupt_vector_count; i += 1) {
+                auto device_interrupt = &global_device_interrupts[i];
+
+                if(device_interrupt->is_used) {
+                    if(device_interrupt->location == location && device_interrupt->entry == entry) {
+                        is_bound = true;
+                    }
+                } else if(index == device_interrupt_vector_count) {
+                    index = i;
+                }
+            }
+
+            if(is_bound || index == device_interrupt_vector_count) {
+                global_device_interrupts_lock = false;
+
+                release_kernel_object(&event->object, global_bitmap);
+
+                if(is_bound) {
+                    *return_1 = (size_t)BindPCIEInterruptResult::AlreadyBound;
+                } else {
+                    *return_1 = (size_t)BindPCIEInterruptResult::OutOfVectors;
+                }
+                break;
+            }
+
+            // Reserved, but interrupts are dropped until the event is set
+            auto device_interrupt = &global_device_interrupts[index];
+            device_interrupt->is_used = true;
+            device_interrupt->event = nullptr;
+            device_interrupt->process_id = process->id;
+            device_interrupt->location = location;
+            device_interrupt->entry = entry;
+
+            global_device_interrupts_lock = false;
+
+            // Delivered to the processor doing the binding, any processor can signal the event
+            auto result = enable_pcie_interrupt(
+                location,
+                entry,
+                (uint8_t)(device_interrupt_vectors_start + index),
+                get_processor_id(),
+                global_bitmap
+            );
+            if(result != EnablePCIEInterruptResult::Success) {
+                acquire_lock(&global_device_interrupts_lock);
+
+                device_interrupt->is_used = false;
+
+                global_device_interrupts_lock = false;
+
+                release_kernel_object(&event->object, global_bitmap);
+
+                switch(result) {
+                    case EnablePCIEInterruptResult::InvalidLocation: {
+                        *return_1 = (size_t)BindPCIEInterruptResult::InvalidLocation;
+                    } break;
+
+                    case EnablePCIEInterruptResult::NotSupported: {
+                        *return_1 = (size_t)BindPCIEInterruptResult::NotSupported;
+                    } break;
+
+                    default: {
+                        *return_1 = (size_t)BindPCIEInterruptResult::OutOfMemory;
+                    } break;
+                }
+                break;
+            }
+
+            acquire_lock(&global_device_interrupts_lock);
+
+            // Takes over the reference
+            device_interrupt->event = event;
+            device_interrupt->signals = signals;
+
+            global_device_interrupts_lock = false;
+
+            *return_1 = (size_t)BindPCIEInterruptResult::Success;
+        } break;
+
+        case SyscallType::UnbindPCIEInterrupt: {
+            auto location = parameter_1;
+            auto entry = parameter_2;
+
+            acquire_lock(&global_device_interrupts_lock);
+
+            auto index = device_interrupt_vector_count;
+            for(size_t i = 0; i < device_interrupt_vector_count; i += 1) {
+                auto device_interrupt = &global_device_interrupts[i];
+
+                if(
+                    device_interrupt->is_used &&
+                    device_interrupt->process_id == process->id &&
+                    device_interrupt->location == location &&
+                    device_interrupt->entry == entry
+                ) {
+                    index = i;
+                    break;
+                }
+            }
+
+            global_device_interrupts_lock = false;
+
+            if(index == device_interrupt_vector_count) {
+                *return_1 = (size_t)UnbindPCIEInterruptResult::NotBound;
+                break;
+            }
+
+            unbind_device_interrupt(index);
+
+            *return_1 = (size_t)UnbindPCIEInterruptResult::Success;
+        } break;
+
+#define X(name) case SyscallType::name:
+        THREAD_SYSCALLS(X)
+#undef X
+        {
+            return false;
+        } break;
+    }
+
+    return true;
+}
+
+// Performs submissions until the submission ring is empty or the completion ring is full, returns how many were
+// performed. Must hold process->syscall_lock.
+static size_t perform_syscall_ring_submissions(Process *process) {
+    auto ring = process->syscall_ring;
+
+    auto submission_head = ring->submission_head;
+    auto completion_tail = ring->completion_tail;
+
+    size_t count = 0;
+    while(true) {
+        auto submission_tail = __atomic_load_n(&ring->submission_tail, __ATOMIC_ACQUIRE);
+        auto completion_head = __atomic_load_n(&ring->completion_head, __ATOMIC_ACQUIRE);
+
+        if(submission_head == submission_tail || completion_tail - completion_head >= syscall_ring_length) {
+            break;
+        }
+
+        // Copied first, as the process can change the entry at any time
+        auto submission = ring->submissions[submission_head % syscall_ring_length];
+
+        SyscallCompletion completion {};
+        completion.user_data = submission.user_data;
+        completion.is_valid = perform_immediate_syscall(
+            process,
+            submission.type,
+            submission.parameters,
+            &completion.return_1,
+            &completion.return_2
+        );
+
+        ring->completions[completion_tail % syscall_ring_length] = completion;
+
+        submission_head += 1;
+        completion_tail += 1;
+
+        __atomic_store_n(&ring->submission_head, submission_head, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->completion_tail, completion_tail, __ATOMIC_RELEASE);
+
+        count += 1;
+    }
+
+    return count;
+}
+
+// Makes every thread of the process resident, so none of them can be entered on any processor. Fails without
+// claiming any thread if one of them already is resident.
+static bool claim_all_process_threads(Process *process) {
+    for(auto thread : process->threads) {
+        if(!compare_and_swap(&thread->is_resident, false, true)) {
+            for(auto claimed_thread : process->threads) {
+                if(claimed_thread == thread) {
+                    break;
+                }
+
+                __atomic_store_n(&claimed_thread->is_resident, false, __ATOMIC_RELEASE);
+            }
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void release_all_process_threads(Process *process) {
+    for(auto thread : process->threads) {
+        __atomic_store_n(&thread->is_resident, false, __ATOMIC_RELEASE);
+    }
+}
+
+// Called by processors with nothing else to do
+static void poll_syscall_rings() {
+    for(auto process : global_processes) {
+        if(!process->is_syscall_ring_polled) {
+            continue;
+        }
+
+        // Skip processes that are busy with a syscall, they'll be picked up on the next poll
+        if(!compare_and_swap(&process->syscall_lock, false, true)) {
+            continue;
+        }
+
+        // Submissions can unmap or copy-on-write pages, and there's no TLB shootdown, so they're only performed here
+        // while none of the process's threads can be running on another processor with stale TLB entries. Entering a
+        // thread reloads CR3 afterwards. Processes with a running thread are left for the next poll, or for their own
+        // SubmitSyscallRing.
+        if(process->is_ready && claim_all_process_threads(process)) {
+            perform_syscall_ring_submissions(process);
+
+            release_all_process_threads(process);
+        }
+
+        process->syscall_lock = false;
+    }
+}
+
+void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
+    auto processor_id = get_processor_id();
+    auto processor_area = &global_processor_areas[processor_id];
+
+    auto start_time = read_timestamp_counter();
+    auto start_combined_paging_lock_wait_cycles = combined_paging_lock_wait_cycles[processor_id];
+
+    processor_area->in_syscall_or_user_exception = true;
+
+    enable_interrupts();
+
+    auto process = *processor_area->current_process_iterator;
+    auto thread = *processor_area->current_thread_iterator;
+
+    auto syscall_index = stack_frame->rbx;
+    size_t parameters[syscall_parameter_count] {
+        stack_frame->rdx,
+        stack_frame->rsi,
+        stack_frame->rdi,
+        stack_frame->r8,
+        stack_frame->r9,
+        stack_frame->r10
+    };
+
+    auto parameter_1 = parameters[0];
+    auto parameter_2 = parameters[1];
+
+    auto return_1 = &stack_frame->rbx;
+    auto return_2 = &stack_frame->rdx;
+
+    // Syscalls run to completion on this processor (preempts are deferred), so only it touches these statistics
+    SyscallStatistics *statistics = nullptr;
+    if(syscall_index < syscall_type_count) {
+        statistics = &processor_area->syscall_statistics[syscall_index];
+
+        statistics->call_count += 1;
+    }
+
+    switch((SyscallType)syscall_index) {
+        case SyscallType::Exit: {
+            terminate_process(processor_area->current_process_iterator);
+
+            enter_next_process(processor_area, global_bitmap, &global_processes);
+        } break;
+
+        case SyscallType::RelinquishTime: {
+            suspend_thread(processor_area, thread, stack_frame);
+
+            enter_next_process(processor_area, global_bitmap, &global_processes);
+        } break;
+
+        case SyscallType::SetThreadPeriod: {
+            // parameter_1 is the period and parameter_2 the budget, in microseconds. A period of 0 makes the thread non-periodic.
+            // Both are checked before converting, so the conversion can't overflow.
+            if(parameter_1 != 0 && (parameter_1 > maximum_thread_period || parameter_2 == 0 || parameter_2 > parameter_1)) {
+                *return_1 = (size_t)SetThreadPeriodResult::InvalidPeriod;
+                break;
+            }
+
+            auto period = parameter_1 * (global_timestamp_counter_frequency / 1000000);
+            auto budget = parameter_2 * (global_timestamp_counter_frequency / 1000000);
+
+            if(parameter_1 != 0 && budget == 0) {
+                *return_1 = (size_t)SetThreadPeriodResult::InvalidPeriod;
+                break;
+            }
+
+            // From the converted times, as those are what the scheduler enforces
+            size_t utilization = 0;
+            if(parameter_1 != 0) {
+                utilization = divide_round_up(budget * 1000, period);
+            }
+
+            acquire_lock(&global_periodic_lock);
+
+            auto other_utilization = global_periodic_utilization;
+            if(thread->is_periodic) {
+                other_utilization -= thread->utilization;
+            }
+
+            // Leave some time on every processor for non-periodic threads, or the budgets couldn't be guaranteed anyway
+            if(other_utilization + utilization > global_processor_count * 900) {
+                global_periodic_lock = false;
+
+                *return_1 = (size_t)SetThreadPeriodResult::Overcommitted;
+                break;
+            }
+
+            if(thread->is_periodic) {
+                global_periodic_thread_count -= 1;
+            }
+
+            if(parameter_1 != 0) {
+                auto time = read_timestamp_counter();
+
+                thread->period = period;
+                thread->budget = budget;
+                thread->period_start = time;
+                thread->budget_used = 0;
+                thread->entered_time = time;
+                thread->is_waiting_for_next_period = false;
+
+                global_periodic_thread_count += 1;
+            }
+
+            thread->is_periodic = parameter_1 != 0;
+            thread->utilization = utilization;
+            global_periodic_utilization = other_utilization + utilization;
+
+            global_periodic_lock = false;
+
+            *return_1 = (size_t)SetThreadPeriodResult::Success;
+        } break;
+
+        case SyscallType::CreateSyscallRing: {
+            // parameter_1 is whether idle processors should poll the ring, so submissions don't need SubmitSyscallRing
+            auto is_polled = (bool)parameter_1;
+
+            acquire_lock(&process->syscall_lock);
+
+            do { // Purely so break can be used for early-out
+                if(process->syscall_ring != nullptr) {
+                    *return_1 = (size_t)CreateSyscallRingResult::AlreadyCreated;
+                    break;
+                }
+
+                SyscallRing *ring;
+                size_t user_pages_start;
+                if(!allocate_kernel_shared_memory(process, sizeof(SyscallRing), false, (void**)&ring, &user_pages_start)) {
+                    *return_1 = (size_t)CreateSyscallRingResult::OutOfMemory;
+                    break;
+                }
+
+                process->syscall_ring = ring;
+                process->syscall_ring_user_pages_start = user_pages_start;
+
+                if(is_polled) {
+                    process->is_syscall_ring_polled = true;
+
+                    __atomic_add_fetch(&global_polled_syscall_ring_count, 1, __ATOMIC_RELAXED);
+                }
+
+                *return_1 = (size_t)CreateSyscallRingResult::Success;
+                *return_2 = user_pages_start * page_size;
+            } while(false);
+
+            process->syscall_lock = false;
+        } break;
+
+        case SyscallType::SubmitSyscallRing: {
+            *return_1 = 0;
+
+            acquire_lock(&process->syscall_lock);
+
+            if(process->syscall_ring != nullptr) {
+                *return_1 = perform_syscall_ring_submissions(process);
+            }
+
+            process->syscall_lock = false;
+        } break;
+
+        case SyscallType::CloneProcess: {
+            *return_1 = (size_t)CloneProcessResult::OutOfMemory;
+
+            acquire_lock(&process->syscall_lock);
+
+            // The clone starts off with the FPU state the thread has right now
+            save_thread_fpu_state(thread);
+
+            Process *clone;
+            Processes::Iterator clone_iterator;
+            ProcessThread *clone_thread;
+            if(clone_process(
+                process,
+                thread,
+                stack_frame,
+                global_bitmap,
+                global_processor_area_count,
+                global_processor_areas_physical_address,
+                &global_processes,
+                &clone,
+                &clone_iterator,
+                &clone_thread
+            )) {
+                if(clone_process_rings(process, clone)) {
+                    if(process->is_syscall_ring_polled) {
+                        clone->is_syscall_ring_polled = true;
+
+                        __atomic_add_fetch(&global_polled_syscall_ring_count, 1, __ATOMIC_RELAXED);
+                    }
+
+                    if(clone->log_ring != nullptr) {
+                        __atomic_add_fetch(&global_log_ring_count, 1, __ATOMIC_RELAXED);
+                    }
+
+                    auto clone_id = clone->id;
+
+                    clone_thread->frame.rbx = (size_t)CloneProcessResult::IsClone;
+                    clone_thread->frame.rdx = clone_id;
+
+                    publish_process_alive(clone_id);
+
+                    // The clone isn't touched once it's ready, as it can exit and be destroyed right away
+                    clone_thread->is_ready = true;
+                    clone->is_ready = true;
+
+                    *return_1 = (size_t)CloneProcessResult::Success;
+                    *return_2 = clone_id;
+                } else {
+                    destroy_process(clone_iterator, global_bitmap);
+                }
+            }
+
+            process->syscall_lock = false;
+        } break;
+
+        case SyscallType::MapSharedMemory: {
+            auto target_process_id = parameter_1;
+            auto address = parameter_2;
+            auto size = parameters[2];
+
+            auto target_logical_pages_start = address / page_size;
+            auto target_logical_pages_end = divide_round_up(address + size, page_size);
+
+            auto page_count = target_logical_pages_end - target_logical_pages_start;
+
+            Processes::Iterator target_iterator;
+            if(!find_ready_process(target_process_id, &target_iterator)) {
+                *return_1 = (size_t)MapSharedMemoryResult::InvalidProcessID;
+                break;
+            }
+
+            auto target_process = *target_iterator;
+
+            // The target's mappings are read while its UnmapMemory or destruction could drop them, and this process's
+            // change, so both processes are locked, in the same order as GrantMemory
+            auto first_process = process < target_process ? process : target_process;
+            auto second_process = process < target_process ? target_process : process;
+
+            acquire_lock(&first_process->syscall_lock);
+            if(second_process != first_process) {
+                acquire_lock(&second_process->syscall_lock);
+            }
+
+            *return_1 = (size_t)MapSharedMemoryResult::InvalidMemoryRange;
+
+            // terminate_process waits for the lock before destroying the target, so it's only still around if it's
+            // still ready now
+            if(!target_process->is_ready || target_process->id != target_process_id) {
+                *return_1 = (size_t)MapSharedMemoryResult::InvalidProcessID;
+            } else {
+                for(auto mapping : target_process->mappings) {
+                    if(
+                        mapping->logical_pages_start == target_logical_pages_start &&
+                        mapping->page_count == page_count &&
+                        mapping->shared_memory != nullptr
+                    ) {
+                        size_t logical_pages_start;
+                        if(!map_shared_memory(
+                            process,
+                            mapping->shared_memory,
+                            PagePermissions::Write,
+                            global_bitmap,
+                            &logical_pages_start
+                        )) {
+                            *return_1 = (size_t)MapSharedMemoryResult::OutOfMemory;
+                            break;
+                        }
+
+                        *return_1 = (size_t)MapSharedMemoryResult::Success;
+                        *return_2 = logical_pages_start * page_size;
+
+                        break;
+                    }
+                }
+            }
+
+            if(second_process != first_process) {
+                second_process->syscall_lock = false;
+            }
+            first_process->syscall_lock = false;
+        } break;
+
+        case SyscallType::GrantMemory: {
+            auto address = parameter_1;
+            auto size = parameter_2;
+            auto target_process_id = parameters[2];
 
-            size_t kernel_pages_start;
-            if(!map_and_allocate_pages(page_count, global_bitmap, &kernel_pages_start)) {
+            Processes::Iterator target_process_iterator;
+            if(target_process_id == process->id || !find_ready_process(target_process_id, &target_process_iterator)) {
+                *return_1 = (size_t)GrantMemoryResult::InvalidProcessID;
                 break;
             }
 
-            size_t user_pages_start;
-            if(!map_pages_from_kernel(
-                kernel_pages_start,
-                page_count,
-                PagePermissions::Write,
-                process->pml4_table_physical_address,
-                global_bitmap,
-                &user_pages_start
-            )) {
-                unmap_and_deallocate_pages(kernel_pages_start, page_count, global_bitmap);
+            auto target_process = *target_process_iterator;
 
+            if(address % page_size != 0) {
+                *return_1 = (size_t)GrantMemoryResult::InvalidMemoryRange;
                 break;
             }
 
-            if(!register_process_mapping(process, user_pages_start, page_count, true, true, global_bitmap)) {
-                unmap_and_deallocate_pages(kernel_pages_start, page_count, global_bitmap);
+            // Both page tables and mapping lists change, so both processes are locked, always in the same order so two
+            // processes granting to each other can't deadlock
+            auto first_process = process < target_process ? process : target_process;
+            auto second_process = process < target_process ? target_process : process;
 
-                unmap_pages(user_pages_start, page_count, process->pml4_table_physical_address, false, global_bitmap);
+            acquire_lock(&first_process->syscall_lock);
+            acquire_lock(&second_process->syscall_lock);
+
+            // terminate_process waits for the lock before destroying the target, so it's only still around if it's
+            // still ready now
+            if(!target_process->is_ready || target_process->id != target_process_id) {
+                second_process->syscall_lock = false;
+                first_process->syscall_lock = false;
 
+                *return_1 = (size_t)GrantMemoryResult::InvalidProcessID;
                 break;
             }
 
-            clear_pages(kernel_pages_start, page_count);
-
-            unmap_pages(kernel_pages_start, page_count);
-
-            *return_1 = user_pages_start * page_size;
-        } break;
-
-        case SyscallType::MapSharedMemory: {
-            const MapSharedMemoryParameters *parameters;
-            switch(map_process_memory_into_kernel(process, parameter_1, sizeof(MapSharedMemoryParameters), (void**)&parameters)) {
-                case MapProcessMemoryResult::Success: {
-                    auto target_logical_pages_start = parameters->address / page_size;
-                    auto target_logical_pages_end = divide_round_up(parameters->address + parameters->size, page_size);
-
-                    auto page_count = target_logical_pages_end - target_logical_pages_start;
-
-                    *return_1 = (size_t)MapSharedMemoryResult::InvalidProcessID;
-                    for(auto target_process : global_processes) {
-                        if(target_process->id == parameters->process_id && target_process->is_ready) {
-                            *return_1 = (size_t)MapSharedMemoryResult::InvalidMemoryRange;
-                            for(auto mapping : target_process->mappings) {
-                                if(
-                                    mapping->logical_pages_start == target_logical_pages_start &&
-                                    mapping->page_count == page_count &&
-                                    mapping->is_shared
-                                ) {
-                                    size_t logical_pages_start;
-                                    if(!map_pages_between_user(
-                                        target_logical_pages_start,
-                                        page_count,
-                                        PagePermissions::Write,
-                                        target_process->pml4_table_physical_address,
-                                        process->pml4_table_physical_address,
-                                        global_bitmap,
-                                        &logical_pages_start
-                                    )) {
-                                        *return_1 = (size_t)MapSharedMemoryResult::OutOfMemory;
-                                        break;
-                                    }
-
-                                    if(!register_process_mapping(process, logical_pages_start, page_count, true, false, global_bitmap)) {
-                                        *return_1 = (size_t)MapSharedMemoryResult::OutOfMemory;
-
-                                        break;
-                                    }
-
-                                    *return_1 = (size_t)MapSharedMemoryResult::Success;
-                                    *return_2 = logical_pages_start * page_size;
-
-                                    break;
-                                }
-                            }
+            size_t target_pages_start;
+            auto result = move_process_mapping(
+                process,
+                address / page_size,
+                divide_round_up(size, page_size),
+                target_process,
+                global_bitmap,
+                &target_pages_start
+            );
 
-                            break;
-                        }
-                    }
+            second_process->syscall_lock = false;
+            first_process->syscall_lock = false;
 
-                    unmap_memory((void*)parameters, sizeof(MapSharedMemoryParameters));
+            switch(result) {
+                case MoveProcessMappingResult::Success: {
+                    *return_1 = (size_t)GrantMemoryResult::Success;
+                    *return_2 = target_pages_start * page_size;
                 } break;
 
-                case MapProcessMemoryResult::OutOfMemory: {
-                    *return_1 = (size_t)MapSharedMemoryResult::OutOfMemory;
+                case MoveProcessMappingResult::OutOfMemory: {
+                    *return_1 = (size_t)GrantMemoryResult::OutOfMemory;
                 } break;
 
-                case MapProcessMemoryResult::InvalidMemoryRange: {
-                    *return_1 = (size_t)MapSharedMemoryResult::InvalidMemoryRange;
+                case MoveProcessMappingResult::InvalidMemoryRange: {
+                    *return_1 = (size_t)GrantMemoryResult::InvalidMemoryRange;
                 } break;
             }
         } break;
 
-        case SyscallType::UnmapMemory: {
-            auto logical_pages_start = parameter_1 / page_size;
+        case SyscallType::WaitForNextPeriod: {
+            // Gives up the rest of this period, the thread is entered again at the start of the next one
+            if(thread->is_periodic) {
+                acquire_lock(&global_periodic_lock);
 
-            for(auto iterator = begin(process->mappings); iterator != end(process->mappings); ++iterator) {
-                auto mapping = *iterator;
+                thread->is_waiting_for_next_period = true;
 
-                if(mapping->logical_pages_start == logical_pages_start) {
-                    remove_item_from_bucket_array(iterator);
+                global_periodic_lock = false;
+            }
 
-                    unmap_pages(
-                        mapping->logical_pages_start,
-                        mapping->page_count,
-                        process->pml4_table_physical_address,
-                        mapping->is_owned,
-                        global_bitmap
-                    );
+            suspend_thread(processor_area, thread, stack_frame);
 
-                    break;
-                }
-            }
+            enter_next_process(processor_area, global_bitmap, &global_processes);
         } break;
 
-        case SyscallType::CreateProcess: {
-            const CreateProcessParameters *parameters;
-            switch(map_process_memory_into_kernel(process, parameter_1, sizeof(CreateProcessParameters), (void**)&parameters)) {
-                case MapProcessMemoryResult::Success: {
-                    uint8_t *elf_binary;
-                    switch(map_process_memory_into_kernel(process, (size_t)parameters->elf_binary, parameters->elf_binary_size, (void**)&elf_binary)) {
-                        case MapProcessMemoryResult::Success: {
-                            void *data;
-                            if(parameters->data == nullptr || parameters->data_size == 0) {
-                                data = nullptr;
-                            } else {
-                                auto success = true;
-                                switch(map_process_memory_into_kernel(process, (size_t)parameters->data, parameters->data_size, &data)) {
-                                    case MapProcessMemoryResult::Success: break;
-
-                                    case MapProcessMemoryResult::OutOfMemory: {
-                                        *return_1 = (size_t)CreateProcessResult::OutOfMemory;
-
-                                        success = true;
-                                    } break;
-
-                                    case MapProcessMemoryResult::InvalidMemoryRange: {
-                                        *return_1 = (size_t)CreateProcessResult::InvalidMemoryRange;
-
-                                        success = true;
-                                    } break;
-                                }
-
-                                if(!success) {
-                                    break;
-                                }
-                            }
-
-                            Process *new_process;
-                            Processes::Iterator new_process_iterator;
-                            switch(create_process_from_elf(
-                                elf_binary,
-                                parameters->elf_binary_size,
-                                data,
-                                parameters->data_size,
-                                global_bitmap,
-                                global_processor_area_count,
-                                global_processor_areas_physical_address,
-                                &global_processes,
-                                &new_process,
-                                &new_process_iterator
-                            )) {
-                                case CreateProcessFromELFResult::Success: {
-                                    *return_1 = (size_t)CreateProcessResult::Success;
-                                    *return_2 = new_process->id;
-                                } break;
-
-                                case CreateProcessFromELFResult::OutOfMemory: {
-                                    *return_1 = (size_t)CreateProcessResult::OutOfMemory;
-                                } break;
-
-                                case CreateProcessFromELFResult::InvalidELF: {
-                                    *return_1 = (size_t)CreateProcessResult::InvalidELF;
-                                } break;
-
-                                default: halt();
-                            }
-
-                            if(parameters->data == nullptr && parameters->data_size == 0) {
-                                unmap_memory(data, parameters->data_size);
-                            }
-
-                            unmap_memory(elf_binary, parameters->elf_binary_size);
-                        } break;
-
-                        case MapProcessMemoryResult::OutOfMemory: {
-                            *return_1 = (size_t)CreateProcessResult::OutOfMemory;
-                        } break;
+        case SyscallType::IPCCall: {
+            auto callee_process_id = parameter_1;
 
-                        case MapProcessMemoryResult::InvalidMemoryRange: {
-                            *return_1 = (size_t)CreateProcessResult::InvalidMemoryRange;
-                        } break;
-                    }
+            // Saved before the call becomes visible, as the callee writes the reply straight into thread->frame
+            thread->frame = *stack_frame;
 
-                    unmap_memory((void*)parameters, sizeof(CreateProcessParameters));
-                } break;
+            acquire_lock(&global_ipc_lock);
 
-                case MapProcessMemoryResult::OutOfMemory: {
-                    *return_1 = (size_t)MapSharedMemoryResult::OutOfMemory;
-                } break;
+            Processes::Iterator callee_process_iterator;
+            if(callee_process_id == process->id || !find_ready_process(callee_process_id, &callee_process_iterator)) {
+                global_ipc_lock = false;
 
-                case MapProcessMemoryResult::InvalidMemoryRange: {
-                    *return_1 = (size_t)MapSharedMemoryResult::InvalidMemoryRange;
-                } break;
+                *return_1 = (size_t)IPCCallResult::InvalidProcessID;
+                break;
             }
-        } break;
 
-        case SyscallType::DoesProcessExist: {
-            auto process_id = parameter_1;
+            auto callee_process = *callee_process_iterator;
 
-            *return_1 = 0;
+            if(callee_process->ipc_receiving_thread != nullptr) {
+                auto callee_thread_iterator = callee_process->ipc_receiving_thread_iterator;
+                auto callee_thread = *callee_thread_iterator;
 
-            for(auto process : global_processes) {
-                if(process->id == process_id && process->is_ready) {
-                    *return_1 = 1;
-                    break;
-                }
+                callee_process->ipc_receiving_thread = nullptr;
+
+                copy_ipc_message(stack_frame, &callee_thread->frame);
+                callee_thread->frame.rbx = (size_t)IPCReceiveResult::Success;
+                callee_thread->frame.rdx = process->id;
+
+                callee_thread->ipc_state = ThreadIPCState::None;
+                callee_thread->is_ready = true;
+
+                thread->ipc_state = ThreadIPCState::WaitingForReply;
+                thread->ipc_peer_process_id = callee_process_id;
+                thread->is_ready = false;
+
+                global_ipc_lock = false;
+
+                hand_off_to_thread(processor_area, thread, callee_process_iterator, callee_thread_iterator);
             }
-        } break;
 
-        case SyscallType::FindPCIEDevice: {
-            const FindPCIEDeviceParameters *parameters;
-            switch(map_process_memory_into_kernel(process, parameter_1, sizeof(FindPCIEDeviceParameters), (void**)&parameters)) {
-                case MapProcessMemoryResult::Success: {
-                    MCFGTable *mcfg_table;
-                    {
-                        auto status = AcpiGetTable((char*)ACPI_SIG_MCFG, 1, (ACPI_TABLE_HEADER**)&mcfg_table);
-                        if(status != AE_OK) {
-                            *return_1 = (size_t)FindPCIEDeviceResult::NotFound;
+            auto queued_call = allocate_from_bucket_array(&callee_process->ipc_queued_calls, global_bitmap, true);
+            if(queued_call == nullptr) {
+                global_ipc_lock = false;
 
-                            break;
-                        }
-                    }
+                *return_1 = (size_t)IPCCallResult::OutOfMemory;
+                break;
+            }
 
-                    *return_1 = (size_t)FindPCIEDeviceResult::NotFound;
-
-                    size_t current_index = 0;
-
-                    auto done = false;
-                    for(size_t i = 0; i < (mcfg_table->preamble.Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION); i += 1) {
-                        auto physical_memory_start = (size_t)mcfg_table->allocations[i].Address;
-                        auto segment = (size_t)mcfg_table->allocations[i].PciSegment;
-                        auto start_bus_number = (size_t)mcfg_table->allocations[i].StartBusNumber;
-                        auto end_bus_number = (size_t)mcfg_table->allocations[i].EndBusNumber;
-                        auto bus_count = end_bus_number - start_bus_number + 1;
-
-                        for(size_t bus = 0; bus < bus_count; bus += 1) {
-                            auto bus_memory_size = device_count * function_count * configuration_area_size;
-
-                            auto bus_memory = map_memory(
-                                physical_memory_start + bus * device_count * function_count * configuration_area_size,
-                                bus_memory_size,
-                                global_bitmap
-                            );
-                            if(bus_memory == nullptr) {
-                                done = true;
-                                break;
-                            }
-
-                            for(size_t device = 0; device < device_count; device += 1) {
-                                for(size_t function = 0; function < function_count; function += 1) {
-                                    auto device_base_index = 
-                                        device * function_count * configuration_area_size +
-                                        function * configuration_area_size;
-
-                                    auto header = (volatile PCIHeader*)((size_t)bus_memory + device_base_index);
-
-                                    if(header->vendor_id == 0xFFFF) {
-                                        continue;
-                                    }
-
-                                    if(!(
-                                        (parameters->require_vendor_id && header->vendor_id != parameters->vendor_id) ||
-                                        (parameters->require_device_id && header->device_id != parameters->device_id) ||
-                                        (parameters->require_class_code && header->class_code != parameters->class_code) ||
-                                        (parameters->require_subclass && header->subclass != parameters->subclass) ||
-                                        (parameters->require_interface && header->interface != parameters->interface)
-                                    )) {
-                                        if(current_index == parameters->index) {
-                                            *return_1 = (size_t)FindPCIEDeviceResult::Success;
-                                            *return_2 =
-                                                function |
-                                                device << function_bits |
-                                                bus << (function_bits + device_bits) |
-                                                segment << (function_bits + device_bits + bus_bits);
-
-                                            done = true;
-                                            break;
-                                        } else {
-                                            current_index += 1;
-                                        }
-                                    }
-                                }
-
-                                if(done) {
-                                    break;
-                                }
-                            }
-
-                            unmap_memory((void*)bus_memory, bus_memory_size);
-
-                            if(done) {
-                                break;
-                            }
-                        }
+            queued_call->caller_process_id = process->id;
 
-                        if(done) {
-                            break;
-                        }
-                    }
+            thread->ipc_state = ThreadIPCState::Calling;
+            thread->ipc_peer_process_id = callee_process_id;
+            thread->is_ready = false;
 
-                    AcpiPutTable(&mcfg_table->preamble.Header);
+            global_ipc_lock = false;
 
-                    unmap_memory((void*)parameters, sizeof(FindPCIEDeviceParameters));   
-                } break;
+            release_thread(processor_area, thread);
 
-                case MapProcessMemoryResult::OutOfMemory: {
-                    *return_1 = (size_t)FindPCIEDeviceResult::OutOfMemory;
-                } break;
+            enter_next_process(processor_area, global_bitmap, &global_processes);
+        } break;
 
-                case MapProcessMemoryResult::InvalidMemoryRange: {
-                    *return_1 = (size_t)FindPCIEDeviceResult::InvalidMemoryRange;
-                } break;
+        case SyscallType::IPCReceive: {
+            // parameter_1 is the timeout in microseconds, see ipc_receive_forever
+            auto timeout = parameter_1;
+
+            acquire_lock(&global_ipc_lock);
+
+            if(receive_queued_ipc_call(process, stack_frame)) {
+                global_ipc_lock = false;
+
+                break;
             }
-        } break;
 
-        case SyscallType::MapPCIEConfiguration: {
-            auto function = parameter_1 & bits_to_mask(function_bits);
-            auto device = parameter_1 >> function_bits & bits_to_mask(device_bits);
-            auto bus = parameter_1 >> (function_bits + device_bits) & bits_to_mask(bus_bits);
-            auto target_segment = parameter_1 >> (function_bits + device_bits + bus_bits);
-
-            MCFGTable *mcfg_table;
-            {
-                auto status = AcpiGetTable((char*)ACPI_SIG_MCFG, 1, (ACPI_TABLE_HEADER**)&mcfg_table);
-                if(status != AE_OK) {
-                    break;
-                }
+            if(timeout == 0 || process->ipc_receiving_thread != nullptr) {
+                global_ipc_lock = false;
+
+                *return_1 = (size_t)IPCReceiveResult::NoCall;
+                break;
             }
 
-            *return_1 = 0;
+            thread->frame = *stack_frame;
 
-            for(size_t i = 0; i < (mcfg_table->preamble.Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION); i += 1) {
-                auto physical_memory_start = (size_t)mcfg_table->allocations[i].Address;
-                auto segment = (size_t)mcfg_table->allocations[i].PciSegment;
-
-                if(segment == target_segment) {
-                    size_t logical_pages_start;
-                    if(!map_pages(
-                        physical_memory_start / page_size +
-                            bus * device_count * function_count +
-                            device * function_count +
-                            function,
-                        1,
-                        PagePermissions::Write,
-                        process->pml4_table_physical_address,
-                        global_bitmap,
-                        &logical_pages_start
-                    )) {
-                        break;
-                    }
+            thread->wait_deadline = get_wait_deadline(timeout);
+            thread->ipc_state = ThreadIPCState::Receiving;
+            thread->is_ready = false;
 
-                    if(!register_process_mapping(process, logical_pages_start, 1, false, false, global_bitmap)) {
-                        break;
-                    }
+            process->ipc_receiving_thread = thread;
+            process->ipc_receiving_thread_iterator = processor_area->current_thread_iterator;
 
-                    *return_1 = logical_pages_start * page_size;
+            global_ipc_lock = false;
 
-                    break;
-                }
-            }
+            release_thread(processor_area, thread);
 
-            AcpiPutTable(&mcfg_table->preamble.Header);
+            enter_next_process(processor_area, global_bitmap, &global_processes);
         } break;
 
-        case SyscallType::MapPCIEBar: {
-            auto bar_index = parameter_1 & bits_to_mask(bar_index_bits);
-            auto function = parameter_1 >> bar_index_bits & bits_to_mask(function_bits);
-            auto device = parameter_1 >> (bar_index_bits + function_bits) & bits_to_mask(device_bits);
-            auto bus = parameter_1 >> (bar_index_bits + function_bits + device_bits) & bits_to_mask(bus_bits);
-            auto target_segment = parameter_1 >> (bar_index_bits + function_bits + device_bits + bus_bits);
-
-            MCFGTable *mcfg_table;
-            {
-                auto status = AcpiGetTable((char*)ACPI_SIG_MCFG, 1, (ACPI_TABLE_HEADER**)&mcfg_table);
-                if(status != AE_OK) {
-                    break;
+        case SyscallType::IPCReply:
+        case SyscallType::IPCReplyAndReceive: {
+            auto caller_process_id = parameter_1;
+
+            auto and_receive = (SyscallType)syscall_index == SyscallType::IPCReplyAndReceive;
+
+            acquire_lock(&global_ipc_lock);
+
+            Processes::Iterator caller_process_iterator;
+            ProcessThreads::Iterator caller_thread_iterator;
+            if(!find_ipc_caller_thread(caller_process_id, process->id, ThreadIPCState::WaitingForReply, &caller_process_iterator, &caller_thread_iterator)) {
+                global_ipc_lock = false;
+
+                if(and_receive) {
+                    *return_1 = (size_t)IPCReceiveResult::InvalidProcessID;
+                } else {
+                    *return_1 = (size_t)IPCReplyResult::InvalidProcessID;
                 }
+                break;
             }
 
-            *return_1 = 0;
+            auto caller_thread = *caller_thread_iterator;
 
-            for(size_t i = 0; i < (mcfg_table->preamble.Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION); i += 1) {
-                auto physical_memory_start = (size_t)mcfg_table->allocations[i].Address;
-                auto segment = (size_t)mcfg_table->allocations[i].PciSegment;
-
-                if(segment == target_segment) {
-                    auto configuration_memory = map_memory(
-                        physical_memory_start +
-                            (bus * device_count * function_count +
-                            device * function_count +
-                            function) * configuration_area_size,
-                        configuration_area_size,
-                        global_bitmap
-                    );
-                    if(configuration_memory == nullptr) {
-                        break;
-                    }
+            copy_ipc_message(stack_frame, &caller_thread->frame);
+            caller_thread->frame.rbx = (size_t)IPCCallResult::Success;
+
+            caller_thread->ipc_state = ThreadIPCState::None;
+            caller_thread->is_ready = true;
 
-                    auto header = (volatile PCIHeader*)configuration_memory;
+            if(!and_receive) {
+                global_ipc_lock = false;
 
-                    auto bar_value = header->bars[bar_index];
+                *return_1 = (size_t)IPCReplyResult::Success;
+                break;
+            }
 
-                    auto bar_type = bar_value & bits_to_mask(bar_type_bits);
+            // Keep going if there's more work, the caller is picked up by the scheduler
+            if(receive_queued_ipc_call(process, stack_frame)) {
+                global_ipc_lock = false;
 
-                    size_t address;
-                    size_t size;
-                    auto valid_bar = true;
-                    if(bar_type == 0) { // Memory BAR
-                        auto memory_bar_type = bar_value >> bar_type_bits & bits_to_mask(memory_bar_type_bits);
+                break;
+            }
 
-                        const auto info_bits = bar_type_bits + memory_bar_type_bits + memory_bar_prefetchable_bits;
+            thread->frame = *stack_frame;
 
-                        switch(memory_bar_type) {
-                            case 0b00: { // 32-bit memory BAR
-                                address = (size_t)(bar_value & ~bits_to_mask(info_bits));
+            thread->wait_deadline = UINT64_MAX;
+            thread->ipc_state = ThreadIPCState::Receiving;
+            thread->is_ready = false;
 
-                                header->bars[bar_index] = -1;
+            process->ipc_receiving_thread = thread;
+            process->ipc_receiving_thread_iterator = processor_area->current_thread_iterator;
 
-                                auto temp_bar_value = header->bars[bar_index] & ~bits_to_mask(info_bits);
+            global_ipc_lock = false;
 
-                                temp_bar_value = ~temp_bar_value;
-                                temp_bar_value += 1;
+            // Directly switch back to the caller, L4-style
+            hand_off_to_thread(processor_area, thread, caller_process_iterator, caller_thread_iterator);
+        } break;
 
-                                size = (size_t)temp_bar_value;
+        case SyscallType::ChannelReceive: {
+            // The channel handles are passed in place of the message words
+            auto channel_count = parameter_1 & ~channel_receive_block;
+            auto block = (parameter_1 & channel_receive_block) != 0;
 
-                                header->bars[bar_index] = bar_value;
-                            } break;
+            if(channel_count == 0 || channel_count > ipc_message_length) {
+                *return_1 = (size_t)ChannelReceiveResult::InvalidHandle;
+                break;
+            }
+
+            Channel *channels[ipc_message_length];
+            size_t referenced_count = 0;
+            while(
+                referenced_count < channel_count &&
+                reference_channel_handle(process, parameters[referenced_count + 1], handle_right_receive, &channels[referenced_count])
+            ) {
+                referenced_count += 1;
+            }
 
-                            case 0b10: { // 64-bit memory BAR
-                                auto second_bar_value = header->bars[bar_index + 1];
+            auto result = ChannelReceiveResult::Success;
+            if(referenced_count != channel_count) {
+                result = ChannelReceiveResult::InvalidHandle;
+            } else {
+                acquire_lock(&global_ipc_lock);
+
+                if(take_channel_message(channels, channel_count, stack_frame)) {
+                    global_ipc_lock = false;
+                } else if(!block) {
+                    global_ipc_lock = false;
+
+                    result = ChannelReceiveResult::NoMessage;
+                } else {
+                    thread->frame = *stack_frame;
+
+                    size_t receiver_count = 0;
+                    while(receiver_count < channel_count) {
+                        auto receiver = allocate_from_bucket_array(&channels[receiver_count]->receivers, global_bitmap, true);
+                        if(receiver == nullptr) {
+                            break;
+                        }
 
-                                address = (size_t)(bar_value & ~bits_to_mask(info_bits)) | (size_t)second_bar_value << 32;
+                        receiver->thread = thread;
+                        receiver->index = receiver_count;
 
-                                header->bars[bar_index] = -1;
-                                header->bars[bar_index + 1] = -1;
+                        thread->receiving_channels[receiver_count] = channels[receiver_count];
 
-                                size = (header->bars[bar_index] & ~bits_to_mask(info_bits)) | (size_t)header->bars[bar_index + 1] << 32;
+                        receiver_count += 1;
+                    }
 
-                                size = ~size;
-                                size += 1;
+                    if(receiver_count != channel_count) {
+                        // Undoes the receivers, and drops the references of the channels they were for
+                        thread->receiving_channel_count = receiver_count;
 
-                                header->bars[bar_index] = bar_value;
-                                header->bars[bar_index + 1] = second_bar_value;
-                            } break;
+                        stop_receiving_channels(thread);
 
-                            default: {
-                                valid_bar = false;
-                            } break;
+                        global_ipc_lock = false;
+
+                        for(size_t i = receiver_count; i < channel_count; i += 1) {
+                            release_kernel_object(&channels[i]->object, global_bitmap);
                         }
-                    } else { // IO BAR
-                        valid_bar = false;
-                    }
 
-                    if(!valid_bar) {
+                        *return_1 = (size_t)ChannelReceiveResult::OutOfMemory;
                         break;
                     }
 
-                    unmap_memory(configuration_memory, configuration_area_size);
+                    // The references to the channels now belong to the thread, until it stops receiving
+                    thread->receiving_channel_count = channel_count;
+                    thread->ipc_state = ThreadIPCState::ReceivingChannels;
+                    thread->is_ready = false;
 
-                    auto physical_pages_start = address / page_size;
-                    auto physical_pages_end = divide_round_up(address + size, page_size);
-                    auto page_count = physical_pages_end - physical_pages_start;
+                    global_ipc_lock = false;
 
-                    size_t logical_pages_start;
-                    if(!map_pages(
-                        physical_pages_start,
-                        page_count,
-                        PagePermissions::Write,
-                        process->pml4_table_physical_address,
-                        global_bitmap,
-                        &logical_pages_start
-                    )) {
-                        break;
-                    }
+                    release_thread(processor_area, thread);
 
-                    if(!register_process_mapping(process, logical_pages_start, page_count, false, false, global_bitmap)) {
-                        break;
-                    }
+                    enter_next_process(processor_area, global_bitmap, &global_processes);
+                }
+            }
+
+            for(size_t i = 0; i < referenced_count; i += 1) {
+                release_kernel_object(&channels[i]->object, global_bitmap);
+            }
+
+            if(result != ChannelReceiveResult::Success) {
+                *return_1 = (size_t)result;
+            }
+        } break;
+
+        case SyscallType::WaitEvent: {
+            auto mask = parameter_2;
+            auto timeout = parameters[2];
+
+            Event *event;
+            if(!reference_event_handle(process, parameter_1, handle_right_wait, &event)) {
+                *return_1 = (size_t)WaitEventResult::InvalidHandle;
+                break;
+            }
+
+            acquire_lock(&global_ipc_lock);
+
+            auto taken_signals = event->signals & mask;
+            if(taken_signals != 0 || timeout == 0) {
+                event->signals &= ~taken_signals;
+
+                global_ipc_lock = false;
 
-                    *return_1 = logical_pages_start * page_size;
+                release_kernel_object(&event->object, global_bitmap);
+
+                if(taken_signals != 0) {
+                    *return_1 = (size_t)WaitEventResult::Success;
+                } else {
+                    *return_1 = (size_t)WaitEventResult::TimedOut;
                 }
+                *return_2 = taken_signals;
+                break;
+            }
+
+            auto waiter = allocate_from_bucket_array(&event->waiters, global_bitmap, true);
+            if(waiter == nullptr) {
+                global_ipc_lock = false;
+
+                release_kernel_object(&event->object, global_bitmap);
+
+                *return_1 = (size_t)WaitEventResult::OutOfMemory;
+                break;
             }
 
-            AcpiPutTable(&mcfg_table->preamble.Header);
+            waiter->thread = thread;
+
+            thread->frame = *stack_frame;
+
+            // The reference to the event now belongs to the thread, until it stops waiting
+            thread->waiting_event = event;
+            thread->waiting_event_mask = mask;
+            thread->wait_deadline = get_wait_deadline(timeout);
+            thread->ipc_state = ThreadIPCState::WaitingForEvent;
+            thread->is_ready = false;
+
+            global_ipc_lock = false;
+
+            release_thread(processor_area, thread);
+
+            enter_next_process(processor_area, global_bitmap, &global_processes);
+        } break;
+
+#define X(name) case SyscallType::name:
+        IMMEDIATE_SYSCALLS(X)
+#undef X
+        {
+            acquire_lock(&process->syscall_lock);
+
+            perform_immediate_syscall(
+                process,
+                (SyscallType)syscall_index,
+                parameters,
+                return_1,
+                return_2
+            );
+
+            process->syscall_lock = false;
         } break;
 
-        default: { // unknown syscall
+        default: {
+            // Unknown syscall
             printf("Unknown syscall from process %zu at %p\n", process->id, stack_frame->interrupt_frame.instruction_pointer);
 
             // Disable APIC timer and clear any pending interrupt
@@ -1514,12 +4035,18 @@ void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
             processor_area->in_syscall_or_user_exception = false;
             processor_area->preempt_during_syscall_or_user_exception = false;
 
-            destroy_process(processor_area->current_process_iterator, global_bitmap);
+            terminate_process(processor_area->current_process_iterator);
 
             enter_next_process(processor_area, global_bitmap, &global_processes);
         } break;
     }
 
+    record_syscall_latency(
+        statistics,
+        read_timestamp_counter() - start_time,
+        combined_paging_lock_wait_cycles[processor_id] - start_combined_paging_lock_wait_cycles
+    );
+
     // Check for preempt during syscall
 
     disable_interrupts();
@@ -1530,9 +4057,7 @@ void syscall_entrance_continued(ThreadStackFrame *stack_frame) {
         processor_area->in_syscall_or_user_exception = false;
         processor_area->preempt_during_syscall_or_user_exception = false;
 
-        thread->frame = *stack_frame;
-
-        thread->is_resident = false;
+        suspend_thread(processor_area, thread, stack_frame);
 
         enter_next_process(processor_area, global_bitmap, &global_processes);
     }
@@ -1776,6 +4301,58 @@ static ProcessorArea *setup_processor(ProcessorArea *processor_areas, MADTTable
     return processor_area;
 }
 
+// Measures the timestamp counter and APIC timer frequencies against PIT channel 2, which runs at a known frequency.
+// The APIC timer must be masked.
+static void calibrate_timers(APICRegisters *apic_registers) {
+    const uint64_t pit_frequency = 1193182;
+    const uint16_t pit_count = pit_frequency / 100; // ~10ms
+
+    // Gate channel 2 off, and disconnect it from the PC speaker
+    auto port_b_value = io_in(0x61);
+    io_out(0x61, port_b_value & ~0b11);
+
+    // Channel 2, lobyte/hibyte access, mode 0 (interrupt on terminal count), binary
+    io_out(0x43, 0b10110000);
+    io_out(0x42, (uint8_t)pit_count);
+    io_out(0x42, (uint8_t)(pit_count >> 8));
+
+    // Gate channel 2 on to start counting down
+    io_out(0x61, (port_b_value & ~0b10) | 0b1);
+
+    apic_registers->timer_initial_count.value = 0xFFFFFFFF;
+    auto start_time = read_timestamp_counter();
+
+    // Channel 2 output goes high on terminal count
+    while((io_in(0x61) & 1 << 5) == 0) {
+        spinloop_pause();
+    }
+
+    auto end_time = read_timestamp_counter();
+    auto apic_timer_ticks = 0xFFFFFFFF - apic_registers->timer_current_count.value;
+
+    apic_registers->timer_initial_count.value = 0;
+
+    io_out(0x61, port_b_value);
+
+    global_timestamp_counter_frequency = (end_time - start_time) * pit_frequency / pit_count;
+    global_apic_timer_frequency = (uint64_t)apic_timer_ticks * pit_frequency / pit_count;
+
+    if(global_timestamp_counter_frequency == 0 || global_apic_timer_frequency == 0) {
+        printf("Error: Unable to calibrate timers\n");
+
+        halt();
+    }
+
+    global_apic_timer_ticks_per_cycle = (global_apic_timer_frequency << 32) / global_timestamp_counter_frequency;
+    global_preempt_cycles = (uint64_t)preempt_time * global_timestamp_counter_frequency / global_apic_timer_frequency;
+
+    printf(
+        "Timestamp counter at %zu kHz, APIC timer at %zu kHz\n",
+        (size_t)(global_timestamp_counter_frequency / 1000),
+        (size_t)(global_apic_timer_frequency / 1000)
+    );
+}
+
 [[noreturn]] static void bootstrap_processor_entry_continued() {
     // MAKE SURE the processor area for the bootstrap processor is initalized BEFORE this point
 
@@ -1783,6 +4360,26 @@ static ProcessorArea *setup_processor(ProcessorArea *processor_areas, MADTTable
 
     auto processor_area = &global_processor_areas[bootstrap_processor_id];
 
+    calibrate_timers(processor_area->apic_registers);
+
+    global_kernel_info = (KernelInfo*)map_and_allocate_consecutive_memory(
+        sizeof(KernelInfo),
+        global_bitmap,
+        &global_kernel_info_physical_address
+    );
+    if(global_kernel_info == nullptr) {
+        printf("Error: Out of memory\n");
+
+        halt();
+    }
+
+    fill_memory(global_kernel_info, sizeof(KernelInfo), 0);
+
+    global_kernel_info->processor_count = global_processor_count;
+    global_kernel_info->timestamp_counter_frequency = global_timestamp_counter_frequency;
+    global_kernel_info->boot_timestamp_counter = read_timestamp_counter();
+    global_kernel_info->nanoseconds_per_cycle = (1000000000ull << 32) / global_timestamp_counter_frequency;
+
     MADTTable *madt_table;
     acpi_call(
         AcpiGetTable((char*)ACPI_SIG_MADT, 1, (ACPI_TABLE_HEADER**)&madt_table),
@@ -1887,6 +4484,12 @@ static ProcessorArea *setup_processor(ProcessorArea *processor_areas, MADTTable
 
     global_all_processors_initialized = true;
 
+    if(!enumerate_pcie_devices(global_bitmap)) {
+        printf("Error: Out of memory\n");
+
+        halt();
+    }
+
     // Reload TLB
     write_cr3((size_t)&kernel_pml4_table);
 
@@ -1896,19 +4499,30 @@ static ProcessorArea *setup_processor(ProcessorArea *processor_areas, MADTTable
 
     Process *init_process;
     Processes::Iterator init_process_iterator;
+    ProcessThread *init_thread;
     switch(create_process_from_elf(
         embedded_init_binary,
         embedded_init_binary_size,
         nullptr,
         0,
+        nullptr,
+        0,
+        0,
         global_bitmap,
         global_processor_area_count,
         global_processor_areas_physical_address,
+        global_kernel_info_physical_address,
         &global_processes,
         &init_process,
-        &init_process_iterator
+        &init_process_iterator,
+        &init_thread
     )) {
-        case CreateProcessFromELFResult::Success: break;
+        case CreateProcessFromELFResult::Success: {
+            publish_process_alive(init_process->id);
+
+            init_thread->is_ready = true;
+            init_process->is_ready = true;
+        } break;
 
         case CreateProcessFromELFResult::OutOfMemory: {
             printf("Error: Out of memory\n");
@@ -1943,6 +4557,47 @@ static inline void enable_sse() {
         value |= 1 << 9 | 1 << 10;
         write_cr4(value);
     }
+
+    uint32_t cpuid_a;
+    uint32_t cpuid_b;
+    uint32_t cpuid_c;
+    uint32_t cpuid_d;
+    cpuid(1, 0, &cpuid_a, &cpuid_b, &cpuid_c, &cpuid_d);
+
+    if((cpuid_c & (1 << 26)) != 0) { // XSAVE supported
+        {
+            auto value = read_cr4();
+            value |= 1 << 18;
+            write_cr4(value);
+        }
+
+        // x87 and SSE state, plus AVX state if supported
+        uint64_t xsave_mask = 0b11;
+        if((cpuid_c & (1 << 28)) != 0) {
+            xsave_mask |= 0b100;
+        }
+
+        asm volatile(
+            "xsetbv"
+            :
+            : "c"((uint32_t)0), "a"((uint32_t)xsave_mask), "d"((uint32_t)(xsave_mask >> 32))
+        );
+
+        // Size of the XSAVE area for the state components currently enabled in XCR0
+        cpuid(0xD, 0, &cpuid_a, &cpuid_b, &cpuid_c, &cpuid_d);
+
+        if(cpuid_b > fpu_state_size) {
+            printf("Error: XSAVE area too large (%u bytes)\n", cpuid_b);
+
+            halt();
+        }
+
+        cpuid(0xD, 1, &cpuid_a, &cpuid_b, &cpuid_c, &cpuid_d);
+
+        global_fpu_uses_xsave = true;
+        global_fpu_uses_xsaveopt = (cpuid_a & 1) != 0;
+        global_fpu_xsave_mask = xsave_mask;
+    }
 }
 
 [[noreturn]] static void bootstrap_processor_entry() {
@@ -2209,6 +4864,12 @@ static inline void enable_sse() {
 
     global_bitmap = bitmap;
 
+    if(!create_page_share_counts(bitmap)) {
+        printf("Error: Out of memory\n");
+
+        halt();
+    }
+
     acpi_call(AcpiInitializeSubsystem(), "Unable to initialize ACPICA subsystem");
 
     acpi_call(AcpiInitializeTables(nullptr, 8, TRUE), "Unable to load ACPI tables");
@@ -118,6 +118,13 @@ const size_t processor_stack_size = 1024 * 16;
 
 const size_t gdt_size = 7;
 
+// Positions of members in this struct are VERY IMPORTANT and relied on by user_enter_thunk
+struct UserEnterFrame {
+    uint64_t rax;
+
+    InterruptStackFrame interrupt_frame;
+};
+
 struct ProcessorArea {
     // Needed for GS register crazyness in syscall.S
     size_t user_address;
@@ -130,11 +137,28 @@ struct ProcessorArea {
 
     APICRegisters *apic_registers;
 
+    // The only part of a thread's state that has to be copied to user-mapped memory when entering it
+    UserEnterFrame user_enter_frame;
+
     Processes::Iterator current_process_iterator;
     ProcessThreads::Iterator current_thread_iterator;
 
+    // Thread whose FPU state was most recently loaded into this processor's registers
+    ProcessThread *fpu_state_owner;
+
     bool in_syscall_or_user_exception;
     bool preempt_during_syscall_or_user_exception;
+
+    // Halted in enter_next_process with nothing to run, so device interrupts can go straight to the scheduler
+    bool is_idle;
+
+    // When the current context switch started, or 0 if none is being timed, see SchedulerStatistics
+    uint64_t context_switch_start_time;
+
+    SchedulerStatistics scheduler_statistics;
+
+    // Syscalls made by threads running on this processor, indexed by SyscallType
+    SyscallStatistics syscall_statistics[syscall_type_count];
 };
 
 static_assert(processor_stack_size % 16 == 0, "Processor stack size not 16-byte aligned");
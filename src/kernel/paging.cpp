@@ -3,11 +3,31 @@
 #include "memory.h"
 #include "threading_kernel.h"
 #include "multiprocessing.h"
+#include "timing.h"
 
 extern volatile bool global_all_processors_initialized;
 
 static volatile bool combined_paging_lock = false;
 
+uint64_t combined_paging_lock_wait_cycles[maximum_processor_count];
+
+// How many page tables besides the first each physical page is mapped into by clone_user_pages, indexed like the
+// bitmap. Only changed while holding combined_paging_lock.
+static uint32_t *page_share_counts;
+
+static void acquire_combined_paging_lock() {
+    // Only time the lock when it's contended
+    if(compare_and_swap(&combined_paging_lock, false, true)) {
+        return;
+    }
+
+    auto start_time = read_timestamp_counter();
+
+    acquire_lock(&combined_paging_lock);
+
+    combined_paging_lock_wait_cycles[get_processor_id()] += read_timestamp_counter() - start_time;
+}
+
 bool create_page_walker(
     size_t pml4_table_physical_address,
     size_t start_page_index,
@@ -422,7 +442,7 @@ static bool find_free_logical_pages(size_t page_count, size_t *logical_pages_sta
 
 size_t count_page_tables_needed_for_logical_pages(size_t logical_pages_start, size_t page_count, bool lock) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     size_t new_page_table_count = 0;
@@ -535,7 +555,7 @@ bool allocate_next_physical_page(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     auto byte = &bitmap[*bitmap_index];
@@ -590,7 +610,7 @@ bool allocate_consecutive_physical_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     size_t free_pages_start;
@@ -647,7 +667,7 @@ bool allocate_consecutive_physical_pages(
 
 void allocate_bitmap_range(Array<uint8_t> bitmap, size_t start, size_t count, bool lock) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     auto first_bit = start;
@@ -684,7 +704,7 @@ void allocate_bitmap_range(Array<uint8_t> bitmap, size_t start, size_t count, bo
 
 void deallocate_bitmap_range(Array<uint8_t> bitmap, size_t start, size_t count, bool lock) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     auto first_bit = start;
@@ -850,7 +870,7 @@ bool map_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     if(!find_free_logical_pages(page_count, logical_pages_start)) {
@@ -910,7 +930,7 @@ void unmap_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     for(size_t relative_page_index = 0; relative_page_index < page_count; relative_page_index += 1) {
@@ -955,7 +975,7 @@ bool map_and_allocate_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     if(!find_free_logical_pages(page_count, logical_pages_start)) {
@@ -1035,7 +1055,7 @@ bool map_and_allocate_consecutive_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     if(!allocate_consecutive_physical_pages(
@@ -1079,7 +1099,7 @@ void unmap_and_deallocate_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     for(size_t relative_page_index = 0; relative_page_index < page_count; relative_page_index += 1) {
@@ -1331,7 +1351,7 @@ static bool find_free_logical_pages(
                             }
 
                             for(size_t page_index = 0; page_index < page_table_length; page_index += 1) {
-                                if(!page_table[page_index].present) {
+                                if(!page_table[page_index].present && !page_table[page_index].is_reserved) {
                                     if(last_full) {
                                         free_page_range_start = total_page_index;
 
@@ -1384,17 +1404,35 @@ static bool find_free_logical_pages(
     return true;
 }
 
-bool map_pages(
-    size_t physical_pages_start,
+bool find_free_user_pages(
     size_t page_count,
-    PagePermissions permissions,
     size_t pml4_table_physical_address,
     Array<uint8_t> bitmap,
     size_t *logical_pages_start,
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
+    }
+
+    auto result = find_free_logical_pages(page_count, pml4_table_physical_address, bitmap, logical_pages_start);
+
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    return result;
+}
+
+bool reserve_free_user_pages(
+    size_t page_count,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t *logical_pages_start,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
     }
 
     if(!find_free_logical_pages(page_count, pml4_table_physical_address, bitmap, logical_pages_start)) {
@@ -1414,6 +1452,51 @@ bool map_pages(
         return false;
     }
 
+    for(size_t relative_page_index = 0; relative_page_index < page_count; relative_page_index += 1) {
+        if(!increment_page_walker(&walker, bitmap, !lock)) {
+            unmap_page_walker(&walker, !lock);
+
+            if(lock) {
+                combined_paging_lock = false;
+            }
+
+            return false;
+        }
+
+        walker.page_table[walker.page_index].is_reserved = true;
+    }
+
+    unmap_page_walker(&walker, !lock);
+
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    return true;
+}
+
+bool map_pages_at(
+    size_t physical_pages_start,
+    size_t page_count,
+    PagePermissions permissions,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t logical_pages_start,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
+    }
+
+    PageWalker walker;
+    if(!create_page_walker(pml4_table_physical_address, logical_pages_start, bitmap, &walker, !lock)) {
+        if(lock) {
+            combined_paging_lock = false;
+        }
+
+        return false;
+    }
+
     for(
         size_t relative_page_index = 0;
         relative_page_index < page_count;
@@ -1455,29 +1538,53 @@ bool map_pages(
     return true;
 }
 
-bool map_pages_from_kernel(
-    size_t kernel_logical_pages_start,
+bool map_pages(
+    size_t physical_pages_start,
     size_t page_count,
     PagePermissions permissions,
-    size_t user_pml4_table_physical_address,
+    size_t pml4_table_physical_address,
     Array<uint8_t> bitmap,
-    size_t *user_logical_pages_start,
+    size_t *logical_pages_start,
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
-    if(!find_free_logical_pages(page_count, user_pml4_table_physical_address, bitmap, user_logical_pages_start)) {
-        if(lock) {
-            combined_paging_lock = false;
-        }
+    auto result =
+        find_free_logical_pages(page_count, pml4_table_physical_address, bitmap, logical_pages_start) &&
+        map_pages_at(
+            physical_pages_start,
+            page_count,
+            permissions,
+            pml4_table_physical_address,
+            bitmap,
+            *logical_pages_start,
+            false
+        );
 
-        return false;
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    return result;
+}
+
+bool map_pages_from_kernel_at(
+    size_t kernel_logical_pages_start,
+    size_t page_count,
+    PagePermissions permissions,
+    size_t user_pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t user_logical_pages_start,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
     }
 
     PageWalker walker;
-    if(!create_page_walker(user_pml4_table_physical_address, *user_logical_pages_start, bitmap, &walker, !lock)) {
+    if(!create_page_walker(user_pml4_table_physical_address, user_logical_pages_start, bitmap, &walker, !lock)) {
         if(lock) {
             combined_paging_lock = false;
         }
@@ -1540,6 +1647,38 @@ bool map_pages_from_kernel(
     return true;
 }
 
+bool map_pages_from_kernel(
+    size_t kernel_logical_pages_start,
+    size_t page_count,
+    PagePermissions permissions,
+    size_t user_pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t *user_logical_pages_start,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
+    }
+
+    auto result =
+        find_free_logical_pages(page_count, user_pml4_table_physical_address, bitmap, user_logical_pages_start) &&
+        map_pages_from_kernel_at(
+            kernel_logical_pages_start,
+            page_count,
+            permissions,
+            user_pml4_table_physical_address,
+            bitmap,
+            *user_logical_pages_start,
+            false
+        );
+
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    return result;
+}
+
 bool map_pages_from_user(
     size_t user_logical_pages_start,
     size_t page_count,
@@ -1549,7 +1688,7 @@ bool map_pages_from_user(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     if(!find_free_logical_pages(page_count, kernel_logical_pages_start)) {
@@ -1660,7 +1799,7 @@ bool map_pages_between_user(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     if(!find_free_logical_pages(page_count, to_pml4_table_physical_address, bitmap, to_logical_pages_start)) {
@@ -1735,6 +1874,212 @@ bool map_pages_between_user(
     return true;
 }
 
+bool create_page_share_counts(Array<uint8_t> bitmap) {
+    auto size = bitmap.length * 8 * sizeof(uint32_t);
+
+    auto share_counts = (uint32_t*)map_and_allocate_memory(size, bitmap);
+    if(share_counts == nullptr) {
+        return false;
+    }
+
+    fill_memory(share_counts, size, 0);
+
+    page_share_counts = share_counts;
+
+    return true;
+}
+
+bool clone_user_pages(
+    size_t logical_pages_start,
+    size_t page_count,
+    bool is_shared,
+    size_t from_pml4_table_physical_address,
+    size_t to_pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
+    }
+
+    PageWalker from_walker;
+    if(!create_page_walker(from_pml4_table_physical_address, logical_pages_start, bitmap, &from_walker, !lock)) {
+        if(lock) {
+            combined_paging_lock = false;
+        }
+
+        return false;
+    }
+
+    PageWalker to_walker;
+    if(!create_page_walker(to_pml4_table_physical_address, logical_pages_start, bitmap, &to_walker, !lock)) {
+        unmap_page_walker(&from_walker, !lock);
+
+        if(lock) {
+            combined_paging_lock = false;
+        }
+
+        return false;
+    }
+
+    for(size_t relative_page_index = 0; relative_page_index < page_count; relative_page_index += 1) {
+        if(!increment_page_walker(&from_walker, bitmap, !lock) || !increment_page_walker(&to_walker, bitmap, !lock)) {
+            unmap_page_walker(&from_walker, !lock);
+            unmap_page_walker(&to_walker, !lock);
+
+            if(lock) {
+                combined_paging_lock = false;
+            }
+
+            return false;
+        }
+
+        auto from_page = &from_walker.page_table[from_walker.page_index];
+        auto to_page = &to_walker.page_table[to_walker.page_index];
+
+#ifndef OPTIMIZED
+        if(to_page->present) {
+            printf("FATAL ERROR: Trying to map already mapped page. Page index is 0x%zX\n", to_walker.absolute_page_index);
+
+            halt();
+        }
+#endif
+
+        // The stale writable TLB entries of the from process are flushed when it next switches page tables
+        if(from_page->present && !is_shared) {
+            if(from_page->write_allowed) {
+                from_page->write_allowed = false;
+                from_page->is_copy_on_write = true;
+            }
+
+            from_page->is_cloned = true;
+
+            page_share_counts[from_page->page_address] += 1;
+        }
+
+        *to_page = *from_page;
+        to_page->accessed = false;
+        to_page->dirty = false;
+    }
+
+    unmap_page_walker(&from_walker, !lock);
+    unmap_page_walker(&to_walker, !lock);
+
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    return true;
+}
+
+bool copy_on_write_user_pages(
+    size_t logical_pages_start,
+    size_t page_count,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    bool *result_is_writable,
+    bool lock
+) {
+    if(lock) {
+        acquire_combined_paging_lock();
+    }
+
+    PageWalker walker;
+    if(!create_page_walker(pml4_table_physical_address, logical_pages_start, bitmap, &walker, !lock)) {
+        if(lock) {
+            combined_paging_lock = false;
+        }
+
+        return false;
+    }
+
+    size_t bitmap_index = 0;
+    size_t bitmap_sub_bit_index = 0;
+
+    auto is_writable = true;
+    for(size_t relative_page_index = 0; relative_page_index < page_count; relative_page_index += 1) {
+        if(!increment_page_walker(&walker, bitmap, !lock)) {
+            unmap_page_walker(&walker, !lock);
+
+            if(lock) {
+                combined_paging_lock = false;
+            }
+
+            return false;
+        }
+
+        auto page = &walker.page_table[walker.page_index];
+
+        // The last process left sharing the page just takes it over
+        if(page->present && page->is_copy_on_write && page_share_counts[page->page_address] == 0) {
+            page->write_allowed = true;
+            page->is_cloned = false;
+            page->is_copy_on_write = false;
+        }
+
+        if(page->present && page->is_copy_on_write) {
+            size_t physical_page_index;
+            if(!allocate_next_physical_page(&bitmap_index, &bitmap_sub_bit_index, bitmap, &physical_page_index, false)) {
+                unmap_page_walker(&walker, !lock);
+
+                if(lock) {
+                    combined_paging_lock = false;
+                }
+
+                return false;
+            }
+
+            auto from_memory = map_memory(page->page_address * page_size, page_size, bitmap, false);
+            auto to_memory = map_memory(physical_page_index * page_size, page_size, bitmap, false);
+            if(from_memory == nullptr || to_memory == nullptr) {
+                if(from_memory != nullptr) {
+                    unmap_memory(from_memory, page_size, false);
+                }
+
+                if(to_memory != nullptr) {
+                    unmap_memory(to_memory, page_size, false);
+                }
+
+                deallocate_bitmap_range(bitmap, physical_page_index, 1, false);
+
+                unmap_page_walker(&walker, !lock);
+
+                if(lock) {
+                    combined_paging_lock = false;
+                }
+
+                return false;
+            }
+
+            copy_memory(from_memory, to_memory, page_size);
+
+            unmap_memory(from_memory, page_size, false);
+            unmap_memory(to_memory, page_size, false);
+
+            // The original stays with the other process(es) it was cloned into
+            page_share_counts[page->page_address] -= 1;
+
+            page->page_address = physical_page_index;
+            page->write_allowed = true;
+            page->is_cloned = false;
+            page->is_copy_on_write = false;
+        }
+
+        if(!page->present || !page->write_allowed || !page->user_mode_allowed) {
+            is_writable = false;
+        }
+    }
+
+    unmap_page_walker(&walker, !lock);
+
+    if(lock) {
+        combined_paging_lock = false;
+    }
+
+    *result_is_writable = is_writable;
+    return true;
+}
+
 bool unmap_pages(
     size_t logical_pages_start,
     size_t page_count,
@@ -1744,7 +2089,7 @@ bool unmap_pages(
     bool lock
 ) {
     if(lock) {
-        acquire_lock(&combined_paging_lock);
+        acquire_combined_paging_lock();
     }
 
     PageWalker walker;
@@ -1789,11 +2134,19 @@ bool unmap_pages(
         if(deallocate) {
             auto physical_page_index = page->page_address;
 
-            auto byte_index = physical_page_index / 8;
-            auto sub_byte_index = physical_page_index % 8;
+            // Cloned pages are only deallocated once the last process sharing them unmaps them
+            if(page->is_cloned && page_share_counts[physical_page_index] != 0) {
+                page_share_counts[physical_page_index] -= 1;
+            } else {
+                auto byte_index = physical_page_index / 8;
+                auto sub_byte_index = physical_page_index % 8;
 
-            bitmap[byte_index] &= ~(1 << sub_byte_index);
+                bitmap[byte_index] &= ~(1 << sub_byte_index);
+            }
         }
+
+        page->is_cloned = false;
+        page->is_copy_on_write = false;
 #endif
     }
 
@@ -32,7 +32,16 @@ struct __attribute__((packed)) PageTableEntry {
     bool dirty: 1;
     bool page_size: 1;
     bool global: 1;
-    uint8_t _ignored_0: 3;
+
+    // Software-defined, for not-present user pages that find_free_user_pages has to pass over (e.g. a stack's reserve)
+    bool is_reserved: 1;
+
+    // Software-defined, for user pages that clone_user_pages left shared with a cloned process, which unmap_pages only
+    // deallocates once no other process shares them. Writes to copy-on-write ones fault, and the writer gets its own
+    // copy, see copy_on_write_user_pages.
+    bool is_cloned: 1;
+    bool is_copy_on_write: 1;
+
     size_t page_address: 40;
     uint8_t _ignored_1: 7;
     uint8_t protection_key: 4;
@@ -163,6 +172,9 @@ void allocate_bitmap_range(Array<uint8_t> bitmap, size_t start, size_t count, bo
 
 void deallocate_bitmap_range(Array<uint8_t> bitmap, size_t start, size_t count, bool lock = true);
 
+// Timestamp counter cycles each processor has spent waiting for the paging lock, indexed by processor ID
+extern uint64_t combined_paging_lock_wait_cycles[];
+
 // Kernel table-specific functions
 
 bool map_pages(
@@ -241,6 +253,14 @@ enum PagePermissions {
     Execute = 1 << 1
 };
 
+bool find_free_user_pages(
+    size_t page_count,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t *logical_pages_start,
+    bool lock = true
+);
+
 bool map_pages(
     size_t physical_pages_start,
     size_t page_count,
@@ -251,6 +271,27 @@ bool map_pages(
     bool lock = true
 );
 
+// Finds free pages and marks them reserved, so they're never picked for other mappings. They can still be mapped with
+// the *_at functions, and stay reserved once unmapped again.
+bool reserve_free_user_pages(
+    size_t page_count,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t *logical_pages_start,
+    bool lock = true
+);
+
+// Maps at a fixed address, which has to be unmapped
+bool map_pages_at(
+    size_t physical_pages_start,
+    size_t page_count,
+    PagePermissions permissions,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t logical_pages_start,
+    bool lock = true
+);
+
 bool map_pages_from_kernel(
     size_t kernel_logical_pages_start,
     size_t page_count,
@@ -261,6 +302,16 @@ bool map_pages_from_kernel(
     bool lock = true
 );
 
+bool map_pages_from_kernel_at(
+    size_t kernel_logical_pages_start,
+    size_t page_count,
+    PagePermissions permissions,
+    size_t user_pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    size_t user_logical_pages_start,
+    bool lock = true
+);
+
 bool map_pages_from_user(
     size_t user_logical_pages_start,
     size_t page_count,
@@ -281,6 +332,34 @@ bool map_pages_between_user(
     bool lock = true
 );
 
+// Allocates the share counts of clone_user_pages for every page in the bitmap. Must be called once at boot, before any
+// process is created. Returns false if out of memory.
+bool create_page_share_counts(Array<uint8_t> bitmap);
+
+// Maps the pages into another process at the same addresses, not-present (e.g. reserved) ones included. Unless
+// is_shared is set, the pages are made copy-on-write in both processes if writable, and all of them are marked cloned
+// and have their share counts incremented, so only the last process to unmap them deallocates them.
+bool clone_user_pages(
+    size_t logical_pages_start,
+    size_t page_count,
+    bool is_shared,
+    size_t from_pml4_table_physical_address,
+    size_t to_pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    bool lock = true
+);
+
+// Gives the process its own writable copy of any copy-on-write pages in the range. *result_is_writable is set to whether
+// all the pages are present and writable by the process afterwards.
+bool copy_on_write_user_pages(
+    size_t logical_pages_start,
+    size_t page_count,
+    size_t pml4_table_physical_address,
+    Array<uint8_t> bitmap,
+    bool *result_is_writable,
+    bool lock = true
+);
+
 bool unmap_pages(
     size_t logical_pages_start,
     size_t page_count,
@@ -0,0 +1,714 @@
+#include "pcie_devices.h"
+extern "C" {
+#include "acpi.h"
+}
+#include "pcie.h"
+#include "paging.h"
+#include "heap.h"
+#include "memory.h"
+#include "syscalls.h"
+
+#define bits_to_mask(bits) ((1 << (bits)) - 1)
+
+struct MCFGTable {
+    ACPI_TABLE_MCFG preamble;
+
+    ACPI_MCFG_ALLOCATION allocations[0];
+};
+
+// Part of a segment's configuration space from an MCFG allocation
+struct PCIESegmentArea {
+    size_t segment;
+    size_t start_bus;
+    size_t end_bus;
+
+    // Where bus 0 of the segment would be, even if the area starts at a later bus
+    size_t physical_memory_start;
+};
+
+// Devices are chained together by each of these, so lookups only visit the devices that share the IDs
+enum struct PCIEDeviceIndexType {
+    VendorID,
+    VendorAndDeviceID,
+    ClassCode
+};
+
+const size_t pcie_device_index_type_count = 3;
+
+struct PCIEDeviceIndexEntry {
+    uint32_t key;
+
+    // Device index + 1 of the first device with the key, or 0 for an empty entry
+    uint32_t first_device;
+};
+
+// Open-addressed hash table of keys to the first device in the chain for that key
+struct PCIEDeviceIndex {
+    PCIEDeviceIndexEntry *entries;
+    size_t capacity_bits;
+};
+
+const size_t initial_pcie_device_capacity = 32;
+
+const uint16_t status_capabilities_list_bit = 1 << 4;
+const uint16_t command_interrupt_disable_bit = 1 << 10;
+
+const uint8_t msi_capability_id = 0x05;
+const uint8_t msix_capability_id = 0x11;
+
+// Capabilities live after the 64-byte header, and are at least 4 bytes each
+const size_t maximum_capability_count = (configuration_area_size - 64) / 4;
+
+const uint16_t msi_enable_bit = 1 << 0;
+const size_t msi_multiple_message_enable_bits = 3;
+const size_t msi_multiple_message_enable_shift = 4;
+const uint16_t msi_64_bit_bit = 1 << 7;
+
+const size_t msix_table_size_bits = 11;
+const uint16_t msix_function_mask_bit = 1 << 14;
+const uint16_t msix_enable_bit = 1 << 15;
+
+const size_t msix_table_bar_index_bits = 3;
+const size_t msix_table_entry_size = 16;
+const uint32_t msix_entry_masked_bit = 1 << 0;
+
+// Fixed delivery to a single processor in physical destination mode, edge triggered
+const size_t msi_address_base = 0xFEE00000;
+const size_t msi_address_destination_shift = 12;
+
+const size_t bus_memory_size = device_count * function_count * configuration_area_size;
+
+static PCIESegmentArea *segment_areas;
+static size_t segment_area_count;
+
+static PCIEDevice *devices;
+static size_t device_capacity;
+static size_t pcie_device_count;
+
+// Device index + 1 of the next device with the same key for each index type, or 0 if it's the last one
+static uint32_t (*next_devices)[pcie_device_index_type_count];
+
+static PCIEDeviceIndex device_indices[pcie_device_index_type_count];
+
+static size_t make_location(size_t segment, size_t bus, size_t device, size_t function) {
+    return
+        function |
+        device << function_bits |
+        bus << (function_bits + device_bits) |
+        segment << (function_bits + device_bits + bus_bits);
+}
+
+static uint32_t get_index_key(const PCIEDevice *device, PCIEDeviceIndexType type) {
+    switch(type) {
+        case PCIEDeviceIndexType::VendorID: return device->vendor_id;
+        case PCIEDeviceIndexType::VendorAndDeviceID: return (uint32_t)device->vendor_id | (uint32_t)device->device_id << 16;
+        case PCIEDeviceIndexType::ClassCode: return device->class_code;
+    }
+
+    return 0;
+}
+
+static size_t hash_index_key(uint32_t key, size_t capacity_bits) {
+    return (size_t)(uint32_t)(key * 2654435761u) >> (32 - capacity_bits);
+}
+
+static PCIEDeviceIndexEntry *find_index_entry(PCIEDeviceIndex *index, uint32_t key) {
+    auto mask = ((size_t)1 << index->capacity_bits) - 1;
+
+    auto position = hash_index_key(key, index->capacity_bits);
+    while(true) {
+        auto entry = &index->entries[position];
+
+        // The table is never full, so there's always an empty entry to stop at
+        if(entry->first_device == 0 || entry->key == key) {
+            return entry;
+        }
+
+        position = (position + 1) & mask;
+    }
+}
+
+static bool add_device(const PCIEDevice &device) {
+    if(pcie_device_count == device_capacity) {
+        auto new_capacity = device_capacity == 0 ? initial_pcie_device_capacity : device_capacity * 2;
+
+        auto new_devices = (PCIEDevice*)allocate(new_capacity * sizeof(PCIEDevice));
+        if(new_devices == nullptr) {
+            return false;
+        }
+
+        if(devices != nullptr) {
+            copy_memory(devices, new_devices, pcie_device_count * sizeof(PCIEDevice));
+
+            deallocate(devices);
+        }
+
+        devices = new_devices;
+        device_capacity = new_capacity;
+    }
+
+    devices[pcie_device_count] = device;
+    pcie_device_count += 1;
+
+    return true;
+}
+
+// Adds every present function on the bus, and queues the secondary buses of any bridges
+static bool scan_bus(
+    const PCIESegmentArea *area,
+    size_t bus,
+    uint8_t *pending_buses,
+    size_t *pending_bus_count,
+    uint64_t *seen_buses,
+    Array<uint8_t> bitmap
+) {
+    auto bus_memory = map_memory(area->physical_memory_start + bus * bus_memory_size, bus_memory_size, bitmap);
+    if(bus_memory == nullptr) {
+        return false;
+    }
+
+    for(size_t device = 0; device < device_count; device += 1) {
+        auto device_memory = (size_t)bus_memory + device * function_count * configuration_area_size;
+
+        // Devices have to implement function 0, so none of the others need checking if it's absent
+        if(((volatile PCIHeader*)device_memory)->vendor_id == 0xFFFF) {
+            continue;
+        }
+
+        auto present_function_count = function_count;
+        if((((volatile PCIHeader*)device_memory)->header_type & header_type_multi_function_bit) == 0) {
+            present_function_count = 1;
+        }
+
+        for(size_t function = 0; function < present_function_count; function += 1) {
+            auto header = (volatile PCIHeader*)(device_memory + function * configuration_area_size);
+
+            if(header->vendor_id == 0xFFFF) {
+                continue;
+            }
+
+            PCIEDevice entry {};
+            entry.location = make_location(area->segment, bus, device, function);
+            entry.vendor_id = header->vendor_id;
+            entry.device_id = header->device_id;
+            entry.class_code = header->class_code;
+            entry.subclass = header->subclass;
+            entry.interface = header->interface;
+
+            if(!add_device(entry)) {
+                unmap_memory(bus_memory, bus_memory_size);
+
+                return false;
+            }
+
+            if((header->header_type & header_type_mask) == bridge_header_type) {
+                auto secondary_bus = (size_t)((volatile PCIBridgeHeader*)header)->secondary_bus;
+
+                // Bridges that aren't configured yet or point outside the area are skipped, as are buses seen before
+                if(
+                    secondary_bus > bus &&
+                    secondary_bus <= area->end_bus &&
+                    (seen_buses[secondary_bus / 64] & (1ull << (secondary_bus % 64))) == 0
+                ) {
+                    seen_buses[secondary_bus / 64] |= 1ull << (secondary_bus % 64);
+
+                    pending_buses[*pending_bus_count] = (uint8_t)secondary_bus;
+                    *pending_bus_count += 1;
+                }
+            }
+        }
+    }
+
+    unmap_memory(bus_memory, bus_memory_size);
+
+    return true;
+}
+
+static bool scan_segment_area(const PCIESegmentArea *area, Array<uint8_t> bitmap) {
+    // Every bus gets queued at most once, so this can't overflow
+    uint8_t pending_buses[maximum_bus_count];
+    size_t pending_bus_count = 0;
+
+    uint64_t seen_buses[maximum_bus_count / 64] {};
+
+    auto root_bus_memory = map_memory(
+        area->physical_memory_start + area->start_bus * bus_memory_size,
+        function_count * configuration_area_size,
+        bitmap
+    );
+    if(root_bus_memory == nullptr) {
+        return false;
+    }
+
+    // A multi-function host bridge means there are several host bridges, with one root bus per function
+    auto host_bridge = (volatile PCIHeader*)root_bus_memory;
+    if(host_bridge->vendor_id != 0xFFFF) {
+        auto root_bus_count = (host_bridge->header_type & header_type_multi_function_bit) != 0 ? function_count : 1;
+
+        for(size_t function = 0; function < root_bus_count; function += 1) {
+            auto header = (volatile PCIHeader*)((size_t)root_bus_memory + function * configuration_area_size);
+
+            auto bus = area->start_bus + function;
+
+            if(header->vendor_id != 0xFFFF && bus <= area->end_bus) {
+                seen_buses[bus / 64] |= 1ull << (bus % 64);
+
+                pending_buses[pending_bus_count] = (uint8_t)bus;
+                pending_bus_count += 1;
+            }
+        }
+    }
+
+    unmap_memory(root_bus_memory, function_count * configuration_area_size);
+
+    while(pending_bus_count != 0) {
+        pending_bus_count -= 1;
+        auto bus = (size_t)pending_buses[pending_bus_count];
+
+        if(!scan_bus(area, bus, pending_buses, &pending_bus_count, seen_buses, bitmap)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool build_device_index(PCIEDeviceIndexType type) {
+    auto index = &device_indices[(size_t)type];
+
+    // At most half full, so probe sequences stay short
+    size_t capacity_bits = 4;
+    while(((size_t)1 << capacity_bits) < pcie_device_count * 2) {
+        capacity_bits += 1;
+    }
+
+    auto capacity = (size_t)1 << capacity_bits;
+
+    index->entries = (PCIEDeviceIndexEntry*)allocate(capacity * sizeof(PCIEDeviceIndexEntry));
+    if(index->entries == nullptr) {
+        return false;
+    }
+
+    fill_memory(index->entries, capacity * sizeof(PCIEDeviceIndexEntry), 0);
+
+    index->capacity_bits = capacity_bits;
+
+    // Going backwards and pushing onto the front keeps every chain in location order
+    for(size_t i = pcie_device_count; i != 0; i -= 1) {
+        auto device_index = i - 1;
+
+        auto key = get_index_key(&devices[device_index], type);
+
+        auto entry = find_index_entry(index, key);
+
+        next_devices[device_index][(size_t)type] = entry->first_device;
+
+        entry->key = key;
+        entry->first_device = (uint32_t)(device_index + 1);
+    }
+
+    return true;
+}
+
+bool enumerate_pcie_devices(Array<uint8_t> bitmap) {
+    MCFGTable *mcfg_table;
+    {
+        auto status = AcpiGetTable((char*)ACPI_SIG_MCFG, 1, (ACPI_TABLE_HEADER**)&mcfg_table);
+        if(status != AE_OK) {
+            // No PCIe, so every lookup fails
+            return true;
+        }
+    }
+
+    auto allocation_count = (mcfg_table->preamble.Header.Length - sizeof(ACPI_TABLE_MCFG)) / sizeof(ACPI_MCFG_ALLOCATION);
+
+    if(allocation_count != 0) {
+        segment_areas = (PCIESegmentArea*)allocate(allocation_count * sizeof(PCIESegmentArea));
+        if(segment_areas == nullptr) {
+            AcpiPutTable(&mcfg_table->preamble.Header);
+
+            return false;
+        }
+    }
+
+    for(size_t i = 0; i < allocation_count; i += 1) {
+        auto area = &segment_areas[i];
+
+        area->segment = (size_t)mcfg_table->allocations[i].PciSegment;
+        area->start_bus = (size_t)mcfg_table->allocations[i].StartBusNumber;
+        area->end_bus = (size_t)mcfg_table->allocations[i].EndBusNumber;
+        area->physical_memory_start = (size_t)mcfg_table->allocations[i].Address;
+    }
+
+    segment_area_count = allocation_count;
+
+    AcpiPutTable(&mcfg_table->preamble.Header);
+
+    for(size_t i = 0; i < segment_area_count; i += 1) {
+        if(!scan_segment_area(&segment_areas[i], bitmap)) {
+            return false;
+        }
+    }
+
+    // Bridges are followed in whatever order they're found, so put the devices back in location order. There are few
+    // enough for an insertion sort.
+    for(size_t i = 1; i < pcie_device_count; i += 1) {
+        auto device = devices[i];
+
+        auto j = i;
+        while(j != 0 && devices[j - 1].location > device.location) {
+            devices[j] = devices[j - 1];
+            j -= 1;
+        }
+
+        devices[j] = device;
+    }
+
+    if(pcie_device_count == 0) {
+        return true;
+    }
+
+    next_devices = (uint32_t(*)[pcie_device_index_type_count])allocate(
+        pcie_device_count * sizeof(uint32_t[pcie_device_index_type_count])
+    );
+    if(next_devices == nullptr) {
+        return false;
+    }
+
+    for(size_t i = 0; i < pcie_device_index_type_count; i += 1) {
+        if(!build_device_index((PCIEDeviceIndexType)i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool does_device_match(
+    const PCIEDevice *device,
+    uint16_t vendor_id,
+    uint16_t device_id,
+    uint8_t class_code,
+    uint8_t subclass,
+    uint8_t interface,
+    size_t requirements
+) {
+    return !(
+        ((requirements & find_pcie_device_require_vendor_id) != 0 && device->vendor_id != vendor_id) ||
+        ((requirements & find_pcie_device_require_device_id) != 0 && device->device_id != device_id) ||
+        ((requirements & find_pcie_device_require_class_code) != 0 && device->class_code != class_code) ||
+        ((requirements & find_pcie_device_require_subclass) != 0 && device->subclass != subclass) ||
+        ((requirements & find_pcie_device_require_interface) != 0 && device->interface != interface)
+    );
+}
+
+bool find_pcie_device(
+    size_t index,
+    uint16_t vendor_id,
+    uint16_t device_id,
+    uint8_t class_code,
+    uint8_t subclass,
+    uint8_t interface,
+    size_t requirements,
+    const PCIEDevice **result_device
+) {
+    if(pcie_device_count == 0) {
+        return false;
+    }
+
+    PCIEDevice key_device {};
+    key_device.vendor_id = vendor_id;
+    key_device.device_id = device_id;
+    key_device.class_code = class_code;
+
+    auto has_vendor_id = (requirements & find_pcie_device_require_vendor_id) != 0;
+    auto has_device_id = (requirements & find_pcie_device_require_device_id) != 0;
+    auto has_class_code = (requirements & find_pcie_device_require_class_code) != 0;
+
+    auto is_indexed = true;
+    PCIEDeviceIndexType type;
+    if(has_vendor_id && has_device_id) {
+        type = PCIEDeviceIndexType::VendorAndDeviceID;
+    } else if(has_vendor_id) {
+        type = PCIEDeviceIndexType::VendorID;
+    } else if(has_class_code) {
+        type = PCIEDeviceIndexType::ClassCode;
+    } else {
+        is_indexed = false;
+    }
+
+    size_t current_index = 0;
+
+    if(!is_indexed) {
+        for(size_t i = 0; i < pcie_device_count; i += 1) {
+            if(does_device_match(&devices[i], vendor_id, device_id, class_code, subclass, interface, requirements)) {
+                if(current_index == index) {
+                    *result_device = &devices[i];
+                    return true;
+                }
+
+                current_index += 1;
+            }
+        }
+
+        return false;
+    }
+
+    auto entry = find_index_entry(&device_indices[(size_t)type], get_index_key(&key_device, type));
+
+    auto next_device = (size_t)entry->first_device;
+    while(next_device != 0) {
+        auto device_index = next_device - 1;
+
+        if(does_device_match(&devices[device_index], vendor_id, device_id, class_code, subclass, interface, requirements)) {
+            if(current_index == index) {
+                *result_device = &devices[device_index];
+                return true;
+            }
+
+            current_index += 1;
+        }
+
+        next_device = (size_t)next_devices[device_index][(size_t)type];
+    }
+
+    return false;
+}
+
+bool get_pcie_configuration_address(size_t location, size_t *result_physical_address) {
+    auto function = location & bits_to_mask(function_bits);
+    auto device = location >> function_bits & bits_to_mask(device_bits);
+    auto bus = location >> (function_bits + device_bits) & bits_to_mask(bus_bits);
+    auto segment = location >> (function_bits + device_bits + bus_bits);
+
+    for(size_t i = 0; i < segment_area_count; i += 1) {
+        auto area = &segment_areas[i];
+
+        if(area->segment == segment && bus >= area->start_bus && bus <= area->end_bus) {
+            *result_physical_address =
+                area->physical_memory_start +
+                bus * bus_memory_size +
+                (device * function_count + function) * configuration_area_size;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Offset of the first capability with the ID in the configuration space, or 0 if there isn't one
+static size_t find_capability(volatile uint8_t *configuration, uint8_t id) {
+    auto header = (volatile PCIHeader*)configuration;
+
+    if((header->status & status_capabilities_list_bit) == 0) {
+        return 0;
+    }
+
+    auto offset = (size_t)(header->capabilities_offset & ~0b11);
+
+    // Bounded in case a broken device's list loops
+    for(size_t i = 0; i < maximum_capability_count && offset != 0; i += 1) {
+        if(configuration[offset] == id) {
+            return offset;
+        }
+
+        offset = (size_t)(configuration[offset + 1] & ~0b11);
+    }
+
+    return 0;
+}
+
+// Only memory BARs can hold the MSI-X table
+static bool get_memory_bar_address(volatile PCIHeader *header, size_t bar_index, size_t *result_address) {
+    if(bar_index >= bar_count) {
+        return false;
+    }
+
+    auto bar_value = header->bars[bar_index];
+
+    if((bar_value & bits_to_mask(bar_type_bits)) != 0) { // IO BAR
+        return false;
+    }
+
+    auto memory_bar_type = bar_value >> bar_type_bits & bits_to_mask(memory_bar_type_bits);
+
+    const auto info_bits = bar_type_bits + memory_bar_type_bits + memory_bar_prefetchable_bits;
+
+    switch(memory_bar_type) {
+        case 0b00: { // 32-bit memory BAR
+            *result_address = (size_t)(bar_value & ~bits_to_mask(info_bits));
+        } break;
+
+        case 0b10: { // 64-bit memory BAR
+            if(bar_index + 1 == bar_count) {
+                return false;
+            }
+
+            *result_address = (size_t)(bar_value & ~bits_to_mask(info_bits)) | (size_t)header->bars[bar_index + 1] << 32;
+        } break;
+
+        default: return false;
+    }
+
+    return true;
+}
+
+// Maps the MSI-X table entry, which has to be unmapped with msix_table_entry_size
+static EnablePCIEInterruptResult map_msix_table_entry(
+    volatile uint8_t *configuration,
+    size_t capability_offset,
+    size_t entry,
+    Array<uint8_t> bitmap,
+    volatile uint32_t **result_table_entry
+) {
+    auto control = *(volatile uint16_t*)(configuration + capability_offset + 2);
+
+    auto table_size = (size_t)(control & bits_to_mask(msix_table_size_bits)) + 1;
+    if(entry >= table_size) {
+        return EnablePCIEInterruptResult::NotSupported;
+    }
+
+    auto table_location = *(volatile uint32_t*)(configuration + capability_offset + 4);
+
+    size_t bar_address;
+    if(!get_memory_bar_address(
+        (volatile PCIHeader*)configuration,
+        table_location & bits_to_mask(msix_table_bar_index_bits),
+        &bar_address
+    )) {
+        return EnablePCIEInterruptResult::NotSupported;
+    }
+
+    auto table_offset = (size_t)(table_location & ~bits_to_mask(msix_table_bar_index_bits));
+
+    auto table_entry = (volatile uint32_t*)map_memory(
+        bar_address + table_offset + entry * msix_table_entry_size,
+        msix_table_entry_size,
+        bitmap
+    );
+    if(table_entry == nullptr) {
+        return EnablePCIEInterruptResult::OutOfMemory;
+    }
+
+    *result_table_entry = table_entry;
+    return EnablePCIEInterruptResult::Success;
+}
+
+EnablePCIEInterruptResult enable_pcie_interrupt(
+    size_t location,
+    size_t entry,
+    uint8_t vector,
+    uint8_t apic_id,
+    Array<uint8_t> bitmap
+) {
+    size_t physical_address;
+    if(!get_pcie_configuration_address(location, &physical_address)) {
+        return EnablePCIEInterruptResult::InvalidLocation;
+    }
+
+    auto configuration = (volatile uint8_t*)map_memory(physical_address, configuration_area_size, bitmap);
+    if(configuration == nullptr) {
+        return EnablePCIEInterruptResult::OutOfMemory;
+    }
+
+    auto header = (volatile PCIHeader*)configuration;
+
+    if(header->vendor_id == 0xFFFF) {
+        unmap_memory((void*)configuration, configuration_area_size);
+
+        return EnablePCIEInterruptResult::InvalidLocation;
+    }
+
+    auto message_address = (uint32_t)(msi_address_base | (size_t)apic_id << msi_address_destination_shift);
+
+    auto msix_offset = find_capability(configuration, msix_capability_id);
+    if(msix_offset != 0) {
+        volatile uint32_t *table_entry;
+        auto result = map_msix_table_entry(configuration, msix_offset, entry, bitmap, &table_entry);
+        if(result != EnablePCIEInterruptResult::Success) {
+            unmap_memory((void*)configuration, configuration_area_size);
+
+            return result;
+        }
+
+        // Masked while it's rewritten, so the device never sends half of the new message
+        table_entry[3] |= msix_entry_masked_bit;
+
+        table_entry[0] = message_address;
+        table_entry[1] = 0;
+        table_entry[2] = vector;
+
+        table_entry[3] &= ~msix_entry_masked_bit;
+
+        unmap_memory((void*)table_entry, msix_table_entry_size);
+
+        auto control = (volatile uint16_t*)(configuration + msix_offset + 2);
+        *control = (*control | msix_enable_bit) & ~msix_function_mask_bit;
+    } else {
+        auto msi_offset = find_capability(configuration, msi_capability_id);
+        if(msi_offset == 0 || entry != 0) {
+            unmap_memory((void*)configuration, configuration_area_size);
+
+            return EnablePCIEInterruptResult::NotSupported;
+        }
+
+        auto control = (volatile uint16_t*)(configuration + msi_offset + 2);
+
+        *(volatile uint32_t*)(configuration + msi_offset + 4) = message_address;
+
+        size_t data_offset;
+        if((*control & msi_64_bit_bit) != 0) {
+            *(volatile uint32_t*)(configuration + msi_offset + 8) = 0;
+
+            data_offset = 12;
+        } else {
+            data_offset = 8;
+        }
+
+        *(volatile uint16_t*)(configuration + msi_offset + data_offset) = vector;
+
+        // A single message
+        *control =
+            (*control & ~(bits_to_mask(msi_multiple_message_enable_bits) << msi_multiple_message_enable_shift)) |
+            msi_enable_bit;
+    }
+
+    header->command |= command_interrupt_disable_bit;
+
+    unmap_memory((void*)configuration, configuration_area_size);
+
+    return EnablePCIEInterruptResult::Success;
+}
+
+void disable_pcie_interrupt(size_t location, size_t entry, Array<uint8_t> bitmap) {
+    size_t physical_address;
+    if(!get_pcie_configuration_address(location, &physical_address)) {
+        return;
+    }
+
+    auto configuration = (volatile uint8_t*)map_memory(physical_address, configuration_area_size, bitmap);
+    if(configuration == nullptr) {
+        return;
+    }
+
+    auto msix_offset = find_capability(configuration, msix_capability_id);
+    if(msix_offset != 0) {
+        // Other entries may still be in use, so MSI-X itself stays enabled
+        volatile uint32_t *table_entry;
+        if(map_msix_table_entry(configuration, msix_offset, entry, bitmap, &table_entry) == EnablePCIEInterruptResult::Success) {
+            table_entry[3] |= msix_entry_masked_bit;
+
+            unmap_memory((void*)table_entry, msix_table_entry_size);
+        }
+    } else {
+        auto msi_offset = find_capability(configuration, msi_capability_id);
+        if(msi_offset != 0) {
+            auto control = (volatile uint16_t*)(configuration + msi_offset + 2);
+
+            *control &= ~msi_enable_bit;
+        }
+    }
+
+    unmap_memory((void*)configuration, configuration_area_size);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "array.h"
+
+// PCIe devices are enumerated once at boot into a table that never changes afterwards, so it can be read without locks
+struct PCIEDevice {
+    // function | device << function_bits | bus << (function_bits + device_bits) | segment << (function_bits +
+    // device_bits + bus_bits), as returned by FindPCIEDevice
+    size_t location;
+
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t interface;
+};
+
+// Walks every PCIe segment in the MCFG table from its host bridges down through PCI-to-PCI bridges. Must be called
+// once, after the ACPI tables are loaded and before any process runs. Returns false if out of memory.
+bool enumerate_pcie_devices(Array<uint8_t> bitmap);
+
+// Finds the index-th device (in location order) with the IDs selected by the find_pcie_device_require_* flags in
+// requirements. Looks the device up by its vendor and device IDs, vendor ID or class code when those are required, so
+// only devices sharing them are checked.
+bool find_pcie_device(
+    size_t index,
+    uint16_t vendor_id,
+    uint16_t device_id,
+    uint8_t class_code,
+    uint8_t subclass,
+    uint8_t interface,
+    size_t requirements,
+    const PCIEDevice **result_device
+);
+
+// Physical address of the configuration space for a location, whether there's a device at it or not. Fails if no
+// segment covers the location.
+bool get_pcie_configuration_address(size_t location, size_t *result_physical_address);
+
+enum struct EnablePCIEInterruptResult {
+    Success,
+    InvalidLocation,
+    NotSupported,
+    OutOfMemory
+};
+
+// Points the device's MSI-X table entry at the vector on the processor with the APIC ID, and unmasks it. Devices
+// without MSI-X use MSI instead, which only has entry 0. Legacy interrupts are disabled either way.
+EnablePCIEInterruptResult enable_pcie_interrupt(
+    size_t location,
+    size_t entry,
+    uint8_t vector,
+    uint8_t apic_id,
+    Array<uint8_t> bitmap
+);
+
+// Masks the MSI-X table entry, or disables MSI, so the device stops sending the vector
+void disable_pcie_interrupt(size_t location, size_t entry, Array<uint8_t> bitmap);
@@ -4,6 +4,8 @@
 #include "bucket_array_kernel.h"
 #include "threading_kernel.h"
 #include "multiprocessing.h"
+#include "heap.h"
+#include "handles.h"
 
 #define bits_to_mask(bits) ((1 << (bits)) - 1)
 
@@ -80,7 +82,136 @@ struct ELFRelocationAddend {
     intptr_t addend;
 };
 
-size_t next_process_id = 0;
+struct ELFDynamicEntry {
+    intptr_t tag;
+    size_t value;
+};
+
+// The low part of a process ID indexes a two-level table of slots, so processes are found by ID without walking
+// global_processes. The rest of the ID is the slot's generation, which goes up every time the slot is reused, so the IDs
+// of exited processes stay invalid for a long time. Chunks of slots are allocated as needed and never freed, so lookups
+// don't need the lock.
+const size_t process_table_chunk_size = 256;
+const size_t process_table_chunk_count = 1024;
+const size_t process_table_slot_count = process_table_chunk_size * process_table_chunk_count;
+
+struct ProcessTableSlot {
+    // The ID of the process using the slot, or of the last one to use it while the slot is free
+    volatile size_t id;
+    volatile bool is_used;
+
+    Processes::Iterator iterator;
+
+    // Next free slot index + 1, or 0 if it's the last one
+    size_t next_free_slot;
+};
+
+static ProcessTableSlot *process_table[process_table_chunk_count];
+static size_t process_table_slot_end; // Slots below this have been handed out at least once
+static size_t process_table_first_free_slot; // Slot index + 1, or 0 if there are no freed slots
+
+static volatile bool process_table_lock = false;
+
+static ProcessTableSlot *get_process_table_slot(size_t index) {
+    return &process_table[index / process_table_chunk_size][index % process_table_chunk_size];
+}
+
+// Gives the process a fresh ID. Fails if out of memory, or if all the slots are in use.
+static bool register_process_id(Process *process, Processes::Iterator iterator) {
+    acquire_lock(&process_table_lock);
+
+    ProcessTableSlot *slot;
+    size_t id;
+    if(process_table_first_free_slot != 0) {
+        slot = get_process_table_slot(process_table_first_free_slot - 1);
+
+        process_table_first_free_slot = slot->next_free_slot;
+
+        // Next generation of the slot
+        id = slot->id + process_table_slot_count;
+    } else {
+        if(process_table_slot_end == process_table_slot_count) {
+            process_table_lock = false;
+
+            return false;
+        }
+
+        auto chunk = &process_table[process_table_slot_end / process_table_chunk_size];
+        if(*chunk == nullptr) {
+            auto new_chunk = (ProcessTableSlot*)allocate(sizeof(ProcessTableSlot[process_table_chunk_size]));
+            if(new_chunk == nullptr) {
+                process_table_lock = false;
+
+                return false;
+            }
+
+            fill_memory(new_chunk, sizeof(ProcessTableSlot[process_table_chunk_size]), 0);
+
+            // Release store, so lock-free lookups never see the chunk before it's cleared
+            __atomic_store_n(chunk, new_chunk, __ATOMIC_RELEASE);
+        }
+
+        slot = get_process_table_slot(process_table_slot_end);
+
+        id = process_table_slot_end;
+
+        process_table_slot_end += 1;
+    }
+
+    process->id = id;
+
+    slot->iterator = iterator;
+    slot->id = id;
+    __atomic_store_n(&slot->is_used, true, __ATOMIC_RELEASE);
+
+    process_table_lock = false;
+
+    return true;
+}
+
+static void unregister_process_id(Process *process) {
+    auto index = process->id % process_table_slot_count;
+
+    acquire_lock(&process_table_lock);
+
+    auto slot = get_process_table_slot(index);
+
+    slot->is_used = false;
+
+    slot->next_free_slot = process_table_first_free_slot;
+    process_table_first_free_slot = index + 1;
+
+    process_table_lock = false;
+}
+
+bool find_process(size_t id, Processes::Iterator *result_iterator) {
+    auto index = id % process_table_slot_count;
+
+    auto chunk = __atomic_load_n(&process_table[index / process_table_chunk_size], __ATOMIC_ACQUIRE);
+    if(chunk == nullptr) {
+        return false;
+    }
+
+    auto slot = &chunk[index % process_table_chunk_size];
+
+    if(!__atomic_load_n(&slot->is_used, __ATOMIC_ACQUIRE) || __atomic_load_n(&slot->id, __ATOMIC_RELAXED) != id) {
+        return false;
+    }
+
+    auto iterator = slot->iterator;
+
+    // The slot may have been freed and reused while copying the iterator, which is only consistent if it's still used
+    // with the same ID afterwards. A reuse marks it free first, and only marks it used again after giving it a new ID, so
+    // nothing of the process (which may already be destroyed) has to be read to tell.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if(!__atomic_load_n(&slot->is_used, __ATOMIC_ACQUIRE) || __atomic_load_n(&slot->id, __ATOMIC_RELAXED) != id) {
+        return false;
+    }
+
+    *result_iterator = iterator;
+    return true;
+}
 
 static bool c_string_equal(const char *a, const char *b) {
     size_t index = 0;
@@ -138,507 +269,2185 @@ struct SectionAllocation {
 
 using SectionAllocations = BucketArray<SectionAllocation, 16>;
 
-static const SectionAllocation *get_section_allocation(
-    size_t section_index,
-    ConstArray<ELFSectionHeader> section_headers,
-    const SectionAllocations *allocations
-) {
-    auto allocation_iterator = begin(*allocations);
-    for(size_t i = 0; i < section_index; i += 1) {
-        auto section_header = &section_headers[i];
+// Relocations reduced to what they need from the load layout, so repeat launches of an image skip symbol lookups.
+// Section bases are referred to by allocation index (the index among SHF_ALLOC sections).
 
-        if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
-            ++allocation_iterator;
+enum struct PrelinkedBase : uint8_t {
+    None,
+    Section,
+    GlobalOffsetTable,
+    Slot
+};
+
+struct PrelinkedValue {
+    PrelinkedBase base;
+    uint32_t section_allocation_index;
+
+    size_t constant;
+};
+
+struct PrelinkedRelocation {
+    uint32_t slot_allocation_index;
+    uint8_t size; // 4 or 8 bytes
+
+    // Only None, GlobalOffsetTable or Slot
+    PrelinkedBase subtracted_base;
+
+    size_t slot_offset;
+
+    PrelinkedValue value;
+};
+
+extern uint8_t embedded_libuser_binary[];
+extern uint8_t embedded_libuser_binary_end[];
+
+struct SharedLibrary {
+    const char *name;
+
+    const uint8_t *binary;
+    const uint8_t *binary_end;
+};
+
+// The libraries linked images can name with DT_NEEDED, embedded in the kernel. They can't need other libraries.
+static const SharedLibrary shared_libraries[] = {
+    { "libuser.so", embedded_libuser_binary, embedded_libuser_binary_end }
+};
+
+const size_t shared_library_count = sizeof(shared_libraries) / sizeof(SharedLibrary);
+
+const size_t maximum_needed_library_count = 4;
+
+const uint32_t prelinked_binding_absolute = UINT32_MAX;
+
+// A linked image's dynamic relocation with its symbol already looked up. The slot is written with value plus the load
+// bias of image image_index: 0 for the image itself, n for its nth needed library, or prelinked_binding_absolute for
+// no load bias.
+struct PrelinkedBinding {
+    uint32_t image_index;
+
+    // Index among PT_LOAD segments, which has to be writable, and offset from the start of the segment's first page
+    uint32_t slot_load_segment_index;
+    size_t slot_offset;
+
+    size_t value;
+};
+
+struct PrelinkedImage {
+    uint64_t hash;
+    size_t elf_binary_size;
+
+    // Cached images only: a copy of the binary, which has to match in full for a cache hit. The hash is only a quick
+    // filter, as anyone can make a binary with the same hash.
+    uint8_t *elf_binary;
+
+    // Linked (ET_EXEC/ET_DYN) images only: the contents of the read-only PT_LOAD segments, one after another, which
+    // every launch maps instead of copying. Owned by the cache, or by the launched process if the image isn't cached.
+    size_t shared_physical_pages_start;
+    size_t shared_page_count;
+
+    // Linked images only: the DT_NEEDED libraries as indices into shared_libraries, and the image's bindings
+    size_t needed_library_count;
+    uint8_t needed_library_indices[maximum_needed_library_count];
+
+    size_t binding_count;
+    PrelinkedBinding *bindings;
+
+    size_t section_allocation_count;
+
+    PrelinkedValue entry_point;
+
+    size_t relocation_count;
+    PrelinkedRelocation *relocations;
+
+    size_t global_offset_table_entry_count;
+    PrelinkedValue *global_offset_table_entries;
+};
+
+using PrelinkedImages = BucketArray<PrelinkedImage, 8>;
+
+// Images are never removed once cached, so they can be used without holding the lock
+static PrelinkedImages prelinked_images {};
+static size_t prelinked_image_count;
+static volatile bool prelinked_images_lock = false;
+
+const size_t maximum_prelinked_image_count = 32;
+
+// Larger binaries are prelinked again for every launch. Bounds the memory the cached copies take, and the hash and
+// compare every launch pays to look one up.
+const size_t maximum_prelinked_binary_size = 1024 * 1024;
+
+size_t prelinked_image_hit_count;
+size_t prelinked_image_miss_count;
+
+typedef uint64_t __attribute__((aligned(1))) unaligned_uint64_t;
+
+// FNV-1a, a word at a time
+static uint64_t hash_elf_binary(const uint8_t *elf_binary, size_t elf_binary_size) {
+    uint64_t hash = 0xCBF29CE484222325;
+
+    size_t index = 0;
+    for(; index + sizeof(uint64_t) <= elf_binary_size; index += sizeof(uint64_t)) {
+        hash ^= *(const unaligned_uint64_t*)&elf_binary[index];
+        hash *= 0x100000001B3;
+    }
+
+    for(; index < elf_binary_size; index += 1) {
+        hash ^= elf_binary[index];
+        hash *= 0x100000001B3;
+    }
+
+    return hash;
+}
+
+static bool is_elf_binary_equal(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t index = 0;
+    for(; index + sizeof(uint64_t) <= size; index += sizeof(uint64_t)) {
+        if(*(const unaligned_uint64_t*)&a[index] != *(const unaligned_uint64_t*)&b[index]) {
+            return false;
         }
     }
 
-    return *allocation_iterator;
+    for(; index < size; index += 1) {
+        if(a[index] != b[index]) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-CreateProcessFromELFResult create_process_from_elf(
-    uint8_t *elf_binary,
-    size_t elf_binary_size,
-    void *data,
-    size_t data_size,
+// Open-addressing hash table of the defined global symbols, holding symbol indices + 1 (0 is an empty slot)
+struct SymbolIndex {
+    Array<uint32_t> slots;
+};
+
+// FNV-1a
+static uint32_t hash_symbol_name(const char *name) {
+    uint32_t hash = 0x811C9DC5;
+
+    for(size_t i = 0; name[i] != '\0'; i += 1) {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+static bool is_symbol_indexed(const ELFSymbol *symbol, ConstArray<char> symbol_names) {
+    return
+        (symbol->bind == 1 || symbol->bind == 2) && // STB_GLOBAL, STB_WEAK
+        symbol->section_index != 0 && // SHN_UNDEF
+        symbol->name_index != 0 &&
+        symbol->name_index < symbol_names.length;
+}
+
+static bool create_symbol_index(
+    ConstArray<ELFSymbol> symbols,
+    ConstArray<char> symbol_names,
     Array<uint8_t> bitmap,
-    size_t processor_area_count,
-    size_t processor_areas_physical_memory_start,
-    Processes *processes,
-    Process **result_processs,
-    Processes::Iterator *result_process_iterator
+    SymbolIndex *result_index
 ) {
-    Processes::Iterator process_iterator;
-    auto process = allocate_from_bucket_array(processes, bitmap, true, &process_iterator);
-    if(process == nullptr) {
-        return CreateProcessFromELFResult::OutOfMemory;
+    size_t indexed_symbol_count = 0;
+    for(size_t i = 0; i < symbols.length; i += 1) {
+        if(is_symbol_indexed(&symbols[i], symbol_names)) {
+            indexed_symbol_count += 1;
+        }
     }
 
-    process->id = next_process_id;
-    next_process_id += 1;
+    // Keep the table at most half full, with a power-of-two size so the hash can be masked
+    size_t slot_count = 16;
+    while(slot_count < indexed_symbol_count * 2) {
+        slot_count *= 2;
+    }
 
-    size_t bitmap_index = 0;
-    size_t bitmap_sub_bit_index = 0;
+    SymbolIndex index {
+        {
+            (uint32_t*)map_and_allocate_memory(slot_count * sizeof(uint32_t), bitmap),
+            slot_count
+        }
+    };
+    if(index.slots.data == nullptr) {
+        return false;
+    }
 
-    size_t pml4_physical_page_index;
-    if(!allocate_next_physical_page(
-        &bitmap_index,
-        &bitmap_sub_bit_index,
-        bitmap,
-        &pml4_physical_page_index
-    )) {
-        remove_item_from_bucket_array(process_iterator);
+    fill_memory(index.slots.data, slot_count * sizeof(uint32_t), 0);
 
-        return CreateProcessFromELFResult::OutOfMemory;
+    for(size_t i = 0; i < symbols.length; i += 1) {
+        auto symbol = &symbols[i];
+
+        if(!is_symbol_indexed(symbol, symbol_names)) {
+            continue;
+        }
+
+        auto slot_index = hash_symbol_name(&symbol_names[symbol->name_index]) & (slot_count - 1);
+        while(index.slots[slot_index] != 0) {
+            slot_index = (slot_index + 1) & (slot_count - 1);
+        }
+
+        index.slots[slot_index] = (uint32_t)(i + 1);
     }
 
-    process->pml4_table_physical_address = pml4_physical_page_index * page_size;
+    *result_index = index;
+    return true;
+}
 
-    // Currently assumes correct and specific elf header & content, full validation is not done.
+static void destroy_symbol_index(SymbolIndex *index, Array<uint8_t> bitmap) {
+    unmap_and_deallocate_memory(index->slots.data, index->slots.length * sizeof(uint32_t), bitmap);
+}
 
-    auto elf_header = (ELFHeader*)elf_binary;
+// Returns nullptr if there's no defined global symbol with the name
+static const ELFSymbol *find_symbol(
+    SymbolIndex *index,
+    ConstArray<ELFSymbol> symbols,
+    ConstArray<char> symbol_names,
+    const char *name
+) {
+    auto slot_mask = index->slots.length - 1;
 
-    if(elf_header->type != 1) { // ET_REL
-        return CreateProcessFromELFResult::InvalidELF;
+    auto slot_index = hash_symbol_name(name) & slot_mask;
+    while(index->slots[slot_index] != 0) {
+        auto symbol = &symbols[index->slots[slot_index] - 1];
+
+        if(c_string_equal(&symbol_names[symbol->name_index], name)) {
+            return symbol;
+        }
+
+        slot_index = (slot_index + 1) & slot_mask;
     }
 
+    return nullptr;
+}
+
+static void deallocate_prelinked_image(PrelinkedImage *image) {
+    if(image->relocations != nullptr) {
+        deallocate(image->relocations);
+    }
+
+    if(image->global_offset_table_entries != nullptr) {
+        deallocate(image->global_offset_table_entries);
+    }
+
+    if(image->bindings != nullptr) {
+        deallocate(image->bindings);
+    }
+}
+
+enum struct PrelinkELFResult {
+    Success,
+    OutOfMemory,
+    InvalidELF
+};
+
+static PrelinkELFResult prelink_relocatable_elf(
+    const uint8_t *elf_binary,
+    Array<uint8_t> bitmap,
+    PrelinkedImage *result_image
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
     ConstArray<ELFSectionHeader> section_headers {
-        (ELFSectionHeader*)((size_t)elf_binary + elf_header->section_header_offset),
+        (const ELFSectionHeader*)((size_t)elf_binary + elf_header->section_header_offset),
         elf_header->section_header_count
     };
 
-    ConstArray<char> section_names {
-        (const char*)((size_t)elf_binary + section_headers[elf_header->section_names_entry_index].in_file_offset),
-        section_headers[elf_header->section_names_entry_index].size
-    };
-
     ConstArray<ELFSymbol> symbols;
+    ConstArray<char> symbol_names;
     auto symbols_found = false;
     for(size_t i = 0; i < section_headers.length; i += 1) {
         auto section_header = &section_headers[i];
 
         if(section_header->type == 2) { // SHT_SYMTAB
-            symbols.data = (ELFSymbol*)((size_t)elf_binary + section_header->in_file_offset);
+            symbols.data = (const ELFSymbol*)((size_t)elf_binary + section_header->in_file_offset);
             symbols.length = section_header->size / sizeof(ELFSymbol);
 
+            // The symbol table links to its string table
+            if(section_header->link >= section_headers.length) {
+                break;
+            }
+
+            auto symbol_names_section_header = &section_headers[section_header->link];
+
+            symbol_names.data = (const char*)((size_t)elf_binary + symbol_names_section_header->in_file_offset);
+            symbol_names.length = symbol_names_section_header->size;
+
             symbols_found = true;
             break;
         }
     }
 
     if(!symbols_found) {
-        return CreateProcessFromELFResult::InvalidELF;
+        return PrelinkELFResult::InvalidELF;
     }
 
-    ConstArray<char> symbol_names;
-    auto symbol_names_found = false;
+    const size_t no_allocation_index = SIZE_MAX;
+
+    Array<size_t> section_allocation_indices {
+        (size_t*)map_and_allocate_memory(section_headers.length * sizeof(size_t), bitmap),
+        section_headers.length
+    };
+    if(section_allocation_indices.data == nullptr) {
+        return PrelinkELFResult::OutOfMemory;
+    }
+
+    size_t section_allocation_count = 0;
+    size_t maximum_relocation_count = 0;
     for(size_t i = 0; i < section_headers.length; i += 1) {
         auto section_header = &section_headers[i];
 
-        auto name = &section_names[section_header->name_offset];
-
-        if(c_string_equal(name, ".strtab")) {
-            symbol_names.data = (const char*)((size_t)elf_binary + section_header->in_file_offset);
-            symbol_names.length = section_header->size;
+        if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
+            section_allocation_indices[i] = section_allocation_count;
+            section_allocation_count += 1;
+        } else {
+            section_allocation_indices[i] = no_allocation_index;
+        }
 
-            symbol_names_found = true;
-            break;
+        if(section_header->type == 4) { // SHT_RELA
+            maximum_relocation_count += section_header->size / sizeof(ELFRelocationAddend);
         }
     }
 
-    if(!symbol_names_found) {
-        return CreateProcessFromELFResult::InvalidELF;
-    }
+    PrelinkedImage image {};
+    image.section_allocation_count = section_allocation_count;
 
-    const auto entry_symbol_name = "entry";
+    { // Find the entry point
+        SymbolIndex symbol_index;
+        if(!create_symbol_index(symbols, symbol_names, bitmap, &symbol_index)) {
+            unmap_and_deallocate_memory(section_allocation_indices.data, section_headers.length * sizeof(size_t), bitmap);
 
-    const ELFSymbol *entry_symbol;
-    auto entry_symbol_found = false;
-    for(size_t i = 0; i < symbols.length; i += 1) {
-        auto symbol = &symbols[i];
+            return PrelinkELFResult::OutOfMemory;
+        }
 
-        auto symbol_name = &symbol_names[symbol->name_index];
+        auto entry_symbol = find_symbol(&symbol_index, symbols, symbol_names, "entry");
 
-        if(c_string_equal(symbol_name, entry_symbol_name)) {
-            entry_symbol = symbol;
+        destroy_symbol_index(&symbol_index, bitmap);
 
-            entry_symbol_found = true;
-            break;
+        if(
+            entry_symbol == nullptr ||
+            entry_symbol->section_index >= section_headers.length ||
+            section_allocation_indices[entry_symbol->section_index] == no_allocation_index
+        ) {
+            unmap_and_deallocate_memory(section_allocation_indices.data, section_headers.length * sizeof(size_t), bitmap);
+
+            return PrelinkELFResult::InvalidELF;
         }
-    }
 
-    if(!entry_symbol_found) {
-        return CreateProcessFromELFResult::InvalidELF;
+        image.entry_point.base = PrelinkedBase::Section;
+        image.entry_point.section_allocation_index = (uint32_t)section_allocation_indices[entry_symbol->section_index];
+        image.entry_point.constant = entry_symbol->value;
     }
 
-    { // Initalize process page tables with kernel pages
-        auto pml4_table = (PageTableEntry*)map_memory(
-            process->pml4_table_physical_address,
-            sizeof(PageTableEntry[page_table_length]),
-            bitmap
-        );
-        if(pml4_table == nullptr) {
-            remove_item_from_bucket_array(process_iterator);
+    // Each symbol gets at most one GOT entry, however many relocations refer to it
+    const size_t no_global_offset_table_index = SIZE_MAX;
 
-            return CreateProcessFromELFResult::OutOfMemory;
+    Array<size_t> symbol_global_offset_table_indices {
+        (size_t*)map_and_allocate_memory(symbols.length * sizeof(size_t), bitmap),
+        symbols.length
+    };
+
+    image.relocations = (PrelinkedRelocation*)allocate(maximum_relocation_count * sizeof(PrelinkedRelocation));
+
+    if(symbol_global_offset_table_indices.data == nullptr || image.relocations == nullptr) {
+        if(symbol_global_offset_table_indices.data != nullptr) {
+            unmap_and_deallocate_memory(symbol_global_offset_table_indices.data, symbols.length * sizeof(size_t), bitmap);
         }
 
-        fill_memory(pml4_table, sizeof(PageTableEntry[page_table_length]), 0);
+        if(image.relocations != nullptr) {
+            deallocate(image.relocations);
+        }
 
-        PageWalker walker {};
-        walker.absolute_page_index = kernel_pages_start;
-        walker.pml4_table = pml4_table;
+        unmap_and_deallocate_memory(section_allocation_indices.data, section_headers.length * sizeof(size_t), bitmap);
 
-        for(size_t absolute_page_index = kernel_pages_start; absolute_page_index < kernel_pages_end; absolute_page_index += 1) {
-            if(!increment_page_walker(&walker, bitmap)) {
-                unmap_page_walker(&walker);
+        return PrelinkELFResult::OutOfMemory;
+    }
 
-                remove_item_from_bucket_array(process_iterator);
+    for(size_t i = 0; i < symbols.length; i += 1) {
+        symbol_global_offset_table_indices[i] = no_global_offset_table_index;
+    }
 
-                return CreateProcessFromELFResult::OutOfMemory;
-            }
+    auto result = PrelinkELFResult::Success;
 
-            auto page = &walker.page_table[walker.page_index];
+    for(size_t i = 0; i < section_headers.length && result == PrelinkELFResult::Success; i += 1) {
+        auto section_header = &section_headers[i];
 
-            page->present = true;
-            page->write_allowed = true;
-            page->user_mode_allowed = false;
-            page->page_address = absolute_page_index;
+        if(section_header->type != 4) { // SHT_RELA
+            continue;
         }
 
-        unmap_page_walker(&walker);
-    }
+        auto slot_section_index = section_header->info;
 
-    auto processor_areas_page_count = divide_round_up(processor_area_count * sizeof(ProcessorArea), page_size);
-    auto processor_areas_physical_pages_start = processor_areas_physical_memory_start / page_size;
+        if(slot_section_index >= section_headers.length || section_allocation_indices[slot_section_index] == no_allocation_index) {
+            continue;
+        }
 
-    { // Map pages for processor area
-        PageWalker walker;
-        if(!create_page_walker(process->pml4_table_physical_address, user_processor_areas_pages_start, bitmap, &walker)) {
-            printf("Error: Out of memory\n");
+        ConstArray<ELFRelocationAddend> relocations {
+            (const ELFRelocationAddend*)((size_t)elf_binary + section_header->in_file_offset),
+            section_header->size / sizeof(ELFRelocationAddend),
+        };
 
-            halt();
+        for(size_t j = 0; j < relocations.length; j += 1) {
+            auto relocation = &relocations[j];
+
+            if(relocation->symbol >= symbols.length) {
+                result = PrelinkELFResult::InvalidELF;
+                break;
+            }
+
+            auto symbol = &symbols[relocation->symbol];
+
+            PrelinkedValue symbol_value {};
+            symbol_value.constant = symbol->value + relocation->addend;
+            if(symbol->section_index != 0 && symbol->section_index != 0xFFF1) { // SHN_UNDEF, SHN_ABS
+                if(symbol->section_index >= section_headers.length || section_allocation_indices[symbol->section_index] == no_allocation_index) {
+                    result = PrelinkELFResult::InvalidELF;
+                    break;
+                }
+
+                symbol_value.base = PrelinkedBase::Section;
+                symbol_value.section_allocation_index = (uint32_t)section_allocation_indices[symbol->section_index];
+            }
+
+            PrelinkedRelocation prelinked_relocation {};
+            prelinked_relocation.slot_allocation_index = (uint32_t)section_allocation_indices[slot_section_index];
+            prelinked_relocation.slot_offset = relocation->offset;
+
+            auto uses_global_offset_table_entry = false;
+
+            switch(relocation->type) {
+                case 0: { // R_X86_64_NONE
+                    continue;
+                } break;
+
+                case 1: { // R_X86_64_64
+                    prelinked_relocation.size = 8;
+                    prelinked_relocation.value = symbol_value;
+                } break;
+
+                case 2: // R_X86_64_PC32
+                case 4: { // R_X86_64_PLT32
+                    prelinked_relocation.size = 4;
+                    prelinked_relocation.value = symbol_value;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::Slot;
+                } break;
+
+                case 3: { // R_X86_64_GOT32
+                    uses_global_offset_table_entry = true;
+
+                    prelinked_relocation.size = 4;
+                } break;
+
+                case 9: // R_X86_64_GOTPCREL
+                case 41: // R_X86_64_GOTPCRELX
+                case 42: { // R_X86_64_REX_GOTPCRELX
+                    uses_global_offset_table_entry = true;
+
+                    prelinked_relocation.size = 4;
+                    prelinked_relocation.value.base = PrelinkedBase::GlobalOffsetTable;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::Slot;
+                } break;
+
+                case 10: { // R_X86_64_32
+                    prelinked_relocation.size = 4;
+                    prelinked_relocation.value = symbol_value;
+                } break;
+
+                case 24: { // R_X86_64_PC64
+                    prelinked_relocation.size = 8;
+                    prelinked_relocation.value = symbol_value;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::Slot;
+                } break;
+
+                case 25: { // R_X86_64_GOTOFF64
+                    prelinked_relocation.size = 8;
+                    prelinked_relocation.value = symbol_value;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::GlobalOffsetTable;
+                } break;
+
+                case 27: { // R_X86_64_GOT64
+                    uses_global_offset_table_entry = true;
+
+                    prelinked_relocation.size = 8;
+                } break;
+
+                case 26: { // R_X86_64_GOTPC32
+                    prelinked_relocation.size = 4;
+                    prelinked_relocation.value.base = PrelinkedBase::GlobalOffsetTable;
+                    prelinked_relocation.value.constant = relocation->addend;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::Slot;
+                } break;
+
+                case 29: { // R_X86_64_GOTPC64
+                    prelinked_relocation.size = 8;
+                    prelinked_relocation.value.base = PrelinkedBase::GlobalOffsetTable;
+                    prelinked_relocation.value.constant = relocation->addend;
+                    prelinked_relocation.subtracted_base = PrelinkedBase::Slot;
+                } break;
+
+                default: {
+                    result = PrelinkELFResult::InvalidELF;
+                } break;
+            }
+
+            if(result != PrelinkELFResult::Success) {
+                break;
+            }
+
+            if(uses_global_offset_table_entry) {
+                auto index = symbol_global_offset_table_indices[relocation->symbol];
+                if(index == no_global_offset_table_index) {
+                    index = image.global_offset_table_entry_count;
+                    image.global_offset_table_entry_count += 1;
+
+                    symbol_global_offset_table_indices[relocation->symbol] = index;
+                }
+
+                // The slot gets the entry's offset into the table plus the addend
+                prelinked_relocation.value.constant = index * sizeof(size_t) + relocation->addend;
+            }
+
+            image.relocations[image.relocation_count] = prelinked_relocation;
+            image.relocation_count += 1;
         }
+    }
 
-        for(size_t relative_page_index = 0; relative_page_index < processor_areas_page_count; relative_page_index += 1) {
-            if(!increment_page_walker(&walker, bitmap)) {
-                printf("Error: Out of memory\n");
+    if(result == PrelinkELFResult::Success) {
+        // Now the GOT's size is known, fill in what each entry holds: the symbol's address, without any addend
+        image.global_offset_table_entries = (PrelinkedValue*)allocate(image.global_offset_table_entry_count * sizeof(PrelinkedValue));
+        if(image.global_offset_table_entries == nullptr) {
+            result = PrelinkELFResult::OutOfMemory;
+        } else {
+            for(size_t i = 0; i < symbols.length; i += 1) {
+                auto index = symbol_global_offset_table_indices[i];
+                if(index == no_global_offset_table_index) {
+                    continue;
+                }
 
-                halt();
+                auto symbol = &symbols[i];
+
+                auto entry = &image.global_offset_table_entries[index];
+                *entry = {};
+                entry->constant = symbol->value;
+
+                if(symbol->section_index != 0 && symbol->section_index != 0xFFF1) { // SHN_UNDEF, SHN_ABS
+                    entry->base = PrelinkedBase::Section;
+                    entry->section_allocation_index = (uint32_t)section_allocation_indices[symbol->section_index];
+                }
             }
+        }
+    }
 
-            auto page = &walker.page_table[walker.page_index];
+    unmap_and_deallocate_memory(symbol_global_offset_table_indices.data, symbols.length * sizeof(size_t), bitmap);
+    unmap_and_deallocate_memory(section_allocation_indices.data, section_headers.length * sizeof(size_t), bitmap);
 
-            page->present = true;
-            page->write_allowed = true;
-            page->user_mode_allowed = false;
-            page->page_address = processor_areas_physical_pages_start + relative_page_index;
+    if(result != PrelinkELFResult::Success) {
+        deallocate(image.relocations);
+
+        return result;
+    }
+
+    *result_image = image;
+    return PrelinkELFResult::Success;
+}
+
+const size_t maximum_load_segment_count = 8;
+
+// Only the lower half of the address space is available to processes
+const size_t user_memory_end = (size_t)1 << 47;
+
+static size_t get_load_segment_page_count(const ELFProgramHeader *program_header) {
+    return divide_round_up(program_header->virtual_address % page_size + program_header->in_memory_size, page_size);
+}
+
+// Fails unless the PT_LOAD segments lie in the file, are in address order without sharing pages, and have addresses
+// congruent to their file offsets modulo the page size, so each one can be mapped page by page
+static bool get_program_headers(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    ConstArray<ELFProgramHeader> *result_program_headers
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
+    if(
+        elf_header->program_header_size != sizeof(ELFProgramHeader) ||
+        elf_header->program_header_offset > elf_binary_size ||
+        elf_header->program_header_count > (elf_binary_size - elf_header->program_header_offset) / sizeof(ELFProgramHeader)
+    ) {
+        return false;
+    }
+
+    ConstArray<ELFProgramHeader> program_headers {
+        (const ELFProgramHeader*)((size_t)elf_binary + elf_header->program_header_offset),
+        elf_header->program_header_count
+    };
+
+    size_t load_segment_count = 0;
+    size_t previous_pages_end = 0;
+    for(size_t i = 0; i < program_headers.length; i += 1) {
+        auto program_header = &program_headers[i];
+
+        if(program_header->type != 1) { // PT_LOAD
+            continue;
         }
 
-        unmap_page_walker(&walker);
+        if(
+            program_header->in_file_size > program_header->in_memory_size ||
+            program_header->offset > elf_binary_size ||
+            program_header->in_file_size > elf_binary_size - program_header->offset ||
+            program_header->virtual_address % page_size != program_header->offset % page_size ||
+            program_header->virtual_address >= user_memory_end ||
+            program_header->in_memory_size > user_memory_end - program_header->virtual_address
+        ) {
+            return false;
+        }
+
+        auto pages_start = program_header->virtual_address / page_size;
+
+        if(load_segment_count != 0 && pages_start < previous_pages_end) {
+            return false;
+        }
+
+        previous_pages_end = pages_start + get_load_segment_page_count(program_header);
+
+        load_segment_count += 1;
     }
 
-    SectionAllocations section_allocations {};
+    if(load_segment_count == 0 || load_segment_count > maximum_load_segment_count) {
+        return false;
+    }
+
+    *result_program_headers = program_headers;
+    return true;
+}
+
+// Finds the file contents loaded at [address, address + size), or returns nullptr if they aren't all in one segment
+static const uint8_t *get_loaded_file_data(
+    const uint8_t *elf_binary,
+    ConstArray<ELFProgramHeader> program_headers,
+    size_t address,
+    size_t size
+) {
+    for(size_t i = 0; i < program_headers.length; i += 1) {
+        auto program_header = &program_headers[i];
+
+        if(
+            program_header->type == 1 && // PT_LOAD
+            address >= program_header->virtual_address &&
+            size <= program_header->in_file_size &&
+            address - program_header->virtual_address <= program_header->in_file_size - size
+        ) {
+            return &elf_binary[program_header->offset + (address - program_header->virtual_address)];
+        }
+    }
+
+    return nullptr;
+}
+
+struct ELFDynamicInfo {
+    ConstArray<ELFRelocationAddend> relocations; // DT_RELA
+    ConstArray<ELFRelocationAddend> procedure_linkage_table_relocations; // DT_JMPREL
+
+    ConstArray<ELFSymbol> symbols;
+    ConstArray<char> symbol_names;
+
+    size_t needed_library_count;
+    size_t needed_library_name_offsets[maximum_needed_library_count];
+};
+
+// Images without PT_DYNAMIC have no relocations, dynamic symbols or needed libraries. Dynamic symbols are found through
+// the section headers, as DT_SYMTAB doesn't give their count.
+static bool get_dynamic_info(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    ConstArray<ELFProgramHeader> program_headers,
+    ELFDynamicInfo *result_info
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
+    ELFDynamicInfo info {};
+
+    if(
+        elf_header->section_header_size == sizeof(ELFSectionHeader) &&
+        elf_header->section_header_offset <= elf_binary_size &&
+        elf_header->section_header_count <= (elf_binary_size - elf_header->section_header_offset) / sizeof(ELFSectionHeader)
+    ) {
+        ConstArray<ELFSectionHeader> section_headers {
+            (const ELFSectionHeader*)((size_t)elf_binary + elf_header->section_header_offset),
+            elf_header->section_header_count
+        };
 
-    {
         for(size_t i = 0; i < section_headers.length; i += 1) {
             auto section_header = &section_headers[i];
 
-            if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
-                auto page_count = divide_round_up(section_header->size, page_size);
+            if(section_header->type != 11) { // SHT_DYNSYM
+                continue;
+            }
 
-                PagePermissions permissions {};
+            if(section_header->link >= section_headers.length) {
+                return false;
+            }
 
-                if((section_header->flags & 0b1) != 0) { // SHF_WRITE
-                    permissions = (PagePermissions)(permissions | PagePermissions::Write);
-                }
+            auto symbol_names_section_header = &section_headers[section_header->link];
 
-                if((section_header->flags & 0b100) != 0) { // SHF_EXECINSTR
-                    permissions = (PagePermissions)(permissions | PagePermissions::Execute);
-                }
+            if(
+                section_header->in_file_offset > elf_binary_size ||
+                section_header->size > elf_binary_size - section_header->in_file_offset ||
+                symbol_names_section_header->in_file_offset > elf_binary_size ||
+                symbol_names_section_header->size > elf_binary_size - symbol_names_section_header->in_file_offset
+            ) {
+                return false;
+            }
 
-                size_t user_pages_start;
-                size_t kernel_pages_start;
-                if(!map_and_allocate_pages_in_process_and_kernel(
-                    page_count,
-                    permissions,
-                    process,
-                    bitmap,
-                    &user_pages_start,
-                    &kernel_pages_start
-                )) {
-                    destroy_process(process_iterator, bitmap);
-                    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+            info.symbols.data = (const ELFSymbol*)((size_t)elf_binary + section_header->in_file_offset);
+            info.symbols.length = section_header->size / sizeof(ELFSymbol);
 
-                    return CreateProcessFromELFResult::OutOfMemory;
-                }
+            info.symbol_names.data = (const char*)((size_t)elf_binary + symbol_names_section_header->in_file_offset);
+            info.symbol_names.length = symbol_names_section_header->size;
 
-                auto section_allocation = allocate_from_bucket_array(&section_allocations, bitmap, false);
-                if(section_allocation == nullptr) {
-                    destroy_process(process_iterator, bitmap);
-                    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+            break;
+        }
+    }
 
-                    return CreateProcessFromELFResult::OutOfMemory;
-                }
+    const ELFProgramHeader *dynamic_program_header = nullptr;
+    for(size_t i = 0; i < program_headers.length; i += 1) {
+        if(program_headers[i].type == 2) { // PT_DYNAMIC
+            dynamic_program_header = &program_headers[i];
+            break;
+        }
+    }
 
-                *section_allocation = {
-                    user_pages_start,
-                    kernel_pages_start,
-                    page_count
-                };
+    if(dynamic_program_header == nullptr) {
+        *result_info = info;
+        return true;
+    }
 
-                if((section_header->flags & 0b100) != 0) { // SHF_EXECINSTR
-                    auto debug_code_section = allocate_from_bucket_array(&process->debug_code_sections, bitmap, true);
-                    if(section_allocation == nullptr) {
-                        destroy_process(process_iterator, bitmap);
-                        unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+    if(
+        dynamic_program_header->offset > elf_binary_size ||
+        dynamic_program_header->in_file_size > elf_binary_size - dynamic_program_header->offset
+    ) {
+        return false;
+    }
 
-                        return CreateProcessFromELFResult::OutOfMemory;
-                    }
+    ConstArray<ELFDynamicEntry> dynamic_entries {
+        (const ELFDynamicEntry*)((size_t)elf_binary + dynamic_program_header->offset),
+        dynamic_program_header->in_file_size / sizeof(ELFDynamicEntry)
+    };
 
-                    debug_code_section->memory_start = user_pages_start * page_size;
-                    debug_code_section->size = page_count * page_size;
+    size_t relocations_address = 0;
+    size_t relocations_size = 0;
+    size_t procedure_linkage_table_relocations_address = 0;
+    size_t procedure_linkage_table_relocations_size = 0;
+    for(size_t i = 0; i < dynamic_entries.length; i += 1) {
+        auto entry = &dynamic_entries[i];
 
-                    for(size_t i = 0; i < DebugCodeSection::name_buffer_length; i += 1) {
-                        auto character = section_names[section_header->name_offset + i];
+        if(entry->tag == 0) { // DT_NULL
+            break;
+        }
 
-                        if(character == 0) {
-                            break;
-                        }
+        switch(entry->tag) {
+            case 1: { // DT_NEEDED
+                if(info.needed_library_count == maximum_needed_library_count) {
+                    return false;
+                }
 
-                        debug_code_section->name_buffer[i] = character;
+                info.needed_library_name_offsets[info.needed_library_count] = entry->value;
+                info.needed_library_count += 1;
+            } break;
 
-                        debug_code_section->name_length += 1;
-                    }
+            case 2: { // DT_PLTRELSZ
+                procedure_linkage_table_relocations_size = entry->value;
+            } break;
+
+            case 7: { // DT_RELA
+                relocations_address = entry->value;
+            } break;
+
+            case 8: { // DT_RELASZ
+                relocations_size = entry->value;
+            } break;
+
+            case 9: { // DT_RELAENT
+                if(entry->value != sizeof(ELFRelocationAddend)) {
+                    return false;
                 }
-            }
+            } break;
+
+            case 17: { // DT_REL
+                return false;
+            } break;
+
+            case 20: { // DT_PLTREL
+                if(entry->value != 7) { // DT_RELA
+                    return false;
+                }
+            } break;
+
+            case 23: { // DT_JMPREL
+                procedure_linkage_table_relocations_address = entry->value;
+            } break;
         }
     }
 
-    {
-        auto section_allocation_iterator = begin(section_allocations);
+    if(relocations_size != 0) {
+        auto data = get_loaded_file_data(elf_binary, program_headers, relocations_address, relocations_size);
+        if(data == nullptr) {
+            return false;
+        }
 
-        for(size_t i = 0; i < section_headers.length; i += 1) {
-            auto section_header = &section_headers[i];
+        info.relocations.data = (const ELFRelocationAddend*)data;
+        info.relocations.length = relocations_size / sizeof(ELFRelocationAddend);
+    }
 
-            if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
-                if(section_header->type != 8) { // SHT_NOBITS
-                    auto allocation = *section_allocation_iterator;
+    if(procedure_linkage_table_relocations_size != 0) {
+        auto data = get_loaded_file_data(
+            elf_binary,
+            program_headers,
+            procedure_linkage_table_relocations_address,
+            procedure_linkage_table_relocations_size
+        );
+        if(data == nullptr) {
+            return false;
+        }
 
-                    copy_memory(
-                        (void*)((size_t)elf_binary + section_header->in_file_offset),
-                        (void*)(allocation->kernel_pages_start * page_size),
-                        section_header->size
-                    );
-                }
+        info.procedure_linkage_table_relocations.data = (const ELFRelocationAddend*)data;
+        info.procedure_linkage_table_relocations.length = procedure_linkage_table_relocations_size / sizeof(ELFRelocationAddend);
+    }
 
-                ++section_allocation_iterator;
-            }
+    for(size_t i = 0; i < info.needed_library_count; i += 1) {
+        if(info.needed_library_name_offsets[i] >= info.symbol_names.length) {
+            return false;
         }
     }
 
-    // Global Offset Table is fixed-size for now, should expand dynamically at some point.
+    *result_info = info;
+    return true;
+}
 
-    const size_t global_offset_table_size = 4096;
-    const size_t global_offset_table_page_count = divide_round_up(global_offset_table_size, page_size);
+struct NeededLibrarySymbols {
+    ConstArray<ELFSymbol> symbols;
+    ConstArray<char> symbol_names;
 
-    size_t global_offset_table_user_pages_start;
-    size_t global_offset_table_kernel_pages_start;
-    if(!map_and_allocate_pages_in_process_and_kernel(
-        global_offset_table_page_count,
-        {},
-        process,
-        bitmap,
-        &global_offset_table_user_pages_start,
-        &global_offset_table_kernel_pages_start
-    )) {
-        destroy_process(process_iterator, bitmap);
-        unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+    // Only built once a symbol has to be looked up in the library
+    bool is_indexed;
+    SymbolIndex index;
+};
 
-        return CreateProcessFromELFResult::OutOfMemory;
+// Turns every dynamic relocation into a binding, looking up symbols the image doesn't define in its needed libraries
+// (in DT_NEEDED order). Slots have to be in writable segments.
+static PrelinkELFResult prelink_bindings(
+    ConstArray<ELFProgramHeader> program_headers,
+    const ELFDynamicInfo *dynamic_info,
+    Array<uint8_t> bitmap,
+    PrelinkedImage *image
+) {
+    NeededLibrarySymbols needed_library_symbols[maximum_needed_library_count] {};
+
+    for(size_t i = 0; i < image->needed_library_count; i += 1) {
+        auto library = &shared_libraries[image->needed_library_indices[i]];
+        auto library_binary_size = (size_t)library->binary_end - (size_t)library->binary;
+
+        ConstArray<ELFProgramHeader> library_program_headers;
+        ELFDynamicInfo library_dynamic_info;
+        if(
+            !get_program_headers(library->binary, library_binary_size, &library_program_headers) ||
+            !get_dynamic_info(library->binary, library_binary_size, library_program_headers, &library_dynamic_info) ||
+            library_dynamic_info.needed_library_count != 0 // Libraries can't need other libraries
+        ) {
+            return PrelinkELFResult::InvalidELF;
+        }
+
+        needed_library_symbols[i].symbols = library_dynamic_info.symbols;
+        needed_library_symbols[i].symbol_names = library_dynamic_info.symbol_names;
     }
 
-    auto global_offset_table_address = global_offset_table_user_pages_start * page_size;
+    auto relocation_count = dynamic_info->relocations.length + dynamic_info->procedure_linkage_table_relocations.length;
+    if(relocation_count == 0) {
+        return PrelinkELFResult::Success;
+    }
 
-    Array<size_t> global_offset_table {
-        (size_t*)(global_offset_table_kernel_pages_start * page_size),
-        global_offset_table_size / sizeof(size_t)
-    };
+    image->bindings = (PrelinkedBinding*)allocate(relocation_count * sizeof(PrelinkedBinding));
+    if(image->bindings == nullptr) {
+        return PrelinkELFResult::OutOfMemory;
+    }
 
-    size_t next_global_offset_table_index = 0;
-    for(size_t i = 0; i < section_headers.length; i += 1) {
-        auto section_header = &section_headers[i];
+    auto relocations = dynamic_info->relocations;
+    auto procedure_linkage_table_relocations = dynamic_info->procedure_linkage_table_relocations;
 
-        if(section_header->type == 4) { // SHT_RELA
-            auto slot_section_index = section_header->info;
+    auto symbols = dynamic_info->symbols;
+    auto symbol_names = dynamic_info->symbol_names;
+
+    auto result = PrelinkELFResult::Success;
 
-            auto slot_section_header = &section_headers[slot_section_index];
+    for(size_t i = 0; i < relocation_count; i += 1) {
+        const ELFRelocationAddend *relocation;
+        if(i < relocations.length) {
+            relocation = &relocations[i];
+        } else {
+            relocation = &procedure_linkage_table_relocations[i - relocations.length];
+        }
+
+        PrelinkedBinding binding {};
 
-            if((slot_section_header->flags & 0b10) == 0) { // !SHF_ALLOC
+        switch(relocation->type) {
+            case 0: { // R_X86_64_NONE
                 continue;
-            }
+            } break;
+
+            case 8: { // R_X86_64_RELATIVE
+                binding.image_index = 0;
+                binding.value = relocation->addend;
+            } break;
+
+            case 1: // R_X86_64_64
+            case 6: // R_X86_64_GLOB_DAT
+            case 7: { // R_X86_64_JUMP_SLOT
+                if(
+                    relocation->symbol == 0 ||
+                    relocation->symbol >= symbols.length ||
+                    symbols[relocation->symbol].name_index >= symbol_names.length
+                ) {
+                    result = PrelinkELFResult::InvalidELF;
+                    break;
+                }
 
-            auto slot_section_allocation = get_section_allocation(slot_section_index, section_headers, &section_allocations);
+                auto symbol = &symbols[relocation->symbol];
 
-            ConstArray<ELFRelocationAddend> relocations {
-                (const ELFRelocationAddend*)((size_t)elf_binary + section_header->in_file_offset),
-                section_header->size / sizeof(ELFRelocationAddend),
-            };
+                if(symbol->section_index != 0) { // SHN_UNDEF
+                    binding.image_index = symbol->section_index == 0xFFF1 ? prelinked_binding_absolute : 0; // SHN_ABS
+                    binding.value = symbol->value + relocation->addend;
 
-            auto slot_section_kernel_address = slot_section_allocation->kernel_pages_start * page_size;
-            auto slot_section_user_address = slot_section_allocation->user_pages_start * page_size;
+                    break;
+                }
 
-            for(size_t j = 0; j < relocations.length; j += 1) {
-                auto relocation = &relocations[j];
+                auto name = &symbol_names[symbol->name_index];
 
-                auto symbol = &symbols[relocation->symbol];
+                auto found = false;
+                for(size_t j = 0; j < image->needed_library_count; j += 1) {
+                    auto library_symbols = &needed_library_symbols[j];
+
+                    if(!library_symbols->is_indexed) {
+                        if(!create_symbol_index(
+                            library_symbols->symbols,
+                            library_symbols->symbol_names,
+                            bitmap,
+                            &library_symbols->index
+                        )) {
+                            result = PrelinkELFResult::OutOfMemory;
+                            break;
+                        }
+
+                        library_symbols->is_indexed = true;
+                    }
+
+                    auto library_symbol = find_symbol(
+                        &library_symbols->index,
+                        library_symbols->symbols,
+                        library_symbols->symbol_names,
+                        name
+                    );
+
+                    if(library_symbol != nullptr) {
+                        binding.image_index = library_symbol->section_index == 0xFFF1 ? prelinked_binding_absolute : (uint32_t)(j + 1); // SHN_ABS
+                        binding.value = library_symbol->value + relocation->addend;
 
-                auto symbol_user_address = symbol->value;
-                if(symbol->section_index != 0) {
-                    auto symbol_section_allocation = get_section_allocation(symbol->section_index, section_headers, &section_allocations);
+                        found = true;
+                        break;
+                    }
+                }
+
+                if(result != PrelinkELFResult::Success) {
+                    break;
+                }
+
+                if(!found) {
+                    // Undefined weak symbols are left null
+                    if(symbol->bind == 2) { // STB_WEAK
+                        binding.image_index = prelinked_binding_absolute;
+                        binding.value = 0;
+                    } else {
+                        result = PrelinkELFResult::InvalidELF;
+                    }
+                }
+            } break;
+
+            default: {
+                result = PrelinkELFResult::InvalidELF;
+            } break;
+        }
+
+        if(result != PrelinkELFResult::Success) {
+            break;
+        }
+
+        // Find which segment the slot is in, in PT_LOAD order
+        auto slot_found = false;
+        size_t load_segment_index = 0;
+        for(size_t j = 0; j < program_headers.length; j += 1) {
+            auto program_header = &program_headers[j];
+
+            if(program_header->type != 1) { // PT_LOAD
+                continue;
+            }
 
-                    symbol_user_address += symbol_section_allocation->user_pages_start * page_size;
+            if(
+                relocation->offset >= program_header->virtual_address &&
+                program_header->in_memory_size >= sizeof(uint64_t) &&
+                relocation->offset - program_header->virtual_address <= program_header->in_memory_size - sizeof(uint64_t)
+            ) {
+                if((program_header->flags & 0b10) != 0) { // PF_W
+                    binding.slot_load_segment_index = (uint32_t)load_segment_index;
+                    binding.slot_offset = program_header->virtual_address % page_size + (relocation->offset - program_header->virtual_address);
+
+                    slot_found = true;
                 }
 
-                auto slot_relative_address = relocation->offset;
+                break;
+            }
+
+            load_segment_index += 1;
+        }
+
+        if(!slot_found) {
+            result = PrelinkELFResult::InvalidELF;
+            break;
+        }
+
+        image->bindings[image->binding_count] = binding;
+        image->binding_count += 1;
+    }
+
+    for(size_t i = 0; i < image->needed_library_count; i += 1) {
+        if(needed_library_symbols[i].is_indexed) {
+            destroy_symbol_index(&needed_library_symbols[i].index, bitmap);
+        }
+    }
 
-                auto slot_kernel_address = slot_section_kernel_address + slot_relative_address;
-                auto slot_user_address = slot_section_user_address + slot_relative_address;
+    if(result != PrelinkELFResult::Success) {
+        deallocate(image->bindings);
 
-                switch(relocation->type) {
-                    case 0: break; // R_X86_64_NONE
+        image->bindings = nullptr;
+        image->binding_count = 0;
+    }
+
+    return result;
+}
 
-                    case 1: { // R_X86_64_64
-                        *(uint64_t*)slot_kernel_address = symbol_user_address + relocation->addend;
-                    } break;
+// Linked images are relocated by writing their bindings, which are worked out here once. Their read-only segments are
+// also copied out, once, for every launch to share.
+static PrelinkELFResult prelink_linked_elf(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    Array<uint8_t> bitmap,
+    PrelinkedImage *result_image
+) {
+    ConstArray<ELFProgramHeader> program_headers;
+    ELFDynamicInfo dynamic_info;
+    if(
+        !get_program_headers(elf_binary, elf_binary_size, &program_headers) ||
+        !get_dynamic_info(elf_binary, elf_binary_size, program_headers, &dynamic_info)
+    ) {
+        return PrelinkELFResult::InvalidELF;
+    }
+
+    PrelinkedImage image {};
+
+    image.needed_library_count = dynamic_info.needed_library_count;
+    for(size_t i = 0; i < dynamic_info.needed_library_count; i += 1) {
+        auto name = &dynamic_info.symbol_names[dynamic_info.needed_library_name_offsets[i]];
+
+        auto found = false;
+        for(size_t j = 0; j < shared_library_count; j += 1) {
+            if(c_string_equal(shared_libraries[j].name, name)) {
+                image.needed_library_indices[i] = (uint8_t)j;
+
+                found = true;
+                break;
+            }
+        }
+
+        if(!found) {
+            return PrelinkELFResult::InvalidELF;
+        }
+    }
+
+    auto result = prelink_bindings(program_headers, &dynamic_info, bitmap, &image);
+    if(result != PrelinkELFResult::Success) {
+        return result;
+    }
+
+    for(size_t i = 0; i < program_headers.length; i += 1) {
+        auto program_header = &program_headers[i];
+
+        if(program_header->type == 1 && (program_header->flags & 0b10) == 0) { // PT_LOAD, PF_W
+            image.shared_page_count += get_load_segment_page_count(program_header);
+        }
+    }
+
+    if(image.shared_page_count != 0) {
+        size_t shared_physical_memory_start;
+        auto shared_pages = (uint8_t*)map_and_allocate_consecutive_memory(
+            image.shared_page_count * page_size,
+            bitmap,
+            &shared_physical_memory_start
+        );
+        if(shared_pages == nullptr) {
+            deallocate_prelinked_image(&image);
+
+            return PrelinkELFResult::OutOfMemory;
+        }
+
+        fill_memory(shared_pages, image.shared_page_count * page_size, 0);
+
+        size_t page_offset = 0;
+        for(size_t i = 0; i < program_headers.length; i += 1) {
+            auto program_header = &program_headers[i];
+
+            if(program_header->type == 1 && (program_header->flags & 0b10) == 0) { // PT_LOAD, PF_W
+                copy_memory(
+                    (void*)((size_t)elf_binary + program_header->offset),
+                    &shared_pages[page_offset * page_size + program_header->virtual_address % page_size],
+                    program_header->in_file_size
+                );
+
+                page_offset += get_load_segment_page_count(program_header);
+            }
+        }
+
+        unmap_memory(shared_pages, image.shared_page_count * page_size);
+
+        image.shared_physical_pages_start = shared_physical_memory_start / page_size;
+    }
+
+    *result_image = image;
+    return PrelinkELFResult::Success;
+}
+
+// Looks the image up in the cache, prelinking (and caching) it if it isn't there. If *result_is_cached is false the
+// caller has to deallocate the image after use.
+static PrelinkELFResult find_or_prelink_elf(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    Array<uint8_t> bitmap,
+    PrelinkedImage *result_image,
+    bool *result_is_cached
+) {
+    auto is_cacheable = elf_binary_size <= maximum_prelinked_binary_size;
+
+    uint64_t hash = 0;
+    if(is_cacheable) {
+        hash = hash_elf_binary(elf_binary, elf_binary_size);
+    }
+
+    acquire_lock(&prelinked_images_lock);
+
+    if(is_cacheable) {
+        for(auto image : prelinked_images) {
+            if(
+                image->hash == hash &&
+                image->elf_binary_size == elf_binary_size &&
+                is_elf_binary_equal(image->elf_binary, elf_binary, elf_binary_size)
+            ) {
+                *result_image = *image;
+
+                prelinked_image_hit_count += 1;
+
+                prelinked_images_lock = false;
+
+                *result_is_cached = true;
+                return PrelinkELFResult::Success;
+            }
+        }
+    }
+
+    prelinked_image_miss_count += 1;
+
+    prelinked_images_lock = false;
+
+    PrelinkedImage image;
+    PrelinkELFResult result;
+    if(((const ELFHeader*)elf_binary)->type == 1) { // ET_REL
+        result = prelink_relocatable_elf(elf_binary, bitmap, &image);
+    } else {
+        result = prelink_linked_elf(elf_binary, elf_binary_size, bitmap, &image);
+    }
+
+    if(result != PrelinkELFResult::Success) {
+        return result;
+    }
+
+    image.hash = hash;
+    image.elf_binary_size = elf_binary_size;
+    image.elf_binary = nullptr;
+
+    *result_image = image;
+    *result_is_cached = false;
+
+    if(!is_cacheable) {
+        return PrelinkELFResult::Success;
+    }
+
+    // Copied before taking the lock, and thrown away if the image doesn't end up cached
+    auto elf_binary_copy = (uint8_t*)map_and_allocate_memory(elf_binary_size, bitmap);
+    if(elf_binary_copy == nullptr) {
+        return PrelinkELFResult::Success;
+    }
+
+    copy_memory(elf_binary, elf_binary_copy, elf_binary_size);
+
+    acquire_lock(&prelinked_images_lock);
+
+    // Another processor may have cached the same image in the meantime
+    auto is_already_cached = false;
+    for(auto other_image : prelinked_images) {
+        if(
+            other_image->hash == hash &&
+            other_image->elf_binary_size == elf_binary_size &&
+            is_elf_binary_equal(other_image->elf_binary, elf_binary_copy, elf_binary_size)
+        ) {
+            is_already_cached = true;
+            break;
+        }
+    }
+
+    if(!is_already_cached && prelinked_image_count != maximum_prelinked_image_count) {
+        auto cached_image = allocate_from_bucket_array(&prelinked_images, bitmap, true);
+        if(cached_image != nullptr) {
+            image.elf_binary = elf_binary_copy;
+
+            *cached_image = image;
+
+            prelinked_image_count += 1;
+
+            *result_image = image;
+            *result_is_cached = true;
+        }
+    }
+
+    prelinked_images_lock = false;
+
+    if(!*result_is_cached) {
+        unmap_and_deallocate_memory(elf_binary_copy, elf_binary_size, bitmap);
+    }
+
+    return PrelinkELFResult::Success;
+}
+
+static size_t get_prelinked_value(
+    const PrelinkedValue *value,
+    ConstArray<SectionAllocation> section_allocations,
+    size_t global_offset_table_address
+) {
+    switch(value->base) {
+        case PrelinkedBase::Section: {
+            return section_allocations[value->section_allocation_index].user_pages_start * page_size + value->constant;
+        } break;
+
+        case PrelinkedBase::GlobalOffsetTable: {
+            return global_offset_table_address + value->constant;
+        } break;
+
+        default: {
+            return value->constant;
+        } break;
+    }
+}
+
+// Returns false if the image doesn't fit the sections it's applied to
+static bool apply_prelinked_image(
+    const PrelinkedImage *image,
+    ConstArray<SectionAllocation> section_allocations,
+    Array<size_t> global_offset_table,
+    size_t global_offset_table_address
+) {
+    if(image->section_allocation_count != section_allocations.length) {
+        return false;
+    }
+
+    if(image->global_offset_table_entry_count > global_offset_table.length) {
+        return false;
+    }
+
+    for(size_t i = 0; i < image->global_offset_table_entry_count; i += 1) {
+        global_offset_table[i] = get_prelinked_value(
+            &image->global_offset_table_entries[i],
+            section_allocations,
+            global_offset_table_address
+        );
+    }
+
+    for(size_t i = 0; i < image->relocation_count; i += 1) {
+        auto relocation = &image->relocations[i];
+
+        auto slot_section_allocation = &section_allocations[relocation->slot_allocation_index];
+
+        if(relocation->slot_offset + relocation->size > slot_section_allocation->page_count * page_size) {
+            return false;
+        }
+
+        auto slot_kernel_address = slot_section_allocation->kernel_pages_start * page_size + relocation->slot_offset;
+        auto slot_user_address = slot_section_allocation->user_pages_start * page_size + relocation->slot_offset;
+
+        auto value = get_prelinked_value(&relocation->value, section_allocations, global_offset_table_address);
+
+        switch(relocation->subtracted_base) {
+            case PrelinkedBase::GlobalOffsetTable: {
+                value -= global_offset_table_address;
+            } break;
+
+            case PrelinkedBase::Slot: {
+                value -= slot_user_address;
+            } break;
+
+            default: break;
+        }
+
+        if(relocation->size == 8) {
+            *(uint64_t*)slot_kernel_address = value;
+        } else {
+            *(uint32_t*)slot_kernel_address = (uint32_t)value;
+        }
+    }
+
+    return true;
+}
+
+// Sections are each copied into their own allocation, then relocated. Only frees its own temporaries on failure.
+static CreateProcessFromELFResult load_relocatable_elf(
+    const uint8_t *elf_binary,
+    const PrelinkedImage *prelinked_image,
+    Process *process,
+    Array<uint8_t> bitmap,
+    void **result_entry_point
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
+    ConstArray<ELFSectionHeader> section_headers {
+        (const ELFSectionHeader*)((size_t)elf_binary + elf_header->section_header_offset),
+        elf_header->section_header_count
+    };
+
+    ConstArray<char> section_names {
+        (const char*)((size_t)elf_binary + section_headers[elf_header->section_names_entry_index].in_file_offset),
+        section_headers[elf_header->section_names_entry_index].size
+    };
+
+    SectionAllocations section_allocations {};
+
+    {
+        for(size_t i = 0; i < section_headers.length; i += 1) {
+            auto section_header = &section_headers[i];
+
+            if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
+                auto page_count = divide_round_up(section_header->size, page_size);
+
+                PagePermissions permissions {};
+
+                if((section_header->flags & 0b1) != 0) { // SHF_WRITE
+                    permissions = (PagePermissions)(permissions | PagePermissions::Write);
+                }
+
+                if((section_header->flags & 0b100) != 0) { // SHF_EXECINSTR
+                    permissions = (PagePermissions)(permissions | PagePermissions::Execute);
+                }
+
+                size_t user_pages_start;
+                size_t kernel_pages_start;
+                if(!map_and_allocate_pages_in_process_and_kernel(
+                    page_count,
+                    permissions,
+                    process,
+                    bitmap,
+                    &user_pages_start,
+                    &kernel_pages_start
+                )) {
+                    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+
+                    return CreateProcessFromELFResult::OutOfMemory;
+                }
+
+                auto section_allocation = allocate_from_bucket_array(&section_allocations, bitmap, false);
+                if(section_allocation == nullptr) {
+                    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+
+                    return CreateProcessFromELFResult::OutOfMemory;
+                }
+
+                *section_allocation = {
+                    user_pages_start,
+                    kernel_pages_start,
+                    page_count
+                };
+
+                if((section_header->flags & 0b100) != 0) { // SHF_EXECINSTR
+                    auto debug_code_section = allocate_from_bucket_array(&process->debug_code_sections, bitmap, true);
+                    if(section_allocation == nullptr) {
+                        unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+
+                        return CreateProcessFromELFResult::OutOfMemory;
+                    }
+
+                    debug_code_section->memory_start = user_pages_start * page_size;
+                    debug_code_section->size = page_count * page_size;
+
+                    for(size_t i = 0; i < DebugCodeSection::name_buffer_length; i += 1) {
+                        auto character = section_names[section_header->name_offset + i];
+
+                        if(character == 0) {
+                            break;
+                        }
+
+                        debug_code_section->name_buffer[i] = character;
+
+                        debug_code_section->name_length += 1;
+                    }
+                }
+            }
+        }
+    }
+
+    {
+        auto section_allocation_iterator = begin(section_allocations);
+
+        for(size_t i = 0; i < section_headers.length; i += 1) {
+            auto section_header = &section_headers[i];
+
+            if((section_header->flags & 0b10) != 0) { // SHF_ALLOC
+                if(section_header->type != 8) { // SHT_NOBITS
+                    auto allocation = *section_allocation_iterator;
+
+                    copy_memory(
+                        (void*)((size_t)elf_binary + section_header->in_file_offset),
+                        (void*)(allocation->kernel_pages_start * page_size),
+                        section_header->size
+                    );
+                }
+
+                ++section_allocation_iterator;
+            }
+        }
+    }
+
+    auto result = CreateProcessFromELFResult::Success;
+
+    { // Allocate the Global Offset Table and apply the relocations, with the section allocations flattened so they can be indexed
+        // GOT-relative relocations need the table to have an address even if it has no entries
+        auto global_offset_table_size = prelinked_image->global_offset_table_entry_count * sizeof(size_t);
+        if(global_offset_table_size == 0) {
+            global_offset_table_size = sizeof(size_t);
+        }
+
+        auto global_offset_table_page_count = divide_round_up(global_offset_table_size, page_size);
+
+        size_t global_offset_table_user_pages_start;
+        size_t global_offset_table_kernel_pages_start;
+        if(!map_and_allocate_pages_in_process_and_kernel(
+            global_offset_table_page_count,
+            {},
+            process,
+            bitmap,
+            &global_offset_table_user_pages_start,
+            &global_offset_table_kernel_pages_start
+        )) {
+            result = CreateProcessFromELFResult::OutOfMemory;
+        } else {
+            auto global_offset_table_address = global_offset_table_user_pages_start * page_size;
+
+            Array<size_t> global_offset_table {
+                (size_t*)(global_offset_table_kernel_pages_start * page_size),
+                prelinked_image->global_offset_table_entry_count
+            };
+
+            size_t section_allocation_count = 0;
+            for(size_t i = 0; i < section_headers.length; i += 1) {
+                if((section_headers[i].flags & 0b10) != 0) { // SHF_ALLOC
+                    section_allocation_count += 1;
+                }
+            }
+
+            Array<SectionAllocation> flat_section_allocations {
+                (SectionAllocation*)map_and_allocate_memory(section_allocation_count * sizeof(SectionAllocation), bitmap),
+                section_allocation_count
+            };
+
+            if(flat_section_allocations.data == nullptr) {
+                result = CreateProcessFromELFResult::OutOfMemory;
+            } else {
+                size_t index = 0;
+                for(auto allocation : section_allocations) {
+                    flat_section_allocations[index] = *allocation;
+                    index += 1;
+                }
+
+                ConstArray<SectionAllocation> const_flat_section_allocations {
+                    flat_section_allocations.data,
+                    flat_section_allocations.length
+                };
+
+                if(!apply_prelinked_image(
+                    prelinked_image,
+                    const_flat_section_allocations,
+                    global_offset_table,
+                    global_offset_table_address
+                )) {
+                    result = CreateProcessFromELFResult::InvalidELF;
+                }
+
+                *result_entry_point = (void*)get_prelinked_value(
+                    &prelinked_image->entry_point,
+                    const_flat_section_allocations,
+                    global_offset_table_address
+                );
+
+                unmap_and_deallocate_memory(flat_section_allocations.data, section_allocation_count * sizeof(SectionAllocation), bitmap);
+            }
+
+            unmap_pages(global_offset_table_kernel_pages_start, global_offset_table_page_count);
+        }
+    }
+
+    for(auto allocation : section_allocations) {
+        unmap_pages(allocation->kernel_pages_start, allocation->page_count);
+    }
+
+    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+
+    return result;
+}
+
+struct LoadedSegment {
+    const ELFProgramHeader *program_header;
+
+    size_t user_pages_start;
+    size_t page_count;
+
+    // Writable segments are allocated per process, and stay mapped in the kernel until loading is done
+    bool is_writable;
+    size_t kernel_pages_start;
+};
+
+struct LoadedImage {
+    size_t load_bias;
+
+    size_t segment_count;
+    LoadedSegment segments[maximum_load_segment_count];
+};
+
+static void unmap_loaded_image_from_kernel(const LoadedImage *image) {
+    for(size_t i = 0; i < image->segment_count; i += 1) {
+        if(image->segments[i].is_writable) {
+            unmap_pages(image->segments[i].kernel_pages_start, image->segments[i].page_count);
+        }
+    }
+}
+
+// Read-only segments are mapped straight from the image's shared pages, and only writable ones (data & .bss) are
+// allocated. ET_EXEC images load at their linked addresses, which must be at or above minimum_user_pages_start, and
+// ET_DYN ones wherever they fit. On success the writable segments are left mapped in the kernel for the bindings to be
+// written, see unmap_loaded_image_from_kernel. Only frees its own temporaries on failure.
+static CreateProcessFromELFResult map_linked_elf(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    const PrelinkedImage *prelinked_image,
+    bool is_prelinked_image_cached,
+    size_t minimum_user_pages_start,
+    const char *name,
+    Process *process,
+    Array<uint8_t> bitmap,
+    LoadedImage *result_image
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
+    ConstArray<ELFProgramHeader> program_headers;
+    auto result = CreateProcessFromELFResult::Success;
+    if(!get_program_headers(elf_binary, elf_binary_size, &program_headers)) {
+        result = CreateProcessFromELFResult::InvalidELF;
+    }
+
+    // Load bias in pages, wrapping around for images linked above where they're loaded
+    size_t load_bias_pages = 0;
+
+    if(result == CreateProcessFromELFResult::Success) {
+        auto image_pages_start = SIZE_MAX;
+        size_t image_pages_end = 0;
+        for(size_t i = 0; i < program_headers.length; i += 1) {
+            auto program_header = &program_headers[i];
+
+            if(program_header->type == 1) { // PT_LOAD
+                auto pages_start = program_header->virtual_address / page_size;
+
+                if(pages_start < image_pages_start) {
+                    image_pages_start = pages_start;
+                }
+
+                image_pages_end = pages_start + get_load_segment_page_count(program_header);
+            }
+        }
+
+        if(elf_header->type == 2) { // ET_EXEC
+            if(image_pages_start < minimum_user_pages_start) {
+                result = CreateProcessFromELFResult::InvalidELF;
+            }
+        } else {
+            size_t free_pages_start;
+            if(!find_free_user_pages(
+                image_pages_end - image_pages_start,
+                process->pml4_table_physical_address,
+                bitmap,
+                &free_pages_start
+            )) {
+                result = CreateProcessFromELFResult::OutOfMemory;
+            } else {
+                load_bias_pages = free_pages_start - image_pages_start;
+            }
+        }
+    }
+
+    LoadedImage image {};
+    image.load_bias = load_bias_pages * page_size;
+
+    // How many of the shared pages have been mapped, and so passed on to the process if it owns them
+    size_t mapped_shared_page_count = 0;
+
+    for(size_t i = 0; i < program_headers.length && result == CreateProcessFromELFResult::Success; i += 1) {
+        auto program_header = &program_headers[i];
+
+        if(program_header->type != 1) { // PT_LOAD
+            continue;
+        }
+
+        LoadedSegment segment {};
+        segment.program_header = program_header;
+        segment.user_pages_start = load_bias_pages + program_header->virtual_address / page_size;
+        segment.page_count = get_load_segment_page_count(program_header);
+        segment.is_writable = (program_header->flags & 0b10) != 0; // PF_W
+
+        PagePermissions permissions {};
+
+        if(segment.is_writable) {
+            permissions = (PagePermissions)(permissions | PagePermissions::Write);
+        }
+
+        if((program_header->flags & 0b1) != 0) { // PF_X
+            permissions = (PagePermissions)(permissions | PagePermissions::Execute);
+        }
+
+        if(segment.is_writable) {
+            if(!map_and_allocate_pages(segment.page_count, bitmap, &segment.kernel_pages_start)) {
+                result = CreateProcessFromELFResult::OutOfMemory;
+                break;
+            }
+
+            if(!map_pages_from_kernel_at(
+                segment.kernel_pages_start,
+                segment.page_count,
+                permissions,
+                process->pml4_table_physical_address,
+                bitmap,
+                segment.user_pages_start
+            )) {
+                unmap_and_deallocate_pages(segment.kernel_pages_start, segment.page_count, bitmap);
+
+                result = CreateProcessFromELFResult::OutOfMemory;
+                break;
+            }
+
+            register_process_mapping(process, segment.user_pages_start, segment.page_count, false, true, bitmap);
+
+            auto segment_memory = (uint8_t*)(segment.kernel_pages_start * page_size);
+
+            fill_memory(segment_memory, segment.page_count * page_size, 0);
+
+            copy_memory(
+                (void*)((size_t)elf_binary + program_header->offset),
+                &segment_memory[program_header->virtual_address % page_size],
+                program_header->in_file_size
+            );
+        } else {
+            if(!map_pages_at(
+                prelinked_image->shared_physical_pages_start + mapped_shared_page_count,
+                segment.page_count,
+                permissions,
+                process->pml4_table_physical_address,
+                bitmap,
+                segment.user_pages_start
+            )) {
+                result = CreateProcessFromELFResult::OutOfMemory;
+                break;
+            }
+
+            register_process_mapping(
+                process,
+                segment.user_pages_start,
+                segment.page_count,
+                false,
+                !is_prelinked_image_cached,
+                bitmap
+            );
+
+            mapped_shared_page_count += segment.page_count;
+        }
+
+        image.segments[image.segment_count] = segment;
+        image.segment_count += 1;
+
+        if((program_header->flags & 0b1) != 0) { // PF_X
+            auto debug_code_section = allocate_from_bucket_array(&process->debug_code_sections, bitmap, true);
+            if(debug_code_section == nullptr) {
+                result = CreateProcessFromELFResult::OutOfMemory;
+                break;
+            }
+
+            debug_code_section->memory_start = segment.user_pages_start * page_size;
+            debug_code_section->size = segment.page_count * page_size;
+
+            for(size_t i = 0; i < DebugCodeSection::name_buffer_length; i += 1) {
+                if(name[i] == 0) {
+                    break;
+                }
+
+                debug_code_section->name_buffer[i] = name[i];
+
+                debug_code_section->name_length += 1;
+            }
+        }
+    }
+
+    if(result != CreateProcessFromELFResult::Success) {
+        unmap_loaded_image_from_kernel(&image);
+
+        // Shared pages that never made it into one of the process's mappings would otherwise be leaked
+        if(!is_prelinked_image_cached && mapped_shared_page_count != prelinked_image->shared_page_count) {
+            deallocate_bitmap_range(
+                bitmap,
+                prelinked_image->shared_physical_pages_start + mapped_shared_page_count,
+                prelinked_image->shared_page_count - mapped_shared_page_count
+            );
+        }
+
+        return result;
+    }
+
+    *result_image = image;
+    return CreateProcessFromELFResult::Success;
+}
+
+// images[0] is the image the bindings are for, and the rest its needed libraries in order
+static void apply_prelinked_bindings(const PrelinkedImage *prelinked_image, ConstArray<LoadedImage> images) {
+    for(size_t i = 0; i < prelinked_image->binding_count; i += 1) {
+        auto binding = &prelinked_image->bindings[i];
+
+        auto value = binding->value;
+        if(binding->image_index != prelinked_binding_absolute) {
+            value += images[binding->image_index].load_bias;
+        }
+
+        auto segment = &images[0].segments[binding->slot_load_segment_index];
+
+        *(unaligned_uint64_t*)(segment->kernel_pages_start * page_size + binding->slot_offset) = value;
+    }
+}
+
+// Libraries never change, so once one's image is cached it's remembered here to save hashing the library every launch
+static PrelinkedImage shared_library_images[shared_library_count];
+static volatile bool is_shared_library_image_cached[shared_library_count];
+
+static PrelinkELFResult find_or_prelink_shared_library(
+    size_t library_index,
+    Array<uint8_t> bitmap,
+    PrelinkedImage *result_image,
+    bool *result_is_cached
+) {
+    if(__atomic_load_n(&is_shared_library_image_cached[library_index], __ATOMIC_ACQUIRE)) {
+        *result_image = shared_library_images[library_index];
+
+        *result_is_cached = true;
+        return PrelinkELFResult::Success;
+    }
+
+    auto library = &shared_libraries[library_index];
+
+    auto result = find_or_prelink_elf(
+        library->binary,
+        (size_t)library->binary_end - (size_t)library->binary,
+        bitmap,
+        result_image,
+        result_is_cached
+    );
+
+    if(result == PrelinkELFResult::Success && *result_is_cached) {
+        acquire_lock(&prelinked_images_lock);
+
+        if(!is_shared_library_image_cached[library_index]) {
+            shared_library_images[library_index] = *result_image;
+
+            __atomic_store_n(&is_shared_library_image_cached[library_index], true, __ATOMIC_RELEASE);
+        }
+
+        prelinked_images_lock = false;
+    }
+
+    return result;
+}
+
+// Maps the image and its needed libraries, then writes all of their bindings. Only frees its own temporaries on failure.
+static CreateProcessFromELFResult load_linked_elf(
+    const uint8_t *elf_binary,
+    size_t elf_binary_size,
+    const PrelinkedImage *prelinked_image,
+    bool is_prelinked_image_cached,
+    size_t minimum_user_pages_start,
+    Process *process,
+    Array<uint8_t> bitmap,
+    void **result_entry_point
+) {
+    auto elf_header = (const ELFHeader*)elf_binary;
+
+    LoadedImage images[1 + maximum_needed_library_count];
+    size_t image_count = 0;
+
+    auto result = map_linked_elf(
+        elf_binary,
+        elf_binary_size,
+        prelinked_image,
+        is_prelinked_image_cached,
+        minimum_user_pages_start,
+        "executable",
+        process,
+        bitmap,
+        &images[0]
+    );
+
+    if(result == CreateProcessFromELFResult::Success) {
+        image_count = 1;
+    }
+
+    for(size_t i = 0; i < prelinked_image->needed_library_count && result == CreateProcessFromELFResult::Success; i += 1) {
+        auto library_index = prelinked_image->needed_library_indices[i];
+
+        PrelinkedImage library_image;
+        bool is_library_image_cached;
+        switch(find_or_prelink_shared_library(library_index, bitmap, &library_image, &is_library_image_cached)) {
+            case PrelinkELFResult::Success: break;
+
+            case PrelinkELFResult::OutOfMemory: {
+                result = CreateProcessFromELFResult::OutOfMemory;
+            } break;
+
+            case PrelinkELFResult::InvalidELF: {
+                result = CreateProcessFromELFResult::InvalidELF;
+            } break;
+        }
+
+        if(result != CreateProcessFromELFResult::Success) {
+            break;
+        }
+
+        auto library = &shared_libraries[library_index];
+
+        result = map_linked_elf(
+            library->binary,
+            (size_t)library->binary_end - (size_t)library->binary,
+            &library_image,
+            is_library_image_cached,
+            minimum_user_pages_start,
+            library->name,
+            process,
+            bitmap,
+            &images[image_count]
+        );
+
+        if(result == CreateProcessFromELFResult::Success) {
+            // Libraries don't need other libraries, so their bindings only refer to themselves
+            apply_prelinked_bindings(&library_image, ConstArray<LoadedImage> { &images[image_count], 1 });
+
+            image_count += 1;
+        }
+
+        if(!is_library_image_cached) {
+            deallocate_prelinked_image(&library_image);
+        }
+    }
+
+    if(result == CreateProcessFromELFResult::Success) {
+        apply_prelinked_bindings(prelinked_image, ConstArray<LoadedImage> { images, image_count });
+
+        auto is_entry_point_executable = false;
+        for(size_t i = 0; i < images[0].segment_count; i += 1) {
+            auto program_header = images[0].segments[i].program_header;
+
+            if(
+                (program_header->flags & 0b1) != 0 && // PF_X
+                elf_header->entry_point >= program_header->virtual_address &&
+                elf_header->entry_point - program_header->virtual_address < program_header->in_memory_size
+            ) {
+                is_entry_point_executable = true;
+                break;
+            }
+        }
+
+        if(is_entry_point_executable) {
+            *result_entry_point = (void*)(images[0].load_bias + elf_header->entry_point);
+        } else {
+            result = CreateProcessFromELFResult::InvalidELF;
+        }
+    }
+
+    for(size_t i = 0; i < image_count; i += 1) {
+        unmap_loaded_image_from_kernel(&images[i]);
+    }
+
+    return result;
+}
+
+// Allocates the process's PML4 table, and maps the kernel and the processor areas into it
+static bool create_process_page_tables(
+    Process *process,
+    size_t processor_area_count,
+    size_t processor_areas_physical_memory_start,
+    Array<uint8_t> bitmap
+) {
+    size_t bitmap_index = 0;
+    size_t bitmap_sub_bit_index = 0;
+
+    size_t pml4_physical_page_index;
+    if(!allocate_next_physical_page(
+        &bitmap_index,
+        &bitmap_sub_bit_index,
+        bitmap,
+        &pml4_physical_page_index
+    )) {
+        return false;
+    }
+
+    process->pml4_table_physical_address = pml4_physical_page_index * page_size;
+
+    { // Initalize process page tables with kernel pages
+        auto pml4_table = (PageTableEntry*)map_memory(
+            process->pml4_table_physical_address,
+            sizeof(PageTableEntry[page_table_length]),
+            bitmap
+        );
+        if(pml4_table == nullptr) {
+            return false;
+        }
+
+        fill_memory(pml4_table, sizeof(PageTableEntry[page_table_length]), 0);
+
+        PageWalker walker {};
+        walker.absolute_page_index = kernel_pages_start;
+        walker.pml4_table = pml4_table;
+
+        for(size_t absolute_page_index = kernel_pages_start; absolute_page_index < kernel_pages_end; absolute_page_index += 1) {
+            if(!increment_page_walker(&walker, bitmap)) {
+                unmap_page_walker(&walker);
+
+                return false;
+            }
+
+            auto page = &walker.page_table[walker.page_index];
+
+            page->present = true;
+            page->write_allowed = true;
+            page->user_mode_allowed = false;
+            page->page_address = absolute_page_index;
+        }
+
+        unmap_page_walker(&walker);
+    }
+
+    auto processor_areas_page_count = divide_round_up(processor_area_count * sizeof(ProcessorArea), page_size);
+    auto processor_areas_physical_pages_start = processor_areas_physical_memory_start / page_size;
+
+    { // Map pages for processor area
+        PageWalker walker;
+        if(!create_page_walker(process->pml4_table_physical_address, user_processor_areas_pages_start, bitmap, &walker)) {
+            printf("Error: Out of memory\n");
+
+            halt();
+        }
+
+        for(size_t relative_page_index = 0; relative_page_index < processor_areas_page_count; relative_page_index += 1) {
+            if(!increment_page_walker(&walker, bitmap)) {
+                printf("Error: Out of memory\n");
+
+                halt();
+            }
+
+            auto page = &walker.page_table[walker.page_index];
+
+            page->present = true;
+            page->write_allowed = true;
+            page->user_mode_allowed = false;
+            page->page_address = processor_areas_physical_pages_start + relative_page_index;
+        }
+
+        unmap_page_walker(&walker);
+    }
+
+    return true;
+}
+
+CreateProcessFromELFResult create_process_from_elf(
+    uint8_t *elf_binary,
+    size_t elf_binary_size,
+    void *data,
+    size_t data_size,
+    Process *data_source_process,
+    size_t stack_size,
+    size_t stack_reserve,
+    Array<uint8_t> bitmap,
+    size_t processor_area_count,
+    size_t processor_areas_physical_memory_start,
+    size_t kernel_info_physical_memory_start,
+    Processes *processes,
+    Process **result_processs,
+    Processes::Iterator *result_process_iterator,
+    ProcessThread **result_thread
+) {
+    // Currently assumes correct and specific elf header & content, full validation is not done.
+
+    auto elf_header = (ELFHeader*)elf_binary;
+
+    if(elf_header->type != 1 && elf_header->type != 2 && elf_header->type != 3) { // ET_REL, ET_EXEC, ET_DYN
+        return CreateProcessFromELFResult::InvalidELF;
+    }
 
-                    case 2: { // R_X86_64_PC32
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(symbol_user_address + relocation->addend - slot_user_address);
-                    } break;
+    Processes::Iterator process_iterator;
+    auto process = allocate_from_bucket_array(processes, bitmap, true, &process_iterator);
+    if(process == nullptr) {
+        return CreateProcessFromELFResult::OutOfMemory;
+    }
 
-                    case 3: { // R_X86_64_GOT32
-                        auto index = next_global_offset_table_index;
-                        next_global_offset_table_index += 1;
+    if(!register_process_id(process, process_iterator)) {
+        remove_item_from_bucket_array(process_iterator);
 
-                        if(index == global_offset_table.length) {
-                            destroy_process(process_iterator, bitmap);
-                            unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+        return CreateProcessFromELFResult::OutOfMemory;
+    }
 
-                            return CreateProcessFromELFResult::OutOfMemory;
-                        }
+    if(!create_process_page_tables(process, processor_area_count, processor_areas_physical_memory_start, bitmap)) {
+        unregister_process_id(process);
 
-                        global_offset_table[index] = symbol_user_address;
+        remove_item_from_bucket_array(process_iterator);
 
-                        auto offset = index * sizeof(size_t);
+        return CreateProcessFromELFResult::OutOfMemory;
+    }
 
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(offset + relocation->addend);
-                    } break;
+    auto processor_areas_page_count = divide_round_up(processor_area_count * sizeof(ProcessorArea), page_size);
 
-                    case 4: { // R_X86_64_PLT32
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(symbol_user_address + relocation->addend - slot_user_address);
-                    } break;
+    PrelinkedImage prelinked_image;
+    bool is_prelinked_image_cached;
+    switch(find_or_prelink_elf(
+        elf_binary,
+        elf_binary_size,
+        bitmap,
+        &prelinked_image,
+        &is_prelinked_image_cached
+    )) {
+        case PrelinkELFResult::Success: break;
 
-                    case 9: // R_X86_64_GOTPCREL
-                    case 41: // R_X86_64_GOTPCRELX
-                    case 42: { // R_X86_64_REX_GOTPCRELX
-                        auto index = next_global_offset_table_index;
-                        next_global_offset_table_index += 1;
+        case PrelinkELFResult::OutOfMemory: {
+            destroy_process(process_iterator, bitmap);
 
-                        if(index == global_offset_table.length) {
-                            destroy_process(process_iterator, bitmap);
-                            unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+            return CreateProcessFromELFResult::OutOfMemory;
+        } break;
 
-                            return CreateProcessFromELFResult::OutOfMemory;
-                        }
+        case PrelinkELFResult::InvalidELF: {
+            destroy_process(process_iterator, bitmap);
 
-                        global_offset_table[index] = symbol_user_address;
+            return CreateProcessFromELFResult::InvalidELF;
+        } break;
+    }
 
-                        auto offset = index * sizeof(size_t);
+    void *entry_point;
+    CreateProcessFromELFResult result;
+    if(elf_header->type == 1) { // ET_REL
+        result = load_relocatable_elf(elf_binary, &prelinked_image, process, bitmap, &entry_point);
+    } else {
+        result = load_linked_elf(
+            elf_binary,
+            elf_binary_size,
+            &prelinked_image,
+            is_prelinked_image_cached,
+            user_processor_areas_pages_start + processor_areas_page_count,
+            process,
+            bitmap,
+            &entry_point
+        );
+    }
 
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(
-                            offset +
-                            global_offset_table_address +
-                            relocation->addend -
-                            slot_user_address
-                        );
-                    } break;
+    if(!is_prelinked_image_cached) {
+        deallocate_prelinked_image(&prelinked_image);
+    }
 
-                    case 10: { // R_X86_64_32
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(symbol_user_address + relocation->addend);
-                    } break;
+    if(result != CreateProcessFromELFResult::Success) {
+        destroy_process(process_iterator, bitmap);
 
-                    case 24: { // R_X86_64_PC64
-                        *(uint64_t*)slot_kernel_address = symbol_user_address + relocation->addend - slot_user_address;
-                    } break;
+        return result;
+    }
 
-                    case 25: { // R_X86_64_GOTOFF64
-                        *(uint64_t*)slot_kernel_address = symbol_user_address + relocation->addend - global_offset_table_address;
-                    } break;
+    // Read-only for the process, and not registered as a mapping so the process can't unmap it. Mapped after the image
+    // so it can't take any of an ET_EXEC image's fixed addresses.
+    size_t kernel_info_user_pages_start;
+    if(!map_pages(
+        kernel_info_physical_memory_start / page_size,
+        1,
+        PagePermissions {},
+        process->pml4_table_physical_address,
+        bitmap,
+        &kernel_info_user_pages_start
+    )) {
+        destroy_process(process_iterator, bitmap);
 
-                    case 27: { // R_X86_64_GOT64
-                        auto index = next_global_offset_table_index;
-                        next_global_offset_table_index += 1;
+        return CreateProcessFromELFResult::OutOfMemory;
+    }
 
-                        if(index == global_offset_table.length) {
-                            destroy_process(process_iterator, bitmap);
-                            unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+    process->kernel_info_user_pages_start = kernel_info_user_pages_start;
 
-                            return CreateProcessFromELFResult::OutOfMemory;
-                        }
+    if(stack_size == 0) {
+        stack_size = default_process_stack_size;
+    }
 
-                        global_offset_table[index] = symbol_user_address;
+    if(stack_reserve == 0) {
+        stack_reserve = default_process_stack_reserve;
+    }
 
-                        auto offset = index * sizeof(size_t);
+    if(stack_reserve < stack_size) {
+        stack_reserve = stack_size;
+    }
 
-                        *(uint64_t*)slot_kernel_address = offset + relocation->addend;
-                    } break;
+    if(stack_reserve > maximum_process_stack_reserve) {
+        destroy_process(process_iterator, bitmap);
 
-                    case 26: { // R_X86_64_GOTPC32
-                        *(uint32_t*)slot_kernel_address = (uint32_t)(global_offset_table_address + relocation->addend - slot_user_address);
-                    } break;
+        return CreateProcessFromELFResult::OutOfMemory;
+    }
 
-                    case 29: { // R_X86_64_GOTPC64
-                        *(uint64_t*)slot_kernel_address = global_offset_table_address + relocation->addend - slot_user_address;
-                    } break;
+    { // Reserve the stack with a guard page below it, and commit the requested size
+        auto stack_reserve_page_count = divide_round_up(stack_reserve, page_size);
 
-                    default: {
-                        destroy_process(process_iterator, bitmap);
-                        unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+        size_t guard_page;
+        if(!reserve_free_user_pages(
+            stack_reserve_page_count + 1,
+            process->pml4_table_physical_address,
+            bitmap,
+            &guard_page
+        )) {
+            destroy_process(process_iterator, bitmap);
 
-                        return CreateProcessFromELFResult::InvalidELF;
-                    } break;
-                }
-            }
+            return CreateProcessFromELFResult::OutOfMemory;
         }
-    }
-
-    unmap_pages(global_offset_table_kernel_pages_start, global_offset_table_page_count);
 
-    for(auto allocation : section_allocations) {
-        unmap_pages(allocation->kernel_pages_start, allocation->page_count);
-    }
+        process->stack_reserve_pages_start = guard_page + 1;
+        process->stack_pages_end = process->stack_reserve_pages_start + stack_reserve_page_count;
+        process->stack_committed_pages_start = process->stack_pages_end;
 
-    const size_t stack_size = 1024 * 16;
-    const size_t stack_page_count = divide_round_up(stack_size, page_size);
+        auto stack_page_count = divide_round_up(stack_size, page_size);
 
-    size_t stack_user_pages_start;
-    size_t stack_kernel_pages_start;
-    if(!map_and_allocate_pages_in_process_and_kernel(
-        stack_page_count,
-        PagePermissions::Write,
-        process,
-        bitmap,
-        &stack_user_pages_start,
-        &stack_kernel_pages_start
-    )) {
-        destroy_process(process_iterator, bitmap);
-        unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
+        if(!grow_process_stack(process, (process->stack_pages_end - stack_page_count) * page_size, bitmap)) {
+            destroy_process(process_iterator, bitmap);
 
-        return CreateProcessFromELFResult::OutOfMemory;
+            return CreateProcessFromELFResult::OutOfMemory;
+        }
     }
 
-    unmap_pages(stack_kernel_pages_start, stack_page_count);
-
-    auto stack_top = (void*)(stack_user_pages_start * page_size + stack_size);
+    auto stack_top = (void*)(process->stack_pages_end * page_size);
 
     auto data_page_count = divide_round_up(data_size, page_size);
 
@@ -646,6 +2455,30 @@ CreateProcessFromELFResult create_process_from_elf(
     size_t data_kernel_pages_start;
     if(data_size == 0 || data == nullptr) {
         data_user_pages_start = 0;
+    } else if(data_source_process != nullptr) {
+        if((size_t)data % page_size != 0) {
+            destroy_process(process_iterator, bitmap);
+
+            return CreateProcessFromELFResult::InvalidMemoryRange;
+        }
+
+        auto result = move_process_mapping(
+            data_source_process,
+            (size_t)data / page_size,
+            data_page_count,
+            process,
+            bitmap,
+            &data_user_pages_start
+        );
+        if(result != MoveProcessMappingResult::Success) {
+            destroy_process(process_iterator, bitmap);
+
+            if(result == MoveProcessMappingResult::OutOfMemory) {
+                return CreateProcessFromELFResult::OutOfMemory;
+            } else {
+                return CreateProcessFromELFResult::InvalidMemoryRange;
+            }
+        }
     } else {
         if(!map_and_allocate_pages_in_process_and_kernel(
             data_page_count,
@@ -656,7 +2489,6 @@ CreateProcessFromELFResult create_process_from_elf(
             &data_kernel_pages_start
         )) {
             destroy_process(process_iterator, bitmap);
-            unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
 
             return CreateProcessFromELFResult::OutOfMemory;
         }
@@ -666,12 +2498,6 @@ CreateProcessFromELFResult create_process_from_elf(
         unmap_pages(data_kernel_pages_start, data_page_count);
     }
 
-    auto entry_section_allocation = get_section_allocation(entry_symbol->section_index, section_headers, &section_allocations);
-
-    auto entry_point = (void*)(entry_section_allocation->user_pages_start * page_size + entry_symbol->value);
-
-    unmap_and_deallocate_bucket_array(&section_allocations, bitmap);
-
     auto thread = allocate_from_bucket_array(&process->threads, bitmap, true);
 
     // Set process entry conditions
@@ -681,23 +2507,179 @@ CreateProcessFromELFResult create_process_from_elf(
     thread->frame.interrupt_frame.stack_pointer = (void*)((size_t)stack_top - 8);
     thread->frame.interrupt_frame.stack_segment = 0x1B;
 
-    // Set entry function parameters (process ID, data & data-size)
+    // Set entry function parameters (process ID, data, data-size & kernel info)
     thread->frame.rdi = process->id;
     thread->frame.rsi = data_user_pages_start * page_size;
     thread->frame.rdx = data_size;
+    thread->frame.rcx = kernel_info_user_pages_start * page_size;
 
     // Set ABI-specified intial register states
 
-    thread->frame.mxcsr |= bits_to_mask(6) << 7;
-
-    thread->is_ready = true;
-    process->is_ready = true;
+    thread->fpu_state.x87_control_word = 0x37F;
+    thread->fpu_state.mxcsr = bits_to_mask(6) << 7;
 
     *result_processs = process;
     *result_process_iterator = process_iterator;
+    *result_thread = thread;
     return CreateProcessFromELFResult::Success;
 }
 
+bool clone_process(
+    Process *source_process,
+    const ProcessThread *source_thread,
+    const ThreadStackFrame *frame,
+    Array<uint8_t> bitmap,
+    size_t processor_area_count,
+    size_t processor_areas_physical_memory_start,
+    Processes *processes,
+    Process **result_process,
+    Processes::Iterator *result_process_iterator,
+    ProcessThread **result_thread
+) {
+    Processes::Iterator process_iterator;
+    auto process = allocate_from_bucket_array(processes, bitmap, true, &process_iterator);
+    if(process == nullptr) {
+        return false;
+    }
+
+    if(!register_process_id(process, process_iterator)) {
+        remove_item_from_bucket_array(process_iterator);
+
+        return false;
+    }
+
+    if(!create_process_page_tables(process, processor_area_count, processor_areas_physical_memory_start, bitmap)) {
+        unregister_process_id(process);
+
+        remove_item_from_bucket_array(process_iterator);
+
+        return false;
+    }
+
+    if(!clone_user_pages(
+        source_process->kernel_info_user_pages_start,
+        1,
+        true,
+        source_process->pml4_table_physical_address,
+        process->pml4_table_physical_address,
+        bitmap
+    )) {
+        destroy_process(process_iterator, bitmap);
+
+        return false;
+    }
+
+    process->kernel_info_user_pages_start = source_process->kernel_info_user_pages_start;
+
+    for(auto mapping : source_process->mappings) {
+        // The rings are shared with the kernel, so the caller gives the clone its own
+        if(
+            (source_process->syscall_ring != nullptr && mapping->logical_pages_start == source_process->syscall_ring_user_pages_start) ||
+            (source_process->log_ring != nullptr && mapping->logical_pages_start == source_process->log_ring_user_pages_start)
+        ) {
+            continue;
+        }
+
+        // Shared memory, and memory that isn't the process's own (e.g. device memory) or whose physical addresses it
+        // knows, stays shared. The clone doesn't own any of it, as with MapSharedMemory.
+        auto is_shared = mapping->is_shared || !mapping->is_owned || mapping->is_pinned;
+
+        if(!clone_user_pages(
+            mapping->logical_pages_start,
+            mapping->page_count,
+            is_shared,
+            source_process->pml4_table_physical_address,
+            process->pml4_table_physical_address,
+            bitmap
+        )) {
+            destroy_process(process_iterator, bitmap);
+
+            return false;
+        }
+
+        if(!register_process_mapping(
+            process,
+            mapping->logical_pages_start,
+            mapping->page_count,
+            mapping->is_shared,
+            !is_shared,
+            bitmap,
+            mapping->is_pinned,
+            mapping->shared_memory
+        )) {
+            // Drops the share counts taken by clone_user_pages, as destroy_process only knows about registered mappings
+            unmap_pages(
+                mapping->logical_pages_start,
+                mapping->page_count,
+                process->pml4_table_physical_address,
+                !is_shared,
+                bitmap
+            );
+
+            destroy_process(process_iterator, bitmap);
+
+            return false;
+        }
+
+        if(mapping->shared_memory != nullptr) {
+            reference_kernel_object(&mapping->shared_memory->object);
+        }
+    }
+
+    { // The guard page and the uncommitted reserve come along too, so the clone's stack grows the same way
+        auto guard_page = source_process->stack_reserve_pages_start - 1;
+
+        if(!clone_user_pages(
+            guard_page,
+            source_process->stack_pages_end - guard_page,
+            false,
+            source_process->pml4_table_physical_address,
+            process->pml4_table_physical_address,
+            bitmap
+        )) {
+            destroy_process(process_iterator, bitmap);
+
+            return false;
+        }
+
+        process->stack_reserve_pages_start = source_process->stack_reserve_pages_start;
+        process->stack_committed_pages_start = source_process->stack_committed_pages_start;
+        process->stack_pages_end = source_process->stack_pages_end;
+    }
+
+    for(auto section : source_process->debug_code_sections) {
+        auto new_section = allocate_from_bucket_array(&process->debug_code_sections, bitmap, true);
+        if(new_section == nullptr) {
+            destroy_process(process_iterator, bitmap);
+
+            return false;
+        }
+
+        *new_section = *section;
+    }
+
+    auto thread = allocate_from_bucket_array(&process->threads, bitmap, true);
+    if(thread == nullptr) {
+        destroy_process(process_iterator, bitmap);
+
+        return false;
+    }
+
+    thread->frame = *frame;
+    thread->fpu_state = source_thread->fpu_state;
+
+    if(!copy_handles(source_process, process)) {
+        destroy_process(process_iterator, bitmap);
+
+        return false;
+    }
+
+    *result_process = process;
+    *result_process_iterator = process_iterator;
+    *result_thread = thread;
+    return true;
+}
+
 inline void deallocate_page(size_t page_index, Array<uint8_t> bitmap) {
     auto byte_index = page_index / 8;
     auto sub_byte_index = page_index % 8;
@@ -710,18 +2692,46 @@ bool destroy_process(Processes::Iterator iterator, Array<uint8_t> bitmap) {
 
     auto process = *iterator;
 
-    // Deallocate owned memory mappings for process
+    unregister_process_id(process);
+
+    close_all_handles(process, bitmap);
+
+    if(process->syscall_ring != nullptr) {
+        unmap_memory(process->syscall_ring, sizeof(SyscallRing));
+    }
+
+    if(process->log_ring != nullptr) {
+        unmap_memory(process->log_ring, sizeof(LogRing));
+    }
+
+    if(process->stack_committed_pages_start != process->stack_pages_end) {
+        if(!unmap_pages(
+            process->stack_committed_pages_start,
+            process->stack_pages_end - process->stack_committed_pages_start,
+            process->pml4_table_physical_address,
+            true,
+            bitmap
+        )) {
+            return false;
+        }
+    }
+
+    // Deallocate owned memory mappings for process, cloned pages only once no other process shares them
 
     for(auto mapping : process->mappings) {
         if(!unmap_pages(
             mapping->logical_pages_start,
             mapping->page_count,
             process->pml4_table_physical_address,
-            false,
+            mapping->is_owned,
             bitmap
         )) {
             return false;
         }
+
+        if(mapping->shared_memory != nullptr) {
+            release_kernel_object(&mapping->shared_memory->object, bitmap);
+        }
     }
 
     // Deallocate the memory mappings bucket array
@@ -730,6 +2740,16 @@ bool destroy_process(Processes::Iterator iterator, Array<uint8_t> bitmap) {
     // Deallocate the debug sections
     unmap_and_deallocate_bucket_array(&process->debug_code_sections, bitmap);
 
+    // Deallocate the IPC call queue
+    unmap_and_deallocate_bucket_array(&process->ipc_queued_calls, bitmap);
+
+    // Any watchers left were never notified (the process was never made ready), so only their references are dropped
+    for(auto watcher : process->exit_watchers) {
+        release_kernel_object(watcher->object, bitmap);
+    }
+
+    unmap_and_deallocate_bucket_array(&process->exit_watchers, bitmap);
+
     // Deallocate the page tables themselves
 
     auto pml4_table = (PageTableEntry*)map_memory(
@@ -796,7 +2816,9 @@ bool register_process_mapping(
     size_t page_count,
     bool is_shared,
     bool is_owned,
-    Array<uint8_t> bitmap
+    Array<uint8_t> bitmap,
+    bool is_pinned,
+    SharedMemory *shared_memory
 ) {
     auto page_mapping = allocate_from_bucket_array(&process->mappings, bitmap, true);
     if(page_mapping == nullptr) {
@@ -807,8 +2829,120 @@ bool register_process_mapping(
         logical_pages_start,
         page_count,
         is_shared,
-        is_owned
+        is_owned,
+        is_pinned,
+        shared_memory
     };
 
+    return true;
+}
+
+MoveProcessMappingResult move_process_mapping(
+    Process *source_process,
+    size_t logical_pages_start,
+    size_t page_count,
+    Process *destination_process,
+    Array<uint8_t> bitmap,
+    size_t *result_logical_pages_start
+) {
+    // The kernel keeps using the syscall and log rings for the lifetime of the process
+    if(
+        (source_process->syscall_ring != nullptr && logical_pages_start == source_process->syscall_ring_user_pages_start) ||
+        (source_process->log_ring != nullptr && logical_pages_start == source_process->log_ring_user_pages_start)
+    ) {
+        return MoveProcessMappingResult::InvalidMemoryRange;
+    }
+
+    for(auto iterator = begin(source_process->mappings); iterator != end(source_process->mappings); ++iterator) {
+        auto mapping = *iterator;
+
+        if(mapping->logical_pages_start != logical_pages_start) {
+            continue;
+        }
+
+        if(mapping->page_count != page_count || mapping->is_shared || !mapping->is_owned || mapping->is_pinned) {
+            return MoveProcessMappingResult::InvalidMemoryRange;
+        }
+
+        // Also makes sure every page is present and writable, so none are read-only pages still shared with a clone
+        bool is_writable;
+        if(!copy_on_write_user_pages(
+            logical_pages_start,
+            page_count,
+            source_process->pml4_table_physical_address,
+            bitmap,
+            &is_writable
+        )) {
+            return MoveProcessMappingResult::OutOfMemory;
+        }
+
+        if(!is_writable) {
+            return MoveProcessMappingResult::InvalidMemoryRange;
+        }
+
+        size_t destination_pages_start;
+        if(!map_pages_between_user(
+            logical_pages_start,
+            page_count,
+            PagePermissions::Write,
+            source_process->pml4_table_physical_address,
+            destination_process->pml4_table_physical_address,
+            bitmap,
+            &destination_pages_start
+        )) {
+            return MoveProcessMappingResult::OutOfMemory;
+        }
+
+        if(!register_process_mapping(destination_process, destination_pages_start, page_count, false, true, bitmap)) {
+            unmap_pages(destination_pages_start, page_count, destination_process->pml4_table_physical_address, false, bitmap);
+
+            return MoveProcessMappingResult::OutOfMemory;
+        }
+
+        remove_item_from_bucket_array(iterator);
+
+        unmap_pages(logical_pages_start, page_count, source_process->pml4_table_physical_address, false, bitmap);
+
+        *result_logical_pages_start = destination_pages_start;
+        return MoveProcessMappingResult::Success;
+    }
+
+    return MoveProcessMappingResult::InvalidMemoryRange;
+}
+
+bool grow_process_stack(Process *process, size_t address, Array<uint8_t> bitmap) {
+    auto pages_start = address / page_size;
+
+    if(pages_start < process->stack_reserve_pages_start || pages_start >= process->stack_committed_pages_start) {
+        return false;
+    }
+
+    // Everything between the fault and the committed stack is committed too, as stacks are used top-down
+    auto page_count = process->stack_committed_pages_start - pages_start;
+
+    size_t kernel_pages_start;
+    if(!map_and_allocate_pages(page_count, bitmap, &kernel_pages_start)) {
+        return false;
+    }
+
+    fill_memory((void*)(kernel_pages_start * page_size), page_count * page_size, 0);
+
+    if(!map_pages_from_kernel_at(
+        kernel_pages_start,
+        page_count,
+        PagePermissions::Write,
+        process->pml4_table_physical_address,
+        bitmap,
+        pages_start
+    )) {
+        unmap_and_deallocate_pages(kernel_pages_start, page_count, bitmap);
+
+        return false;
+    }
+
+    unmap_pages(kernel_pages_start, page_count);
+
+    process->stack_committed_pages_start = pages_start;
+
     return true;
 }
\ No newline at end of file
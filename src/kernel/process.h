@@ -4,6 +4,7 @@
 #include "interrupts.h"
 #include "bucket_array.h"
 #include "array.h"
+#include "syscalls.h"
 
 // Positions of members in this struct are VERY IMPORTANT and relied on by assembly code and the architecture
 struct __attribute__((aligned(16))) ThreadStackFrame {
@@ -26,17 +27,29 @@ struct __attribute__((aligned(16))) ThreadStackFrame {
 
     uint8_t padding[8];
 
+    InterruptStackFrame interrupt_frame;
+};
+
+// Large enough for the legacy area, the XSAVE header and the AVX state
+const size_t fpu_state_size = 1024;
+
+// Positions of members in this struct are VERY IMPORTANT and relied on by the FXSAVE/XSAVE instructions
+struct __attribute__((aligned(64))) FPUState {
     // x87/MMX/SSE registers
-    uint8_t x87_flags[24];
+    uint16_t x87_control_word;
+    uint8_t x87_flags[22];
     uint32_t mxcsr;
     uint32_t mxcsr_mask;
     uint8_t mmx_x87[8][16];
     uint8_t sse[16][16];
     uint8_t reserved[96];
 
-    InterruptStackFrame interrupt_frame;
+    // XSAVE header and extended (AVX) state, unused with FXSAVE
+    uint8_t extended_state[fpu_state_size - 512];
 };
 
+static_assert(sizeof(FPUState) == fpu_state_size, "FPU state struct is incorrect size");
+
 struct DebugCodeSection {
     size_t memory_start;
     size_t size;
@@ -48,27 +61,101 @@ struct DebugCodeSection {
 
 using DebugCodeSections = BucketArray<DebugCodeSection, 16>;
 
+struct SharedMemory;
+
 struct ProcessPageMapping {
     size_t logical_pages_start;
     size_t page_count;
 
     bool is_shared;
     bool is_owned;
+
+    // The process knows the physical addresses (e.g. for DMA), so the pages are never copied on write
+    bool is_pinned;
+
+    // The object owning the pages, if they're shared memory. The mapping holds a reference to it.
+    SharedMemory *shared_memory;
 };
 
 using ProcessPageMappings = BucketArray<ProcessPageMapping, 16>;
 
+enum struct ThreadIPCState : uint8_t {
+    None,
+    Calling, // Queued on the callee, waiting for it to receive the call
+    WaitingForReply, // Call received by the callee, waiting for its reply
+    Receiving, // Waiting for any call, or for wait_deadline
+    ReceivingChannels, // Waiting for a message on any of receiving_channels
+    WaitingForEvent // Waiting for any of waiting_event_mask to be signalled on waiting_event, or for wait_deadline
+};
+
+struct Channel;
+struct Event;
+struct Handle;
+
 struct ProcessThread {
     ThreadStackFrame frame;
 
+    // Only saved/restored when the thread actually uses the FPU, see device_not_available_handler
+    FPUState fpu_state;
+
+    // Whether fpu_state is also currently loaded into the registers of processor fpu_state_processor_id
+    bool is_fpu_state_loaded;
+    uint8_t fpu_state_processor_id;
+
     bool is_resident;
     uint8_t resident_processor_id;
+    bool has_been_resident;
+
+    // Times a processor other than resident_processor_id has passed over this thread since it was last entered, only
+    // counted up to thread_migration_skip_threshold (give or take concurrent increments)
+    size_t affinity_skip_count;
 
     bool is_ready;
+
+    ThreadIPCState ipc_state;
+    size_t ipc_peer_process_id;
+
+    // The thread holds a reference to each of these while receiving from them
+    Channel *receiving_channels[ipc_message_length];
+    size_t receiving_channel_count;
+
+    // The thread holds a reference to the event while waiting on it. wait_deadline is in timestamp counter cycles, or
+    // UINT64_MAX to wait without a timeout, and also applies while receiving IPC calls.
+    Event *waiting_event;
+    size_t waiting_event_mask;
+    uint64_t wait_deadline;
+
+    // Periodic (deadline) scheduling, see SyscallType::SetThreadPeriod. Times are in timestamp counter cycles.
+    // Only changed while holding global_periodic_lock.
+    bool is_periodic;
+    bool is_waiting_for_next_period; // Not entered again until the current period ends
+    uint64_t period;
+    uint64_t budget;
+    uint64_t period_start;
+    uint64_t budget_used;
+    size_t utilization; // Per-mille of a processor, budget / period rounded up
+    uint64_t entered_time;
 };
 
 using ProcessThreads = BucketArray<ProcessThread, 4>;
 
+struct IPCQueuedCall {
+    size_t caller_process_id;
+};
+
+using IPCQueuedCalls = BucketArray<IPCQueuedCall, 8>;
+
+struct KernelObject;
+
+// See SyscallType::WatchProcessExit. Holds a reference to the object.
+struct ProcessExitWatcher {
+    KernelObject *object;
+
+    size_t user_data;
+};
+
+using ProcessExitWatchers = BucketArray<ProcessExitWatcher, 4>;
+
 struct Process {
     size_t pml4_table_physical_address;
 
@@ -80,6 +167,47 @@ struct Process {
 
     ProcessThreads threads;
 
+    // Calls made while no thread of this process was receiving
+    IPCQueuedCalls ipc_queued_calls;
+
+    ProcessThread *ipc_receiving_thread;
+    ProcessThreads::Iterator ipc_receiving_thread_iterator;
+
+    // Notified once the process exits. Only changed while holding global_ipc_lock, and only added to while the process is
+    // ready.
+    ProcessExitWatchers exit_watchers;
+
+    // Kernel mapping of the ring, or nullptr if the process hasn't created one
+    SyscallRing *syscall_ring;
+    size_t syscall_ring_user_pages_start;
+    bool is_syscall_ring_polled;
+
+    // Serialises syscalls performed for the process, as ring submissions can be performed by any processor
+    volatile bool syscall_lock;
+
+    // Kernel mapping of the log ring, or nullptr if the process hasn't created one
+    LogRing *log_ring;
+    size_t log_ring_user_pages_start;
+
+    // Held while draining the log ring, so the characters from it and from DebugWrite stay in order
+    volatile bool log_lock;
+
+    // The stack is committed from stack_committed_pages_start to stack_pages_end, and page faults below that grow it as
+    // far as stack_reserve_pages_start. The page below the reserve is never mapped, as a guard. The committed pages
+    // aren't registered as a mapping, so the process can't unmap them. Only changed while holding syscall_lock.
+    size_t stack_reserve_pages_start;
+    size_t stack_committed_pages_start;
+    size_t stack_pages_end;
+
+    size_t kernel_info_user_pages_start;
+
+    // Indexed by handle - 1, see handles.h. Only changed while holding handles_lock.
+    Handle *handles;
+    size_t handle_capacity;
+    bool are_handles_closed;
+
+    volatile bool handles_lock;
+
     bool is_ready;
 };
 
@@ -87,30 +215,88 @@ using Processes = BucketArray<Process, 4>;
 
 extern Processes global_processes;
 
+// Finds the process with the ID in constant time, whether it's ready or not
+bool find_process(size_t id, Processes::Iterator *result_iterator);
+
 enum struct CreateProcessFromELFResult {
     Success,
     OutOfMemory,
-    InvalidELF
+    InvalidELF,
+    InvalidMemoryRange
 };
 
+// If data_source_process is set, data is the address of one of its mappings, whose pages are moved into the new process
+// (see move_process_mapping) rather than copied. data_size then has to round up to the size of the mapping. Must hold data_source_process->syscall_lock.
+// The process and its thread are left not ready, for the caller to make ready once it's done with them (e.g. after
+// publishing the process as alive), as the process can exit and be destroyed any time afterwards.
 CreateProcessFromELFResult create_process_from_elf(
     uint8_t *elf_binary,
     size_t elf_binary_size,
     void *data,
     size_t data_size,
+    Process *data_source_process,
+    size_t stack_size,
+    size_t stack_reserve,
     Array<uint8_t> bitmap,
     size_t processor_area_count,
     size_t processor_areas_physical_memory_start,
+    size_t kernel_info_physical_memory_start,
     Processes *processes,
     Process **result_processs,
-    Processes::Iterator *result_process_iterator
+    Processes::Iterator *result_process_iterator,
+    ProcessThread **result_thread
 );
 bool destroy_process(Processes::Iterator iterator, Array<uint8_t> bitmap);
+
+// Creates a process sharing all of the source process's memory copy-on-write, with one thread starting from frame with
+// the source thread's FPU state, and with the same handles. The syscall and log rings aren't cloned, and neither the
+// clone nor its thread are made ready, both are left to the caller. Fails only if out of memory. Must hold source_process->syscall_lock.
+bool clone_process(
+    Process *source_process,
+    const ProcessThread *source_thread,
+    const ThreadStackFrame *frame,
+    Array<uint8_t> bitmap,
+    size_t processor_area_count,
+    size_t processor_areas_physical_memory_start,
+    Processes *processes,
+    Process **result_process,
+    Processes::Iterator *result_process_iterator,
+    ProcessThread **result_thread
+);
+
+enum struct MoveProcessMappingResult {
+    Success,
+    OutOfMemory,
+    InvalidMemoryRange
+};
+
+// Moves the pages of the mapping at logical_pages_start (which has to cover exactly page_count pages) to free addresses
+// in another process, without copying them, and unmaps them from the source process. Only memory the source process owns outright can be moved, so not
+// shared, pinned or device memory, nor the syscall and log rings. Pages still shared copy-on-write with a clone are
+// copied first. Must hold the syscall_lock of both processes, unless the destination isn't ready yet.
+MoveProcessMappingResult move_process_mapping(
+    Process *source_process,
+    size_t logical_pages_start,
+    size_t page_count,
+    Process *destination_process,
+    Array<uint8_t> bitmap,
+    size_t *result_logical_pages_start
+);
+
+// Commits the process's stack down to the page holding address. Fails if the address isn't in the uncommitted part of
+// the stack reserve (the guard page included), or if out of memory. Must hold process->syscall_lock.
+bool grow_process_stack(Process *process, size_t address, Array<uint8_t> bitmap);
+
+// Launches that found their image's relocations already prelinked, and ones that had to prelink them
+extern size_t prelinked_image_hit_count;
+extern size_t prelinked_image_miss_count;
 bool register_process_mapping(
     Process *process,
     size_t logical_pages_start,
     size_t page_count,
     bool is_shared,
     bool is_owned,
-    Array<uint8_t> bitmap
+    Array<uint8_t> bitmap,
+    bool is_pinned = false,
+    SharedMemory *shared_memory = nullptr
 );
\ No newline at end of file
@@ -17,6 +17,9 @@ static inline void acquire_lock(volatile bool *lock) {
     }
 }
 
+// Processor IDs are 8-bit local APIC IDs
+const size_t maximum_processor_count = 256;
+
 static inline uint8_t get_processor_id() {
     uint32_t cpuid_value_a;
     uint32_t cpuid_value_b;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "timing.h"
+
+const size_t kernel_info_process_slot_count = 256;
+
+// Marks a slot that more than one live process hashes to
+const size_t kernel_info_process_slot_shared = SIZE_MAX;
+
+// Kernel-maintained, mapped read-only into every process. The user address is passed as the fourth entry parameter.
+struct KernelInfo {
+    size_t processor_count;
+
+    uint64_t timestamp_counter_frequency; // Hz
+    uint64_t boot_timestamp_counter;
+
+    // Nanoseconds per timestamp counter cycle, as a 32.32 fixed point number
+    uint64_t nanoseconds_per_cycle;
+
+    // Indexed by process ID modulo the slot count. Holds the process ID + 1 of the only live process in the slot, 0 if
+    // there are none, or kernel_info_process_slot_shared if there are several.
+    volatile size_t process_slots[kernel_info_process_slot_count];
+};
+
+static_assert(sizeof(KernelInfo) <= 4096, "KernelInfo must fit in a page");
+
+enum struct ProcessLiveness {
+    Alive,
+    Dead,
+    Unknown
+};
+
+// Unknown means the slot is shared, and the DoesProcessExist syscall has to be used instead
+static inline ProcessLiveness get_process_liveness(const KernelInfo *kernel_info, size_t process_id) {
+    auto slot = __atomic_load_n(&kernel_info->process_slots[process_id % kernel_info_process_slot_count], __ATOMIC_ACQUIRE);
+
+    if(slot == process_id + 1) {
+        return ProcessLiveness::Alive;
+    } else if(slot == kernel_info_process_slot_shared) {
+        return ProcessLiveness::Unknown;
+    } else {
+        return ProcessLiveness::Dead;
+    }
+}
+
+// Nanoseconds since boot
+static inline uint64_t get_time_nanoseconds(const KernelInfo *kernel_info) {
+    auto cycles = read_timestamp_counter() - kernel_info->boot_timestamp_counter;
+
+    return (uint64_t)(((unsigned __int128)cycles * kernel_info->nanoseconds_per_cycle) >> 32);
+}
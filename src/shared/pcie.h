@@ -21,6 +21,11 @@ const size_t memory_bar_prefetchable_bits = 1;
 
 const size_t io_bar_reserved_bits = 1;
 
+const uint8_t header_type_mask = 0x7F;
+const uint8_t header_type_multi_function_bit = 0x80;
+
+const uint8_t bridge_header_type = 1;
+
 struct PCIHeader {
     uint16_t vendor_id;
     uint16_t device_id;
@@ -45,4 +50,25 @@ struct PCIHeader {
     uint8_t interrupt_pin;
     uint8_t minimum_grant;
     uint8_t maximum_latency;
-};
\ No newline at end of file
+};
+
+// Start of the type 1 header used by PCI-to-PCI bridges, which is the same as PCIHeader up to the BARs
+struct PCIBridgeHeader {
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t command;
+    uint16_t status;
+    uint8_t revision;
+    uint8_t interface;
+    uint8_t subclass;
+    uint8_t class_code;
+    uint8_t cache_line_size;
+    uint8_t latency_timer;
+    uint8_t header_type;
+    uint8_t bist;
+    uint32_t bars[2];
+    uint8_t primary_bus;
+    uint8_t secondary_bus;
+    uint8_t subordinate_bus;
+    uint8_t secondary_latency_timer;
+};
@@ -1,12 +1,7 @@
 #pragma once
 
 #include <stddef.h>
-
-struct MapSharedMemoryParameters {
-    size_t process_id;
-    size_t address;
-    size_t size;
-};
+#include <stdint.h>
 
 enum struct MapSharedMemoryResult : size_t {
     Success,
@@ -15,60 +10,356 @@ enum struct MapSharedMemoryResult : size_t {
     InvalidMemoryRange
 };
 
-struct CreateProcessParameters {
-    void *elf_binary;
-    size_t elf_binary_size;
+enum struct CreateProcessResult : size_t {
+    Success,
+    OutOfMemory,
+    InvalidELF,
+    InvalidMemoryRange
+};
+
+// A process's stack starts with its stack size committed, and grows on demand up to its stack reserve, below which is
+// an unmapped guard page. CreateProcess uses these when given 0 for either.
+const size_t default_process_stack_size = 1024 * 16;
+const size_t default_process_stack_reserve = 1024 * 1024;
+
+const size_t maximum_process_stack_reserve = 1024 * 1024 * 256;
+
+// Longest period SetThreadPeriod accepts, in microseconds
+const size_t maximum_thread_period = 1000 * 1000 * 60;
+
+// Or'd into CreateProcess's data size to move the pages of the data mapping into the new process instead of copying
+// them, see GrantMemory. The data address has to be the start of a mapping, and the size has to round up to its size.
+const size_t create_process_move_data = (size_t)1 << 63;
+
+// FindPCIEDevice takes the index among matching devices, the IDs packed by pack_pcie_device_ids, and which of them have
+// to match as find_pcie_device_require_* flags
+const size_t find_pcie_device_require_vendor_id = 1 << 0;
+const size_t find_pcie_device_require_device_id = 1 << 1;
+const size_t find_pcie_device_require_class_code = 1 << 2;
+const size_t find_pcie_device_require_subclass = 1 << 3;
+const size_t find_pcie_device_require_interface = 1 << 4;
+
+inline size_t pack_pcie_device_ids(uint16_t vendor_id, uint16_t device_id, uint8_t class_code, uint8_t subclass, uint8_t interface) {
+    return
+        (size_t)vendor_id |
+        (size_t)device_id << 16 |
+        (size_t)class_code << 32 |
+        (size_t)subclass << 40 |
+        (size_t)interface << 48;
+}
+
+enum struct FindPCIEDeviceResult : size_t {
+    Success,
+    NotFound
+};
+
+// The device signals the event through MSI-X, or MSI if it doesn't have MSI-X (where the entry has to be 0). The
+// binding lasts until UnbindPCIEInterrupt or until the process exits, and each entry can only be bound by one process.
+enum struct BindPCIEInterruptResult : size_t {
+    Success,
+    InvalidHandle,
+    InvalidLocation,
+    NotSupported,
+    AlreadyBound,
+    OutOfVectors,
+    OutOfMemory
+};
 
-    void *data;
-    size_t data_size;
+enum struct UnbindPCIEInterruptResult : size_t {
+    Success,
+    NotBound
 };
 
-enum struct CreateProcessResult : size_t {
+// Message words are passed in the rsi, rdi, r8, r9 and r10 registers
+const size_t ipc_message_length = 5;
+
+struct IPCMessage {
+    size_t words[ipc_message_length];
+};
+
+enum struct IPCCallResult : size_t {
+    Success,
+    InvalidProcessID,
+    OutOfMemory
+};
+
+// IPCReceive timeout that never expires. A timeout of 0 only takes a call that's already queued.
+const size_t ipc_receive_forever = SIZE_MAX;
+
+enum struct IPCReceiveResult : size_t {
+    Success,
+    NoCall,
+    InvalidProcessID
+};
+
+enum struct IPCReplyResult : size_t {
+    Success,
+    InvalidProcessID
+};
+
+// Kernel objects are referred to by handles, which are per-process. A handle can be shared with another process with
+// the same or fewer rights.
+const size_t handle_right_send = 1 << 0;
+const size_t handle_right_receive = 1 << 1;
+const size_t handle_right_signal = 1 << 2;
+const size_t handle_right_wait = 1 << 3;
+const size_t handle_right_read = 1 << 4;
+const size_t handle_right_write = 1 << 5;
+
+enum struct ShareHandleResult : size_t {
+    Success,
+    InvalidHandle,
+    InvalidRights,
+    InvalidProcessID,
+    OutOfMemory
+};
+
+// Channels queue up to this many messages, ChannelSend fails once they're full
+const size_t channel_capacity = 64;
+
+enum struct CreateChannelResult : size_t {
+    Success,
+    OutOfMemory
+};
+
+enum struct ChannelSendResult : size_t {
+    Success,
+    InvalidHandle,
+    Full
+};
+
+// ChannelReceive takes the number of channels (up to ipc_message_length) in rdx, or'd with channel_receive_block to
+// wait for a message, and the channel handles in place of the message words
+const size_t channel_receive_block = (size_t)1 << 63;
+
+enum struct ChannelReceiveResult : size_t {
+    Success,
+    InvalidHandle,
+    NoMessage,
+    OutOfMemory
+};
+
+enum struct GrantMemoryResult : size_t {
     Success,
     OutOfMemory,
-    InvalidELF,
+    InvalidProcessID,
     InvalidMemoryRange
 };
 
-struct FindPCIEDeviceParameters {
-    size_t index;
+enum struct WatchProcessExitResult : size_t {
+    Success,
+    InvalidHandle,
+    InvalidProcessID,
+    OutOfMemory
+};
 
-    uint16_t vendor_id;
-    uint16_t device_id;
+enum struct CreateSharedMemoryObjectResult : size_t {
+    Success,
+    OutOfMemory
+};
 
-    uint8_t class_code;
-    uint8_t subclass;
-    uint8_t interface;
+enum struct MapSharedMemoryObjectResult : size_t {
+    Success,
+    InvalidHandle,
+    OutOfMemory
+};
 
-    bool require_vendor_id;
-    bool require_device_id;
+enum struct CreateEventResult : size_t {
+    Success,
+    OutOfMemory
+};
 
-    bool require_class_code;
-    bool require_subclass;
-    bool require_interface;
+enum struct SignalEventResult : size_t {
+    Success,
+    InvalidHandle
 };
 
-enum struct FindPCIEDeviceResult : size_t {
+// WaitEvent timeout that never expires. A timeout of 0 only takes the signals that are already raised.
+const size_t event_wait_forever = SIZE_MAX;
+
+enum struct WaitEventResult : size_t {
+    Success,
+    InvalidHandle,
+    TimedOut,
+    OutOfMemory
+};
+
+enum struct SetThreadPeriodResult : size_t {
+    Success,
+    InvalidPeriod,
+    Overcommitted
+};
+
+enum struct CreateSyscallRingResult : size_t {
+    Success,
+    OutOfMemory,
+    AlreadyCreated
+};
+
+enum struct CreateLogRingResult : size_t {
+    Success,
+    OutOfMemory,
+    AlreadyCreated
+};
+
+enum struct DebugWriteResult : size_t {
     Success,
-    NotFound,
     OutOfMemory,
     InvalidMemoryRange
 };
 
+enum struct GetSyscallStatisticsResult : size_t {
+    Success,
+    InvalidSyscallType,
+    InvalidMemoryRange,
+    OutOfMemory
+};
+
+// Bucket i counts calls that took [2^i, 2^(i + 1)) timestamp counter cycles, the last bucket also counts anything longer
+const size_t syscall_latency_bucket_count = 32;
+
+// Summed over all processors by GetSyscallStatistics. Calls that switch away from the calling thread (exiting,
+// relinquishing time or blocking) are counted, but don't contribute to the latencies.
+struct SyscallStatistics {
+    size_t call_count;
+
+    uint64_t total_cycles;
+    uint64_t combined_paging_lock_wait_cycles;
+
+    size_t latency_histogram[syscall_latency_bucket_count];
+};
+
+enum struct GetSchedulerStatisticsResult : size_t {
+    Success,
+    InvalidProcessorID,
+    InvalidMemoryRange,
+    OutOfMemory
+};
+
+// Per processor, see GetSchedulerStatistics
+struct SchedulerStatistics {
+    // Times from a thread giving up the processor to the next thread being entered, excluding idle time, in timestamp
+    // counter cycles
+    size_t context_switch_count;
+    uint64_t context_switch_cycles;
+
+    // Threads entered on the processor that were last resident on another one
+    size_t thread_migration_count;
+};
+
+// The calling process gets Success with the clone's ID, and the clone carries on from the same point with IsClone and
+// its own ID
+enum struct CloneProcessResult : size_t {
+    Success,
+    OutOfMemory,
+    IsClone
+};
+
 static_assert(sizeof(bool) == 1, "Boolean (bool) type is not the expected size of 1 byte");
 
+// Every syscall, with the type of its first result and how many parameters it takes.
+// The syscall type is passed in rbx, parameters in rdx, rsi, rdi, r8, r9 and r10 (in that order), and results come back
+// in rbx and rdx. User stubs (syscall_* functions) are generated from this in syscall.h.
+#define SYSCALL_TABLE(X) \
+    X(Exit, exit, size_t, 0) \
+    X(RelinquishTime, relinquish_time, size_t, 0) \
+    X(DebugPrint, debug_print, size_t, 1) \
+    X(MapFreeMemory, map_free_memory, size_t, 1) /* size. Returns address */ \
+    X(MapFreeConsecutiveMemory, map_free_consecutive_memory, size_t, 1) /* size. Returns address, physical address */ \
+    X(CreateSharedMemory, create_shared_memory, size_t, 1) /* size. Returns address */ \
+    X(MapSharedMemory, map_shared_memory, MapSharedMemoryResult, 3) /* process ID, address, size. Returns address */ \
+    X(UnmapMemory, unmap_memory, size_t, 1) /* address */ \
+    X(CreateProcess, create_process, CreateProcessResult, 6) /* ELF binary, ELF size, data, data size, stack size, stack reserve. Returns ID */ \
+    X(DoesProcessExist, does_process_exist, bool, 1) /* process ID */ \
+    X(FindPCIEDevice, find_pcie_device, FindPCIEDeviceResult, 3) /* See pack_pcie_device_ids. Returns location */ \
+    X(MapPCIEConfiguration, map_pcie_configuration, size_t, 1) /* location. Returns address */ \
+    X(MapPCIEBar, map_pcie_bar, size_t, 1) /* BAR index | location << bar_index_bits. Returns address */ \
+    X(IPCCall, ipc_call, IPCCallResult, 6) /* See ipc_syscall */ \
+    X(IPCReceive, ipc_receive, IPCReceiveResult, 1) /* timeout in microseconds */ \
+    X(IPCReply, ipc_reply, IPCReplyResult, 6) \
+    X(IPCReplyAndReceive, ipc_reply_and_receive, IPCReceiveResult, 6) \
+    X(SetThreadPeriod, set_thread_period, SetThreadPeriodResult, 2) /* period, budget in microseconds */ \
+    X(WaitForNextPeriod, wait_for_next_period, size_t, 0) \
+    X(CreateSyscallRing, create_syscall_ring, CreateSyscallRingResult, 1) /* is polled. Returns address */ \
+    X(SubmitSyscallRing, submit_syscall_ring, size_t, 0) /* Returns submissions performed */ \
+    X(GetSyscallStatistics, get_syscall_statistics, GetSyscallStatisticsResult, 2) /* type, SyscallStatistics address */ \
+    X(CreateLogRing, create_log_ring, CreateLogRingResult, 0) /* Returns address */ \
+    X(DebugWrite, debug_write, DebugWriteResult, 2) /* address, size. Drains the log ring first */ \
+    X(CloneProcess, clone_process, CloneProcessResult, 0) /* Returns ID. Memory is shared copy-on-write */ \
+    X(ShareHandle, share_handle, ShareHandleResult, 3) /* handle, process ID, rights. Returns the other process's handle */ \
+    X(CloseHandle, close_handle, size_t, 1) /* handle */ \
+    X(CreateChannel, create_channel, CreateChannelResult, 0) /* Returns handle, with send and receive rights */ \
+    X(ChannelSend, channel_send, ChannelSendResult, 6) /* See channel_send */ \
+    X(ChannelReceive, channel_receive, ChannelReceiveResult, 6) /* See channel_receive */ \
+    X(CreateEvent, create_event, CreateEventResult, 0) /* Returns handle, with signal and wait rights */ \
+    X(SignalEvent, signal_event, SignalEventResult, 2) /* handle, signals. Raised signals stay raised until taken */ \
+    X(WaitEvent, wait_event, WaitEventResult, 3) /* handle, signal mask, timeout in microseconds. Returns and clears the raised signals in the mask */ \
+    X(CreateSharedMemoryObject, create_shared_memory_object, CreateSharedMemoryObjectResult, 1) /* size. Returns handle, with read and write rights */ \
+    X(MapSharedMemoryObject, map_shared_memory_object, MapSharedMemoryObjectResult, 1) /* handle. Returns address, writable if the handle has the write right */ \
+    X(GrantMemory, grant_memory, GrantMemoryResult, 3) /* address, size, process ID. Moves the mapping to the process, returns its address there */ \
+    X(WatchProcessExit, watch_process_exit, WatchProcessExitResult, 3) /* process ID, channel or event handle, user data. See notify_process_exit */ \
+    X(BindPCIEInterrupt, bind_pcie_interrupt, BindPCIEInterruptResult, 4) /* location, MSI-X table entry, event handle, signals */ \
+    X(UnbindPCIEInterrupt, unbind_pcie_interrupt, UnbindPCIEInterruptResult, 2) /* location, MSI-X table entry */ \
+    X(GetSchedulerStatistics, get_scheduler_statistics, GetSchedulerStatisticsResult, 2) /* processor ID, SchedulerStatistics address */
+
+const size_t syscall_parameter_count = 6;
+
 enum struct SyscallType : size_t {
-    Exit,
-    RelinquishTime,
-    DebugPrint,
-    MapFreeMemory,
-    MapFreeConsecutiveMemory,
-    CreateSharedMemory,
-    MapSharedMemory,
-    UnmapMemory,
-    CreateProcess,
-    DoesProcessExist,
-    FindPCIEDevice,
-    MapPCIEConfiguration,
-    MapPCIEBar
+#define X(name, snake_name, result_type, parameter_count) name,
+    SYSCALL_TABLE(X)
+#undef X
+};
+
+const size_t syscall_type_count = 0
+#define X(name, snake_name, result_type, parameter_count) + 1
+    SYSCALL_TABLE(X)
+#undef X
+;
+
+const size_t syscall_ring_length = 64;
+
+struct SyscallSubmission {
+    SyscallType type;
+
+    size_t parameters[syscall_parameter_count];
+
+    // Copied to the completion as-is
+    size_t user_data;
+};
+
+struct SyscallCompletion {
+    size_t user_data;
+
+    // False if the syscall can't be performed through a ring (it blocks, acts on the calling thread, or locks another
+    // process, e.g. GrantMemory and MapSharedMemory)
+    bool is_valid;
+
+    size_t return_1;
+    size_t return_2;
+};
+
+// Shared between a process and the kernel, see SyscallType::CreateSyscallRing. Heads and tails are free-running
+// indices. The process only writes submission_tail and completion_head, the kernel only submission_head and
+// completion_tail.
+struct SyscallRing {
+    size_t submission_head;
+    size_t submission_tail;
+
+    size_t completion_head;
+    size_t completion_tail;
+
+    SyscallSubmission submissions[syscall_ring_length];
+    SyscallCompletion completions[syscall_ring_length];
+};
+
+const size_t log_ring_length = 4096;
+
+// Shared between a process and the kernel, see SyscallType::CreateLogRing. Characters written to the ring are printed
+// by idle processors, on DebugWrite, or when the process exits. head and tail are free-running indices, the process only
+// writes tail and the kernel only head.
+struct LogRing {
+    size_t head;
+    size_t tail;
+
+    char buffer[log_ring_length];
 };
\ No newline at end of file
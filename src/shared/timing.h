@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+// Not serializing, so only suitable for measuring intervals that are long compared to the instruction window
+static inline uint64_t read_timestamp_counter() {
+    uint32_t time_low;
+    uint32_t time_high;
+    asm volatile(
+        "rdtsc"
+        : "=a"(time_low), "=d"(time_high)
+    );
+
+    return (uint64_t)time_low | (uint64_t)time_high << 32;
+}
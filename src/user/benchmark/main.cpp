@@ -0,0 +1,360 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include "printf.h"
+#include "syscall.h"
+#include "ring.h"
+#include "kernel_info.h"
+#include "timing.h"
+#include "memory.h"
+
+// Launched from the app launch bar. Measures kernel and IPC paths from user space, and reports the results on the
+// kernel console through DebugWrite.
+
+void _putchar(char character) {
+    syscall_debug_print(character);
+}
+
+static void report(const char *format, ...) {
+    char buffer[256];
+
+    va_list arguments;
+    va_start(arguments, format);
+    auto length = vsnprintf(buffer, sizeof(buffer), format, arguments);
+    va_end(arguments);
+
+    if(length < 0) {
+        return;
+    }
+
+    if((size_t)length >= sizeof(buffer)) {
+        length = sizeof(buffer) - 1;
+    }
+
+    syscall_debug_write((size_t)buffer, (size_t)length);
+}
+
+// Entries per second, from a count and nanoseconds
+static size_t get_rate(size_t count, uint64_t time) {
+    if(time == 0) {
+        return 0;
+    }
+
+    return (size_t)((unsigned __int128)count * 1000000000 / time);
+}
+
+const size_t ring_benchmark_length = 1024;
+const size_t ring_benchmark_entry_count = 1 << 22;
+const size_t ring_benchmark_batch_size = 16;
+const size_t ring_benchmark_mpsc_producer_count = 2;
+
+// In shared memory, so the producers stay on it after CloneProcess
+struct RingBenchmark {
+    SPSCRing<size_t, ring_benchmark_length> spsc_ring;
+    MPSCRing<size_t, ring_benchmark_length> mpsc_ring;
+
+    size_t finished_producer_count;
+};
+
+// Runs in a clone. Writes ring_benchmark_entry_count entries in batches, as fast as it can, so entries the consumer
+// can't keep up with are dropped and counted as overflowed.
+[[noreturn]] static void produce_ring_entries(RingBenchmark *benchmark, bool is_mpsc) {
+    size_t entries[ring_benchmark_batch_size];
+    for(size_t i = 0; i < ring_benchmark_batch_size; i += 1) {
+        entries[i] = i;
+    }
+
+    for(size_t i = 0; i < ring_benchmark_entry_count; i += ring_benchmark_batch_size) {
+        bool is_written;
+        if(is_mpsc) {
+            is_written = write_mpsc_ring(&benchmark->mpsc_ring, entries, ring_benchmark_batch_size);
+        } else {
+            is_written = write_spsc_ring(&benchmark->spsc_ring, entries, ring_benchmark_batch_size) == ring_benchmark_batch_size;
+        }
+
+        // Let the consumer catch up when it shares the processor
+        if(!is_written) {
+            syscall_relinquish_time();
+        }
+    }
+
+    __atomic_add_fetch(&benchmark->finished_producer_count, 1, __ATOMIC_RELEASE);
+
+    exit();
+}
+
+static bool start_ring_producers(RingBenchmark *benchmark, bool is_mpsc, size_t producer_count) {
+    for(size_t i = 0; i < producer_count; i += 1) {
+        size_t clone_id;
+        switch(syscall_clone_process_2(&clone_id)) {
+            case CloneProcessResult::Success: break;
+
+            case CloneProcessResult::IsClone: {
+                produce_ring_entries(benchmark, is_mpsc);
+            } break;
+
+            case CloneProcessResult::OutOfMemory: {
+                report("Error: Unable to clone ring producer: Out of memory\n");
+
+                return false;
+            } break;
+        }
+    }
+
+    return true;
+}
+
+static void run_ring_benchmark(const KernelInfo *kernel_info, bool is_mpsc) {
+    auto benchmark = (RingBenchmark*)syscall_create_shared_memory(sizeof(RingBenchmark));
+    if(benchmark == nullptr) {
+        report("Error: Unable to create ring benchmark memory\n");
+
+        return;
+    }
+
+    // Shared memory starts out zeroed, which is only a valid state for the SPSC ring
+    init_mpsc_ring(&benchmark->mpsc_ring);
+
+    size_t producer_count = 1;
+    if(is_mpsc) {
+        producer_count = ring_benchmark_mpsc_producer_count;
+    }
+
+    auto start_time = get_time_nanoseconds(kernel_info);
+
+    if(!start_ring_producers(benchmark, is_mpsc, producer_count)) {
+        syscall_unmap_memory((size_t)benchmark);
+
+        return;
+    }
+
+    size_t entries[ring_benchmark_batch_size];
+    size_t read_count = 0;
+    while(true) {
+        // Checked before reading, so whatever the producers wrote before finishing is read after
+        auto is_finished = __atomic_load_n(&benchmark->finished_producer_count, __ATOMIC_ACQUIRE) == producer_count;
+
+        size_t count;
+        if(is_mpsc) {
+            count = read_mpsc_ring(&benchmark->mpsc_ring, entries, ring_benchmark_batch_size);
+        } else {
+            count = read_spsc_ring(&benchmark->spsc_ring, entries, ring_benchmark_batch_size);
+        }
+
+        read_count += count;
+
+        if(count == 0) {
+            if(is_finished) {
+                break;
+            }
+
+            syscall_relinquish_time();
+        }
+    }
+
+    auto time = get_time_nanoseconds(kernel_info) - start_time;
+
+    size_t overflow_count;
+    if(is_mpsc) {
+        overflow_count = __atomic_load_n(&benchmark->mpsc_ring.overflow_count, __ATOMIC_RELAXED);
+    } else {
+        overflow_count = __atomic_load_n(&benchmark->spsc_ring.overflow_count, __ATOMIC_RELAXED);
+    }
+
+    report(
+        "%s ring, %zu producer(s): %zu entries read in %zu us, %zu entries/s, %zu overflowed\n",
+        is_mpsc ? "MPSC" : "SPSC",
+        producer_count,
+        read_count,
+        (size_t)(time / 1000),
+        get_rate(read_count, time),
+        overflow_count
+    );
+
+    syscall_unmap_memory((size_t)benchmark);
+}
+
+const size_t process_lookup_benchmark_process_count = 2048;
+const size_t process_lookup_benchmark_repeat_count = 4;
+
+// Mean timestamp counter cycles of DoesProcessExist for each of the processes, and of MapSharedMemory (with the
+// UnmapMemory to undo it) for their copies of the mapping at shared_address
+static void measure_process_lookups(
+    const size_t *process_ids,
+    size_t process_count,
+    size_t shared_address,
+    size_t shared_size,
+    uint64_t *result_exists_cycles,
+    uint64_t *result_map_cycles
+) {
+    auto start_time = read_timestamp_counter();
+
+    for(size_t repeat = 0; repeat < process_lookup_benchmark_repeat_count; repeat += 1) {
+        for(size_t i = 0; i < process_count; i += 1) {
+            syscall_does_process_exist(process_ids[i]);
+        }
+    }
+
+    auto exists_time = read_timestamp_counter();
+
+    for(size_t i = 0; i < process_count; i += 1) {
+        size_t address;
+        if(syscall_map_shared_memory_2(&address, process_ids[i], shared_address, shared_size) == MapSharedMemoryResult::Success) {
+            syscall_unmap_memory(address);
+        }
+    }
+
+    auto end_time = read_timestamp_counter();
+
+    *result_exists_cycles = (exists_time - start_time) / (process_count * process_lookup_benchmark_repeat_count);
+    *result_map_cycles = (end_time - exists_time) / process_count;
+}
+
+// Times looking processes up by ID with just this process alive, and again with thousands of clones, which share the
+// same mapping. Lookups through the process table shouldn't get slower as processes are added.
+static void run_process_lookup_benchmark(size_t process_id) {
+    size_t shared_size = 4096;
+
+    auto shared_address = syscall_create_shared_memory(shared_size);
+    if(shared_address == 0) {
+        report("Error: Unable to create process lookup benchmark memory\n");
+
+        return;
+    }
+
+    auto clone_ids = (size_t*)syscall_map_free_memory(process_lookup_benchmark_process_count * sizeof(size_t));
+    if(clone_ids == nullptr) {
+        report("Error: Unable to allocate process lookup benchmark memory\n");
+
+        syscall_unmap_memory(shared_address);
+
+        return;
+    }
+
+    uint64_t exists_cycles;
+    uint64_t map_cycles;
+    measure_process_lookups(&process_id, 1, shared_address, shared_size, &exists_cycles, &map_cycles);
+
+    report(
+        "Process lookups with 1 process: DoesProcessExist %zu cycles, MapSharedMemory %zu cycles\n",
+        (size_t)exists_cycles,
+        (size_t)map_cycles
+    );
+
+    size_t clone_count = 0;
+    while(clone_count < process_lookup_benchmark_process_count) {
+        size_t clone_id;
+        auto result = syscall_clone_process_2(&clone_id);
+
+        if(result == CloneProcessResult::IsClone) {
+            // Stays alive until the benchmark calls it
+            size_t caller_process_id;
+            IPCMessage message;
+            ipc_receive(ipc_receive_forever, &caller_process_id, &message);
+
+            exit();
+        }
+
+        if(result != CloneProcessResult::Success) {
+            report("Error: Out of memory after %zu clones\n", clone_count);
+
+            break;
+        }
+
+        clone_ids[clone_count] = clone_id;
+        clone_count += 1;
+    }
+
+    if(clone_count != 0) {
+        measure_process_lookups(clone_ids, clone_count, shared_address, shared_size, &exists_cycles, &map_cycles);
+
+        report(
+            "Process lookups with %zu processes: DoesProcessExist %zu cycles, MapSharedMemory %zu cycles\n",
+            clone_count + 1,
+            (size_t)exists_cycles,
+            (size_t)map_cycles
+        );
+    }
+
+    // The clones exit as soon as they receive the call, which fails it with InvalidProcessID
+    for(size_t i = 0; i < clone_count; i += 1) {
+        IPCMessage message {};
+        ipc_call(clone_ids[i], &message);
+    }
+
+    syscall_unmap_memory((size_t)clone_ids);
+    syscall_unmap_memory(shared_address);
+}
+
+const size_t spawn_benchmark_repeat_count = 16;
+
+// Times CreateProcess with this benchmark's own binary, which init passes as the data. The launched copies get no data
+// and exit straight away. The first launch prelinks the binary, and the repeats should find it in the kernel's cache.
+static void run_spawn_benchmark(const void *elf_binary, size_t elf_binary_size, size_t process_id) {
+    auto binary = (uint8_t*)syscall_map_free_memory(elf_binary_size);
+    if(binary == nullptr) {
+        report("Error: Unable to allocate spawn benchmark memory\n");
+
+        return;
+    }
+
+    copy_memory(elf_binary, binary, elf_binary_size);
+
+    // The unused bytes at the end of the ELF identity make the binary differ from the one init launched (and from
+    // earlier runs), so the first launch can't hit the cache
+    const size_t elf_identity_padding_offset = 9;
+    copy_memory(&process_id, &binary[elf_identity_padding_offset], sizeof(process_id) - 1);
+
+    uint64_t first_cycles = 0;
+    uint64_t repeat_cycles = 0;
+    for(size_t i = 0; i < spawn_benchmark_repeat_count + 1; i += 1) {
+        auto start_time = read_timestamp_counter();
+
+        auto result = syscall_create_process(binary, elf_binary_size, nullptr, 0, 0, 0);
+
+        auto time = read_timestamp_counter() - start_time;
+
+        if(result != CreateProcessResult::Success) {
+            report("Error: Unable to create spawn benchmark process\n");
+
+            syscall_unmap_memory((size_t)binary);
+
+            return;
+        }
+
+        if(i == 0) {
+            first_cycles = time;
+        } else {
+            repeat_cycles += time;
+        }
+    }
+
+    report(
+        "CreateProcess (%zu byte binary): first launch %zu cycles, repeat launches %zu cycles\n",
+        elf_binary_size,
+        (size_t)first_cycles,
+        (size_t)(repeat_cycles / spawn_benchmark_repeat_count)
+    );
+
+    syscall_unmap_memory((size_t)binary);
+}
+
+extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_size, const KernelInfo *kernel_info) {
+    // A copy launched by the spawn benchmark
+    if(data_size == 0) {
+        exit();
+    }
+
+    report("Benchmark started on %zu processor(s)\n", kernel_info->processor_count);
+
+    run_ring_benchmark(kernel_info, false);
+    run_ring_benchmark(kernel_info, true);
+
+    run_process_lookup_benchmark(process_id);
+
+    run_spawn_benchmark(data, data_size, process_id);
+
+    report("Benchmark done\n");
+
+    exit();
+}
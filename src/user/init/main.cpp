@@ -9,16 +9,29 @@
 #include "bucket_array_user.h"
 #include "compositor.h"
 #include "memory.h"
+#include "kernel_info.h"
 
 #define min(a, b) ((a) > (b) ? (b) : (a))
 #define max(a, b) ((a) < (b) ? (b) : (a))
 
+static LogRing *log_ring = nullptr;
+
 void _putchar(char character) {
-    syscall(SyscallType::DebugPrint, character, 0);
+    if(log_ring == nullptr) {
+        syscall_debug_print(character);
+    } else if(!write_log_ring(log_ring, character)) {
+        // The kernel hasn't caught up, have it drain the ring and then print the character straight away
+        syscall_debug_write((size_t)&character, 1);
+    }
 }
 
 const size_t queue_descriptor_count = 2;
 
+// Signalled by the virtio-gpu device's interrupt when it completes a command, or 0 if commands are spun on instead
+static size_t gpu_completion_event = 0;
+
+const size_t gpu_completion_signal = 1 << 0;
+
 const size_t buffer_size = 1024;
 
 static volatile virtio_gpu_ctrl_hdr *send_command(
@@ -37,7 +50,12 @@ static volatile virtio_gpu_ctrl_hdr *send_command(
 
     *notify = 0;
 
-    while(used_ring->idx == previous_used_index);
+    // Raised signals stay raised, so a completion between checking and waiting isn't missed
+    while(used_ring->idx == previous_used_index) {
+        if(gpu_completion_event != 0) {
+            syscall_wait_event(gpu_completion_event, gpu_completion_signal, event_wait_forever);
+        }
+    }
 
     return (volatile virtio_gpu_ctrl_hdr*)(buffers_address + buffer_size);
 }
@@ -45,6 +63,9 @@ static volatile virtio_gpu_ctrl_hdr *send_command(
 extern uint8_t test_app_executable[];
 extern uint8_t test_app_executable_end[];
 
+extern uint8_t benchmark_executable[];
+extern uint8_t benchmark_executable_end[];
+
 size_t cursor_bitmap_size = 16;
 extern uint32_t cursor_bitmap[];
 
@@ -54,8 +75,7 @@ extern uint32_t background_bitmap[];
 struct ClientProcess {
     size_t process_id;
 
-    volatile CompositorMailbox* mailbox;
-    volatile CompositorRing* ring;
+    CompositorRing *ring;
 };
 
 using ClientProcesses = BucketArray<ClientProcess, 4>;
@@ -91,32 +111,49 @@ using Windows = BucketArray<Window, 4>;
 static void send_size_changed_event(const Window *window) {
     auto ring = window->client_process->ring;
 
-    if(ring->read_head != ring->write_head) {
-        auto entry = &ring->entries[ring->write_head];
+    CompositorEvent compositor_event {};
 
-        entry->window_id = window->id;
+    compositor_event.window_id = window->id;
 
-        entry->type = CompositorEventType::SizeChanged;
+    compositor_event.type = CompositorEventType::SizeChanged;
 
-        entry->size_changed.width = window->width;
-        entry->size_changed.height = window->height;
+    compositor_event.size_changed.width = window->width;
+    compositor_event.size_changed.height = window->height;
 
-        ring->write_head = (ring->write_head + 1) % compositor_ring_length;
-    }
+    write_spsc_ring(ring, compositor_event);
 }
 
 static void send_focus_lost_event(const Window *window) {
     auto ring = window->client_process->ring;
 
-    if(ring->read_head != ring->write_head) {
-        auto entry = &ring->entries[ring->write_head];
+    CompositorEvent compositor_event {};
+
+    compositor_event.window_id = window->id;
 
-        entry->window_id = window->id;
+    compositor_event.type = CompositorEventType::FocusLost;
 
-        entry->type = CompositorEventType::FocusLost;
+    write_spsc_ring(ring, compositor_event);
+}
+
+// Closes all the windows belonging to a client process, then forgets it
+static void remove_client_process(ClientProcesses::Iterator client_process_iterator, Windows *windows, Window **focused_window) {
+    auto client_process = *client_process_iterator;
+
+    for(auto window_iterator = begin(*windows); window_iterator != end(*windows); ++window_iterator) {
+        auto window = *window_iterator;
+
+        if(window->client_process == client_process) {
+            if(window == *focused_window) {
+                *focused_window = nullptr;
+            }
 
-        ring->write_head = (ring->write_head + 1) % compositor_ring_length;
+            remove_item_from_bucket_array(window_iterator);
+        }
     }
+
+    syscall_unmap_memory((size_t)client_process->ring);
+
+    remove_item_from_bucket_array(client_process_iterator);
 }
 
 struct Framebuffer {
@@ -153,7 +190,12 @@ static void fill_rectangle(
     }
 }
 
-extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_size) {
+extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_size, const KernelInfo *kernel_info) {
+    size_t log_ring_address;
+    if(syscall_create_log_ring_2(&log_ring_address) == CreateLogRingResult::Success) {
+        log_ring = (LogRing*)log_ring_address;
+    }
+
     struct VirtIOInputDevice {
         volatile virtq_avail *available_ring;
 
@@ -174,19 +216,12 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     size_t virtio_input_index = 0;
     while(true) {
         size_t pcie_location;
-        FindPCIEDeviceParameters parameters {};
-        parameters.index = virtio_input_index;
-        parameters.require_vendor_id = true;
-        parameters.vendor_id = 0x1AF4;
-        parameters.require_device_id = true;
-        parameters.device_id = 0x1052;
-
-        if(syscall(
-            SyscallType::FindPCIEDevice,
-            (size_t)&parameters,
-            0,
-            &pcie_location
-        ) != (size_t)FindPCIEDeviceResult::Success) {
+        if(syscall_find_pcie_device_2(
+            &pcie_location,
+            virtio_input_index,
+            pack_pcie_device_ids(0x1AF4, 0x1052, 0, 0, 0),
+            find_pcie_device_require_vendor_id | find_pcie_device_require_device_id
+        ) != FindPCIEDeviceResult::Success) {
             break;
         }
 
@@ -208,11 +243,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         common_configuration->queue_select = 0; // Select eventq queue
 
         size_t queue_descriptors_physical_address;
-        auto queue_descriptors = (volatile virtq_desc*)syscall(
-            SyscallType::MapFreeConsecutiveMemory,
-            sizeof(virtq_desc) * virtio_input_queue_descriptor_count,
-            0,
-            &queue_descriptors_physical_address
+        auto queue_descriptors = (volatile virtq_desc*)syscall_map_free_consecutive_memory_2(
+            &queue_descriptors_physical_address,
+            sizeof(virtq_desc) * virtio_input_queue_descriptor_count
         );
         if(queue_descriptors == nullptr) {
             printf("Error: Unable to allocate memory for queue descriptor\n");
@@ -223,7 +256,7 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         common_configuration->queue_size = virtio_input_queue_descriptor_count; // Set eventq queue size
 
         size_t buffers_physical_address;
-        auto buffers_address = syscall(SyscallType::MapFreeConsecutiveMemory, virtio_input_buffer_size * virtio_input_queue_descriptor_count, 0, &buffers_physical_address);
+        auto buffers_address = syscall_map_free_consecutive_memory_2(&buffers_physical_address, virtio_input_buffer_size * virtio_input_queue_descriptor_count);
         if(buffers_address == 0) {
             printf("Error: Unable to allocate memory for queue buffers\n");
 
@@ -238,11 +271,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         }
 
         size_t available_ring_physical_address;
-        auto available_ring = (volatile virtq_avail*)syscall(
-            SyscallType::MapFreeConsecutiveMemory,
-            sizeof(virtq_avail) + sizeof(uint16_t) * virtio_input_queue_descriptor_count,
-            0,
-            &available_ring_physical_address
+        auto available_ring = (volatile virtq_avail*)syscall_map_free_consecutive_memory_2(
+            &available_ring_physical_address,
+            sizeof(virtq_avail) + sizeof(uint16_t) * virtio_input_queue_descriptor_count
         );
         if(available_ring == nullptr) {
             printf("Error: Unable to allocate memory for available ring\n");
@@ -251,11 +282,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         }
 
         size_t used_ring_physical_address;
-        auto used_ring = (volatile virtq_used*)syscall(
-            SyscallType::MapFreeConsecutiveMemory,
-            sizeof(virtq_used) + sizeof(virtq_used_elem) * virtio_input_queue_descriptor_count,
-            0,
-            &used_ring_physical_address
+        auto used_ring = (volatile virtq_used*)syscall_map_free_consecutive_memory_2(
+            &used_ring_physical_address,
+            sizeof(virtq_used) + sizeof(virtq_used_elem) * virtio_input_queue_descriptor_count
         );
         if(used_ring == nullptr) {
             printf("Error: Unable to allocate memory for used ring\n");
@@ -289,18 +318,12 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
     size_t virtio_gpu_location;
     {
-        FindPCIEDeviceParameters parameters {};
-        parameters.require_vendor_id = true;
-        parameters.vendor_id = 0x1AF4;
-        parameters.require_device_id = true;
-        parameters.device_id = 0x1050;
-
-        if(syscall(
-            SyscallType::FindPCIEDevice,
-            (size_t)&parameters,
+        if(syscall_find_pcie_device_2(
+            &virtio_gpu_location,
             0,
-            &virtio_gpu_location
-        ) != (size_t)FindPCIEDeviceResult::Success) {
+            pack_pcie_device_ids(0x1AF4, 0x1050, 0, 0, 0),
+            find_pcie_device_require_vendor_id | find_pcie_device_require_device_id
+        ) != FindPCIEDeviceResult::Success) {
             printf("Error: virtio-gpu device not present\n");
 
             exit();
@@ -318,11 +341,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     common_configuration->queue_select = 0; // Select controlq queue
 
     size_t queue_descriptors_physical_address;
-    auto queue_descriptors = (volatile virtq_desc*)syscall(
-        SyscallType::MapFreeConsecutiveMemory,
-        sizeof(virtq_desc) * queue_descriptor_count,
-        0,
-        &queue_descriptors_physical_address
+    auto queue_descriptors = (volatile virtq_desc*)syscall_map_free_consecutive_memory_2(
+        &queue_descriptors_physical_address,
+        sizeof(virtq_desc) * queue_descriptor_count
     );
     if(queue_descriptors == nullptr) {
         printf("Error: Unable to allocate memory for queue descriptor\n");
@@ -338,7 +359,7 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     queue_descriptors[1].flags = 0b10; // Set device writable (device buffer)
 
     size_t buffers_physical_address;
-    auto buffers_address = syscall(SyscallType::MapFreeConsecutiveMemory, buffer_size * queue_descriptor_count, 0, &buffers_physical_address);
+    auto buffers_address = syscall_map_free_consecutive_memory_2(&buffers_physical_address, buffer_size * queue_descriptor_count);
     if(buffers_address == 0) {
         printf("Error: Unable to allocate memory for queue buffers\n");
 
@@ -351,11 +372,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     }
 
     size_t available_ring_physical_address;
-    auto available_ring = (volatile virtq_avail*)syscall(
-        SyscallType::MapFreeConsecutiveMemory,
-        sizeof(virtq_avail) + sizeof(uint16_t) * queue_descriptor_count,
-        0,
-        &available_ring_physical_address
+    auto available_ring = (volatile virtq_avail*)syscall_map_free_consecutive_memory_2(
+        &available_ring_physical_address,
+        sizeof(virtq_avail) + sizeof(uint16_t) * queue_descriptor_count
     );
     if(available_ring == nullptr) {
         printf("Error: Unable to allocate memory for available ring\n");
@@ -364,11 +383,9 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     }
 
     size_t used_ring_physical_address;
-    auto used_ring = (volatile virtq_used*)syscall(
-        SyscallType::MapFreeConsecutiveMemory,
-        sizeof(virtq_used) + sizeof(virtq_used_elem) * queue_descriptor_count,
-        0,
-        &used_ring_physical_address
+    auto used_ring = (volatile virtq_used*)syscall_map_free_consecutive_memory_2(
+        &used_ring_physical_address,
+        sizeof(virtq_used) + sizeof(virtq_used_elem) * queue_descriptor_count
     );
     if(used_ring == nullptr) {
         printf("Error: Unable to allocate memory for used ring\n");
@@ -380,6 +397,24 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     common_configuration->queue_driver = available_ring_physical_address;
     common_configuration->queue_device = used_ring_physical_address;
 
+    size_t completion_event;
+    if(syscall_create_event_2(&completion_event) == CreateEventResult::Success) {
+        if(syscall_bind_pcie_interrupt(virtio_gpu_location, 0, completion_event, gpu_completion_signal) == BindPCIEInterruptResult::Success) {
+            common_configuration->queue_msix_vector = 0; // Use MSI-X table entry 0 for controlq
+
+            // Reads back as VIRTIO_MSI_NO_VECTOR if the device couldn't take it
+            if(common_configuration->queue_msix_vector == 0) {
+                gpu_completion_event = completion_event;
+            } else {
+                syscall_unbind_pcie_interrupt(virtio_gpu_location, 0);
+            }
+        }
+
+        if(gpu_completion_event == 0) {
+            syscall_close_handle(completion_event);
+        }
+    }
+
     common_configuration->queue_enable = 1;
 
     auto notify_capability = (volatile virtio_pci_notify_cap*)find_capability(configuration_address, 2);
@@ -389,7 +424,7 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         exit();
     }
 
-    auto notify_bar_address = syscall(SyscallType::MapPCIEBar, notify_capability->bar | virtio_gpu_location << bar_index_bits, 0);
+    auto notify_bar_address = syscall_map_pcie_bar(notify_capability->bar | virtio_gpu_location << bar_index_bits);
     if(notify_bar_address == 0) {
         printf("Error: Unable to map notify BAR for virtio-gpu\n");
 
@@ -452,7 +487,7 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     auto display_framebuffer_size = display_height * display_width * 4;
 
     size_t framebuffer_physical_address;
-    auto display_framebuffer_address = syscall(SyscallType::MapFreeConsecutiveMemory, display_framebuffer_size, 0, &framebuffer_physical_address);
+    auto display_framebuffer_address = syscall_map_free_consecutive_memory_2(&framebuffer_physical_address, display_framebuffer_size);
     if(display_framebuffer_address == 0) {
         printf("Error: Unable to allocate memory for display framebuffer\n");
 
@@ -513,22 +548,14 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
     size_t next_window_id = 0;
 
-    auto connection_mailbox_address = syscall(SyscallType::CreateSharedMemory, sizeof(CompositorConnectionMailbox), 0);
-    if(connection_mailbox_address == 0) {
-        printf("Error: Unable to allocate shared memory for compositor connection mailbox\n");
-
-        exit();
-    }
-
-    auto connection_mailbox = (volatile CompositorConnectionMailbox*)connection_mailbox_address;
-
     TestAppParameters test_app_parameters {
-        process_id,
-        connection_mailbox_address
+        process_id
     };
 
     auto test_app_executable_size = (size_t)&test_app_executable_end - (size_t)&test_app_executable;
 
+    auto benchmark_executable_size = (size_t)&benchmark_executable_end - (size_t)&benchmark_executable;
+
     const intptr_t window_title_height = 32;
 
     enum struct WindowSide {
@@ -548,6 +575,29 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
     auto previous_cursor_x = cursor_x;
     auto previous_cursor_y = cursor_y;
 
+    // The kernel sends a message from each client as it exits, see WatchProcessExit
+    size_t client_exit_channel;
+    if(syscall_create_channel_2(&client_exit_channel) != CreateChannelResult::Success) {
+        printf("Error: Unable to create client exit channel\n");
+
+        exit();
+    }
+
+    // Each frame is drawn at the start of a 60Hz period, with time for it guaranteed, and client commands are handled
+    // for the rest of the period. Without a period WaitForNextPeriod only relinquishes, so the receive timeout alone
+    // paces the frames.
+    if(syscall_set_thread_period(16666, 8000) != SetThreadPeriodResult::Success) {
+        printf("Error: Unable to set compositor frame period\n");
+    }
+
+    const uint64_t frame_duration = 16666667; // Nanoseconds
+
+    // Commands stop being taken this long before the period ends, so WaitForNextPeriod is reached within the period
+    // rather than giving up the whole next one
+    const uint64_t frame_wait_margin = 1000000; // Nanoseconds
+
+    auto frame_start_time = get_time_nanoseconds(kernel_info);
+
     while(true) {
         auto get_display_info_command = (volatile virtio_gpu_ctrl_hdr*)buffers_address;
         get_display_info_command->type = virtio_gpu_ctrl_type::VIRTIO_GPU_CMD_GET_DISPLAY_INFO;
@@ -621,7 +671,7 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
             auto display_framebuffer_size = display_height * display_width * 4;
 
             size_t framebuffer_physical_address;
-            display_framebuffer_address = syscall(SyscallType::MapFreeConsecutiveMemory, display_framebuffer_size, 0, &framebuffer_physical_address);
+            display_framebuffer_address = syscall_map_free_consecutive_memory_2(&framebuffer_physical_address, display_framebuffer_size);
             if(display_framebuffer_address == 0) {
                 printf("Error: Unable to allocate memory for display framebuffer\n");
 
@@ -686,266 +736,288 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
             }
         }
 
-        if(connection_mailbox->locked && connection_mailbox->connection_requested) {
-            do { // Purely so break can be used for early-out
-                if(!(bool)syscall(SyscallType::DoesProcessExist, connection_mailbox->process_id, 0)) {
-                    connection_mailbox->result = CompositorConnectionResult::InvalidProcessID;
-
-                    break;
-                }
+        // Forget the clients that exited since the last frame
+        while(true) {
+            size_t channel_index;
+            size_t exited_process_id;
+            IPCMessage exit_message;
+            if(channel_receive(&client_exit_channel, 1, false, &channel_index, &exited_process_id, &exit_message) != ChannelReceiveResult::Success) {
+                break;
+            }
 
-                auto mailbox_address = syscall(SyscallType::CreateSharedMemory, sizeof(CompositorMailbox), 0);
-                if(mailbox_address == 0) {
-                    connection_mailbox->result = CompositorConnectionResult::OutOfMemory;
+            for(auto client_process_iterator = begin(client_processes); client_process_iterator != end(client_processes); ++client_process_iterator) {
+                if((*client_process_iterator)->process_id == exited_process_id) {
+                    remove_client_process(client_process_iterator, &windows, &focused_window);
 
                     break;
                 }
+            }
+        }
 
-                auto mailbox = (volatile CompositorMailbox*)mailbox_address;
-
-                auto ring_address = syscall(SyscallType::CreateSharedMemory, sizeof(CompositorRing), 0);
-                if(ring_address == 0) {
-                    syscall(SyscallType::UnmapMemory, mailbox_address, 0);
+        // Handle the commands clients send until the period is nearly over. Each client is blocked in ipc_call until the
+        // reply, and while the compositor is waiting here its call is handed straight over and replied to right away.
+        auto receive_end_time = frame_start_time + frame_duration - frame_wait_margin;
 
-                    connection_mailbox->result = CompositorConnectionResult::OutOfMemory;
+        while(true) {
+            auto time = get_time_nanoseconds(kernel_info);
 
-                    break;
-                }
+            size_t timeout = 0;
+            if(time < receive_end_time) {
+                timeout = (size_t)((receive_end_time - time) / 1000);
+            }
 
-                auto ring = (volatile CompositorRing*)ring_address;
+            size_t caller_process_id;
+            IPCMessage message;
+            if(ipc_receive(timeout, &caller_process_id, &message) != IPCReceiveResult::Success) {
+                break;
+            }
 
-                auto client_process = allocate_from_bucket_array(&client_processes);
-                if(client_process == nullptr) {
-                    syscall(SyscallType::UnmapMemory, mailbox_address, 0);
-                    syscall(SyscallType::UnmapMemory, ring_address, 0);
+            IPCMessage reply {};
 
-                    connection_mailbox->result = CompositorConnectionResult::OutOfMemory;
+            ClientProcess *client_process = nullptr;
+            for(auto the_client_process : client_processes) {
+                if(the_client_process->process_id == caller_process_id) {
+                    client_process = the_client_process;
 
                     break;
                 }
+            }
 
-                client_process->process_id = connection_mailbox->process_id;
-                client_process->mailbox = mailbox;
-                client_process->ring = ring;
-
-                connection_mailbox->mailbox_shared_memory = mailbox_address;
-                connection_mailbox->ring_shared_memory = ring_address;
-
-                connection_mailbox->result = CompositorConnectionResult::Success;
-            } while(false);
-
-            connection_mailbox->connection_requested = false;
-        }
-
-        for(auto client_process_iterator = begin(client_processes); client_process_iterator != end(client_processes); ++client_process_iterator) {
-            auto client_process = *client_process_iterator;
+            switch((CompositorCommandType)message.words[0]) {
+                case CompositorCommandType::Connect: {
+                    if(client_process != nullptr) {
+                        reply.words[0] = (size_t)CompositorConnectionResult::Success;
+                        reply.words[1] = (size_t)client_process->ring;
 
-            if(!(bool)syscall(SyscallType::DoesProcessExist, client_process->process_id, 0)) {
-                for(auto window_iterator = begin(windows); window_iterator != end(windows); ++window_iterator) {
-                    auto window = *window_iterator;
+                        break;
+                    }
 
-                    if(window->client_process == client_process) {
-                        if(window == focused_window) {
-                            focused_window = nullptr;
-                        }
+                    auto ring_address = syscall_create_shared_memory(sizeof(CompositorRing));
+                    if(ring_address == 0) {
+                        reply.words[0] = (size_t)CompositorConnectionResult::OutOfMemory;
 
-                        remove_item_from_bucket_array(window_iterator);
+                        break;
                     }
-                }
 
-                syscall(SyscallType::UnmapMemory, (size_t)client_process->mailbox, 0);
-                syscall(SyscallType::UnmapMemory, (size_t)client_process->ring, 0);
+                    auto ring = (CompositorRing*)ring_address;
 
-                remove_item_from_bucket_array(client_process_iterator);
+                    // Without an exit notification the client would never be cleaned up
+                    if(syscall_watch_process_exit(caller_process_id, client_exit_channel, 0) != WatchProcessExitResult::Success) {
+                        syscall_unmap_memory(ring_address);
 
-                continue;
-            }
+                        reply.words[0] = (size_t)CompositorConnectionResult::OutOfMemory;
 
-            auto mailbox = client_process->mailbox;
-            auto ring = client_process->ring;
+                        break;
+                    }
 
-            if(mailbox->command_present){
-                switch(mailbox->command_type) {
-                    case CompositorCommandType::CreateWindow: {
-                        auto command = &mailbox->create_window;
+                    client_process = allocate_from_bucket_array(&client_processes);
+                    if(client_process == nullptr) {
+                        syscall_unmap_memory(ring_address);
 
-                        if(command->width <= 0 || command->height <= 0) {
-                            command->result = CreateWindowResult::InvalidSize;
+                        reply.words[0] = (size_t)CompositorConnectionResult::OutOfMemory;
 
-                            mailbox->command_present = false;
+                        break;
+                    }
 
-                            break;
-                        }
+                    client_process->process_id = caller_process_id;
+                    client_process->ring = ring;
 
-                        auto swap_indicator_address = syscall(SyscallType::CreateSharedMemory, sizeof(bool), 0);
-                        if(swap_indicator_address == 0) {
-                            command->result = CreateWindowResult::OutOfMemory;
+                    reply.words[0] = (size_t)CompositorConnectionResult::Success;
+                    reply.words[1] = ring_address;
+                } break;
 
-                            mailbox->command_present = false;
+                case CompositorCommandType::CreateWindow: {
+                    auto x = (intptr_t)message.words[1];
+                    auto y = (intptr_t)message.words[2];
+                    auto width = (intptr_t)message.words[3];
+                    auto height = (intptr_t)message.words[4];
 
-                            break;
-                        }
+                    if(client_process == nullptr) {
+                        reply.words[0] = (size_t)CreateWindowResult::NotConnected;
 
-                        auto framebuffers_address = syscall(SyscallType::CreateSharedMemory, command->width * command->height * 4 * 2, 0);
-                        if(framebuffers_address == 0) {
-                            syscall(SyscallType::UnmapMemory, swap_indicator_address, 0);
+                        break;
+                    }
 
-                            command->result = CreateWindowResult::OutOfMemory;
+                    auto ring = client_process->ring;
 
-                            mailbox->command_present = false;
+                    if(width <= 0 || height <= 0) {
+                        reply.words[0] = (size_t)CreateWindowResult::InvalidSize;
 
-                            break;
-                        }
+                        break;
+                    }
 
-                        auto window = allocate_from_bucket_array(&windows);
-                        if(window == nullptr) {
-                            syscall(SyscallType::UnmapMemory, swap_indicator_address, 0);
-                            syscall(SyscallType::UnmapMemory, framebuffers_address, 0);
+                    auto swap_indicator_address = syscall_create_shared_memory(sizeof(bool));
+                    if(swap_indicator_address == 0) {
+                        reply.words[0] = (size_t)CreateWindowResult::OutOfMemory;
 
-                            command->result = CreateWindowResult::OutOfMemory;
+                        break;
+                    }
 
-                            mailbox->command_present = false;
+                    auto framebuffers_address = syscall_create_shared_memory(width * height * 4 * 2);
+                    if(framebuffers_address == 0) {
+                        syscall_unmap_memory(swap_indicator_address);
 
-                            break;
-                        }
+                        reply.words[0] = (size_t)CreateWindowResult::OutOfMemory;
 
-                        auto any_windows = false;
-                        size_t highest_window_z_index;
-                        for(auto window : windows) {
-                            if(!any_windows || window->z_index > highest_window_z_index) {
-                                highest_window_z_index = window->z_index;
-                                any_windows = true;
-                            }
-                        }
+                        break;
+                    }
 
-                        window->client_process = client_process;
+                    auto window = allocate_from_bucket_array(&windows);
+                    if(window == nullptr) {
+                        syscall_unmap_memory(swap_indicator_address);
+                        syscall_unmap_memory(framebuffers_address);
 
-                        window->id = next_window_id;
-                        next_window_id += 1;
+                        reply.words[0] = (size_t)CreateWindowResult::OutOfMemory;
 
-                        window->x = command->x;
-                        window->y = command->y;
-                        window->width = command->width;
-                        window->height = command->height;
-                        window->framebuffer_width = command->width;
-                        window->framebuffer_height = command->height;
+                        break;
+                    }
 
-                        if(any_windows) {
-                            window->z_index = highest_window_z_index + 1;
+                    auto any_windows = false;
+                    size_t highest_window_z_index;
+                    for(auto window : windows) {
+                        if(!any_windows || window->z_index > highest_window_z_index) {
+                            highest_window_z_index = window->z_index;
+                            any_windows = true;
                         }
+                    }
 
-                        window->framebuffers = (volatile uint32_t*)framebuffers_address;
-                        window->swap_indicator = (volatile bool*)swap_indicator_address;
+                    window->client_process = client_process;
 
-                        command->result = CreateWindowResult::Success;
+                    window->id = next_window_id;
+                    next_window_id += 1;
 
-                        command->id = window->id;
-                        command->framebuffers_shared_memory = framebuffers_address;
-                        command->swap_indicator_shared_memory = swap_indicator_address;
+                    window->x = x;
+                    window->y = y;
+                    window->width = width;
+                    window->height = height;
+                    window->framebuffer_width = width;
+                    window->framebuffer_height = height;
 
-                        mailbox->command_present = false;
+                    if(any_windows) {
+                        window->z_index = highest_window_z_index + 1;
+                    }
 
-                        if(focused_window != nullptr) {
-                            if(resizing_focused_window) {
-                                send_size_changed_event(focused_window);
+                    window->framebuffers = (volatile uint32_t*)framebuffers_address;
+                    window->swap_indicator = (volatile bool*)swap_indicator_address;
 
-                                resizing_focused_window = false;
-                            }
+                    reply.words[0] = (size_t)CreateWindowResult::Success;
+                    reply.words[1] = window->id;
+                    reply.words[2] = framebuffers_address;
+                    reply.words[3] = swap_indicator_address;
 
-                            dragging_focused_window = false;
+                    if(focused_window != nullptr) {
+                        if(resizing_focused_window) {
+                            send_size_changed_event(focused_window);
 
-                            send_focus_lost_event(focused_window);
+                            resizing_focused_window = false;
                         }
 
-                        focused_window = window;
+                        dragging_focused_window = false;
 
-                        if(ring->read_head != ring->write_head) {
-                            auto entry = &ring->entries[ring->write_head];
-
-                            entry->window_id = focused_window->id;
+                        send_focus_lost_event(focused_window);
+                    }
 
-                            entry->type = CompositorEventType::FocusGained;
+                    focused_window = window;
 
-                            entry->focus_gained.mouse_x = cursor_x - focused_window->x;
-                            entry->focus_gained.mouse_y = cursor_y - focused_window->y - window_title_height;
+                    CompositorEvent compositor_event {};
 
-                            ring->write_head = (ring->write_head + 1) % compositor_ring_length;
-                        }
-                    } break;
+                    compositor_event.window_id = focused_window->id;
 
-                    case CompositorCommandType::DestroyWindow: {
-                        auto command = &mailbox->destroy_window;
+                    compositor_event.type = CompositorEventType::FocusGained;
 
-                        for(auto window_iterator = begin(windows); window_iterator != end(windows); ++window_iterator) {
-                            auto window = *window_iterator;
+                    compositor_event.focus_gained.mouse_x = cursor_x - focused_window->x;
+                    compositor_event.focus_gained.mouse_y = cursor_y - focused_window->y - window_title_height;
 
-                            if(window->id == command->id) {
-                                if(window == focused_window) {
-                                    focused_window = nullptr;
-                                }
+                    write_spsc_ring(ring, compositor_event);
+                } break;
 
-                                syscall(SyscallType::UnmapMemory, (size_t)window->framebuffers, 0);
-                                syscall(SyscallType::UnmapMemory, (size_t)window->swap_indicator, 0);
+                case CompositorCommandType::DestroyWindow: {
+                    auto id = message.words[1];
 
-                                remove_item_from_bucket_array(window_iterator);
+                    if(client_process == nullptr) {
+                        reply.words[0] = (size_t)DestroyWindowResult::NotConnected;
 
-                                break;
-                            }
-                        }
+                        break;
+                    }
 
-                        mailbox->command_present = false;
-                    } break;
+                    for(auto window_iterator = begin(windows); window_iterator != end(windows); ++window_iterator) {
+                        auto window = *window_iterator;
 
-                    case CompositorCommandType::ResizeFramebuffers: {
-                        auto command = &mailbox->resize_framebuffers;
+                        if(window->id == id && window->client_process == client_process) {
+                            if(window == focused_window) {
+                                focused_window = nullptr;
+                            }
 
-                        if(command->width <= 0 || command->height <= 0) {
-                            command->result = ResizeFramebuffersResult::InvalidSize;
+                            syscall_unmap_memory((size_t)window->framebuffers);
+                            syscall_unmap_memory((size_t)window->swap_indicator);
 
-                            mailbox->command_present = false;
+                            remove_item_from_bucket_array(window_iterator);
 
                             break;
                         }
+                    }
 
-                        command->result = ResizeFramebuffersResult::InvalidWindowID;
+                    reply.words[0] = (size_t)DestroyWindowResult::Success;
+                } break;
 
-                        for(auto window_iterator = begin(windows); window_iterator != end(windows); ++window_iterator) {
-                            auto window = *window_iterator;
+                case CompositorCommandType::ResizeFramebuffers: {
+                    auto id = message.words[1];
+                    auto width = (intptr_t)message.words[2];
+                    auto height = (intptr_t)message.words[3];
 
-                            if(window->id == command->id) {
-                                auto framebuffers_address = syscall(SyscallType::CreateSharedMemory, command->width * command->height * 4 * 2, 0);
-                                if(framebuffers_address == 0) {
-                                    command->result = ResizeFramebuffersResult::OutOfMemory;
+                    if(client_process == nullptr) {
+                        reply.words[0] = (size_t)ResizeFramebuffersResult::NotConnected;
 
-                                    mailbox->command_present = false;
+                        break;
+                    }
 
-                                    break;
-                                }
+                    if(width <= 0 || height <= 0) {
+                        reply.words[0] = (size_t)ResizeFramebuffersResult::InvalidSize;
 
-                                syscall(SyscallType::UnmapMemory, (size_t)window->framebuffers, 0);
+                        break;
+                    }
 
-                                window->framebuffer_width = command->width;
-                                window->framebuffer_height = command->height;
-                                window->framebuffers = (volatile uint32_t*)framebuffers_address;
+                    reply.words[0] = (size_t)ResizeFramebuffersResult::InvalidWindowID;
 
-                                command->framebuffers_shared_memory = framebuffers_address;
+                    for(auto window_iterator = begin(windows); window_iterator != end(windows); ++window_iterator) {
+                        auto window = *window_iterator;
 
-                                command->result = ResizeFramebuffersResult::Success;
+                        if(window->id == id && window->client_process == client_process) {
+                            auto framebuffers_address = syscall_create_shared_memory(width * height * 4 * 2);
+                            if(framebuffers_address == 0) {
+                                reply.words[0] = (size_t)ResizeFramebuffersResult::OutOfMemory;
 
                                 break;
                             }
-                        }
 
-                        mailbox->command_present = false;
-                    } break;
+                            syscall_unmap_memory((size_t)window->framebuffers);
 
-                    default: {
-                        printf("Error: Unknown compositor command type %u from client process %zu\n", mailbox->command_type, client_process->process_id);
-                    } break;
-                }
+                            window->framebuffer_width = width;
+                            window->framebuffer_height = height;
+                            window->framebuffers = (volatile uint32_t*)framebuffers_address;
+
+                            reply.words[0] = (size_t)ResizeFramebuffersResult::Success;
+                            reply.words[1] = framebuffers_address;
+
+                            break;
+                        }
+                    }
+                } break;
+
+                default: {
+                    printf("Error: Unknown compositor command type %zu from process %zu\n", message.words[0], caller_process_id);
+                } break;
             }
+
+            ipc_reply(caller_process_id, reply);
         }
 
+        // Calls that come in while waiting are queued for the next frame. Frames that run late aren't made up for, the
+        // next one starts with the next period.
+        syscall_wait_for_next_period();
+
+        frame_start_time = get_time_nanoseconds(kernel_info);
+
         intptr_t app_launch_bar_size = 48;
 
         for(auto device : virtio_input_devices) {
@@ -964,14 +1036,14 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
                             if(key_state && is_mouse_button && cursor_y >= display_height - app_launch_bar_size) {
                                 if(event->code == 0x110 && cursor_x < app_launch_bar_size) { // BTN_LEFT
-                                    CreateProcessParameters parameters {
+                                    switch(syscall_create_process(
                                         &test_app_executable,
                                         test_app_executable_size,
                                         &test_app_parameters,
-                                        sizeof(TestAppParameters)
-                                    };
-
-                                    switch((CreateProcessResult)syscall(SyscallType::CreateProcess, (size_t)&parameters, 0)) {
+                                        sizeof(TestAppParameters),
+                                        0,
+                                        0
+                                    )) {
                                         case CreateProcessResult::Success: break;
 
                                         case CreateProcessResult::OutOfMemory: {
@@ -986,6 +1058,31 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                                             printf("Error: Unable to create test app process: Invalid ELF binary\n");
                                         } break;
                                     }
+                                } else if(event->code == 0x110 && cursor_x < app_launch_bar_size * 2) { // BTN_LEFT
+                                    // The benchmark reports on the kernel console, so it has no window. It gets its
+                                    // own binary to time launching it.
+                                    switch(syscall_create_process(
+                                        &benchmark_executable,
+                                        benchmark_executable_size,
+                                        &benchmark_executable,
+                                        benchmark_executable_size,
+                                        0,
+                                        0
+                                    )) {
+                                        case CreateProcessResult::Success: break;
+
+                                        case CreateProcessResult::OutOfMemory: {
+                                            printf("Error: Unable to create benchmark process: Out of memory\n");
+                                        } break;
+
+                                        case CreateProcessResult::InvalidMemoryRange: {
+                                            printf("Error: Unable to create benchmark process: Invalid memory range for ELF binary\n");
+                                        } break;
+
+                                        case CreateProcessResult::InvalidELF: {
+                                            printf("Error: Unable to create benchmark process: Invalid ELF binary\n");
+                                        } break;
+                                    }
                                 }
                             } else {
                                 if(key_state && is_mouse_button) {
@@ -1103,14 +1200,14 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                                         } else if(cursor_y < focused_window->y + window_title_height) {
                                             if(event->code == 0x110) { // BTN_LEFT
                                                 if(cursor_x > focused_window->x + focused_window->width - window_title_height) {
-                                                    if(key_state && ring->read_head != ring->write_head) {
-                                                        auto entry = &ring->entries[ring->write_head];
+                                                    if(key_state) {
+                                                        CompositorEvent compositor_event {};
 
-                                                        entry->window_id = focused_window->id;
+                                                        compositor_event.window_id = focused_window->id;
 
-                                                        entry->type = CompositorEventType::CloseRequested;
+                                                        compositor_event.type = CompositorEventType::CloseRequested;
 
-                                                        ring->write_head = (ring->write_head + 1) % compositor_ring_length;
+                                                        write_spsc_ring(ring, compositor_event);
                                                     }
                                                 } else if(cursor_x > focused_window->x + focused_window->width - window_title_height * 2) {
                                                     if(key_state) {
@@ -1161,20 +1258,20 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                                         }
                                     }
 
-                                    if(forward_event && ring->read_head != ring->write_head) {
-                                        auto entry = &ring->entries[ring->write_head];
+                                    if(forward_event) {
+                                        CompositorEvent compositor_event {};
 
-                                        entry->window_id = focused_window->id;
+                                        compositor_event.window_id = focused_window->id;
 
                                         if(key_state) {
-                                            entry->type = CompositorEventType::KeyDown;
-                                            entry->key_down.scancode = event->code;
+                                            compositor_event.type = CompositorEventType::KeyDown;
+                                            compositor_event.key_down.scancode = event->code;
                                         } else {
-                                            entry->type = CompositorEventType::KeyUp;
-                                            entry->key_down.scancode = event->code;
+                                            compositor_event.type = CompositorEventType::KeyUp;
+                                            compositor_event.key_down.scancode = event->code;
                                         }
 
-                                        ring->write_head = (ring->write_head + 1) % compositor_ring_length;
+                                        write_spsc_ring(ring, compositor_event);
                                     }
                                 }
                             }
@@ -1241,19 +1338,19 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                                             focused_window->width += cursor_x_difference;
                                         } break;
                                     }
-                                } else if(ring->read_head != ring->write_head) {
-                                    auto entry = &ring->entries[ring->write_head];
+                                } else {
+                                    CompositorEvent compositor_event {};
 
-                                    entry->window_id = focused_window->id;
+                                    compositor_event.window_id = focused_window->id;
 
-                                    entry->type = CompositorEventType::MouseMove;
+                                    compositor_event.type = CompositorEventType::MouseMove;
 
-                                    entry->mouse_move.x = cursor_x - focused_window->x;
-                                    entry->mouse_move.dx = dx;
-                                    entry->mouse_move.y = cursor_y - focused_window->y - window_title_height;
-                                    entry->mouse_move.dy = dy;
+                                    compositor_event.mouse_move.x = cursor_x - focused_window->x;
+                                    compositor_event.mouse_move.dx = dx;
+                                    compositor_event.mouse_move.y = cursor_y - focused_window->y - window_title_height;
+                                    compositor_event.mouse_move.dy = dy;
 
-                                    ring->write_head = (ring->write_head + 1) % compositor_ring_length;
+                                    write_spsc_ring(ring, compositor_event);
                                 }
                             }
                         } break;
@@ -1434,6 +1531,13 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
             display_framebuffer
         );
 
+        fill_rectangle(
+            app_launch_bar_size, display_height - app_launch_bar_size,
+            app_launch_bar_size, app_launch_bar_size,
+            0x999999,
+            display_framebuffer
+        );
+
         for(size_t y = 0; y < cursor_bitmap_size; y += 1) {
             for(size_t x = 0; x < cursor_bitmap_size; x += 1) {
                 auto absolute_x = x + cursor_x;
@@ -1505,10 +1609,17 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 asm(
     ".section .rodata\n"
     "test_app_executable:\n"
-    ".incbin \"build/test_app.elf\"\n"
+    ".incbin \"build/test_app_linked.elf\"\n"
     "test_app_executable_end:"
 );
 
+asm(
+    ".section .rodata\n"
+    "benchmark_executable:\n"
+    ".incbin \"build/benchmark.elf\"\n"
+    "benchmark_executable_end:"
+);
+
 asm(
     ".section .rodata\n"
     "cursor_bitmap:\n"
@@ -27,7 +27,7 @@ bool init_virtio_device(
     size_t *result_configuration_address,
     volatile virtio_pci_common_cfg **result_common_configuration
 ) {
-    auto configuration_address = syscall(SyscallType::MapPCIEConfiguration, pci_device_location, 0);
+    auto configuration_address = syscall_map_pcie_configuration(pci_device_location);
     if(configuration_address == 0) {
         return false;
     }
@@ -37,7 +37,7 @@ bool init_virtio_device(
         return false;
     }
 
-    auto common_bar_address = syscall(SyscallType::MapPCIEBar, common_config_capability->bar | pci_device_location << bar_index_bits, 0);
+    auto common_bar_address = syscall_map_pcie_bar(common_config_capability->bar | pci_device_location << bar_index_bits);
     if(common_bar_address == 0) {
         return false;
     }
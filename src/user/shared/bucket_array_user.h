@@ -10,7 +10,7 @@ static T *allocate_from_bucket_array(
     auto iterator = find_available_bucket_slot(bucket_array);
 
     if(iterator.current_bucket == nullptr) {
-        auto new_bucket = (Bucket<T, N>*)syscall(SyscallType::MapFreeMemory, sizeof(Bucket<T, N>), 0);
+        auto new_bucket = (Bucket<T, N>*)syscall_map_free_memory(sizeof(Bucket<T, N>));
         if(new_bucket == nullptr) {
             return nullptr;
         }
@@ -48,7 +48,7 @@ static void deallocate_bucket(const Bucket<T, N> *bucket) {
         deallocate_bucket(bucket->next);
     }
 
-    syscall(SyscallType::UnmapMemory, (size_t)bucket, 0);
+    syscall_unmap_memory((size_t)bucket);
 }
 
 template <typename T, size_t N>
@@ -1,80 +1,47 @@
 #pragma once
 
-enum struct CompositorConnectionResult {
-    Success,
-    InvalidProcessID,
-    OutOfMemory
-};
+#include "ring.h"
 
-struct CompositorConnectionMailbox {
-    bool locked;
+// Commands are sent to the compositor process with ipc_call. Word 0 of the message is the CompositorCommandType and
+// the following words are the parameters. Word 0 of the reply is the result, followed by the returns.
 
-    bool connection_requested;
+enum struct CompositorCommandType : size_t {
+    // Returns: ring shared memory
+    Connect,
 
-    // Parameters
-    size_t process_id;
-
-    // Returns
-    CompositorConnectionResult result;
-    size_t mailbox_shared_memory;
-    size_t ring_shared_memory;
-};
-
-enum struct CompositorCommandType {
+    // Parameters: x, y, width, height. Returns: id, framebuffers shared memory, swap indicator shared memory
     CreateWindow,
+
+    // Parameters: id
     DestroyWindow,
+
+    // Parameters: id, width, height. Returns: framebuffers shared memory
     ResizeFramebuffers
 };
 
-enum struct CreateWindowResult {
+enum struct CompositorConnectionResult : size_t {
     Success,
-    InvalidSize,
     OutOfMemory
 };
 
-enum struct ResizeFramebuffersResult {
+enum struct CreateWindowResult : size_t {
     Success,
     InvalidSize,
-    InvalidWindowID,
-    OutOfMemory
+    OutOfMemory,
+    NotConnected
 };
 
-struct CompositorMailbox {
-    bool command_present;
-
-    CompositorCommandType command_type;
-
-    union {
-        struct {
-            // Parameters
-            intptr_t x;
-            intptr_t y;
-            intptr_t width;
-            intptr_t height;
-
-            // Returns
-            CreateWindowResult result;
-            size_t id;
-            size_t framebuffers_shared_memory;
-            size_t swap_indicator_shared_memory;
-        } create_window;
-
-        struct {
-            // Parameters
-            size_t id;
-        } destroy_window;
-
-        struct {
-            // Parameters
-            size_t id;
-            intptr_t width;
-            intptr_t height;
+enum struct DestroyWindowResult : size_t {
+    Success,
+    NotConnected
+};
 
-            // Returns
-            ResizeFramebuffersResult result;
-            size_t framebuffers_shared_memory;
-        } resize_framebuffers;
-    };
+enum struct ResizeFramebuffersResult : size_t {
+    Success,
+    InvalidSize,
+    InvalidWindowID,
+    OutOfMemory,
+    NotConnected
 };
 
 enum struct CompositorEventType {
@@ -121,11 +88,7 @@ struct CompositorEvent {
     };
 };
 
-const size_t compositor_ring_length = 16;
-
-struct CompositorRing {
-    size_t read_head;
-    size_t write_head;
+const size_t compositor_ring_length = 64;
 
-    CompositorEvent entries[compositor_ring_length];
-};
\ No newline at end of file
+// Written by the compositor, read by the client. Events that don't fit are counted in overflow_count.
+using CompositorRing = SPSCRing<CompositorEvent, compositor_ring_length>;
\ No newline at end of file
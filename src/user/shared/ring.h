@@ -0,0 +1,203 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free rings for queues in shared memory. Heads and tails are free-running indices on their own cache lines, so
+// the producer and consumer sides don't bounce a line between them. Entries written by the producer are published with
+// a release store and picked up with an acquire load, the same way round for freed entries. Writers never block or
+// overwrite, entries that don't fit are dropped and counted in overflow_count instead.
+
+const size_t ring_cache_line_size = 64;
+
+// One producer, one consumer. The producer only writes tail and overflow_count, the consumer only head.
+template <typename T, size_t length>
+struct SPSCRing {
+    static_assert(length != 0 && (length & (length - 1)) == 0, "Ring length must be a power of two");
+
+    alignas(ring_cache_line_size) size_t head;
+
+    alignas(ring_cache_line_size) size_t tail;
+    size_t overflow_count;
+
+    alignas(ring_cache_line_size) T entries[length];
+};
+
+// Publishes as many of the entries as fit with a single tail update, returns how many were written
+template <typename T, size_t length>
+inline size_t write_spsc_ring(SPSCRing<T, length> *ring, const T *entries, size_t count) {
+    auto tail = ring->tail;
+    auto free_count = length - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+
+    auto write_count = count;
+    if(write_count > free_count) {
+        write_count = free_count;
+
+        __atomic_store_n(&ring->overflow_count, ring->overflow_count + (count - free_count), __ATOMIC_RELAXED);
+    }
+
+    for(size_t i = 0; i < write_count; i += 1) {
+        ring->entries[(tail + i) & (length - 1)] = entries[i];
+    }
+
+    __atomic_store_n(&ring->tail, tail + write_count, __ATOMIC_RELEASE);
+
+    return write_count;
+}
+
+// Returns false (and counts the entry as overflowed) if the ring is full
+template <typename T, size_t length>
+inline bool write_spsc_ring(SPSCRing<T, length> *ring, const T &entry) {
+    return write_spsc_ring(ring, &entry, 1) == 1;
+}
+
+// Entries ready to be read, which stay valid until consumed
+template <typename T, size_t length>
+inline size_t get_spsc_ring_read_count(const SPSCRing<T, length> *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - ring->head;
+}
+
+// index is relative to the oldest unconsumed entry, and must be below get_spsc_ring_read_count
+template <typename T, size_t length>
+inline const T *get_spsc_ring_entry(const SPSCRing<T, length> *ring, size_t index) {
+    return &ring->entries[(ring->head + index) & (length - 1)];
+}
+
+// Frees the oldest count entries for the producer with a single head update
+template <typename T, size_t length>
+inline void consume_spsc_ring(SPSCRing<T, length> *ring, size_t count) {
+    __atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+}
+
+// Copies out and consumes up to max_count entries, returns how many were read
+template <typename T, size_t length>
+inline size_t read_spsc_ring(SPSCRing<T, length> *ring, T *entries, size_t max_count) {
+    auto count = get_spsc_ring_read_count(ring);
+    if(count > max_count) {
+        count = max_count;
+    }
+
+    for(size_t i = 0; i < count; i += 1) {
+        entries[i] = *get_spsc_ring_entry(ring, i);
+    }
+
+    consume_spsc_ring(ring, count);
+
+    return count;
+}
+
+template <typename T>
+struct MPSCRingSlot {
+    // Equal to the slot's position once the slot is free to be written at that position, and to the position + 1 once
+    // the entry written there is published
+    size_t sequence;
+
+    T entry;
+};
+
+// Any number of producers, one consumer. Producers claim positions by advancing tail with a compare and swap, then
+// publish each slot through its sequence, so a slow producer only holds up the consumer at its own slots. Must be
+// initialized with init_mpsc_ring before use.
+template <typename T, size_t length>
+struct MPSCRing {
+    static_assert(length != 0 && (length & (length - 1)) == 0, "Ring length must be a power of two");
+
+    alignas(ring_cache_line_size) size_t head;
+
+    alignas(ring_cache_line_size) size_t tail;
+    size_t overflow_count;
+
+    alignas(ring_cache_line_size) MPSCRingSlot<T> slots[length];
+};
+
+// Must happen before the ring is shared
+template <typename T, size_t length>
+inline void init_mpsc_ring(MPSCRing<T, length> *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overflow_count = 0;
+
+    for(size_t i = 0; i < length; i += 1) {
+        ring->slots[i].sequence = i;
+    }
+}
+
+// Claims consecutive positions for all of the entries at once, or for none of them (counting them as overflowed) if
+// there isn't room
+template <typename T, size_t length>
+inline bool write_mpsc_ring(MPSCRing<T, length> *ring, const T *entries, size_t count) {
+    if(count == 0) {
+        return true;
+    }
+
+    if(count > length) {
+        __atomic_add_fetch(&ring->overflow_count, count, __ATOMIC_RELAXED);
+
+        return false;
+    }
+
+    auto tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    while(true) {
+        // The consumer frees slots in order, so the last slot being free for its position means all of them are
+        auto last_position = tail + count - 1;
+        auto sequence = __atomic_load_n(&ring->slots[last_position & (length - 1)].sequence, __ATOMIC_ACQUIRE);
+
+        auto difference = (intptr_t)(sequence - last_position);
+        if(difference < 0) {
+            __atomic_add_fetch(&ring->overflow_count, count, __ATOMIC_RELAXED);
+
+            return false;
+        }
+
+        if(difference == 0 && __atomic_compare_exchange_n(&ring->tail, &tail, tail + count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        // Another producer claimed the positions first
+        if(difference != 0) {
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    for(size_t i = 0; i < count; i += 1) {
+        auto slot = &ring->slots[(tail + i) & (length - 1)];
+
+        slot->entry = entries[i];
+
+        __atomic_store_n(&slot->sequence, tail + i + 1, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+template <typename T, size_t length>
+inline bool write_mpsc_ring(MPSCRing<T, length> *ring, const T &entry) {
+    return write_mpsc_ring(ring, &entry, 1);
+}
+
+// Copies out and consumes up to max_count published entries, stopping at the first slot that's still being written.
+// Returns how many were read.
+template <typename T, size_t length>
+inline size_t read_mpsc_ring(MPSCRing<T, length> *ring, T *entries, size_t max_count) {
+    auto head = ring->head;
+
+    size_t count = 0;
+    while(count < max_count) {
+        auto slot = &ring->slots[(head + count) & (length - 1)];
+
+        if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != head + count + 1) {
+            break;
+        }
+
+        entries[count] = slot->entry;
+
+        // Free for the position one lap ahead
+        __atomic_store_n(&slot->sequence, head + count + length, __ATOMIC_RELEASE);
+
+        count += 1;
+    }
+
+    ring->head = head + count;
+
+    return count;
+}
@@ -2,25 +2,200 @@
 
 #include "syscalls.h"
 
-inline size_t syscall(SyscallType syscall_type, size_t parameter_1, size_t parameter_2, size_t *return_2) {
+inline size_t raw_syscall(
+    SyscallType syscall_type,
+    size_t *return_2,
+    size_t parameter_1 = 0,
+    size_t parameter_2 = 0,
+    size_t parameter_3 = 0,
+    size_t parameter_4 = 0,
+    size_t parameter_5 = 0,
+    size_t parameter_6 = 0
+) {
     size_t return_1;
+    register size_t parameter_4_register asm("r8") = parameter_4;
+    register size_t parameter_5_register asm("r9") = parameter_5;
+    register size_t parameter_6_register asm("r10") = parameter_6;
     asm volatile(
         "syscall"
-        : "=b"(return_1), "=d"(*return_2), "=S"(parameter_2)
-        : "b"(syscall_type), "d"(parameter_1), "S"(parameter_2)
-        : "rax", "rcx", "r11"
+        : "=b"(return_1), "+d"(parameter_1), "+S"(parameter_2), "+D"(parameter_3), "+r"(parameter_4_register), "+r"(parameter_5_register), "+r"(parameter_6_register)
+        : "b"(syscall_type)
+        : "rax", "rcx", "r11", "memory"
     );
 
+    *return_2 = parameter_1;
+
+    return return_1;
+}
+
+// Typed stubs for every syscall, e.g. syscall_unmap_memory(address). The _2 variants take a pointer to receive the
+// second result first, e.g. syscall_map_shared_memory_2(&address, process_id, shared_address, size).
+#define X(name, snake_name, result_type, parameter_count) \
+    template <typename... Parameters> \
+    inline result_type syscall_##snake_name##_2(size_t *return_2, Parameters... parameters) { \
+        static_assert(sizeof...(Parameters) == parameter_count, "Wrong number of parameters for " #name " syscall"); \
+        return (result_type)raw_syscall(SyscallType::name, return_2, (size_t)parameters...); \
+    } \
+    template <typename... Parameters> \
+    inline result_type syscall_##snake_name(Parameters... parameters) { \
+        size_t return_2; \
+        return syscall_##snake_name##_2(&return_2, parameters...); \
+    }
+
+SYSCALL_TABLE(X)
+
+#undef X
+
+// Passes the message in registers both ways, parameter in rdx both ways
+inline size_t ipc_syscall(SyscallType syscall_type, size_t *parameter, IPCMessage *message) {
+    size_t return_1;
+    register size_t word_2 asm("r8") = message->words[2];
+    register size_t word_3 asm("r9") = message->words[3];
+    register size_t word_4 asm("r10") = message->words[4];
+    asm volatile(
+        "syscall"
+        : "=b"(return_1), "+d"(*parameter), "+S"(message->words[0]), "+D"(message->words[1]), "+r"(word_2), "+r"(word_3), "+r"(word_4)
+        : "b"(syscall_type)
+        : "rax", "rcx", "r11", "memory"
+    );
+
+    message->words[2] = word_2;
+    message->words[3] = word_3;
+    message->words[4] = word_4;
+
     return return_1;
 }
 
-inline size_t syscall(SyscallType syscall_type, size_t parameter_1, size_t parameter_2) {
-    size_t return_2;
-    return syscall(syscall_type, parameter_1, parameter_2, &return_2);
+// Blocks until the callee replies, the reply overwrites message
+inline IPCCallResult ipc_call(size_t process_id, IPCMessage *message) {
+    return (IPCCallResult)ipc_syscall(SyscallType::IPCCall, &process_id, message);
+}
+
+// Waits up to timeout microseconds for a call, see ipc_receive_forever. Fails with NoCall if none came in time.
+inline IPCReceiveResult ipc_receive(size_t timeout, size_t *caller_process_id, IPCMessage *message) {
+    size_t parameter = timeout;
+    auto result = (IPCReceiveResult)ipc_syscall(SyscallType::IPCReceive, &parameter, message);
+
+    *caller_process_id = parameter;
+
+    return result;
+}
+
+inline IPCReplyResult ipc_reply(size_t caller_process_id, IPCMessage message) {
+    return (IPCReplyResult)ipc_syscall(SyscallType::IPCReply, &caller_process_id, &message);
+}
+
+// Replies to the caller, then blocks until the next call. caller_process_id and message are overwritten with the next call.
+inline IPCReceiveResult ipc_reply_and_receive(size_t *caller_process_id, IPCMessage *message) {
+    return (IPCReceiveResult)ipc_syscall(SyscallType::IPCReplyAndReceive, caller_process_id, message);
+}
+
+// Never blocks, fails if the channel already holds channel_capacity messages
+inline ChannelSendResult channel_send(size_t handle, IPCMessage message) {
+    return (ChannelSendResult)ipc_syscall(SyscallType::ChannelSend, &handle, &message);
+}
+
+// Takes the oldest message from the first of the channels (up to ipc_message_length of them) that has one, optionally
+// blocking until one does. *index is set to which of the channels the message came from, returned in r12.
+inline ChannelReceiveResult channel_receive(
+    const size_t *handles,
+    size_t handle_count,
+    bool block,
+    size_t *index,
+    size_t *sender_process_id,
+    IPCMessage *message
+) {
+    size_t words[ipc_message_length] {};
+    for(size_t i = 0; i < handle_count && i < ipc_message_length; i += 1) {
+        words[i] = handles[i];
+    }
+
+    size_t parameter = handle_count;
+    if(block) {
+        parameter |= channel_receive_block;
+    }
+
+    size_t return_1;
+    register size_t word_2 asm("r8") = words[2];
+    register size_t word_3 asm("r9") = words[3];
+    register size_t word_4 asm("r10") = words[4];
+    register size_t index_register asm("r12");
+    asm volatile(
+        "syscall"
+        : "=b"(return_1), "+d"(parameter), "+S"(words[0]), "+D"(words[1]), "+r"(word_2), "+r"(word_3), "+r"(word_4), "=r"(index_register)
+        : "b"(SyscallType::ChannelReceive)
+        : "rax", "rcx", "r11", "memory"
+    );
+
+    message->words[0] = words[0];
+    message->words[1] = words[1];
+    message->words[2] = word_2;
+    message->words[3] = word_3;
+    message->words[4] = word_4;
+
+    *index = index_register;
+    *sender_process_id = parameter;
+
+    return (ChannelReceiveResult)return_1;
+}
+
+// Queues a syscall on the ring, performed on the next SubmitSyscallRing (or poll). Returns false if the ring is full.
+template <typename... Parameters>
+inline bool queue_syscall(SyscallRing *ring, size_t user_data, SyscallType syscall_type, Parameters... parameters) {
+    static_assert(sizeof...(Parameters) <= syscall_parameter_count, "Too many parameters for syscall");
+
+    auto tail = ring->submission_tail;
+
+    if(tail - __atomic_load_n(&ring->submission_head, __ATOMIC_ACQUIRE) >= syscall_ring_length) {
+        return false;
+    }
+
+    auto submission = &ring->submissions[tail % syscall_ring_length];
+    submission->type = syscall_type;
+    submission->user_data = user_data;
+
+    size_t parameter_values[syscall_parameter_count] { (size_t)parameters... };
+    for(size_t i = 0; i < syscall_parameter_count; i += 1) {
+        submission->parameters[i] = parameter_values[i];
+    }
+
+    __atomic_store_n(&ring->submission_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Returns false if there are no completions left
+inline bool take_syscall_completion(SyscallRing *ring, SyscallCompletion *completion) {
+    auto head = ring->completion_head;
+
+    if(head == __atomic_load_n(&ring->completion_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    *completion = ring->completions[head % syscall_ring_length];
+
+    __atomic_store_n(&ring->completion_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+// Returns false if the ring is full
+inline bool write_log_ring(LogRing *ring, char character) {
+    auto tail = ring->tail;
+
+    if(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= log_ring_length) {
+        return false;
+    }
+
+    ring->buffer[tail % log_ring_length] = character;
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
 }
 
 [[noreturn]] inline void exit() {
-    syscall(SyscallType::Exit, 0, 0);
+    syscall_exit();
 
     while(true);
 }
\ No newline at end of file
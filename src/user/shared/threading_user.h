@@ -15,6 +15,6 @@ static inline void acquire_lock(volatile bool *lock) {
             asm volatile("pause");
         }
 
-        syscall(SyscallType::RelinquishTime, 0, 0);
+        syscall_relinquish_time();
     }
 }
\ No newline at end of file
@@ -9,12 +9,25 @@
 #include "bucket_array_user.h"
 #include "threading_user.h"
 #include "memory.h"
+#include "kernel_info.h"
+
+static LogRing *log_ring = nullptr;
 
 void _putchar(char character) {
-    syscall(SyscallType::DebugPrint, character, 0);
+    if(log_ring == nullptr) {
+        syscall_debug_print(character);
+    } else if(!write_log_ring(log_ring, character)) {
+        // The kernel hasn't caught up, have it drain the ring and then print the character straight away
+        syscall_debug_write((size_t)&character, 1);
+    }
 }
 
-extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_size) {
+extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_size, const KernelInfo *kernel_info) {
+    size_t log_ring_address;
+    if(syscall_create_log_ring_2(&log_ring_address) == CreateLogRingResult::Success) {
+        log_ring = (LogRing*)log_ring_address;
+    }
+
     printf("Test app started!\n");
 
     if(data == nullptr) {
@@ -31,105 +44,38 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
     auto parameters = (TestAppParameters*)data;
 
-    volatile CompositorConnectionMailbox *compositor_connection_mailbox;
+    size_t compositor_ring_shared_memory;
     {
-        MapSharedMemoryParameters syscall_parameters {
-            parameters->compositor_process_id,
-            parameters->compositor_connection_mailbox_shared_memory,
-            sizeof(CompositorConnectionMailbox)
-        };
-        switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, (size_t*)&compositor_connection_mailbox)) {
-            case MapSharedMemoryResult::Success: break;
-
-            case MapSharedMemoryResult::OutOfMemory: {
-                printf("Error: Unable to map compositor connection mailbox shared memory: Out of memory\n");
-
-                exit();
-            } break;
-
-            case MapSharedMemoryResult::InvalidProcessID: {
-                printf("Error: Unable to map compositor connection mailbox shared memory: Compositor process does not exist\n");
-
-                exit();
-            } break;
-
-            case MapSharedMemoryResult::InvalidMemoryRange: {
-                printf("Error: Unable to map compositor connection mailbox shared memory: Invalid memory range\n");
-
-                exit();
-            } break;
-        }
-    }
-
-    acquire_lock(&compositor_connection_mailbox->locked);
-
-    compositor_connection_mailbox->process_id = process_id;
-
-    compositor_connection_mailbox->connection_requested = true;
-
-    while(compositor_connection_mailbox->connection_requested) {
-        syscall(SyscallType::RelinquishTime, 0, 0);
-    }
-
-    switch(compositor_connection_mailbox->result) {
-        case CompositorConnectionResult::Success: break;
+        IPCMessage message {};
+        message.words[0] = (size_t)CompositorCommandType::Connect;
 
-        case CompositorConnectionResult::InvalidProcessID: {
+        if(ipc_call(parameters->compositor_process_id, &message) != IPCCallResult::Success) {
             printf("Error: Unable to create compositor connection: Compositor does not exist\n");
 
             exit();
-        } break;
-
-        case CompositorConnectionResult::OutOfMemory: {
-            printf("Error: Unable to create compositor connection: Out of memory\n");
-
-            exit();
-        } break;
-    }
-
-    auto compositor_mailbox_shared_memory = compositor_connection_mailbox->mailbox_shared_memory;
-    auto compositor_ring_shared_memory = compositor_connection_mailbox->ring_shared_memory;
-
-    compositor_connection_mailbox->locked = false;
-
-    volatile CompositorMailbox *compositor_mailbox;
-    {
-        MapSharedMemoryParameters syscall_parameters {
-            parameters->compositor_process_id,
-            compositor_mailbox_shared_memory,
-            sizeof(CompositorMailbox)
-        };
-        switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, (size_t*)&compositor_mailbox)) {
-            case MapSharedMemoryResult::Success: break;
-
-            case MapSharedMemoryResult::OutOfMemory: {
-                printf("Error: Unable to map compositor mailbox shared memory: Out of memory\n");
+        }
 
-                exit();
-            } break;
+        switch((CompositorConnectionResult)message.words[0]) {
+            case CompositorConnectionResult::Success: break;
 
-            case MapSharedMemoryResult::InvalidProcessID: {
-                printf("Error: Unable to map compositor mailbox shared memory: Compositor process does not exist\n");
-
-                exit();
-            } break;
-
-            case MapSharedMemoryResult::InvalidMemoryRange: {
-                printf("Error: Unable to map compositor mailbox shared memory: Invalid memory range\n");
+            case CompositorConnectionResult::OutOfMemory: {
+                printf("Error: Unable to create compositor connection: Out of memory\n");
 
                 exit();
             } break;
         }
+
+        compositor_ring_shared_memory = message.words[1];
     }
 
-    volatile CompositorRing *compositor_ring;
+    CompositorRing *compositor_ring;
     {
-        MapSharedMemoryParameters syscall_parameters {
+        switch(syscall_map_shared_memory_2(
+            (size_t*)&compositor_ring,
             parameters->compositor_process_id,
             compositor_ring_shared_memory,
             sizeof(CompositorRing)
-        };
-        switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, (size_t*)&compositor_ring)) {
+        )) {
             case MapSharedMemoryResult::Success: break;
 
             case MapSharedMemoryResult::OutOfMemory: {
@@ -178,22 +124,23 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
     auto window_count = 3;
     for(auto i = 0; i < window_count; i += 1) {
-        compositor_mailbox->command_type = CompositorCommandType::CreateWindow;
+        intptr_t width = 300;
+        intptr_t height = 300;
 
-        auto command = &compositor_mailbox->create_window;
+        IPCMessage message {};
+        message.words[0] = (size_t)CompositorCommandType::CreateWindow;
+        message.words[1] = (size_t)(i * 100);
+        message.words[2] = (size_t)(i * 50);
+        message.words[3] = (size_t)width;
+        message.words[4] = (size_t)height;
 
-        command->x = i * 100;
-        command->y = i * 50;
-        command->width = 300;
-        command->height = 300;
+        if(ipc_call(parameters->compositor_process_id, &message) != IPCCallResult::Success) {
+            printf("Error: Unable to create window: Compositor does not exist\n");
 
-        compositor_mailbox->command_present = true;
-
-        while(compositor_mailbox->command_present) {
-            syscall(SyscallType::RelinquishTime, 0, 0);
+            exit();
         }
 
-        switch(command->result) {
+        switch((CreateWindowResult)message.words[0]) {
             case CreateWindowResult::Success: break;
 
             case CreateWindowResult::InvalidSize: {
@@ -207,8 +154,18 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
                 exit();
             } break;
+
+            case CreateWindowResult::NotConnected: {
+                printf("Error: Unable to create window: Not connected to compositor\n");
+
+                exit();
+            } break;
         }
 
+        auto window_id = message.words[1];
+        auto framebuffers_shared_memory = message.words[2];
+        auto swap_indicator_shared_memory = message.words[3];
+
         auto window = allocate_from_bucket_array(&windows);
         if(window == nullptr) {
             printf("Error: Unable to allocate window: Out of memory\n");
@@ -218,12 +175,12 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
         size_t framebuffers_address;
         {
-            MapSharedMemoryParameters syscall_parameters {
+            switch(syscall_map_shared_memory_2(
+                &framebuffers_address,
                 parameters->compositor_process_id,
-                command->framebuffers_shared_memory,
-                (size_t)(command->width * command->height * 4 * 2)
-            };
-            switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, &framebuffers_address)) {
+                framebuffers_shared_memory,
+                (size_t)(width * height * 4 * 2)
+            )) {
                 case MapSharedMemoryResult::Success: break;
 
                 case MapSharedMemoryResult::OutOfMemory: {
@@ -248,12 +205,12 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
         bool *swap_indicator;
         {
-            MapSharedMemoryParameters syscall_parameters {
+            switch(syscall_map_shared_memory_2(
+                (size_t*)&swap_indicator,
                 parameters->compositor_process_id,
-                command->swap_indicator_shared_memory,
+                swap_indicator_shared_memory,
                 1
-            };
-            switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, (size_t*)&swap_indicator)) {
+            )) {
                 case MapSharedMemoryResult::Success: break;
 
                 case MapSharedMemoryResult::OutOfMemory: {
@@ -280,27 +237,28 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
 
         auto background_shade = HMM_Lerp(.3f, shade, .7f);
 
-        window->id = compositor_mailbox->create_window.id;
-        window->framebuffer_width = command->width;
-        window->framebuffer_height = command->height;
+        window->id = window_id;
+        window->framebuffer_width = width;
+        window->framebuffer_height = height;
         window->color = HMM_Vec3(1, shade, shade);
         window->background_shade = background_shade;
         window->framebuffers_address = framebuffers_address;
         window->swap_indicator = swap_indicator;
     }
 
+    if(syscall_set_thread_period(16666, 4000) != SetThreadPeriodResult::Success) {
+        printf("Error: Unable to set frame period\n");
+    }
+
     while(true) {
         auto mouse_dx = 0;
         auto mouse_dy = 0;
 
-        while(true) {
-            auto next_read_head = (compositor_ring->read_head + 1) % compositor_ring_length;
+        // Handled as one batch, so the compositor only sees the ring freed up once per frame
+        auto entry_count = get_spsc_ring_read_count(compositor_ring);
 
-            if(next_read_head == compositor_ring->write_head) {
-                break;
-            }
-
-            auto entry = &compositor_ring->entries[next_read_head];
+        for(size_t i = 0; i < entry_count; i += 1) {
+            auto entry = get_spsc_ring_entry(compositor_ring, i);
 
             Window *window = nullptr;
             Windows::Iterator window_iterator;
@@ -314,8 +272,6 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
             }
 
             if(window == nullptr) {
-                compositor_ring->read_head = next_read_head;
-
                 continue;
             }
 
@@ -391,20 +347,14 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                 } break;
 
                 case CompositorEventType::CloseRequested: {
-                    compositor_mailbox->command_type = CompositorCommandType::DestroyWindow;
+                    IPCMessage message {};
+                    message.words[0] = (size_t)CompositorCommandType::DestroyWindow;
+                    message.words[1] = window->id;
 
-                    auto command = &compositor_mailbox->destroy_window;
+                    ipc_call(parameters->compositor_process_id, &message);
 
-                    command->id = window->id;
-
-                    compositor_mailbox->command_present = true;
-
-                    while(compositor_mailbox->command_present) {
-                        syscall(SyscallType::RelinquishTime, 0, 0);
-                    }
-
-                    syscall(SyscallType::UnmapMemory, window->framebuffers_address, 0);
-                    syscall(SyscallType::UnmapMemory, (size_t)window->swap_indicator, 0);
+                    syscall_unmap_memory(window->framebuffers_address);
+                    syscall_unmap_memory((size_t)window->swap_indicator);
 
                     remove_item_from_bucket_array(window_iterator);
                 } break;
@@ -412,35 +362,33 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                 case CompositorEventType::SizeChanged: {
                     auto event = &entry->size_changed;
 
-                    compositor_mailbox->command_type = CompositorCommandType::ResizeFramebuffers;
-
-                    auto command = &compositor_mailbox->resize_framebuffers;
+                    IPCMessage message {};
+                    message.words[0] = (size_t)CompositorCommandType::ResizeFramebuffers;
+                    message.words[1] = window->id;
+                    message.words[2] = (size_t)event->width;
+                    message.words[3] = (size_t)event->height;
 
-                    command->id = window->id;
-                    command->width = event->width;
-                    command->height = event->height;
+                    if(ipc_call(parameters->compositor_process_id, &message) != IPCCallResult::Success) {
+                        printf("Error: Unable to resize framebuffer: Compositor does not exist\n");
 
-                    compositor_mailbox->command_present = true;
-
-                    while(compositor_mailbox->command_present) {
-                        syscall(SyscallType::RelinquishTime, 0, 0);
+                        exit();
                     }
 
-                    switch(command->result) {
+                    switch((ResizeFramebuffersResult)message.words[0]) {
                         case ResizeFramebuffersResult::Success: {
-                            syscall(SyscallType::UnmapMemory, window->framebuffers_address, 0);
+                            syscall_unmap_memory(window->framebuffers_address);
 
                             window->framebuffer_width = event->width;
                             window->framebuffer_height = event->height;
 
                             size_t framebuffers_address;
                             {
-                                MapSharedMemoryParameters syscall_parameters {
+                                switch(syscall_map_shared_memory_2(
+                                    &framebuffers_address,
                                     parameters->compositor_process_id,
-                                    command->framebuffers_shared_memory,
+                                    message.words[1],
                                     (size_t)(window->framebuffer_width * window->framebuffer_height * 4 * 2)
-                                };
-                                switch((MapSharedMemoryResult)syscall(SyscallType::MapSharedMemory, (size_t)&syscall_parameters, 0, &framebuffers_address)) {
+                                )) {
                                     case MapSharedMemoryResult::Success: break;
 
                                     case MapSharedMemoryResult::OutOfMemory: {
@@ -477,26 +425,18 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
                         case ResizeFramebuffersResult::OutOfMemory: {
                             printf("Error: Unable to resize framebuffer: Out of memory\n");
                         } break;
+
+                        case ResizeFramebuffersResult::NotConnected: {
+                            printf("Error: Unable to resize framebuffer: Not connected to compositor\n");
+                        } break;
                     }
                 } break;
             }
-
-            compositor_ring->read_head = next_read_head;
         }
 
-        uint32_t ticks_low;
-        uint32_t ticks_high;
-        asm volatile(
-            "cpuid\n" // Using CPUID instruction to serialize instruction execution
-            "rdtsc"
-            : "=a"(ticks_low), "=d"(ticks_high)
-            :
-            : "ebx", "ecx"
-        );
+        consume_spsc_ring(compositor_ring, entry_count);
 
-        auto ticks = (size_t)ticks_low | (size_t)ticks_high << 32;
-
-        auto time = (float)ticks / 1e10f;
+        auto time = (float)get_time_nanoseconds(kernel_info) / 1e9f;
 
         auto all_windows_closed = true;
         for(auto window : windows) {
@@ -667,6 +607,8 @@ extern "C" [[noreturn]] void entry(size_t process_id, void *data, size_t data_si
         if(all_windows_closed) {
             break;
         }
+
+        syscall_wait_for_next_period();
     }
 
     exit();
@@ -2,6 +2,4 @@
 
 struct TestAppParameters {
     size_t compositor_process_id;
-
-    size_t compositor_connection_mailbox_shared_memory;
 };
\ No newline at end of file